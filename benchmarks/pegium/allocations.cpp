@@ -0,0 +1,72 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <pegium/allocations.hpp>
+
+namespace pegium::bench {
+
+namespace {
+
+std::atomic_size_t count{0};
+std::atomic_size_t bytes{0};
+std::atomic_size_t current{0};
+std::atomic_size_t peak{0};
+
+/// the size of the header storing the size of an allocation, keeping the
+/// alignment of the returned storage
+constexpr std::size_t Header = alignof(std::max_align_t);
+
+void *allocate(std::size_t size) {
+  auto *storage = static_cast<char *>(std::malloc(Header + size));
+  if (!storage) {
+    throw std::bad_alloc{};
+  }
+  *reinterpret_cast<std::size_t *>(storage) = size;
+  count.fetch_add(1, std::memory_order_relaxed);
+  bytes.fetch_add(size, std::memory_order_relaxed);
+  const auto now = current.fetch_add(size, std::memory_order_relaxed) + size;
+  auto max = peak.load(std::memory_order_relaxed);
+  while (now > max &&
+         !peak.compare_exchange_weak(max, now, std::memory_order_relaxed)) {
+  }
+  return storage + Header;
+}
+
+void deallocate(void *ptr) noexcept {
+  if (!ptr) {
+    return;
+  }
+  auto *storage = static_cast<char *>(ptr) - Header;
+  current.fetch_sub(*reinterpret_cast<std::size_t *>(storage),
+                    std::memory_order_relaxed);
+  std::free(storage);
+}
+
+} // namespace
+
+Allocations allocations() noexcept {
+  return {count.load(std::memory_order_relaxed),
+          bytes.load(std::memory_order_relaxed),
+          current.load(std::memory_order_relaxed),
+          peak.load(std::memory_order_relaxed)};
+}
+
+void reset_peak() noexcept {
+  peak.store(current.load(std::memory_order_relaxed),
+             std::memory_order_relaxed);
+}
+
+} // namespace pegium::bench
+
+void *operator new(std::size_t size) { return pegium::bench::allocate(size); }
+void *operator new[](std::size_t size) {
+  return pegium::bench::allocate(size);
+}
+void operator delete(void *ptr) noexcept { pegium::bench::deallocate(ptr); }
+void operator delete[](void *ptr) noexcept { pegium::bench::deallocate(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept {
+  pegium::bench::deallocate(ptr);
+}
+void operator delete[](void *ptr, std::size_t) noexcept {
+  pegium::bench::deallocate(ptr);
+}
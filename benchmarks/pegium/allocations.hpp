@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+
+namespace pegium::bench {
+
+/// The allocations counted by the global operator new of the benchmarks
+struct Allocations {
+  /// the number of allocations
+  std::size_t count;
+  /// the number of allocated bytes
+  std::size_t bytes;
+  /// the number of bytes currently allocated
+  std::size_t current;
+  /// the maximum number of bytes allocated at once since the last call to
+  /// reset_peak()
+  std::size_t peak;
+};
+
+/// @return the allocations counted so far
+Allocations allocations() noexcept;
+
+/// Reset the peak of allocated bytes to the number of bytes currently
+/// allocated
+void reset_peak() noexcept;
+
+} // namespace pegium::bench
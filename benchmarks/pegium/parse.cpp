@@ -0,0 +1,178 @@
+#include <benchmark/benchmark.h>
+#include <pegium/Parser.hpp>
+#include <pegium/allocations.hpp>
+#include <pegium/xsmp.hpp>
+#include <string>
+
+using namespace pegium;
+
+namespace {
+
+struct Block : public AstNode {
+  string name;
+  vector<containment<Block>> child;
+};
+
+class BenchGrammar : public Parser {
+public:
+  BenchGrammar() {
+    terminal("WS").ignore()(+s);
+    terminal("SL_COMMENT").hide()("//"_kw, many(cls("\r\n", true)));
+    terminal("ML_COMMENT").hide()("/*"_kw >> "*/"_kw);
+    terminal("ID")(cls("a-zA-Z_"), *w);
+    terminal("INT")(+d);
+    rule("Tokens")(many(call("ID") | call("INT")));
+    rule("QualifiedName")(at_least_one_sep('.'_kw, call("ID")));
+    rule("Keywords")(many("catalogue"_kw | "namespace"_kw | "struct"_kw |
+                          "class"_kw | "private"_kw | "protected"_kw |
+                          "public"_kw | "abstract"_kw));
+    rule("InsensitiveKeywords")(at_least_one_sep('.'_kw, "test"_ikw));
+    rule<Block>("Block")(
+        "block"_kw, assign<&Block::name>(call("ID")),
+        opt("{"_kw, *append<&Block::child>(call("Block")), "}"_kw));
+  }
+};
+
+const BenchGrammar &grammar() {
+  static const BenchGrammar instance;
+  return instance;
+}
+
+const Xsmp::XsmpParser &xsmp() {
+  static const Xsmp::XsmpParser instance;
+  return instance;
+}
+
+/// @param count the number of repetitions
+/// @param pattern the repeated text
+/// @param last the text appended after the repetitions
+/// @return the repeated text
+std::string repeat(std::int64_t count, std::string_view pattern,
+                   std::string_view last = {}) {
+  std::string text;
+  text.reserve(count * pattern.size() + last.size());
+  for (std::int64_t i = 0; i < count; ++i) {
+    text += pattern;
+  }
+  text += last;
+  return text;
+}
+
+/// @param depth the number of nested blocks
+/// @return the text of the nested blocks
+std::string nested_blocks(std::int64_t depth) {
+  return repeat(depth, "block a { ") + "block b" + repeat(depth, " }");
+}
+
+/// @param count the number of namespaces
+/// @return the text of a catalogue
+std::string catalogue(std::int64_t count) {
+  return "/** A generated catalogue */\ncatalogue demo\n" +
+         repeat(count, R"(
+    // a namespace
+    namespace A
+    {
+      @Abstract()
+      public protected private struct MyStruct{}
+      namespace B
+      {
+        /* a class */
+        private public abstract public class MyClass{}
+      }
+    }
+)");
+}
+
+constexpr ParseMode modes[] = {ParseMode::Full, ParseMode::Ast,
+                               ParseMode::Recognize};
+constexpr const char *mode_names[] = {"Full", "Ast", "Recognize"};
+
+/// Run a benchmark parsing a text, reporting the throughput and the
+/// allocations per parse
+/// @param state the benchmark state
+/// @param parser the parser
+/// @param rule the parsed rule
+/// @param text the parsed text
+/// @param mode the parse mode
+void run(benchmark::State &state, const Parser &parser,
+         const std::string &rule, std::string_view text,
+         ParseMode mode = ParseMode::Full) {
+  if (auto result = parser.parse(rule, text, mode);
+      !result.ret || result.len != text.size()) {
+    state.SkipWithError("the input is not parsed");
+    return;
+  }
+  const auto before = bench::allocations();
+  bench::reset_peak();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(parser.parse(rule, text, mode));
+  }
+  const auto after = bench::allocations();
+  using benchmark::Counter;
+  state.counters["allocs"] = Counter(
+      static_cast<double>(after.count - before.count), Counter::kAvgIterations);
+  state.counters["bytes"] = Counter(
+      static_cast<double>(after.bytes - before.bytes), Counter::kAvgIterations,
+      Counter::kIs1024);
+  state.counters["peak"] = Counter(
+      static_cast<double>(after.peak - before.current), Counter::kDefaults,
+      Counter::kIs1024);
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<std::int64_t>(text.size()));
+}
+
+void BM_Terminals(benchmark::State &state) {
+  const auto text = repeat(state.range(0), "abc_12 x 42 Identifier 7\n");
+  run(state, grammar(), "Tokens", text);
+}
+BENCHMARK(BM_Terminals)->Arg(1'000)->Arg(100'000);
+
+void BM_HiddenTokens(benchmark::State &state) {
+  const auto text = repeat(state.range(0), R"(
+    // comment
+    a.b.c.d.e.
+    /* comment*/
+    g.h.
+    )",
+                           "end");
+  run(state, grammar(), "QualifiedName", text,
+      modes[static_cast<std::size_t>(state.range(1))]);
+  state.SetLabel(mode_names[state.range(1)]);
+}
+BENCHMARK(BM_HiddenTokens)->ArgsProduct({{1'000, 100'000}, {0, 1, 2}});
+
+void BM_Keywords(benchmark::State &state) {
+  const auto text =
+      repeat(state.range(0), "catalogue namespace struct class private "
+                             "protected public abstract\n");
+  run(state, grammar(), "Keywords", text);
+}
+BENCHMARK(BM_Keywords)->Arg(1'000)->Arg(100'000);
+
+void BM_InsensitiveKeywords(benchmark::State &state) {
+  const auto text = repeat(state.range(0), R"(
+    // comment
+    test.test.TEST.test
+    /* comment*/
+    .test.TesT.Test.TeST.test.tesT.
+    )",
+                           "test");
+  run(state, grammar(), "InsensitiveKeywords", text);
+}
+BENCHMARK(BM_InsensitiveKeywords)->Arg(1'000)->Arg(100'000);
+
+void BM_DeepRecursion(benchmark::State &state) {
+  const auto text = nested_blocks(state.range(0));
+  run(state, grammar(), "Block", text);
+}
+BENCHMARK(BM_DeepRecursion)->Arg(10)->Arg(100)->Arg(1'000);
+
+void BM_Xsmp(benchmark::State &state) {
+  const auto text = catalogue(state.range(0));
+  run(state, xsmp(), "Catalogue", text,
+      modes[static_cast<std::size_t>(state.range(1))]);
+  state.SetLabel(mode_names[state.range(1)]);
+}
+BENCHMARK(BM_Xsmp)->ArgsProduct({{100, 10'000}, {0, 1, 2}});
+
+} // namespace
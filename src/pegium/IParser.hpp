@@ -5,16 +5,47 @@
 #include <pegium/syntax-tree.hpp>
 #include <string>
 #include <string_view>
+#include <vector>
 
 namespace pegium {
 
+class Interner;
+
+/// A syntax error found by a parse
+struct ParseError {
+  /// the offset of the error in the input text
+  std::size_t offset = 0;
+  /// the length of the text skipped by the recovery, 0 if not recovered
+  std::size_t length = 0;
+  /// the tokens that were expected at the offset
+  std::vector<const GrammarElement *> expected;
+};
+
 struct ParseResult {
   bool ret = false;
+  /// true if broken parts of the input were skipped, the parse result is
+  /// complete except for them
   bool recovered = false;
   size_t len = 0;
   std::shared_ptr<RootCstNode> root_node;
   std::any value;
-  // TODO add errors
+  /// the owner of the input text when there is no root node, keeping the
+  /// std::string_view values alive
+  std::shared_ptr<const void> storage;
+  /// the interner of the std::string_view values that are not a view of the
+  /// input text, or nullptr if none was interned
+  std::shared_ptr<Interner> interner;
+  /// the errors skipped by the recovery in the order of the input, followed
+  /// by the furthest failure if the parse failed
+  std::vector<ParseError> errors;
+};
+
+/// An edit of a parsed text: `removed` characters at `offset` are replaced by
+/// the `inserted` text
+struct TextEdit {
+  std::size_t offset = 0;
+  std::size_t removed = 0;
+  std::string_view inserted;
 };
 
 class IParser {
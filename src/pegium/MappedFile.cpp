@@ -0,0 +1,110 @@
+#include <pegium/MappedFile.hpp>
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace pegium {
+
+#ifdef _WIN32
+
+namespace {
+/// Close a Windows handle when going out of scope
+struct HandleGuard {
+  HANDLE handle;
+  ~HandleGuard() {
+    if (handle && handle != INVALID_HANDLE_VALUE)
+      CloseHandle(handle);
+  }
+};
+} // namespace
+
+MappedFile::MappedFile(const std::filesystem::path &path) {
+  HandleGuard file{CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                               nullptr, OPEN_EXISTING,
+                               FILE_FLAG_SEQUENTIAL_SCAN, nullptr)};
+  if (file.handle == INVALID_HANDLE_VALUE) {
+    throw std::system_error(static_cast<int>(GetLastError()),
+                            std::system_category(), path.string());
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file.handle, &size)) {
+    throw std::system_error(static_cast<int>(GetLastError()),
+                            std::system_category(), path.string());
+  }
+  _size = static_cast<std::size_t>(size.QuadPart);
+  // an empty file cannot be mapped
+  if (_size == 0) {
+    return;
+  }
+  _mapping =
+      CreateFileMappingW(file.handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!_mapping) {
+    throw std::system_error(static_cast<int>(GetLastError()),
+                            std::system_category(), path.string());
+  }
+  _data = static_cast<const char *>(
+      MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+  if (!_data) {
+    auto error = GetLastError();
+    CloseHandle(_mapping);
+    throw std::system_error(static_cast<int>(error), std::system_category(),
+                            path.string());
+  }
+}
+
+MappedFile::~MappedFile() noexcept {
+  if (_data)
+    UnmapViewOfFile(_data);
+  if (_mapping)
+    CloseHandle(_mapping);
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(), path.string());
+  }
+  struct stat st {};
+  if (::fstat(fd, &st) != 0) {
+    auto error = errno;
+    ::close(fd);
+    throw std::system_error(error, std::generic_category(), path.string());
+  }
+  _size = static_cast<std::size_t>(st.st_size);
+  // an empty file cannot be mapped
+  if (_size == 0) {
+    ::close(fd);
+    return;
+  }
+  void *data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+  auto error = errno;
+  // the mapping remains valid after the file is closed
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    throw std::system_error(error, std::generic_category(), path.string());
+  }
+  ::madvise(data, _size, MADV_SEQUENTIAL);
+  _data = static_cast<const char *>(data);
+}
+
+MappedFile::~MappedFile() noexcept {
+  if (_data)
+    ::munmap(const_cast<char *>(_data), _size);
+}
+
+#endif
+
+} // namespace pegium
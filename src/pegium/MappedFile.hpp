@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+namespace pegium {
+
+/// A read-only memory mapping of a file.
+/// The pages of the file are loaded lazily by the system when accessed.
+class MappedFile final {
+public:
+  /// Map a file in memory
+  /// @param path the path of the file
+  /// @throw std::system_error if the file cannot be opened or mapped
+  explicit MappedFile(const std::filesystem::path &path);
+  ~MappedFile() noexcept;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  /// @return the content of the file
+  std::string_view text() const noexcept { return {_data, _size}; }
+
+private:
+  const char *_data = nullptr;
+  std::size_t _size = 0;
+#ifdef _WIN32
+  void *_mapping = nullptr;
+#endif
+};
+
+} // namespace pegium
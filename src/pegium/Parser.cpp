@@ -1,7 +1,106 @@
+#include <fstream>
+#include <functional>
+#include <pegium/MappedFile.hpp>
 #include <pegium/Parser.hpp>
+#include <pegium/analysis.hpp>
+#include <pegium/parallel.hpp>
+#include <pegium/program.hpp>
+#include <stdexcept>
+#include <unordered_map>
 
 namespace pegium {
+
+/// Find the left recursive rules and choose the heads of their cycles, the
+/// other rules of a cycle being involved in the recursion of the heads
+/// @param rules the parser and data type rules
+static void find_left_recursion(const std::vector<Rule *> &rules) {
+  const auto size = rules.size();
+  std::unordered_map<const Rule *, std::size_t> index;
+  for (std::size_t i = 0; i < size; ++i) {
+    index.emplace(rules[i], i);
+  }
+  std::vector<std::vector<std::size_t>> calls(size);
+  for (std::size_t i = 0; i < size; ++i) {
+    for (const auto *callee : left_calls(*rules[i])) {
+      if (auto it = index.find(callee); it != index.end()) {
+        calls[i].push_back(it->second);
+      }
+    }
+  }
+
+  // reaches[i][j] is true if rule j may be called in left position by rule i
+  std::vector<std::vector<bool>> reaches(size, std::vector<bool>(size));
+  for (std::size_t i = 0; i < size; ++i) {
+    std::vector<std::size_t> pending{i};
+    while (!pending.empty()) {
+      const auto current = pending.back();
+      pending.pop_back();
+      for (const auto callee : calls[current]) {
+        if (!reaches[i][callee]) {
+          reaches[i][callee] = true;
+          pending.push_back(callee);
+        }
+      }
+    }
+  }
+
+  std::vector<bool> assigned(size);
+  for (std::size_t i = 0; i < size; ++i) {
+    if (assigned[i] || !reaches[i][i]) {
+      continue;
+    }
+    // the rules of the cycles of rule i
+    std::vector<bool> cycle(size);
+    for (std::size_t j = 0; j < size; ++j) {
+      cycle[j] = reaches[i][j] && reaches[j][i];
+      if (cycle[j]) {
+        assigned[j] = true;
+        rules[j]->leftRecursion(Rule::LeftRecursion::Involved);
+      }
+    }
+    // the rule entering a cycle becomes a head until no cycle is left
+    // without a head
+    enum class State : std::uint8_t { Unvisited, Visiting, Visited };
+    bool found = true;
+    while (found) {
+      found = false;
+      std::vector<State> states(size, State::Unvisited);
+      std::function<void(std::size_t)> visit = [&](std::size_t current) {
+        states[current] = State::Visiting;
+        for (const auto callee : calls[current]) {
+          if (found) {
+            return;
+          }
+          if (!cycle[callee] || rules[callee]->leftRecursion() ==
+                                    Rule::LeftRecursion::Head) {
+            continue;
+          }
+          if (states[callee] == State::Visiting) {
+            rules[callee]->leftRecursion(Rule::LeftRecursion::Head);
+            found = true;
+          } else if (states[callee] == State::Unvisited) {
+            visit(callee);
+          }
+        }
+        states[current] = State::Visited;
+      };
+      for (std::size_t j = 0; j < size && !found; ++j) {
+        if (cycle[j] && states[j] == State::Unvisited) {
+          visit(j);
+        }
+      }
+    }
+  }
+}
+
 Context Parser::createContext() const {
+  compile();
+  Context context{_hidden.get(), _memo_options, &_profiler};
+  context.intern(_intern, _interner);
+  return context;
+}
+
+void Parser::finalize() const {
 
   struct HiddenVisitor : public GrammarElement::Visitor {
 
@@ -16,132 +115,171 @@ Context Parser::createContext() const {
     bool _hidden = false;
   };
 
+  struct TerminalVisitor : public GrammarElement::Visitor {
+    void visit(const TerminalRule &) override { _terminal = true; }
+    static bool isTerminal(const GrammarElement &elem) {
+      TerminalVisitor v;
+      elem.accept(v);
+      return v._terminal;
+    }
+
+  private:
+    bool _terminal = false;
+  };
+
   std::vector<std::shared_ptr<GrammarElement>> hiddenRules;
+  std::vector<Rule *> rules;
+  std::vector<const Rule *> all;
   for (auto &[_, def] : _rules) {
+    if (def) {
+      all.push_back(def.get());
+    }
     if (HiddenVisitor::isHidden(*def)) {
       hiddenRules.emplace_back(std::make_shared<RuleCall>(def));
     }
+    // lower the terminal rules into programs
+    if (def && def->element() && TerminalVisitor::isTerminal(*def)) {
+      std::static_pointer_cast<TerminalRule>(def)->program(
+          std::make_shared<const Program>(Program::compile(*def->element())));
+    } else if (def) {
+      rules.push_back(def.get());
+    }
   }
-  if (hiddenRules.empty())
-    return Context{};
-
+  find_left_recursion(rules);
+  _features = pegium::features(rules);
+  _elements = ElementTable{all};
+  _loops = pegium::nullable_loops(all);
+  pegium::prepare(all);
   if (hiddenRules.size() == 1) {
-    return Context{std::move(hiddenRules.front())};
+    _hidden = std::move(hiddenRules.front());
+  } else if (!hiddenRules.empty()) {
+    _hidden = std::make_shared<PrioritizedChoice>(std::move(hiddenRules));
   }
-  return Context{std::make_shared<PrioritizedChoice>(std::move(hiddenRules))};
 }
 
-std::any getValue(std::vector<std::unique_ptr<CstNode>> &node);
+ParseResult Parser::parse(const std::string &name,
+                          std::string_view text) const {
+  return _rules.at(name)->parse(text);
+}
 
-struct AstBuilder : public GrammarElement::Visitor {
-  static bool build(const GrammarElement &element, CstNode &node,
-                    std::any &result) {
-    AstBuilder builder{result, node};
-    element.accept(builder);
-    return builder._prune;
-  }
-  void visit(const Action &rule) override {
-    // execute the action
-    rule.execute(_result);
-  }
-  void visit(const ParserRule &rule) override {
+ParseResult Parser::parse(const std::string &name,
+                          std::shared_ptr<const std::string> text) const {
+  return _rules.at(name)->parse(std::move(text));
+}
 
-    // create the object
-    rule.execute(_result, _node);
-  }
-  void visit(const TerminalRule &rule) override {
+ParseResult Parser::parse(const std::string &name, std::string_view text,
+                          std::shared_ptr<const void> storage) const {
+  return _rules.at(name)->parse(text, std::move(storage));
+}
 
-    //
-  }
-  void visit(const Assignment &assignment) override;
-
-private:
-  std::any &_result;
-  CstNode &_node;
-  bool _prune = false;
-  AstBuilder(std::any &result, CstNode &node) : _result{result}, _node{node} {}
-  inline void prune() { _prune = true; }
-};
-
-struct RootAstBuilder : public GrammarElement::Visitor {
-  static std::any build(const GrammarElement &element, CstNode &node) {
-    std::any result;
-    RootAstBuilder builder{result, node};
-    element.accept(builder);
-    if (!result.has_value()) {
-      std::string text;
-      for (const auto &n : node)
-        if (n.isLeaf && !n.hidden)
-          text += n.text;
-      result = text;
-    }
+ParseResult Parser::parse(const std::string &name, std::string_view text,
+                          ParseMode mode) const {
+  return _rules.at(name)->parse(text, nullptr, mode);
+}
+
+ParseResult Parser::parse(const std::string &name, std::string_view text,
+                          ParseListener &listener) const {
+  return _rules.at(name)->parse(text, listener);
+}
+
+ParseResult Parser::parse_file(const std::string &name,
+                               const std::filesystem::path &path) const {
+  auto file = std::make_shared<const MappedFile>(path);
+  auto text = file->text();
+  return parse(name, text, std::move(file));
+}
+
+ParseResult Parser::parse_file(const std::string &name,
+                               const std::filesystem::path &path,
+                               const std::filesystem::path &snapshot) const {
+  auto file = std::make_shared<const MappedFile>(path);
+  auto text = file->text();
+  const auto &rule = _rules.at(name);
+  if (auto result = load_snapshot(snapshot, text);
+      result.root_node && result.root_node->grammarSource == rule.get()) {
     return result;
   }
-
- // void visit(const Assignment &assignment) override {}
-  void visit(const ParserRule &rule) override {
-    for (auto it = _node.begin(); it != _node.end(); ++it) {
-      if (AstBuilder::build(*it->grammarSource, *it, _result))
-        it.prune();
-    }
+  auto result = rule->parse(text, std::move(file));
+  if (result.ret && !result.recovered) {
+    std::ofstream os{snapshot, std::ios::binary | std::ios::trunc};
+    save_snapshot(result, os);
   }
+  return result;
+}
 
-  void visit(const DataTypeRule &rule) override {
+void Parser::save_snapshot(const ParseResult &result, std::ostream &os) const {
+  if (!result.root_node || !result.ret || result.recovered) {
+    throw std::invalid_argument{
+        "Only the CST of a successful parse can be saved"};
+  }
+  compile();
+  write_snapshot(os, *result.root_node, _elements);
+}
 
-    std::string text;
-    for (const auto &node : _node) {
-      if (node.isLeaf && !node.hidden)
-        text += node.text;
-    }
-    /*if (rule.getValueConverter()) {
-      _result = rule.getValueConverter()(text);
-    } else*/
-    _result = text;
+ParseResult Parser::load_snapshot(const std::filesystem::path &snapshot,
+                                  std::string_view text) const {
+  compile();
+  auto root = read_snapshot(snapshot, _elements, text);
+  if (!root) {
+    return {};
   }
-  void visit(const TerminalRule &rule) override {
-    std::string text;
-    for (const auto &node : _node) {
-      if (node.isLeaf && !node.hidden)
-        text += node.text;
-    }
-    /*if (rule.getValueConverter()) {
-      _result = rule.getValueConverter()(text);
-    } else*/
-    _result = text;
+  const auto *rule = dynamic_cast<const Rule *>(root->grammarSource);
+  if (!rule) {
+    return {};
   }
+  return rule->rebuild(std::move(root));
+}
 
-private:
-  RootAstBuilder(std::any &result, CstNode &node)
-      : _result{result}, _node{node} {}
-  std::any &_result;
-  CstNode &_node;
-};
-
-void AstBuilder::visit(const Assignment &assignment) {
+ParseResult Parser::reparse(ParseResult previous, const TextEdit &edit) const {
+  if (!previous.root_node) {
+    return {};
+  }
+  const auto *rule =
+      static_cast<const Rule *>(previous.root_node->grammarSource);
+  return rule->reparse(std::move(previous), edit);
+}
 
-  // build the value from all nested nodes
-  /*for (auto &node : _node.content)
-    for (auto it = node.begin(); it != node.end(); ++it) {
-    }*/
-  // assign the computed value
-  assignment.getFeature().assign(
-      _result, RootAstBuilder::build(*_node.content.front().grammarSource,
-                                     _node.content.front()));
-  // prune the current node (the children are already consumed by the
-  // assignment)
-  prune();
+ParseResult Parser::parse_stream(const std::string &name,
+                                 const StreamReader &read,
+                                 const StreamCallback &emit,
+                                 const StreamOptions &options) const {
+  return _rules.at(name)->parse_stream(read, emit, options);
 }
 
-std::any getValue(CstNode &node) {
-  return RootAstBuilder::build(*node.grammarSource, node);
+ParseResult Parser::parse_stream(const std::string &name, std::istream &input,
+                                 const StreamCallback &emit,
+                                 const StreamOptions &options) const {
+  return parse_stream(
+      name,
+      [&input](std::span<char> buffer) {
+        input.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        return static_cast<std::size_t>(input.gcount());
+      },
+      emit, options);
 }
 
-ParseResult Parser::parse(const std::string &name,
-                          std::string_view text) const {
-  auto result = _rules.at(name)->parse(text);
+std::vector<ParseResult>
+Parser::parse_many(const std::string &name,
+                   std::span<const std::string_view> texts,
+                   std::size_t threads) const {
+  const auto &rule = *_rules.at(name);
+  std::vector<ParseResult> results(texts.size());
+  parallel_for(texts.size(), threads,
+               [&](std::size_t i) { results[i] = rule.parse(texts[i]); });
+  return results;
+}
 
-  result.value = getValue(*result.root_node);
-  return result;
+std::vector<ParseResult>
+Parser::parse_many(const std::string &name,
+                   std::span<const std::filesystem::path> paths,
+                   std::size_t threads) const {
+  // check the rule name before starting any thread
+  _rules.at(name);
+  std::vector<ParseResult> results(paths.size());
+  parallel_for(paths.size(), threads, [&](std::size_t i) {
+    results[i] = parse_file(name, paths[i]);
+  });
+  return results;
 }
 
 ParseResult Parser::parse(const std::string &input) const {
@@ -1,12 +1,21 @@
 
 
 #pragma once
+#include <filesystem>
+#include <istream>
 #include <map>
+#include <mutex>
 #include <pegium/IParser.hpp>
+#include <pegium/analysis.hpp>
+#include <pegium/ct.hpp>
 #include <pegium/grammar.hpp>
+#include <pegium/profiler.hpp>
+#include <pegium/snapshot.hpp>
 #include <pegium/syntax-tree.hpp>
+#include <span>
 #include <string>
 #include <string_view>
+#include <vector>
 
 namespace pegium {
 
@@ -27,10 +36,157 @@ concept ValidRuleType = std::is_same_v<T, bool> ||        // bool
                         std::is_same_v<T, std::string> || // string
                         std::is_base_of_v<AstNode, T>;    // AstNode
 
+/// A parser built from a grammar.
+/// The grammar is defined by the constructor of the derived class: once
+/// constructed, a Parser is immutable and all its parse methods are safe to
+/// call concurrently from several threads. Each parse owns its Context (memo
+/// table, value log and CST), and the grammar is compiled once on the first
+/// parse whatever the thread.
 class Parser : public IParser {
 public:
   ParseResult parse(const std::string &input) const override;
+  /// Parse a copy of the text with the given rule
+  /// @param name the rule name
+  /// @param text the input text
+  /// @return the parse result
   ParseResult parse(const std::string &name, std::string_view text) const;
+  /// Parse a shared text with the given rule, without copying it
+  /// @param name the rule name
+  /// @param text the input text kept alive by the result
+  /// @return the parse result
+  ParseResult parse(const std::string &name,
+                    std::shared_ptr<const std::string> text) const;
+  /// Parse a text with the given rule, without copying it
+  /// @param name the rule name
+  /// @param text the input text
+  /// @param storage the owner of the text kept alive by the result, or
+  /// nullptr to borrow the text from the caller
+  /// @return the parse result
+  ParseResult parse(const std::string &name, std::string_view text,
+                    std::shared_ptr<const void> storage) const;
+  /// Parse a text with the given rule, materializing only what the caller
+  /// consumes. The text is borrowed from the caller: it is never copied.
+  /// - ParseMode::Recognize only computes ret and len, no node is created
+  /// - ParseMode::Ast computes the value without creating any CST node
+  /// - ParseMode::Full is the same as parse(name, text, nullptr)
+  /// @param name the rule name
+  /// @param text the input text
+  /// @param mode what the parse materializes
+  /// @return the parse result
+  ParseResult parse(const std::string &name, std::string_view text,
+                    ParseMode mode) const;
+  /// Parse a file with the given rule. The file is memory mapped and the
+  /// mapping is owned by the root node of the result, so the file is never
+  /// copied on the heap.
+  /// @param name the rule name
+  /// @param path the path of the file
+  /// @return the parse result
+  /// @throw std::system_error if the file cannot be mapped
+  ParseResult parse_file(const std::string &name,
+                         const std::filesystem::path &path) const;
+  /// Parse a file with the given rule, loading its result from a snapshot
+  /// when the snapshot was made from the same text by the same grammar, and
+  /// writing the snapshot otherwise
+  /// @param name the rule name
+  /// @param path the path of the file
+  /// @param snapshot the path of the snapshot of the file
+  /// @return the parse result
+  /// @throw std::system_error if the file cannot be mapped
+  ParseResult parse_file(const std::string &name,
+                         const std::filesystem::path &path,
+                         const std::filesystem::path &snapshot) const;
+  /// Write a snapshot of a parse result, see write_snapshot
+  /// @param result the result of a successful full parse by this parser
+  /// @param os the binary output stream
+  /// @throw std::invalid_argument if the result has no CST, failed or was
+  /// recovered
+  void save_snapshot(const ParseResult &result, std::ostream &os) const;
+  /// Load a parse result from a snapshot without parsing its text: the CST
+  /// views the mapped snapshot, and the value is rebuilt from the CST
+  /// @param snapshot the path of the snapshot
+  /// @param text the current text of the snapshot source
+  /// @return the parse result, a failed result if the snapshot is missing,
+  /// invalid, or made from another grammar or text
+  ParseResult load_snapshot(const std::filesystem::path &snapshot,
+                            std::string_view text) const;
+  /// @return the fingerprint of the grammar identifying its snapshots. The
+  /// grammar is compiled on the first call.
+  std::uint64_t fingerprint() const {
+    compile();
+    return _elements.fingerprint();
+  }
+  /// Parse an edited text incrementally, see Rule::reparse
+  /// @param previous the result of a parse by this parser, moved in to be
+  /// patched in place
+  /// @param edit the edit of the text of the previous result
+  /// @return the parse result of the edited text, a failed result if the
+  /// previous result has no CST
+  ParseResult reparse(ParseResult previous, const TextEdit &edit) const;
+  /// Parse a text with the given rule and send its rule calls and tokens to
+  /// a listener, see Rule::parse(sv, listener)
+  /// @param name the rule name
+  /// @param text the input text, borrowed from the caller
+  /// @param listener the listener
+  /// @return the parse result, without root node nor value
+  ParseResult parse(const std::string &name, std::string_view text,
+                    ParseListener &listener) const;
+  /// Parse a streamed input made of a sequence of elements of the given
+  /// rule, see Rule::parse_stream
+  /// @param name the rule name
+  /// @param read the reader of the input
+  /// @param emit the callback receiving each element
+  /// @param options the stream options
+  /// @return the result of the whole parse
+  ParseResult parse_stream(const std::string &name, const StreamReader &read,
+                           const StreamCallback &emit,
+                           const StreamOptions &options = {}) const;
+  /// Parse an input stream made of a sequence of elements of the given rule
+  /// @param name the rule name
+  /// @param input the input stream
+  /// @param emit the callback receiving each element
+  /// @param options the stream options
+  /// @return the result of the whole parse
+  ParseResult parse_stream(const std::string &name, std::istream &input,
+                           const StreamCallback &emit,
+                           const StreamOptions &options = {}) const;
+  /// Parse copies of several texts in parallel with the given rule
+  /// @param name the rule name
+  /// @param texts the input texts
+  /// @param threads the maximum number of threads, 0 to use the hardware
+  /// concurrency
+  /// @return the parse results in the order of the texts
+  std::vector<ParseResult> parse_many(const std::string &name,
+                                      std::span<const std::string_view> texts,
+                                      std::size_t threads = 0) const;
+  /// Parse several files in parallel with the given rule, each file is
+  /// memory mapped as by parse_file
+  /// @param name the rule name
+  /// @param paths the paths of the files
+  /// @param threads the maximum number of threads, 0 to use the hardware
+  /// concurrency
+  /// @return the parse results in the order of the paths
+  /// @throw std::system_error if a file cannot be mapped
+  std::vector<ParseResult>
+  parse_many(const std::string &name,
+             std::span<const std::filesystem::path> paths,
+             std::size_t threads = 0) const;
+  /// The profile of the rule calls of all the parses, collected when the
+  /// library is built with PEGIUM_ENABLE_PROFILING
+  /// @return the profiler
+  Profiler &profiler() const noexcept { return _profiler; }
+  /// @return the features assigned by the rules, e.g. to create an Index.
+  /// The grammar is compiled on the first call.
+  std::span<const Feature> features() const {
+    compile();
+    return _features;
+  }
+  /// @return the loops of the grammar that never end once their element
+  /// matches the empty text, found when the grammar is compiled. The parse
+  /// of such a loop only ends if its element fails.
+  std::span<const NullableLoop> nullable_loops() const {
+    compile();
+    return _loops;
+  }
   ~Parser() noexcept override = default;
 
 protected:
@@ -38,6 +194,9 @@ protected:
   static const inline AnyCharacter dot{};
   /// The end of file token
   static const inline NotPredicate eof = !dot;
+  /// A cut committing the alternatives being tried, e.g.
+  /// `("namespace"_kw, cut, call("ID"), "{"_kw, ...)`
+  static const inline Cut cut{};
   /// The end of line token
   static const inline PrioritizedChoice eol{"\r\n"_kw | '\n'_kw | '\r'_kw};
   /// a space character equivalent to regex `\s`
@@ -137,13 +296,13 @@ protected:
     requires std::derived_from<T, C>
   static Action action(R C::*member) {
 
-    return Action([member](std::any &value) {
+    return Action([member](std::any &value, AstArena &arena) {
       // create a new object of type C
-      auto result = std::make_shared<T>();
+      auto *result = arena.create<T>();
       // assign the current value to the new object member
-      Feature{member}.assign(result, value);
+      Feature::set((*result).*member, value);
       // re-assign the value to the new object
-      value = std::static_pointer_cast<AstNode>(result);
+      value = static_cast<AstNode *>(result);
     });
   }
 
@@ -157,13 +316,13 @@ protected:
   /// @param member the object member
   /// @return the created Action.
   template <typename C, typename R> static Action action(R C::*member) {
-    return Action([member](std::any &value) {
+    return Action([member](std::any &value, AstArena &arena) {
       // create a new object of type C
-      auto result = std::make_shared<C>();
+      auto *result = arena.create<C>();
       // assign the current value to the new object member
-      Feature{member}.assign(result, value);
+      Feature::set((*result).*member, value);
       // re-assign the value to the new object
-      value = std::static_pointer_cast<AstNode>(result);
+      value = static_cast<AstNode *>(result);
     });
   }
 
@@ -174,9 +333,9 @@ protected:
   /// @tparam T the object type
   /// @return the created Action.
   template <typename T> static Action action() {
-    return Action([](std::any &value) {
+    return Action([](std::any &value, AstArena &arena) {
       // create a new object of type T and assign it to value
-      value = std::static_pointer_cast<AstNode>(std::make_shared<T>());
+      value = static_cast<AstNode *>(arena.create<T>());
     });
   }
 
@@ -195,6 +354,7 @@ protected:
   DataTypeRule &rule(std::string name) {
     auto rule = std::make_shared<DataTypeRule>(
         name, [this] { return this->createContext(); }, make_converter<T>());
+    rule->textView(std::same_as<T, std::string_view>);
 
     _rules[name] = rule;
     return *rule.get();
@@ -206,11 +366,41 @@ protected:
 
     auto rule = std::make_shared<TerminalRule>(
         name, [this] { return this->createContext(); }, make_converter<T>());
+    rule->textView(std::same_as<T, std::string_view>);
 
     _rules[name] = rule;
     return *rule.get();
   }
 
+  /// Enable the packrat memoization of all the rule calls. The memo table
+  /// lives for the duration of one parse.
+  /// @param enable true to memoize all the rule calls
+  /// @param limit the maximum number of entries in the memo table
+  void packrat(bool enable = true,
+               std::size_t limit = MemoOptions{}.limit) noexcept {
+    _memo_options = {enable, limit};
+  }
+
+  /// Intern all the values of the rules declared with std::string_view, e.g.
+  /// to compare the identifiers by address. Otherwise the value of such a
+  /// rule is a view of the input text when the text of the rule is
+  /// contiguous, and is only interned when it is not.
+  /// @param enable true to intern all the values
+  /// @param interner the interner shared by all the parses, or nullptr to
+  /// create an interner for each parse (kept alive by its result)
+  void intern(bool enable = true,
+              std::shared_ptr<Interner> interner = nullptr) noexcept {
+    _intern = enable;
+    _interner = std::move(interner);
+  }
+
+  /// Finalize the grammar and compile the terminal rules into programs.
+  /// This is done on the first parse: rules added afterwards are not taken
+  /// into account.
+  void compile() const {
+    std::call_once(_finalized, [this] { finalize(); });
+  }
+
   /// Call an other rule
   /// @param name the rule name
   /// @return the Rule call action
@@ -238,27 +428,47 @@ protected:
     return Assignment::append<e>((std::forward<Args>(args), ...));
   }
 
+  /// Set a boolean member of the current object when the elements match
+  /// @tparam ...Args
+  /// @tparam e the member pointer
+  /// @param ...args the list of grammar elements
+  /// @return
+  template <auto e, typename... Args>
+    requires(IsGrammarElement<Args> && ...)
+  static inline Assignment enable(Args &&...args) {
+    return Assignment::enable<e>((std::forward<Args>(args), ...));
+  }
+
 private:
+  /// Create the context of a parse, the grammar is compiled on the first call
   Context createContext() const;
+  /// Build the parts of the context shared by all the parses
+  void finalize() const;
 
-  template <typename T>
-  std::function<bool(std::any &, CstNode &)> make_converter() const {
-    return [](std::any &value, CstNode &node) {
+  template <typename T> ValueConverter make_converter() const {
+    return [](std::any &value, [[maybe_unused]] AstArena &arena) {
       if constexpr (std::is_base_of_v<AstNode, T>) {
-        value = std::static_pointer_cast<AstNode>(std::make_shared<T>());
-        return true;
-      } else {
-        std::string result;
-        for (const auto &n : node)
-          if (n.isLeaf && !n.hidden)
-            result += n.text;
-
-        value = result;
-        return false;
+        value = static_cast<AstNode *>(arena.create<T>());
       }
+      // TODO convert the text of a data type rule to T
     };
   }
   std::map<std::string, std::shared_ptr<Rule>, std::less<>> _rules;
+  MemoOptions _memo_options;
+  bool _intern = false;
+  /// the interner shared by the parses or nullptr
+  std::shared_ptr<Interner> _interner;
+  mutable std::once_flag _finalized;
+  /// the element matching the hidden tokens or nullptr if there is none
+  mutable std::shared_ptr<GrammarElement> _hidden;
+  /// the profile of the parses
+  mutable Profiler _profiler;
+  /// the features assigned by the rules
+  mutable std::vector<Feature> _features;
+  /// the nullable loops of the grammar
+  mutable std::vector<NullableLoop> _loops;
+  /// the numbered elements of the grammar, identifying them in the snapshots
+  mutable ElementTable _elements;
 };
 
 /// An until operation that starts from element `from` and ends to element
@@ -268,8 +478,8 @@ private:
 /// @return the until element
 template <typename T, typename U>
   requires IsGrammarElement<T> && IsGrammarElement<U>
-Group operator>>(T &&from, U to) {
-  return Group(std::forward<T>(from), Many{(!to, AnyCharacter{})}, to);
+Group operator>>(T &&from, const U &to) {
+  return Group(std::forward<T>(from), Until{to});
 }
 
 /// Create a repetition of one or more elements
@@ -340,10 +550,4 @@ class RegexParser : public Parser {
 
 // static constexpr RegexParser p;
 } // namespace regex
-// Opérateur de string literal ""_reg
-consteval auto operator""_reg(const char *str, std::size_t len) {
-
-  std::string_view input{str, len};
-}
-
 } // namespace pegium
\ No newline at end of file
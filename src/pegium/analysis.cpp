@@ -0,0 +1,521 @@
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <pegium/analysis.hpp>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace pegium {
+
+namespace {
+
+struct FirstSetVisitor : public GrammarElement::Visitor {
+
+  FirstSet compute(const GrammarElement &element) {
+    // an element that is not visited is unknown
+    FirstSet result = FirstSet::any();
+    std::swap(result, _result);
+    element.accept(*this);
+    std::swap(result, _result);
+    return result;
+  }
+
+  void visit(const Group &group) override {
+    _result = {};
+    for (const auto &element : group.elements()) {
+      auto first = compute(*element);
+      _result |= first;
+      if (!first.nullable) {
+        _result.nullable = false;
+        return;
+      }
+    }
+    _result.nullable = true;
+  }
+  void visit(const UnorderedGroup &group) override {
+    _result = {};
+    _result.nullable = true;
+    for (const auto &element : group.elements()) {
+      auto first = compute(*element);
+      const bool nullable = _result.nullable && first.nullable;
+      _result |= first;
+      _result.nullable = nullable;
+    }
+  }
+  void visit(const PrioritizedChoice &choice) override {
+    _result = {};
+    for (const auto &element : choice.elements()) {
+      _result |= compute(*element);
+    }
+  }
+  void visit(const Optional &optional) override {
+    _result = compute(optional.element());
+    _result.nullable = true;
+  }
+  void visit(const Many &many) override {
+    _result = compute(many.element());
+    _result.nullable = true;
+  }
+  void visit(const AtLeastOne &atLeastOne) override {
+    _result = compute(atLeastOne.element());
+  }
+  void visit(const Repetition &repetition) override {
+    if (repetition.max() == 0) {
+      _result = {};
+      _result.nullable = true;
+      return;
+    }
+    _result = compute(repetition.element());
+    _result.nullable |= repetition.min() == 0;
+  }
+  // predicates, actions and cuts do not consume any character
+  void visit(const AndPredicate &) override {
+    _result = {};
+    _result.nullable = true;
+  }
+  void visit(const NotPredicate &) override {
+    _result = {};
+    _result.nullable = true;
+  }
+  void visit(const Action &) override {
+    _result = {};
+    _result.nullable = true;
+  }
+  void visit(const Cut &) override {
+    _result = {};
+    _result.nullable = true;
+  }
+  void visit(const Keyword &keyword) override {
+    _result = {};
+    const auto &value = keyword.value();
+    if (value.empty()) {
+      _result.nullable = true;
+      return;
+    }
+    auto c = static_cast<unsigned char>(value.front());
+    _result.chars[c] = true;
+    if (keyword.ignoreCase() && std::isalpha(c)) {
+      _result.chars[static_cast<unsigned char>(std::tolower(c))] = true;
+      _result.chars[static_cast<unsigned char>(std::toupper(c))] = true;
+    }
+  }
+  void visit(const KeywordSet &keywords) override {
+    _result = {};
+    for (const auto &keyword : keywords.keywords()) {
+      _result |= compute(*keyword);
+    }
+  }
+  void visit(const Character &character) override {
+    _result = {};
+    _result.chars[static_cast<unsigned char>(character.value())] = true;
+  }
+  void visit(const CharacterClass &characterClass) override {
+    _result = {};
+    _result.chars = characterClass.characters();
+  }
+  void visit(const AnyCharacter &) override {
+    _result = {};
+    // the leading bytes accepted by codepoint_length
+    for (std::size_t c = 0; c < _result.chars.size(); ++c) {
+      _result.chars[c] = c < 0x80 || (c & 0xE0) == 0xC0 ||
+                         (c & 0xF0) == 0xE0 || (c & 0xF8) == 0xF0;
+    }
+  }
+  void visit(const Until &until) override {
+    _result = compute(until.expansion());
+  }
+  void visit(const Assignment &assignment) override {
+    _result = compute(assignment.element());
+  }
+  void visit(const RuleCall &call) override {
+    if (call.rule()) {
+      _result = compute(*call.rule());
+    }
+  }
+  void visit(const ParserRule &rule) override { visitRule(rule); }
+  void visit(const DataTypeRule &rule) override { visitRule(rule); }
+  void visit(const TerminalRule &rule) override { visitRule(rule); }
+
+private:
+  FirstSet _result;
+  /// the FIRST set of the visited rules, a rule being analyzed is mapped to
+  /// nullptr
+  std::unordered_map<const Rule *, std::unique_ptr<FirstSet>> _rules;
+
+  void visitRule(const Rule &rule) {
+    auto [it, inserted] = _rules.try_emplace(std::addressof(rule));
+    if (!inserted) {
+      // a recursive rule is conservatively considered as matching any input
+      _result = it->second ? *it->second : FirstSet::any();
+      return;
+    }
+    if (!rule.element()) {
+      _result = FirstSet::any();
+      return;
+    }
+    auto result = compute(*rule.element());
+    _rules[std::addressof(rule)] = std::make_unique<FirstSet>(result);
+    _result = result;
+  }
+};
+
+struct LeftCallVisitor : public GrammarElement::Visitor {
+
+  void visit(const Group &group) override {
+    for (const auto &element : group.elements()) {
+      element->accept(*this);
+      if (!first_set(*element).nullable) {
+        return;
+      }
+    }
+  }
+  void visit(const UnorderedGroup &group) override {
+    // any element may be matched first
+    for (const auto &element : group.elements()) {
+      element->accept(*this);
+    }
+  }
+  void visit(const PrioritizedChoice &choice) override {
+    for (const auto &element : choice.elements()) {
+      element->accept(*this);
+    }
+  }
+  void visit(const Optional &optional) override {
+    optional.element().accept(*this);
+  }
+  void visit(const Many &many) override { many.element().accept(*this); }
+  void visit(const AtLeastOne &atLeastOne) override {
+    atLeastOne.element().accept(*this);
+  }
+  void visit(const Repetition &repetition) override {
+    if (repetition.max() != 0) {
+      repetition.element().accept(*this);
+    }
+  }
+  // a predicate parses its element at the same position
+  void visit(const AndPredicate &predicate) override {
+    predicate.element().accept(*this);
+  }
+  void visit(const NotPredicate &predicate) override {
+    predicate.element().accept(*this);
+  }
+  void visit(const Assignment &assignment) override {
+    assignment.element().accept(*this);
+  }
+  void visit(const RuleCall &call) override {
+    const auto *rule = call.rule();
+    if (rule && std::ranges::find(calls, rule) == calls.end()) {
+      calls.push_back(rule);
+    }
+  }
+
+  std::vector<const Rule *> calls;
+};
+
+struct DescribeVisitor : public GrammarElement::Visitor {
+  /// @return the quoted text
+  static std::string quote(std::string_view text) {
+    std::string result{"'"};
+    result.append(text).push_back('\'');
+    return result;
+  }
+  /// @param c a character of a character class
+  /// @return the character, escaped if not printable
+  static std::string escape(std::size_t c) {
+    static constexpr std::string_view digits = "0123456789abcdef";
+    if (c > ' ' && c < 0x7F) {
+      return c == ']' || c == '\\' || c == '-' || c == '^'
+                 ? std::string{'\\', static_cast<char>(c)}
+                 : std::string{static_cast<char>(c)};
+    }
+    return {'\\', 'x', digits[c >> 4], digits[c & 0xF]};
+  }
+
+  void visit(const Keyword &keyword) override {
+    description = quote(keyword.value());
+  }
+  void visit(const KeywordSet &keywords) override {
+    for (const auto &keyword : keywords.keywords()) {
+      if (!description.empty()) {
+        description += ", ";
+      }
+      description += quote(keyword->value());
+    }
+  }
+  void visit(const Character &character) override {
+    const auto c = character.value();
+    description = quote({&c, 1});
+  }
+  void visit(const CharacterClass &characterClass) override {
+    auto chars = characterClass.characters();
+    description = "[";
+    // a class matching most of the characters is described by its complement
+    if (std::ranges::count(chars, true) > 128) {
+      description += '^';
+      for (auto &c : chars) {
+        c = !c;
+      }
+    }
+    for (std::size_t c = 0; c < chars.size(); ++c) {
+      if (!chars[c]) {
+        continue;
+      }
+      auto last = c;
+      while (last + 1 < chars.size() && chars[last + 1]) {
+        ++last;
+      }
+      description += escape(c);
+      if (last > c) {
+        description += (last > c + 1 ? "-" : "") + escape(last);
+      }
+      c = last;
+    }
+    description += ']';
+  }
+  void visit(const PrioritizedChoice &choice) override {
+    for (const auto &element : choice.elements()) {
+      if (!description.empty()) {
+        description += " or ";
+      }
+      description += describe(*element);
+    }
+  }
+  void visit(const RuleCall &call) override {
+    if (call.rule()) {
+      call.rule()->accept(*this);
+    }
+  }
+  void visit(const AnyCharacter &) override {
+    description = "any character";
+    any = true;
+  }
+  void visit(const NotPredicate &predicate) override {
+    DescribeVisitor v;
+    predicate.element().accept(v);
+    description = v.any ? "end of input" : "not " + v.description;
+  }
+  void visit(const ParserRule &rule) override { description = rule.name(); }
+  void visit(const DataTypeRule &rule) override { description = rule.name(); }
+  void visit(const TerminalRule &rule) override { description = rule.name(); }
+
+  std::string description;
+  /// true if the element is an AnyCharacter
+  bool any = false;
+};
+
+struct FeatureVisitor : public GrammarElement::Visitor {
+  void visit(const Group &group) override {
+    for (const auto &element : group.elements()) {
+      element->accept(*this);
+    }
+  }
+  void visit(const UnorderedGroup &group) override {
+    for (const auto &element : group.elements()) {
+      element->accept(*this);
+    }
+  }
+  void visit(const PrioritizedChoice &choice) override {
+    for (const auto &element : choice.elements()) {
+      element->accept(*this);
+    }
+  }
+  void visit(const Optional &optional) override {
+    optional.element().accept(*this);
+  }
+  void visit(const Many &many) override { many.element().accept(*this); }
+  void visit(const AtLeastOne &atLeastOne) override {
+    atLeastOne.element().accept(*this);
+  }
+  void visit(const Repetition &repetition) override {
+    repetition.element().accept(*this);
+  }
+  void visit(const Assignment &assignment) override {
+    if (std::ranges::find(features, assignment.getFeature()) ==
+        features.end()) {
+      features.push_back(assignment.getFeature());
+    }
+    assignment.element().accept(*this);
+  }
+
+  std::vector<Feature> features;
+};
+
+/// Walk the elements of rules, each element once, the called rules being
+/// ignored
+struct WalkVisitor : public GrammarElement::Visitor {
+  void visit(const Group &group) override {
+    if (enter(group)) {
+      children(group.elements());
+    }
+  }
+  void visit(const UnorderedGroup &group) override {
+    if (enter(group)) {
+      children(group.elements());
+    }
+  }
+  void visit(const PrioritizedChoice &choice) override {
+    if (enter(choice)) {
+      children(choice.elements());
+    }
+  }
+  void visit(const Optional &optional) override {
+    if (enter(optional)) {
+      optional.element().accept(*this);
+    }
+  }
+  void visit(const Many &many) override {
+    if (enter(many)) {
+      many.element().accept(*this);
+    }
+  }
+  void visit(const AtLeastOne &atLeastOne) override {
+    if (enter(atLeastOne)) {
+      atLeastOne.element().accept(*this);
+    }
+  }
+  void visit(const Repetition &repetition) override {
+    if (enter(repetition)) {
+      repetition.element().accept(*this);
+    }
+  }
+  void visit(const AndPredicate &predicate) override {
+    if (enter(predicate)) {
+      predicate.element().accept(*this);
+    }
+  }
+  void visit(const NotPredicate &predicate) override {
+    if (enter(predicate)) {
+      predicate.element().accept(*this);
+    }
+  }
+  void visit(const Until &until) override {
+    if (enter(until)) {
+      until.expansion().accept(*this);
+    }
+  }
+  void visit(const Assignment &assignment) override {
+    if (enter(assignment)) {
+      assignment.element().accept(*this);
+    }
+  }
+
+  /// @param rules the walked rules
+  /// @param callback the callback receiving the rule and each element
+  void walk(std::span<const Rule *const> rules,
+            const std::function<void(const Rule &, const GrammarElement &)>
+                &callback) {
+    _callback = &callback;
+    for (const auto *rule : rules) {
+      _rule = rule;
+      if (rule->element()) {
+        rule->element()->accept(*this);
+      }
+    }
+  }
+
+private:
+  const std::function<void(const Rule &, const GrammarElement &)>
+      *_callback = nullptr;
+  const Rule *_rule = nullptr;
+  std::unordered_set<const GrammarElement *> _visited;
+
+  /// @return true if the element was not visited yet
+  bool enter(const GrammarElement &element) {
+    if (!_visited.insert(std::addressof(element)).second) {
+      return false;
+    }
+    (*_callback)(*_rule, element);
+    return true;
+  }
+  void children(const std::vector<std::shared_ptr<GrammarElement>> &range) {
+    for (const auto &element : range) {
+      element->accept(*this);
+    }
+  }
+};
+
+/// Find the repeated element of a repetition that may match it twice
+struct LoopVisitor : public GrammarElement::Visitor {
+  void visit(const Many &many) override {
+    element = std::addressof(many.element());
+  }
+  void visit(const AtLeastOne &atLeastOne) override {
+    element = std::addressof(atLeastOne.element());
+  }
+  void visit(const Repetition &repetition) override {
+    if (repetition.max() > 1) {
+      element = std::addressof(repetition.element());
+    }
+  }
+
+  const GrammarElement *element = nullptr;
+};
+
+/// Prepare the elements for the parse
+struct PrepareVisitor : public GrammarElement::Visitor {
+  void visit(const PrioritizedChoice &choice) override { choice.prepare(); }
+  void visit(const Many &many) override { many.prepare(); }
+};
+
+} // namespace
+
+std::vector<const Rule *> left_calls(const Rule &rule) {
+  LeftCallVisitor visitor;
+  if (rule.element()) {
+    rule.element()->accept(visitor);
+  }
+  return visitor.calls;
+}
+
+FirstSet first_set(const GrammarElement &element) {
+  FirstSetVisitor visitor;
+  return visitor.compute(element);
+}
+
+std::vector<Feature> features(std::span<const Rule *const> rules) {
+  FeatureVisitor visitor;
+  for (const auto *rule : rules) {
+    if (rule->element()) {
+      rule->element()->accept(visitor);
+    }
+  }
+  return visitor.features;
+}
+
+std::vector<NullableLoop> nullable_loops(std::span<const Rule *const> rules) {
+  std::vector<NullableLoop> loops;
+  // the FIRST sets of the called rules are computed once
+  FirstSetVisitor firsts;
+  for (const auto *rule : rules) {
+    if (rule->isTerminal() && rule->element() &&
+        static_cast<const TerminalRule *>(rule)->hidden() &&
+        firsts.compute(*rule->element()).nullable) {
+      loops.push_back({rule, rule});
+    }
+  }
+  WalkVisitor walker;
+  walker.walk(rules, [&](const Rule &rule, const GrammarElement &element) {
+    LoopVisitor v;
+    element.accept(v);
+    if (v.element && firsts.compute(*v.element).nullable) {
+      loops.push_back({std::addressof(rule), std::addressof(element)});
+    }
+  });
+  return loops;
+}
+
+void prepare(std::span<const Rule *const> rules) {
+  PrepareVisitor v;
+  WalkVisitor walker;
+  walker.walk(rules, [&](const Rule &, const GrammarElement &element) {
+    element.accept(v);
+  });
+}
+
+std::string describe(const GrammarElement &element) {
+  DescribeVisitor visitor;
+  element.accept(visitor);
+  return visitor.description.empty() ? "a token" : visitor.description;
+}
+
+} // namespace pegium
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <pegium/grammar.hpp>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace pegium {
+
+/// The set of characters that may start a successful match of an element.
+struct FirstSet {
+  /// the characters that may be consumed first
+  std::array<bool, 256> chars{};
+  /// true if the element may succeed without consuming any character
+  bool nullable = false;
+
+  FirstSet &operator|=(const FirstSet &other) noexcept {
+    for (std::size_t c = 0; c < chars.size(); ++c) {
+      chars[c] |= other.chars[c];
+    }
+    nullable |= other.nullable;
+    return *this;
+  }
+
+  /// @return a FirstSet that matches any input
+  static FirstSet any() noexcept {
+    FirstSet result;
+    result.chars.fill(true);
+    result.nullable = true;
+    return result;
+  }
+};
+
+/// Compute the FIRST set of a grammar element.
+/// The result is conservative: an element that cannot be analyzed (e.g. a
+/// left recursive rule or an unknown element) may match any input.
+/// @param element the grammar element
+/// @return the FIRST set of the element
+FirstSet first_set(const GrammarElement &element);
+
+/// Find the rules called by a rule in left position, i.e. that may be called
+/// at the position of the rule call before any character is consumed. A rule
+/// is left recursive if it is reachable from itself through these calls.
+/// @param rule the rule
+/// @return the rules called in left position, without duplicates
+std::vector<const Rule *> left_calls(const Rule &rule);
+
+/// Find the features assigned by rules, the called rules being ignored
+/// @param rules the rules
+/// @return the features, without duplicates
+std::vector<Feature> features(std::span<const Rule *const> rules);
+
+/// A loop of a grammar that never ends once its element matches the empty
+/// text, e.g. `many(opt("a"_kw))`
+struct NullableLoop {
+  /// the rule containing the loop
+  const Rule *rule;
+  /// the repetition of a nullable element, or the rule itself for a hidden
+  /// terminal rule matching the empty text since the hidden tokens are
+  /// skipped in a loop
+  const GrammarElement *loop;
+};
+
+/// Find the nullable loops of rules. The FIRST sets being conservative, an
+/// element that cannot be analyzed is considered nullable.
+/// @param rules the rules
+/// @return the nullable loops, the hidden terminal rules first
+std::vector<NullableLoop> nullable_loops(std::span<const Rule *const> rules);
+
+/// Prepare the elements of complete rules for the parse: the tables built
+/// on first use, e.g. the dispatch tables of the choices and the FIRST sets
+/// of the recovering repetitions, are built now
+/// @param rules the rules
+void prepare(std::span<const Rule *const> rules);
+
+/// Describe an element expected by a parse, e.g. to report a syntax error:
+/// a keyword is quoted, a rule is described by its name.
+/// @param element the grammar element
+/// @return the description of the element
+std::string describe(const GrammarElement &element);
+
+} // namespace pegium
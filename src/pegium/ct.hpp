@@ -0,0 +1,920 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <pegium/grammar.hpp>
+#include <pegium/lookup.hpp>
+#include <pegium/scan.hpp>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/// Compile-time grammar expressions.
+/// Unlike the grammar elements, the expressions keep their concrete types:
+/// a terminal made of expressions is compiled into straight-line code and
+/// is only type-erased into a GrammarElement at the rule boundary.
+/// e.g. `terminal("ID")((ct::cls("a-zA-Z_"), *ct::w))`
+namespace pegium::ct {
+
+/// The length returned by a failed match (same as the grammar elements)
+inline constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+/// Base class of the expressions. An expression matches the start of a text
+/// with `match(sv)`, and `match(sv, examined)` also measures the furthest
+/// position examined by the match, the end of the text included.
+struct Tag {};
+
+/// Concept to check if a type is an expression
+template <typename T>
+concept IsExpression = std::derived_from<std::decay_t<T>, Tag>;
+
+namespace detail {
+constexpr char tolower(char c) noexcept {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+constexpr std::size_t codepoint_length(std::string_view sv) noexcept {
+  if (!sv.empty()) {
+    auto b = static_cast<unsigned char>(sv.front());
+    if ((b & 0x80) == 0) {
+      return 1;
+    }
+    if ((b & 0xE0) == 0xC0 && sv.size() >= 2) {
+      return 2;
+    }
+    if ((b & 0xF0) == 0xE0 && sv.size() >= 3) {
+      return 3;
+    }
+    if ((b & 0xF8) == 0xF0 && sv.size() >= 4) {
+      return 4;
+    }
+  }
+  return npos;
+}
+constexpr std::array<bool, 256>
+negate(std::array<bool, 256> lookup) noexcept {
+  for (auto &c : lookup) {
+    c = !c;
+  }
+  return lookup;
+}
+/// Append a number to the description of the structure of an expression
+inline void describe(std::size_t n, std::string &structure) {
+  structure += std::to_string(n);
+  structure += ';';
+}
+/// Append the bitmap of a set to the description of the structure of an
+/// expression
+inline void describe(const std::array<bool, 256> &lookup,
+                     std::string &structure) {
+  for (std::size_t i = 0; i < lookup.size(); i += 8) {
+    unsigned char byte = 0;
+    for (std::size_t j = 0; j < 8; ++j) {
+      byte |= static_cast<unsigned char>(lookup[i + j] << j);
+    }
+    structure += static_cast<char>(byte);
+  }
+}
+} // namespace detail
+
+/// Match a character
+struct Char : Tag {
+  constexpr explicit Char(char value) noexcept : value{value} {}
+  constexpr std::size_t match(std::string_view sv) const noexcept {
+    return !sv.empty() && sv.front() == value ? 1 : npos;
+  }
+  constexpr std::size_t match(std::string_view sv,
+                              std::size_t &examined) const noexcept {
+    examined = 0;
+    return match(sv);
+  }
+  void describe(std::string &structure) const {
+    structure += 'c';
+    structure += value;
+  }
+  char value;
+};
+
+/// Match a string, the text must outlive the expression
+struct String : Tag {
+  constexpr explicit String(std::string_view value,
+                            bool ignoreCase = false) noexcept
+      : value{value}, ignoreCase{ignoreCase} {}
+  constexpr std::size_t match(std::string_view sv) const noexcept {
+    std::size_t examined;
+    return match(sv, examined);
+  }
+  constexpr std::size_t match(std::string_view sv,
+                              std::size_t &examined) const noexcept {
+    for (std::size_t i = 0; i < value.size(); ++i) {
+      examined = i;
+      if (i == sv.size() ||
+          (ignoreCase ? detail::tolower(sv[i]) != detail::tolower(value[i])
+                      : sv[i] != value[i])) {
+        return npos;
+      }
+    }
+    examined = value.empty() ? 0 : value.size() - 1;
+    return value.size();
+  }
+  void describe(std::string &structure) const {
+    structure += ignoreCase ? 'i' : 's';
+    detail::describe(value.size(), structure);
+    structure += value;
+  }
+  std::string_view value;
+  bool ignoreCase;
+};
+
+/// Match any codepoint
+struct Any : Tag {
+  constexpr std::size_t match(std::string_view sv) const noexcept {
+    return detail::codepoint_length(sv);
+  }
+  constexpr std::size_t match(std::string_view sv,
+                              std::size_t &examined) const noexcept {
+    const auto len = match(sv);
+    // a codepoint has at most 4 bytes
+    examined = len == npos ? std::min<std::size_t>(3, sv.size()) : len - 1;
+    return len;
+  }
+  void describe(std::string &structure) const { structure += 'a'; }
+};
+
+/// Match a character of a set
+struct Class : Tag {
+  constexpr explicit Class(const std::array<bool, 256> &lookup) noexcept
+      : lookup{lookup}, ranges{ByteRanges::from(lookup)} {}
+  constexpr std::size_t match(std::string_view sv) const noexcept {
+    return !sv.empty() && lookup[static_cast<unsigned char>(sv.front())]
+               ? 1
+               : npos;
+  }
+  constexpr std::size_t match(std::string_view sv,
+                              std::size_t &examined) const noexcept {
+    examined = 0;
+    return match(sv);
+  }
+  /// @param sv the input text
+  /// @return the length of the longest prefix of sv made of characters of
+  /// the set
+  constexpr std::size_t span(std::string_view sv) const noexcept {
+    if (std::is_constant_evaluated()) {
+      std::size_t i = 0;
+      while (i < sv.size() && lookup[static_cast<unsigned char>(sv[i])]) {
+        ++i;
+      }
+      return i;
+    }
+    return scan(lookup, ranges, sv);
+  }
+  constexpr Class operator~() const noexcept {
+    return Class{detail::negate(lookup)};
+  }
+  void describe(std::string &structure) const {
+    structure += 'k';
+    detail::describe(lookup, structure);
+  }
+  std::array<bool, 256> lookup;
+  ByteRanges ranges;
+};
+
+/// Match a sequence of two expressions
+template <IsExpression L, IsExpression R>
+struct Seq : Tag {
+  constexpr Seq(L left, R right) noexcept
+      : left{std::move(left)}, right{std::move(right)} {}
+  constexpr std::size_t match(std::string_view sv) const noexcept {
+    auto i = left.match(sv);
+    if (i == npos) {
+      return npos;
+    }
+    auto len = right.match({sv.data() + i, sv.size() - i});
+    return len == npos ? npos : i + len;
+  }
+  constexpr std::size_t match(std::string_view sv,
+                              std::size_t &examined) const noexcept {
+    auto i = left.match(sv, examined);
+    if (i == npos) {
+      return npos;
+    }
+    std::size_t next;
+    auto len = right.match({sv.data() + i, sv.size() - i}, next);
+    examined = std::max(examined, i + next);
+    return len == npos ? npos : i + len;
+  }
+  void describe(std::string &structure) const {
+    structure += 'q';
+    left.describe(structure);
+    right.describe(structure);
+  }
+  L left;
+  R right;
+};
+
+/// Match the first matching expression of two expressions
+template <IsExpression L, IsExpression R>
+struct Alt : Tag {
+  constexpr Alt(L left, R right) noexcept
+      : left{std::move(left)}, right{std::move(right)} {}
+  constexpr std::size_t match(std::string_view sv) const noexcept {
+    auto i = left.match(sv);
+    return i != npos ? i : right.match(sv);
+  }
+  constexpr std::size_t match(std::string_view sv,
+                              std::size_t &examined) const noexcept {
+    auto i = left.match(sv, examined);
+    if (i != npos) {
+      return i;
+    }
+    std::size_t next;
+    i = right.match(sv, next);
+    examined = std::max(examined, next);
+    return i;
+  }
+  void describe(std::string &structure) const {
+    structure += 'o';
+    left.describe(structure);
+    right.describe(structure);
+  }
+  L left;
+  R right;
+};
+
+/// Match an expression repeated between min and max times
+template <IsExpression E>
+struct Repeat : Tag {
+  constexpr Repeat(E element, std::size_t min, std::size_t max) noexcept
+      : element{std::move(element)}, min{min}, max{max} {}
+  constexpr std::size_t match(std::string_view sv) const noexcept {
+    if constexpr (std::same_as<E, Class>) {
+      // each character of a class is one byte
+      auto i = element.span({sv.data(), std::min(sv.size(), max)});
+      return i >= min ? i : npos;
+    } else {
+      std::size_t count = 0;
+      std::size_t i = 0;
+      while (count < max) {
+        auto len = element.match({sv.data() + i, sv.size() - i});
+        if (len == npos) {
+          break;
+        }
+        i += len;
+        ++count;
+      }
+      return count >= min ? i : npos;
+    }
+  }
+  constexpr std::size_t match(std::string_view sv,
+                              std::size_t &examined) const noexcept {
+    if constexpr (std::same_as<E, Class>) {
+      // the character ending the span is examined
+      auto i = element.span({sv.data(), std::min(sv.size(), max)});
+      examined = i;
+      return i >= min ? i : npos;
+    } else {
+      std::size_t count = 0;
+      std::size_t i = 0;
+      examined = 0;
+      while (count < max) {
+        std::size_t next;
+        auto len = element.match({sv.data() + i, sv.size() - i}, next);
+        examined = std::max(examined, i + next);
+        if (len == npos) {
+          break;
+        }
+        i += len;
+        ++count;
+      }
+      return count >= min ? i : npos;
+    }
+  }
+  void describe(std::string &structure) const {
+    structure += 'r';
+    detail::describe(min, structure);
+    detail::describe(max, structure);
+    element.describe(structure);
+  }
+  E element;
+  std::size_t min;
+  std::size_t max;
+};
+
+/// Succeed without consuming anything if the expression matches
+template <IsExpression E>
+struct And : Tag {
+  constexpr explicit And(E element) noexcept : element{std::move(element)} {}
+  constexpr std::size_t match(std::string_view sv) const noexcept {
+    return element.match(sv) != npos ? 0 : npos;
+  }
+  constexpr std::size_t match(std::string_view sv,
+                              std::size_t &examined) const noexcept {
+    return element.match(sv, examined) != npos ? 0 : npos;
+  }
+  void describe(std::string &structure) const {
+    structure += '&';
+    element.describe(structure);
+  }
+  E element;
+};
+
+/// Succeed without consuming anything if the expression does not match
+template <IsExpression E>
+struct Not : Tag {
+  constexpr explicit Not(E element) noexcept : element{std::move(element)} {}
+  constexpr std::size_t match(std::string_view sv) const noexcept {
+    return element.match(sv) != npos ? npos : 0;
+  }
+  constexpr std::size_t match(std::string_view sv,
+                              std::size_t &examined) const noexcept {
+    return element.match(sv, examined) != npos ? npos : 0;
+  }
+  void describe(std::string &structure) const {
+    structure += '!';
+    element.describe(structure);
+  }
+  E element;
+};
+
+/// The type-erased base of the grammar elements made of an expression,
+/// visited as a single element
+class ExpressionElement : public GrammarElement {
+public:
+  /// Append a stable description of the structure of the expression: two
+  /// expressions with the same description match the same texts
+  /// @param structure the description
+  virtual void describe(std::string &structure) const = 0;
+};
+
+/// A grammar element made of an expression
+template <IsExpression E>
+class Element final : public ExpressionElement {
+public:
+  explicit Element(E expression) : _expression{std::move(expression)} {}
+
+  std::size_t parse_rule(std::string_view sv, CstNode &parent,
+                         Context &c) const override {
+    std::size_t examined;
+    auto i = _expression.match(sv, examined);
+    if (i == npos) {
+      c.expect(this, sv.data(), examined);
+      return npos;
+    }
+    c.examine(sv.data() + examined);
+    return c.leaf(this, sv, i, parent);
+  }
+  std::size_t parse_hidden(std::string_view sv,
+                           CstNode &parent) const override {
+    auto i = _expression.match(sv);
+    if (i == npos) {
+      return npos;
+    }
+    auto &node = parent.emplace_back();
+    node.grammarSource = this;
+    node.text = {sv.data(), i};
+    node.isLeaf = true;
+    node.hidden = true;
+    return i;
+  }
+  std::size_t parse_terminal(std::string_view sv) const override {
+    return _expression.match(sv);
+  }
+  /// A match examines at least up to the character following it
+  std::size_t match_terminal(std::string_view sv,
+                             std::size_t &examined) const override {
+    auto i = _expression.match(sv, examined);
+    if (i != npos) {
+      examined = std::max(examined, i);
+    }
+    return i;
+  }
+  void accept(Visitor &v) const override { v.visit(*this); }
+  void describe(std::string &structure) const override {
+    _expression.describe(structure);
+  }
+  const E &expression() const noexcept { return _expression; }
+
+private:
+  E _expression;
+};
+
+/// Type-erase an expression into a grammar element
+/// @param expression the expression
+/// @return the grammar element
+template <IsExpression E>
+Element<std::decay_t<E>> to_element(E &&expression) {
+  return Element<std::decay_t<E>>{std::forward<E>(expression)};
+}
+
+/// @param c the character
+/// @return an expression matching the character
+constexpr Char chr(char c) noexcept { return Char{c}; }
+/// @param s the keyword, it must outlive the expression
+/// @return an expression matching the keyword
+constexpr String kw(std::string_view s) noexcept { return String{s}; }
+/// @param s the keyword, it must outlive the expression
+/// @return an expression matching the keyword ignoring the case
+constexpr String ikw(std::string_view s) noexcept { return String{s, true}; }
+
+/// Create a character class, e.g. `cls("a-zA-Z_")`
+/// @param s the characters and ranges of the class
+/// @param negated true to match the characters that are not in the class
+/// @param ignoreCase true to ignore the case of the characters
+/// @return the character class
+consteval Class cls(std::string_view s, bool negated = false,
+                    bool ignoreCase = false) {
+  std::array<bool, 256> lookup{};
+  std::size_t i = 0;
+  while (i < s.size()) {
+    if (i + 2 < s.size() && s[i + 1] == '-') {
+      for (int c = static_cast<unsigned char>(s[i]);
+           c <= static_cast<unsigned char>(s[i + 2]); ++c) {
+        lookup[c] = true;
+      }
+      i += 3;
+    } else {
+      lookup[static_cast<unsigned char>(s[i])] = true;
+      i += 1;
+    }
+  }
+  if (ignoreCase) {
+    for (int c = 'a'; c <= 'z'; ++c) {
+      lookup[c] = lookup[c] || lookup[c - 'a' + 'A'];
+      lookup[c - 'a' + 'A'] = lookup[c];
+    }
+  }
+  return Class{negated ? detail::negate(lookup) : lookup};
+}
+
+/// any character equivalent to regex `.`
+inline constexpr Any dot{};
+/// a space character equivalent to regex `\s`
+inline constexpr Class s{make_lookup(' ', '\t', '\r', '\n', '\f', '\v')};
+/// a non space character equivalent to regex `\S`
+inline constexpr Class S = ~s;
+/// a word character equivalent to regex `\w`
+inline constexpr Class w{make_lookup(std::pair{'a', 'z'}, std::pair{'A', 'Z'},
+                                     std::pair{'0', '9'}, '_')};
+/// a non word character equivalent to regex `\W`
+inline constexpr Class W = ~w;
+/// a digit character equivalent to regex `\d`
+inline constexpr Class d{make_lookup(std::pair{'0', '9'})};
+/// a non-digit character equivalent to regex `\D`
+inline constexpr Class D = ~d;
+
+/// Create a sequence of two expressions
+template <IsExpression L, IsExpression R>
+constexpr Seq<std::decay_t<L>, std::decay_t<R>> operator,(L &&left,
+                                                          R &&right) {
+  return {std::forward<L>(left), std::forward<R>(right)};
+}
+/// Create an ordered choice of two expressions
+template <IsExpression L, IsExpression R>
+constexpr Alt<std::decay_t<L>, std::decay_t<R>> operator|(L &&left,
+                                                          R &&right) {
+  return {std::forward<L>(left), std::forward<R>(right)};
+}
+/// Create a repetition of an expression between min and max times
+template <IsExpression E>
+constexpr Repeat<std::decay_t<E>> rep(E &&element, std::size_t min,
+                                      std::size_t max) {
+  return {std::forward<E>(element), min, max};
+}
+/// Create a repetition of zero or more expressions
+template <IsExpression E>
+constexpr Repeat<std::decay_t<E>> many(E &&element) {
+  return rep(std::forward<E>(element), 0, npos);
+}
+/// Create a repetition of one or more expressions
+template <IsExpression E>
+constexpr Repeat<std::decay_t<E>> at_least_one(E &&element) {
+  return rep(std::forward<E>(element), 1, npos);
+}
+/// Create an option (zero or one)
+template <IsExpression E>
+constexpr Repeat<std::decay_t<E>> opt(E &&element) {
+  return rep(std::forward<E>(element), 0, 1);
+}
+template <IsExpression E>
+constexpr Repeat<std::decay_t<E>> operator*(E &&element) {
+  return many(std::forward<E>(element));
+}
+template <IsExpression E>
+constexpr Repeat<std::decay_t<E>> operator+(E &&element) {
+  return at_least_one(std::forward<E>(element));
+}
+template <IsExpression E>
+constexpr And<std::decay_t<E>> operator&(E &&element) {
+  return And<std::decay_t<E>>{std::forward<E>(element)};
+}
+template <IsExpression E>
+constexpr Not<std::decay_t<E>> operator!(E &&element) {
+  return Not<std::decay_t<E>>{std::forward<E>(element)};
+}
+
+/// A string usable as a template argument
+template <std::size_t N>
+struct FixedString {
+  consteval FixedString(const char (&str)[N]) {
+    for (std::size_t i = 0; i < N; ++i) {
+      value[i] = str[i];
+    }
+  }
+  constexpr std::string_view view() const noexcept { return {value, N - 1}; }
+  char value[N]{};
+};
+
+namespace regex {
+
+enum class Kind : std::uint8_t { Empty, Char, Set, Any, Seq, Alt, Repeat };
+
+struct Node {
+  Kind kind = Kind::Empty;
+  int left = -1;
+  int right = -1;
+  std::size_t min = 0;
+  std::size_t max = 0;
+  char c = 0;
+  int set = -1;
+};
+
+/// The syntax tree of a regular expression of N characters
+template <std::size_t N>
+struct Ast {
+  std::array<Node, 2 * N + 2> nodes{};
+  /// the character sets as bitsets
+  std::array<std::array<std::uint64_t, 4>, N + 1> sets{};
+  int count = 0;
+  int setCount = 0;
+  int root = -1;
+};
+
+/// A consteval parser of regular expressions.
+/// Supported syntax: literals, `.`, escapes (`\d \D \w \W \s \S \n \r \t \f
+/// \v` or an escaped character), classes `[a-z]` `[^a-z]`, groups `( )`,
+/// alternatives `|` and quantifiers `* + ? {n} {n,} {n,m}`.
+template <std::size_t N>
+class Parser {
+public:
+  consteval explicit Parser(std::string_view text) : _text{text} {}
+
+  consteval Ast<N> parse() {
+    _ast.root = alternation();
+    if (_pos != _text.size()) {
+      throw "invalid regular expression: unbalanced ')'";
+    }
+    return _ast;
+  }
+
+private:
+  std::string_view _text;
+  std::size_t _pos = 0;
+  Ast<N> _ast;
+
+  consteval int add(Node node) {
+    _ast.nodes[_ast.count] = node;
+    return _ast.count++;
+  }
+  consteval bool more() const { return _pos < _text.size(); }
+  consteval char peek() const { return _text[_pos]; }
+
+  consteval int alternation() {
+    int left = sequence();
+    while (more() && peek() == '|') {
+      ++_pos;
+      int right = sequence();
+      left = add({.kind = Kind::Alt, .left = left, .right = right});
+    }
+    return left;
+  }
+
+  consteval int sequence() {
+    int left = -1;
+    while (more() && peek() != '|' && peek() != ')') {
+      int right = quantified();
+      left = left < 0 ? right
+                      : add({.kind = Kind::Seq, .left = left, .right = right});
+    }
+    return left < 0 ? add({.kind = Kind::Empty}) : left;
+  }
+
+  consteval std::size_t number() {
+    if (!more() || peek() < '0' || peek() > '9') {
+      throw "invalid regular expression: expected a number";
+    }
+    std::size_t result = 0;
+    while (more() && peek() >= '0' && peek() <= '9') {
+      result = result * 10 + static_cast<std::size_t>(peek() - '0');
+      ++_pos;
+    }
+    return result;
+  }
+
+  consteval int quantified() {
+    int element = atom();
+    while (more()) {
+      std::size_t min = 0;
+      std::size_t max = npos;
+      switch (peek()) {
+      case '*':
+        break;
+      case '+':
+        min = 1;
+        break;
+      case '?':
+        max = 1;
+        break;
+      case '{':
+        ++_pos;
+        min = max = number();
+        if (more() && peek() == ',') {
+          ++_pos;
+          max = more() && peek() == '}' ? npos : number();
+        }
+        if (!more() || peek() != '}' || min > max) {
+          throw "invalid regular expression: invalid repetition";
+        }
+        break;
+      default:
+        return element;
+      }
+      ++_pos;
+      element = add(
+          {.kind = Kind::Repeat, .left = element, .min = min, .max = max});
+    }
+    return element;
+  }
+
+  consteval int atom() {
+    char c = _text[_pos++];
+    switch (c) {
+    case '(': {
+      int element = alternation();
+      if (!more() || peek() != ')') {
+        throw "invalid regular expression: missing ')'";
+      }
+      ++_pos;
+      return element;
+    }
+    case '[':
+      return set();
+    case '.':
+      return add({.kind = Kind::Any});
+    case '\\': {
+      std::array<bool, 256> lookup{};
+      if (escape(lookup)) {
+        return addSet(lookup);
+      }
+      return add({.kind = Kind::Char, .c = escaped(_text[_pos - 1])});
+    }
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+    case ')':
+      throw "invalid regular expression: unexpected character";
+    default:
+      return add({.kind = Kind::Char, .c = c});
+    }
+  }
+
+  /// Parse an escape sequence after the backslash
+  /// @param lookup the set of a class escape
+  /// @return true for a class escape, false for an escaped character
+  consteval bool escape(std::array<bool, 256> &lookup) {
+    if (!more()) {
+      throw "invalid regular expression: trailing '\\'";
+    }
+    char c = _text[_pos++];
+    switch (c) {
+    case 'd':
+      lookup = ct::d.lookup;
+      return true;
+    case 'D':
+      lookup = ct::D.lookup;
+      return true;
+    case 'w':
+      lookup = ct::w.lookup;
+      return true;
+    case 'W':
+      lookup = ct::W.lookup;
+      return true;
+    case 's':
+      lookup = ct::s.lookup;
+      return true;
+    case 'S':
+      lookup = ct::S.lookup;
+      return true;
+    default:
+      return false;
+    }
+  }
+  consteval char escaped(char c) const {
+    switch (c) {
+    case 'n':
+      return '\n';
+    case 'r':
+      return '\r';
+    case 't':
+      return '\t';
+    case 'f':
+      return '\f';
+    case 'v':
+      return '\v';
+    default:
+      return c;
+    }
+  }
+  /// @return the next character of a class
+  consteval char classCharacter(std::array<bool, 256> &lookup, bool &isSet) {
+    isSet = false;
+    char c = _text[_pos++];
+    if (c != '\\') {
+      return c;
+    }
+    isSet = escape(lookup);
+    return escaped(_text[_pos - 1]);
+  }
+
+  consteval int set() {
+    std::array<bool, 256> lookup{};
+    bool negated = more() && peek() == '^';
+    if (negated) {
+      ++_pos;
+    }
+    bool first = true;
+    while (more() && (peek() != ']' || first)) {
+      first = false;
+      std::array<bool, 256> escape{};
+      bool isSet = false;
+      auto low = static_cast<unsigned char>(classCharacter(escape, isSet));
+      if (isSet) {
+        for (std::size_t i = 0; i < lookup.size(); ++i) {
+          lookup[i] = lookup[i] || escape[i];
+        }
+        continue;
+      }
+      auto high = low;
+      if (_pos + 1 < _text.size() && peek() == '-' &&
+          _text[_pos + 1] != ']') {
+        ++_pos;
+        high = static_cast<unsigned char>(classCharacter(escape, isSet));
+        if (isSet || high < low) {
+          throw "invalid regular expression: invalid range";
+        }
+      }
+      for (int i = low; i <= high; ++i) {
+        lookup[i] = true;
+      }
+    }
+    if (!more()) {
+      throw "invalid regular expression: missing ']'";
+    }
+    ++_pos;
+    return addSet(negated ? detail::negate(lookup) : lookup);
+  }
+
+  consteval int addSet(const std::array<bool, 256> &lookup) {
+    auto &bits = _ast.sets[_ast.setCount];
+    for (std::size_t i = 0; i < lookup.size(); ++i) {
+      if (lookup[i]) {
+        bits[i >> 6] |= std::uint64_t{1} << (i & 63);
+      }
+    }
+    return add({.kind = Kind::Set, .set = _ast.setCount++});
+  }
+};
+
+/// @return the syntax tree of a regular expression
+template <FixedString S>
+consteval auto parse() {
+  return Parser<sizeof(S.value)>{S.view()}.parse();
+}
+
+} // namespace regex
+
+/// An expression compiled from a regular expression. The matching follows
+/// the PEG semantic: repetitions are greedy and possessive and alternatives
+/// are ordered, so `a*a` never matches.
+template <auto Ast>
+struct Regex : Tag {
+  constexpr std::size_t match(std::string_view sv) const noexcept {
+    std::size_t examined;
+    return match_node<Ast.root>(sv, examined);
+  }
+  constexpr std::size_t match(std::string_view sv,
+                              std::size_t &examined) const noexcept {
+    return match_node<Ast.root>(sv, examined);
+  }
+  void describe(std::string &structure) const {
+    describe_node<Ast.root>(structure);
+  }
+
+private:
+  template <int I>
+  static constexpr Class set = [] {
+    std::array<bool, 256> lookup{};
+    const auto &bits = Ast.sets[I];
+    for (std::size_t c = 0; c < lookup.size(); ++c) {
+      lookup[c] = (bits[c >> 6] >> (c & 63)) & 1;
+    }
+    return Class{lookup};
+  }();
+
+  template <int I>
+  static constexpr std::size_t match_node(std::string_view sv,
+                                          std::size_t &examined) noexcept {
+    constexpr regex::Node node = Ast.nodes[I];
+    if constexpr (node.kind == regex::Kind::Empty) {
+      examined = 0;
+      return 0;
+    } else if constexpr (node.kind == regex::Kind::Char) {
+      return Char{node.c}.match(sv, examined);
+    } else if constexpr (node.kind == regex::Kind::Set) {
+      return set<node.set>.match(sv, examined);
+    } else if constexpr (node.kind == regex::Kind::Any) {
+      return Any{}.match(sv, examined);
+    } else if constexpr (node.kind == regex::Kind::Seq) {
+      auto i = match_node<node.left>(sv, examined);
+      if (i == npos) {
+        return npos;
+      }
+      std::size_t next;
+      auto len = match_node<node.right>({sv.data() + i, sv.size() - i}, next);
+      examined = std::max(examined, i + next);
+      return len == npos ? npos : i + len;
+    } else if constexpr (node.kind == regex::Kind::Alt) {
+      auto i = match_node<node.left>(sv, examined);
+      if (i != npos) {
+        return i;
+      }
+      std::size_t next;
+      i = match_node<node.right>(sv, next);
+      examined = std::max(examined, next);
+      return i;
+    } else {
+      constexpr regex::Node element = Ast.nodes[node.left];
+      if constexpr (element.kind == regex::Kind::Set) {
+        auto i = set<element.set>.span({sv.data(), std::min(sv.size(),
+                                                            node.max)});
+        examined = i;
+        return i >= node.min ? i : npos;
+      } else {
+        std::size_t count = 0;
+        std::size_t i = 0;
+        examined = 0;
+        while (count < node.max) {
+          std::size_t next;
+          auto len =
+              match_node<node.left>({sv.data() + i, sv.size() - i}, next);
+          examined = std::max(examined, i + next);
+          if (len == npos) {
+            break;
+          }
+          i += len;
+          ++count;
+        }
+        return count >= node.min ? i : npos;
+      }
+    }
+  }
+
+  template <int I> static void describe_node(std::string &structure) {
+    constexpr regex::Node node = Ast.nodes[I];
+    if constexpr (node.kind == regex::Kind::Empty) {
+      structure += 'e';
+    } else if constexpr (node.kind == regex::Kind::Char) {
+      Char{node.c}.describe(structure);
+    } else if constexpr (node.kind == regex::Kind::Set) {
+      set<node.set>.describe(structure);
+    } else if constexpr (node.kind == regex::Kind::Any) {
+      Any{}.describe(structure);
+    } else if constexpr (node.kind == regex::Kind::Seq ||
+                         node.kind == regex::Kind::Alt) {
+      structure += node.kind == regex::Kind::Seq ? 'q' : 'o';
+      describe_node<node.left>(structure);
+      describe_node<node.right>(structure);
+    } else {
+      structure += 'r';
+      detail::describe(node.min, structure);
+      detail::describe(node.max, structure);
+      describe_node<node.left>(structure);
+    }
+  }
+};
+
+} // namespace pegium::ct
+
+namespace pegium {
+inline namespace literals {
+/// Compile a regular expression into an expression, e.g. `"[a-z]\\w*"_reg`
+template <ct::FixedString S>
+consteval auto operator""_reg() {
+  return ct::Regex<ct::regex::parse<S>()>{};
+}
+} // namespace literals
+} // namespace pegium
@@ -1,162 +1,782 @@
+#include <algorithm>
 #include <any>
 #include <array>
 #include <cassert>
 #include <cstddef>
+#include <cstring>
 #include <functional>
 #include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <pegium/analysis.hpp>
 #include <pegium/grammar.hpp>
+#include <pegium/internal.hpp>
+#include <pegium/parallel.hpp>
+#include <pegium/program.hpp>
 #include <string_view>
 #include <vector>
 
 namespace pegium {
 
-consteval std::array<bool, 256> make_lookup() { return {}; }
+Rule::Rule(std::string_view name, ContextProvider provider,
+           ValueConverter action)
+    : _name{name}, _context_provider{std::move(provider)},
+      _action{std::move(action)} {}
+
+const std::string &Rule::name() const noexcept { return _name; }
+
+/// Create the root node of a parse result
+/// @param text the parsed text
+/// @param storage the owner of the text
+/// @param source the parsed rule
+/// @return the created root node
+static std::shared_ptr<RootCstNode>
+make_root(std::string_view text, std::shared_ptr<const void> storage,
+          const GrammarElement *source) {
+  auto root = std::make_shared<RootCstNode>();
+  root->fullText = text;
+  root->storage = std::move(storage);
+  root->text = text;
+  root->grammarSource = source;
+  return root;
+}
+
+ParseResult Rule::parse(std::string_view sv) const {
+  return parse(std::make_shared<const std::string>(sv));
+}
+
+ParseResult Rule::parse(std::shared_ptr<const std::string> text) const {
+  std::string_view sv = *text;
+  return parse(sv, std::move(text));
+}
+
+/// Report the errors recovered by a parse, then its furthest failure if it
+/// failed
+/// @param result the parse result
+/// @param c the parse context
+/// @param sv the input text
+/// @param parsed the parsed length, 0 if the parse failed
+static void report_errors(ParseResult &result, const Context &c,
+                          std::string_view sv, std::size_t parsed) {
+  for (const auto &error : c.errors()) {
+    result.errors.push_back({static_cast<std::size_t>(error.pos - sv.data()),
+                             error.length, error.expected});
+  }
+  result.recovered = !result.errors.empty();
+  if (result.ret) {
+    return;
+  }
+  // the text left after a successful parse is reported when no token failed
+  // further
+  ParseError error{parsed};
+  const auto &failure = c.failure();
+  if (failure.pos &&
+      static_cast<std::size_t>(failure.pos - sv.data()) >= parsed) {
+    error.offset = static_cast<std::size_t>(failure.pos - sv.data());
+    error.expected = failure.expected;
+  }
+  result.errors.push_back(std::move(error));
+}
+
+/// Parse a text from a parser or a data type rule
+/// @param rule the parsed rule
+/// @param sv the input text
+/// @param storage the owner of the text
+/// @param c the parse context
+/// @return the parse result
+static ParseResult parse_root(const Rule &rule, std::string_view sv,
+                              std::shared_ptr<const void> storage,
+                              Context &c) {
+  ParseResult result;
+  // the nodes of a recognizer are never created, the scratch root is only
+  // used for the checkpoints
+  RootCstNode scratch;
+  CstNode *root = &scratch;
+  if (c.buildsCst()) {
+    result.root_node = make_root(sv, std::move(storage), std::addressof(rule));
+    root = result.root_node.get();
+  } else if (c.buildsValue()) {
+    // the value may view the text
+    result.storage = std::move(storage);
+  }
 
-template <typename... Args>
-consteval std::array<bool, 256> make_lookup(char single_char, Args... rest) {
-  std::array<bool, 256> result = make_lookup(rest...);
-  result[static_cast<unsigned char>(single_char)] = true;
+  auto i = c.skipHiddenNodes(sv, *root);
+
+  auto len = rule.parse_rule({sv.data() + i, sv.size() - i}, *root, c);
+  result.len = i + len;
+
+  result.ret = result.len == sv.size();
+  report_errors(result, c, sv, success(len) ? result.len : 0);
+
+  if (c.buildsValue() && success(len)) {
+    result.value = c.value();
+    result.interner = c.interner();
+  }
   return result;
 }
-template <typename... Args>
-consteval std::array<bool, 256> make_lookup(std::pair<char, char> range,
-                                            Args... rest) {
-  std::array<bool, 256> result = make_lookup(rest...);
-  for (char c = range.first; c <= range.second; ++c) {
-    result[static_cast<unsigned char>(c)] = true;
+
+ParseResult Rule::parse(std::string_view sv, ParseListener &listener) const {
+  Context c = _context_provider();
+  c.mode(ParseMode::Events);
+  RootCstNode scratch;
+  ParseResult result;
+  auto i = c.skipHiddenNodes(sv, scratch);
+  auto len = parse_rule({sv.data() + i, sv.size() - i}, scratch, c);
+  if (success(len)) {
+    result.len = i + len;
+    result.ret = result.len == sv.size();
+    c.notify(listener, sv);
   }
+  report_errors(result, c, sv, success(len) ? result.len : 0);
   return result;
 }
 
-inline bool isword(char c) {
-  static constexpr auto lookup = make_lookup(
-      std::pair{'a', 'z'}, std::pair{'A', 'Z'}, std::pair{'0', '9'}, '_');
-  return lookup[static_cast<unsigned char>(c)];
+ParseResult ParserRule::parse(std::string_view sv,
+                              std::shared_ptr<const void> storage,
+                              ParseMode mode) const {
+  Context c = _context_provider();
+  c.mode(mode);
+  return parse_root(*this, sv, std::move(storage), c);
+}
+
+ParseResult DataTypeRule::parse(std::string_view sv,
+                                std::shared_ptr<const void> storage,
+                                ParseMode mode) const {
+  Context c = _context_provider();
+  c.mode(mode);
+  // TODO apply value_converter if any
+  return parse_root(*this, sv, std::move(storage), c);
 }
 
-consteval std::array<unsigned char, 256> make_tolower() {
-  std::array<unsigned char, 256> table{};
-  for (int c = 0; c < 256; ++c) {
-    if (c >= 'A' && c <= 'Z') {
-      table[c] = static_cast<unsigned char>(c) + ('a' - 'A');
+ParseResult TerminalRule::parse(std::string_view sv,
+                                std::shared_ptr<const void> storage,
+                                ParseMode mode) const {
+
+  ParseResult result;
+  if (mode != ParseMode::Recognize) {
+    result.root_node = make_root(sv, std::move(storage), this);
+  }
+
+  result.len = parse_terminal(sv);
+
+  result.ret = result.len == sv.size();
+  if (mode != ParseMode::Recognize && success(result.len)) {
+    const std::string_view text{sv.data(), result.len};
+    if (textView()) {
+      Context c = _context_provider();
+      result.value = c.view(text, true);
+      result.interner = c.interner();
     } else {
-      table[c] = static_cast<unsigned char>(c);
+      result.value = std::string{text};
     }
   }
-  return table;
+  // TODO apply value_converter if any
+  return result;
 }
 
-inline char tolower(char c) {
-  static constexpr auto tolower = make_tolower();
-  return static_cast<char>(tolower[static_cast<unsigned char>(c)]);
+/// The kind of the grammar source of a CST node
+enum class NodeKind { Other, ParserRule, DataTypeRule, Assignment, Action };
+
+/// @param node a CST node
+/// @return the kind of the grammar source of the node
+static NodeKind node_kind(const CstNode &node) {
+  struct KindVisitor : public GrammarElement::Visitor {
+    void visit(const ParserRule &) override { kind = NodeKind::ParserRule; }
+    void visit(const DataTypeRule &) override {
+      kind = NodeKind::DataTypeRule;
+    }
+    void visit(const Assignment &) override { kind = NodeKind::Assignment; }
+    void visit(const Action &) override { kind = NodeKind::Action; }
+    NodeKind kind = NodeKind::Other;
+  };
+  KindVisitor v;
+  if (!node.isLeaf && node.grammarSource) {
+    node.grammarSource->accept(v);
+  }
+  return v.kind;
 }
 
-static constexpr std::size_t PARSE_ERROR =
-    std::numeric_limits<std::size_t>::max();
-inline bool success(size_t len) { return len != PARSE_ERROR; }
+/// @param examined the furthest position examined before a rule call or
+/// nullptr
+/// @param start the start of the call in the input text
+/// @return the examined offset of the node of the call
+static std::uint32_t examined_offset(const char *examined, const char *start) {
+  if (!examined || examined <= start) {
+    return 0;
+  }
+  const auto offset = static_cast<std::size_t>(examined - start);
+  return offset < CstNode::Unexamined ? static_cast<std::uint32_t>(offset)
+                                      : CstNode::Unexamined;
+}
+
+/// Raise the furthest position examined before the outermost rule calls of a
+/// subtree, e.g. when the subtree is reused once more text was examined: the
+/// calls nested in them inherit it
+/// @param node the root of the subtree
+/// @param examined the furthest position examined or nullptr
+static void raise_examined(CstNode &node, const char *examined) {
+  if (node.isLeaf || node.text.data() >= examined) {
+    return;
+  }
+  const auto kind = node_kind(node);
+  if (kind == NodeKind::ParserRule || kind == NodeKind::DataTypeRule) {
+    node.examined =
+        std::max(node.examined, examined_offset(examined, node.text.data()));
+    return;
+  }
+  for (auto *child = node.firstChild;
+       child && child->text.data() < examined; child = child->nextSibling) {
+    raise_examined(*child, examined);
+  }
+}
 
-inline bool fail(size_t len) { return len == PARSE_ERROR; }
-/*-----------------------------------------------------------------------------
- *  UTF8 functions
- *---------------------------------------------------------------------------*/
+/// The state of a replay of the value events of a CST
+struct Replay {
+  /// the context receiving the events
+  Context &c;
+  /// the node used for the checkpoints of the assignments
+  CstNode &scratch;
+  /// the objects assigned by the nodes, updated by the replay, or nullptr
+  CstValues *values = nullptr;
+  /// the reparsed node: the objects assigned by the nodes outside of it and
+  /// of its ancestors are reused, or nullptr to build all the objects
+  const CstNode *reparsed = nullptr;
+
+  /// @param node a CST node
+  /// @return true if the object assigned by the node is reused
+  bool reuses(const CstNode &node) const {
+    if (!reparsed) {
+      return false;
+    }
+    // the node contains the reparsed node only if their texts overlap
+    const auto *begin = node.text.data();
+    if (reparsed->text.data() >= begin &&
+        reparsed->text.data() <= begin + node.text.size()) {
+      for (const auto *ancestor = reparsed; ancestor;
+           ancestor = ancestor->parent) {
+        if (ancestor == &node) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
 
-inline size_t codepoint_length(std::string_view sv) {
-  if (!sv.empty()) {
-    auto b = static_cast<std::byte>(sv.front());
-    if ((b & std::byte{0x80}) == std::byte{0}) {
-      return 1;
+  /// Log the value events of a CST node as the parse that created it did
+  /// @param node the CST node
+  void operator()(const CstNode &node) {
+    if (node.isLeaf) {
+      if (!node.hidden) {
+        c.token(node.grammarSource, node.text);
+      }
+      return;
     }
-    if ((b & std::byte{0xE0}) == std::byte{0xC0} && sv.size() >= 2) {
-      return 2;
+    const auto kind = node_kind(node);
+    switch (kind) {
+    case NodeKind::ParserRule:
+    case NodeKind::DataTypeRule: {
+      const auto first =
+          c.begin(kind == NodeKind::ParserRule ? ValueEvent::Kind::Node
+                                               : ValueEvent::Kind::Text,
+                  node.grammarSource, node.text.data());
+      for (const auto &child : node.children()) {
+        (*this)(child);
+      }
+      c.end(first, node.text.size());
+      break;
     }
-    if ((b & std::byte{0xF0}) == std::byte{0xE0} && sv.size() >= 3) {
-      return 3;
+    case NodeKind::Assignment: {
+      const auto &assignment =
+          *static_cast<const Assignment *>(node.grammarSource);
+      if (values) {
+        const auto it = values->objects.find(&node);
+        if (it != values->objects.end() && reuses(node)) {
+          c.assign(assignment, it->second);
+          break;
+        }
+      }
+      const auto checkpoint = c.checkpoint(scratch);
+      for (const auto &child : node.children()) {
+        (*this)(child);
+      }
+      auto *object = c.assign(assignment, checkpoint);
+      if (values && object) {
+        values->objects[&node] = object;
+      }
+      break;
     }
-    if ((b & std::byte{0xF8}) == std::byte{0xF0} && sv.size() >= 4) {
-      return 4;
+    case NodeKind::Action:
+      c.action(static_cast<const Action *>(node.grammarSource));
+      break;
+    case NodeKind::Other:
+      for (const auto &child : node.children()) {
+        (*this)(child);
+      }
+      break;
     }
   }
-  return PARSE_ERROR;
-}
-
-Rule::Rule(std::string_view name, ContextProvider provider,
-           std::function<bool(std::any &, CstNode &)> action)
-    : _name{name}, _context_provider{std::move(provider)},
-      _action{std::move(action)} {}
-
-const std::string &Rule::name() const noexcept { return _name; }
-
-ParseResult ParserRule::parse(std::string_view text) const {
-
-  ParseResult result;
-  result.root_node = std::make_shared<RootCstNode>();
-  result.root_node->fullText = text;
-  std::string_view sv = result.root_node->fullText;
-  result.root_node->text = result.root_node->fullText;
-  result.root_node->grammarSource = this;
-  Context c = _context_provider();
+};
+
+/// @param node a CST node
+/// @return the first token of the node or nullptr
+static const CstNode *first_token(const CstNode &node) {
+  auto tokens = node.tokens();
+  auto it = tokens.begin();
+  return it == tokens.end() ? nullptr : std::addressof(*it);
+}
+
+/// @param node a CST node
+/// @return the last token of the node or nullptr
+static const CstNode *last_token(const CstNode &node) {
+  // the last token is in the last child containing a token
+  for (const auto *child = node.lastChild; child;) {
+    if (child->isLeaf && !child->hidden) {
+      return child;
+    }
+    const auto *last = child->isLeaf ? nullptr : last_token(*child);
+    if (last) {
+      return last;
+    }
+    // the previous sibling is found from the first child
+    const CstNode *previous = nullptr;
+    for (const auto *sibling = node.firstChild; sibling != child;
+         sibling = sibling->nextSibling) {
+      previous = sibling;
+    }
+    child = previous;
+  }
+  return nullptr;
+}
+
+/// @param view a text of the previous CST outside the edit
+/// @param previous the previous text
+/// @param text the edited text
+/// @param edit the edit of the previous text
+/// @return the same text in the edited text
+static std::string_view rebase(std::string_view view,
+                               std::string_view previous,
+                               std::string_view text, const TextEdit &edit) {
+  if (!view.data()) {
+    return view;
+  }
+  auto shift = [&edit](std::size_t offset) {
+    return offset <= edit.offset ? offset
+                                 : offset - edit.removed + edit.inserted.size();
+  };
+  const auto begin = shift(view.data() - previous.data());
+  const auto end = shift(view.data() + view.size() - previous.data());
+  return text.substr(begin, end - begin);
+}
+
+/// Copy a CST into an edited text, replacing the reparsed rule call
+struct Splice {
+  /// the previous text
+  std::string_view previous;
+  /// the edited text
+  std::string_view text;
+  const TextEdit &edit;
+  /// the replaced node of the previous CST
+  const CstNode *replaced;
+  /// the node whose children replace the children of the replaced node
+  const CstNode &replacement;
+  /// the text of the replacement node
+  std::string_view replacementText;
+  /// the copy of the replaced node
+  CstNode *spliced = nullptr;
+
+  /// Append a copy of the children of a node
+  /// @param node a node of the previous CST
+  /// @param copy the copy of the node
+  void children(const CstNode &node, CstNode &copy) {
+    for (const auto &child : node.children()) {
+      auto &created = copy.emplace_back();
+      created.grammarSource = child.grammarSource;
+      created.isLeaf = child.isLeaf;
+      created.hidden = child.hidden;
+      created.recovered = child.recovered;
+      created.examined = child.examined;
+      if (&child == replaced) {
+        spliced = &created;
+        created.text = replacementText;
+        for (const auto &replacing : replacement.children()) {
+          created.append(replacing);
+        }
+      } else {
+        created.text = rebase(child.text, previous, text, edit);
+        children(child, created);
+      }
+    }
+  }
+};
+
+/// Release the nodes replaced by a reparse in place: their objects are
+/// forgotten and their text is cleared, so they are not rebased
+/// @param first the first released child
+/// @param values the objects of the CST or nullptr
+/// @return the number of released nodes
+static std::size_t release(CstNode *first, CstValues *values) {
+  std::size_t count = 0;
+  for (auto *child = first; child; child = child->nextSibling) {
+    for (auto &node : child->nodes()) {
+      if (values) {
+        values->objects.erase(&node);
+      }
+      node.text = {};
+      ++count;
+    }
+  }
+  return count;
+}
+
+ParseResult Rule::reparse(ParseResult previous, const TextEdit &edit) const {
+  const auto old = previous.root_node->fullText;
+  assert(edit.offset + edit.removed <= old.size());
+  auto edited = std::make_shared<std::string>();
+  edited->reserve(old.size() - edit.removed + edit.inserted.size());
+  edited->append(old.substr(0, edit.offset))
+      .append(edit.inserted)
+      .append(old.substr(edit.offset + edit.removed));
+  std::shared_ptr<const std::string> storage = std::move(edited);
+  const std::string_view text = *storage;
+  if (!previous.ret || previous.recovered ||
+      leftRecursion() != LeftRecursion::None) {
+    return parse(std::move(storage));
+  }
 
-  auto i = c.skipHiddenNodes(sv, *result.root_node);
+  // the rule calls containing the edit, from the outermost
+  const char *from = old.data() + edit.offset;
+  const char *to = from + edit.removed;
+  std::vector<CstNode *> calls;
+  for (CstNode *node = previous.root_node.get(); node;) {
+    CstNode *next = nullptr;
+    for (auto &child : node->children()) {
+      if (!child.isLeaf && child.text.data() < from &&
+          to < child.text.data() + child.text.size()) {
+        next = &child;
+        break;
+      }
+    }
+    if (next && (node_kind(*next) == NodeKind::ParserRule ||
+                 node_kind(*next) == NodeKind::DataTypeRule)) {
+      // a left recursive call parses its text again while growing a seed, and
+      // a choice or a predicate that examined the edit before a call may
+      // decide differently, so the text examined before the call and before
+      // the calls nested in it is kept
+      const auto offset = static_cast<std::size_t>(from - next->text.data());
+      if (static_cast<const Rule *>(next->grammarSource)->leftRecursion() !=
+              LeftRecursion::None ||
+          next->examined >= offset) {
+        break;
+      }
+      calls.push_back(next);
+    }
+    node = next;
+  }
 
-  result.len =
-      i + parse_rule({sv.data() + i, sv.size() - i}, *result.root_node, c);
+  // the CST is patched in place when the previous result is its only owner,
+  // and copied once the released nodes outnumber the allocated ones
+  auto &tree = *previous.root_node;
+  const bool patch = previous.root_node.use_count() == 1 &&
+                     (!tree.values ||
+                      tree.values->released <= tree.arena.watermark());
+  for (auto it = calls.rbegin(); it != calls.rend(); ++it) {
+    auto &call = **it;
+    const auto *first = first_token(call);
+    const auto *last = last_token(call);
+    if (!first || first == last ||
+        from <= first->text.data() + first->text.size() ||
+        last->text.data() <= to) {
+      continue;
+    }
+    Context c = _context_provider();
+    RootCstNode replacement;
+    const auto start = static_cast<std::size_t>(call.text.data() - old.data());
+    const auto watermark = tree.arena.watermark();
+    auto *replaced = patch ? call.detach({nullptr, watermark}) : nullptr;
+    c.examine(text.data() + start + call.examined);
+    const auto len =
+        static_cast<const Rule *>(call.grammarSource)
+            ->parse_rule(text.substr(start), patch ? call : replacement, c);
+    if (fail(len) || !c.errors().empty() ||
+        len != call.text.size() - edit.removed + edit.inserted.size()) {
+      if (patch) {
+        call.rollback({nullptr, watermark});
+        call.attach(replaced);
+      }
+      continue;
+    }
 
-  result.ret = result.len == sv.size();
+    std::shared_ptr<RootCstNode> root;
+    CstNode *reparsed;
+    if (patch) {
+      // the other nodes view the previous text until they are rebased
+      root = std::move(previous.root_node);
+      const auto released = release(replaced, root->values.get());
+      for (std::size_t i = 0; i < watermark; ++i) {
+        auto &node = root->arena[i];
+        node.text = rebase(node.text, old, text, edit);
+      }
+      root->text = rebase(root->text, old, text, edit);
+      call.text = text.substr(start, len);
+      root->fullText = text;
+      root->storage = std::move(storage);
+      if (root->values) {
+        root->values->released += released;
+      }
+      reparsed = &call;
+    } else {
+      root = make_root(text, std::move(storage), this);
+      Splice splice{old,         text,     edit, &call,
+                    replacement, text.substr(start, len)};
+      splice.children(tree, *root);
+      reparsed = splice.spliced;
+    }
+    // the calls following the reparsed one are reused after the text it
+    // examined
+    for (auto *node = reparsed; node != root.get(); node = node->parent) {
+      for (auto *next = node->nextSibling;
+           next && next->text.data() < c.examined(); next = next->nextSibling) {
+        raise_examined(*next, c.examined());
+      }
+    }
 
-  return result;
+    ParseResult result;
+    result.len = text.size();
+    result.ret = true;
+    Context values = _context_provider();
+    values.mode(ParseMode::Ast);
+    // the reused objects outlive the text, so none of them views it
+    values.intern(true, std::move(previous.interner));
+    // the objects are reused if the result is the only owner of their arena
+    previous.value.reset();
+    std::shared_ptr<AstArena> arena;
+    if (!root->values) {
+      root->values = std::make_unique<CstValues>();
+    } else if (root->values->arena.use_count() == 1) {
+      arena = std::move(root->values->arena);
+      values.arena() = std::move(*arena);
+    } else {
+      root->values->objects.clear();
+      root->values->arena.reset();
+    }
+    RootCstNode scratch;
+    const auto reused = values.arena().size();
+    Replay replay{values, scratch, root->values.get(),
+                  arena ? reparsed : nullptr};
+    replay(*root);
+    result.value = values.value(arena);
+    if (replay.reparsed) {
+      // the replaced objects are about as many as the created ones
+      root->values->released += arena->size() - reused;
+    }
+    root->values->arena = std::move(arena);
+    result.interner = values.interner();
+    result.root_node = std::move(root);
+    return result;
+  }
+  return parse(std::move(storage));
 }
 
-ParseResult DataTypeRule::parse(std::string_view text) const {
-
+ParseResult Rule::rebuild(std::shared_ptr<RootCstNode> root) const {
   ParseResult result;
-  result.root_node = std::make_shared<RootCstNode>();
-  result.root_node->fullText = text;
-  std::string_view sv = result.root_node->fullText;
-  result.root_node->text = result.root_node->fullText;
-  result.root_node->grammarSource = this;
-  Context c = _context_provider();
-
-  auto i = c.skipHiddenNodes(sv, *result.root_node);
-
-  result.len =
-      i + parse_rule({sv.data() + i, sv.size() - i}, *result.root_node, c);
-
-  result.ret = result.len == sv.size();
-  // TODO apply value_converter if any
-
+  result.len = root->fullText.size();
+  result.ret = true;
+  Context values = _context_provider();
+  values.mode(ParseMode::Ast);
+  RootCstNode scratch;
+  Replay replay{values, scratch};
+  replay(*root);
+  result.value = values.value();
+  result.interner = values.interner();
+  result.root_node = std::move(root);
   return result;
 }
 
-ParseResult TerminalRule::parse(std::string_view text) const {
-
-  ParseResult result;
-  result.root_node = std::make_shared<RootCstNode>();
-  result.root_node->fullText = text;
-  std::string_view sv = result.root_node->fullText;
-  result.root_node->text = result.root_node->fullText;
-  result.root_node->grammarSource = this;
-
-  result.len = parse_terminal(sv);
+/// Append a copy of the children of a node whose text moved
+/// @param node the copied node
+/// @param copy the copy of the node
+/// @param from the previous location of the text
+/// @param to the new location of the text
+static void copy_children(const CstNode &node, CstNode &copy, const char *from,
+                          const char *to) {
+  for (const auto &child : node.children()) {
+    auto &created = copy.emplace_back();
+    created.text = {to + (child.text.data() - from), child.text.size()};
+    created.grammarSource = child.grammarSource;
+    created.isLeaf = child.isLeaf;
+    created.hidden = child.hidden;
+    created.recovered = child.recovered;
+    created.examined = child.examined;
+    copy_children(child, created, from, to);
+  }
+}
 
-  result.ret = result.len == sv.size();
-  // TODO apply value_converter if any
-  return result;
+ParseResult Rule::parse_stream(const StreamReader &read,
+                               const StreamCallback &emit,
+                               const StreamOptions &options) const {
+  ParseResult summary;
+  std::string buffer;
+  // the start of the pending input in the buffer
+  std::size_t start = 0;
+  bool eof = false;
+  while (true) {
+    const std::string_view sv{buffer.data() + start, buffer.size() - start};
+    Context c = _context_provider();
+    c.mode(options.mode);
+    // the text of the element is released from the buffer
+    c.intern(true, c.interner());
+    RootCstNode root;
+    auto i = c.skipHiddenNodes(sv, root);
+    auto len = parse_rule(sv.substr(i), root, c);
+    // the parse does not depend on the text following the buffer if it
+    // examined none of the last characters
+    const auto examined = c.examined() ? c.examined() - sv.data() : i;
+    const bool final = eof || examined + options.lookahead < sv.size();
+    const bool committed = success(len) && (i + len > 0 || eof) && final;
+    if (committed && i + len > 0) {
+      len += i;
+      ParseResult element;
+      element.ret = true;
+      element.len = len;
+      if (c.buildsCst()) {
+        auto text = std::make_shared<const std::string>(sv.substr(0, len));
+        element.root_node = make_root(*text, text, this);
+        copy_children(root, *element.root_node, sv.data(), text->data());
+      }
+      if (c.buildsValue()) {
+        element.value = c.value();
+        element.interner = c.interner();
+      }
+      emit(std::move(element));
+      summary.len += len;
+      start += len;
+      continue;
+    }
+    if (eof || (fail(len) && final)) {
+      // only hidden tokens may be left, a syntax error stops the parse
+      // without reading the rest of the input
+      summary.len += i;
+      summary.ret = eof && i == sv.size();
+      return summary;
+    }
+    // release the committed text, then read at least as much as is pending
+    // so that a large element is parsed again a logarithmic number of times
+    if (start > buffer.size() / 2) {
+      buffer.erase(0, start);
+      start = 0;
+    }
+    const auto pending = buffer.size();
+    const auto size = std::max(options.chunk, pending - start);
+    buffer.resize(pending + size);
+    const auto count = read({buffer.data() + pending, size});
+    buffer.resize(pending + count);
+    eof = count == 0;
+  }
 }
 
 RuleCall::RuleCall(const std::shared_ptr<Rule> &rule) : _rule(rule) {}
 
+/// Call a terminal rule that is not memoized: the token is matched before
+/// the node of the call is created, so a failed call has nothing to roll back
+/// @param rule the terminal rule
+/// @param sv the input text
+/// @param parent the parent of the node of the call
+/// @param c the context
+/// @return the parsed length or PARSE_ERROR
+static std::size_t call_terminal(const TerminalRule &rule, std::string_view sv,
+                                 CstNode &parent, Context &c) {
+  c.profileEnter(std::addressof(rule));
+  const auto *before = c.examined();
+  std::size_t examined;
+  auto i = rule.match_terminal(sv, examined);
+  c.examine(sv.data() + examined);
+  if (fail(i)) {
+    c.expect(std::addressof(rule), sv.data());
+  } else if (c.buildsCst()) {
+    auto &node = parent.emplace_back();
+    node.examined = examined_offset(before, sv.data());
+    i = rule.token(sv, i, node, c);
+    node.text = {sv.data(), i};
+    node.grammarSource = std::addressof(rule);
+  } else {
+    i = rule.token(sv, i, parent, c);
+  }
+  c.profileExit(i);
+  return i;
+}
+
 std::size_t RuleCall::parse_rule(std::string_view sv, CstNode &parent,
                                  Context &c) const {
   assert(_rule && "Call an undefined rule");
 
-  CstNode node;
-  auto i = _rule->parse_rule(sv, node, c);
+  const bool memoized = c.memoized(*_rule);
+  if (_rule->isTerminal() && !memoized) {
+    return call_terminal(static_cast<const TerminalRule &>(*_rule), sv, parent,
+                         c);
+  }
+  if (memoized) {
+    if (const auto *entry = c.memo().find(_rule.get(), sv.data())) {
+      if (success(entry->len) && entry->node) {
+        // the memoized node was released by the rollback that led to the
+        // hit, unless it is empty and followed by a call at the same
+        // position, or kept by a seed being grown that may be attached again
+        CstNode *node = entry->node;
+        if (entry->len == 0 || c.growing()) {
+          node = &parent.append(*node);
+        } else {
+          c.memo().move(*node, parent);
+        }
+        // the node is reused after the text examined since the call
+        raise_examined(*node, c.examined());
+      }
+      // a failed call has no event but the cuts it passed break the element
+      // again
+      c.append(*entry);
+      c.profileHit(_rule.get(), entry->len);
+      return entry->len;
+    }
+  }
+  if (_rule->leftRecursion() == Rule::LeftRecursion::Head) {
+    // a left recursive call returns the seed being grown
+    if (const auto *seed = c.findSeed(_rule.get(), sv.data())) {
+      if (success(seed->len)) {
+        auto &node = c.buildsCst() ? parent.emplace_back() : parent;
+        c.appendSeed(*seed, node);
+        if (c.buildsCst()) {
+          node.text = {sv.data(), seed->len};
+          node.grammarSource = _rule.get();
+        }
+      }
+      return seed->len;
+    }
+  }
 
-  if (success(i)) {
-    node.text = {sv.data(), i};
-    node.grammarSource = _rule.get();
-    parent.content.emplace_back(std::move(node));
+  c.profileEnter(_rule.get());
+  const auto checkpoint = c.checkpoint(parent);
+  auto i = PARSE_ERROR;
+  CstNode *created = nullptr;
+  if (c.buildsCst()) {
+    auto &node = parent.emplace_back();
+    node.examined = examined_offset(c.examined(), sv.data());
+    i = _rule->parse_rule(sv, node, c);
+    if (success(i)) {
+      node.text = {sv.data(), i};
+      node.grammarSource = _rule.get();
+      created = &node;
+    }
+  } else {
+    i = _rule->parse_rule(sv, parent, c);
+  }
+
+  if (fail(i)) {
+    c.rollback(parent, checkpoint);
+  }
+  // the cuts of the called rule do not commit the alternatives of the caller
+  c.endCuts(checkpoint);
+  c.profileExit(i);
+  if (memoized) {
+    c.memoize(_rule.get(), sv.data(), i, created, checkpoint);
   }
   return i;
 }
@@ -165,10 +785,20 @@ std::size_t RuleCall::parse_hidden(std::string_view sv, CstNode &parent) const {
   assert(_rule && "Call an undefined rule");
   return _rule->parse_hidden(sv, parent);
 }
+std::size_t RuleCall::match_hidden(std::string_view sv, CstNode &parent,
+                                   std::size_t &examined) const {
+  assert(_rule && "Call an undefined rule");
+  return _rule->match_hidden(sv, parent, examined);
+}
 std::size_t RuleCall::parse_terminal(std::string_view sv) const {
   assert(_rule && "Call an undefined rule");
   return _rule->parse_terminal(sv);
 }
+std::size_t RuleCall::match_terminal(std::string_view sv,
+                                     std::size_t &examined) const {
+  assert(_rule && "Call an undefined rule");
+  return _rule->match_terminal(sv, examined);
+}
 void RuleCall::accept(Visitor &v) const { v.visit(*this); }
 
 std::size_t Rule::parse_rule(std::string_view sv, CstNode &parent,
@@ -176,6 +806,44 @@ std::size_t Rule::parse_rule(std::string_view sv, CstNode &parent,
   assert(_element);
   return _element->parse_rule(sv, parent, c);
 }
+std::size_t Rule::grow(ValueEvent::Kind kind, std::string_view sv,
+                       CstNode &node, Context &c) const {
+  c.plantSeed(this, sv.data());
+  while (true) {
+    const auto checkpoint = c.checkpoint(node);
+    const auto first = c.begin(kind, this, sv.data());
+    const auto i = Rule::parse_rule(sv, node, c);
+    c.end(first, i);
+    if (fail(i) || (success(c.seedLength()) && i <= c.seedLength())) {
+      c.rollback(node, checkpoint);
+      const auto len = c.harvestSeed(node);
+      // a growth failing after a cut does not fall back on the seed
+      return fail(i) && c.committed(checkpoint) ? PARSE_ERROR : len;
+    }
+    c.growSeed(i, node, checkpoint);
+  }
+}
+
+std::size_t ParserRule::parse_rule(std::string_view sv, CstNode &parent,
+                                   Context &c) const {
+  if (leftRecursion() == LeftRecursion::Head) {
+    return grow(ValueEvent::Kind::Node, sv, parent, c);
+  }
+  const auto first = c.begin(ValueEvent::Kind::Node, this, sv.data());
+  auto i = Rule::parse_rule(sv, parent, c);
+  c.end(first, i);
+  return i;
+}
+std::size_t DataTypeRule::parse_rule(std::string_view sv, CstNode &parent,
+                                     Context &c) const {
+  if (leftRecursion() == LeftRecursion::Head) {
+    return grow(ValueEvent::Kind::Text, sv, parent, c);
+  }
+  const auto first = c.begin(ValueEvent::Kind::Text, this, sv.data());
+  auto i = Rule::parse_rule(sv, parent, c);
+  c.end(first, i);
+  return i;
+}
 std::size_t Rule::parse_hidden(std::string_view sv, CstNode &parent) const {
   assert(_element);
   return _element->parse_hidden(sv, parent);
@@ -187,55 +855,89 @@ std::size_t Rule::parse_terminal(std::string_view sv) const {
 
 ParserRule::ParserRule(std::string_view name, ContextProvider provider,
 
-                       std::function<bool(std::any &, CstNode &)> action)
+                       ValueConverter action)
     : Rule(name, std::move(provider), std::move(action)) {}
 
 void ParserRule::accept(Visitor &v) const { v.visit(*this); }
 
 DataTypeRule::DataTypeRule(std::string_view name, ContextProvider provider,
 
-                           std::function<bool(std::any &, CstNode &)> action)
+                           ValueConverter action)
     : Rule(name, std::move(provider), std::move(action)) {}
 
 void DataTypeRule::accept(Visitor &v) const { v.visit(*this); }
 
 TerminalRule::TerminalRule(std::string_view name, ContextProvider provider,
 
-                           std::function<bool(std::any &, CstNode &)> action)
-    : Rule(name, std::move(provider), std::move(action)){}
+                           ValueConverter action)
+    : Rule(name, std::move(provider), std::move(action)) {
+  _terminal = true;
+}
 
 std::size_t TerminalRule::parse_rule(std::string_view sv, CstNode &parent,
                                      Context &c) const {
-  auto i = Rule::parse_terminal(sv);
+  std::size_t examined;
+  auto i = TerminalRule::match_terminal(sv, examined);
+  c.examine(sv.data() + examined);
   if (fail(i)) {
+    c.expect(this, sv.data());
     return PARSE_ERROR;
   }
+  return token(sv, i, parent, c);
+}
+
+std::size_t TerminalRule::token(std::string_view sv, std::size_t len,
+                                CstNode &parent, Context &c) const {
   // Do not create a node if the rule is ignored
-  if (_kind != TerminalRule::Kind::Ignored) {
-    auto &node = parent.content.emplace_back();
+  if (c.buildsCst() && _kind != TerminalRule::Kind::Ignored) {
+    auto &node = parent.emplace_back();
     node.grammarSource = this;
-    node.text = {sv.data(), i};
+    node.text = {sv.data(), len};
     node.hidden = _kind == TerminalRule::Kind::Hidden;
     node.isLeaf = true;
   }
-  return i + c.skipHiddenNodes({sv.data() + i, sv.size() - i}, parent);
-}
-
-std::size_t TerminalRule::parse_hidden(std::string_view sv,
-                                       CstNode &parent) const {
-  auto i = Rule::parse_terminal(sv);
-  if (fail(i)) {
-    return PARSE_ERROR;
+  if (_kind == TerminalRule::Kind::Normal) {
+    c.token(this, {sv.data(), len});
   }
-  // Do not create a node if the rule is ignored
-  if (_kind != TerminalRule::Kind::Ignored) {
-    auto &node = parent.content.emplace_back();
-    node.grammarSource = this;
-    node.text = {sv.data(), i};
+  return len + c.skipHiddenNodes({sv.data() + len, sv.size() - len}, parent);
+}
+
+/// Append the node of a hidden token matched by a terminal rule, unless the
+/// rule is ignored
+/// @param rule the terminal rule
+/// @param sv the input text
+/// @param len the length of the token or PARSE_ERROR
+/// @param parent the parent of the node
+/// @return len
+static std::size_t hidden_token(const TerminalRule &rule, std::string_view sv,
+                                std::size_t len, CstNode &parent) {
+  if (success(len) && !rule.ignored()) {
+    auto &node = parent.emplace_back();
+    node.grammarSource = std::addressof(rule);
+    node.text = {sv.data(), len};
     node.hidden = true;
     node.isLeaf = true;
   }
-  return i;
+  return len;
+}
+
+std::size_t TerminalRule::parse_hidden(std::string_view sv,
+                                       CstNode &parent) const {
+  return hidden_token(*this, sv, TerminalRule::parse_terminal(sv), parent);
+}
+std::size_t TerminalRule::match_hidden(std::string_view sv, CstNode &parent,
+                                       std::size_t &examined) const {
+  return hidden_token(*this, sv, TerminalRule::match_terminal(sv, examined),
+                      parent);
+}
+
+std::size_t TerminalRule::parse_terminal(std::string_view sv) const {
+  return _program ? _program->match(sv) : Rule::parse_terminal(sv);
+}
+std::size_t TerminalRule::match_terminal(std::string_view sv,
+                                         std::size_t &examined) const {
+  return _program ? _program->match(sv, examined)
+                  : Rule::match_terminal(sv, examined);
 }
 
 void TerminalRule::accept(Visitor &v) const { v.visit(*this); }
@@ -271,30 +973,25 @@ CharacterClass::CharacterClass(std::string_view s, bool negated,
       c = !c;
     }
   }
+  _ranges = ByteRanges::from(lookup);
 }
 std::size_t CharacterClass::parse_rule(std::string_view sv, CstNode &parent,
                                        Context &c) const {
   auto i = CharacterClass::parse_terminal(sv);
   if (fail(i)) {
-    // c.set_error_pos(s);
+    c.expect(this, sv.data());
     return PARSE_ERROR;
   }
-  auto &node = parent.content.emplace_back();
-  node.grammarSource = this;
-  node.text = {sv.data(), i};
-  node.isLeaf = true;
-
-  return i + c.skipHiddenNodes({sv.data() + i, sv.size() - i}, parent);
+  return c.leaf(this, sv, i, parent);
 }
 
 std::size_t CharacterClass::parse_hidden(std::string_view sv,
                                          CstNode &parent) const {
   auto i = CharacterClass::parse_terminal(sv);
   if (fail(i)) {
-    // c.set_error_pos(s);
     return PARSE_ERROR;
   }
-  auto &node = parent.content.emplace_back();
+  auto &node = parent.emplace_back();
   node.grammarSource = this;
   node.text = {sv.data(), i};
   node.isLeaf = true;
@@ -314,24 +1011,19 @@ std::size_t AnyCharacter::parse_rule(std::string_view sv, CstNode &parent,
                                      Context &c) const {
   auto i = codepoint_length(sv);
   if (fail(i)) {
-    // c.set_error_pos(s);
+    // a codepoint has at most 4 bytes
+    c.expect(this, sv.data(), std::min<std::size_t>(3, sv.size()));
     return PARSE_ERROR;
   }
-  auto &node = parent.content.emplace_back();
-  node.grammarSource = this;
-  node.text = {sv.data(), i};
-  node.isLeaf = true;
-
-  return i + c.skipHiddenNodes({sv.data() + i, sv.size() - i}, parent);
+  return c.leaf(this, sv, i, parent);
 }
 std::size_t AnyCharacter::parse_hidden(std::string_view sv,
                                        CstNode &parent) const {
   auto i = codepoint_length(sv);
   if (fail(i)) {
-    // c.set_error_pos(s);
     return PARSE_ERROR;
   }
-  auto &node = parent.content.emplace_back();
+  auto &node = parent.emplace_back();
   node.grammarSource = this;
   node.text = {sv.data(), i};
   node.hidden = true;
@@ -344,18 +1036,112 @@ std::size_t AnyCharacter::parse_terminal(std::string_view sv) const {
 
 void AnyCharacter::accept(Visitor &v) const { v.visit(*this); }
 
+std::size_t Until::parse_rule(std::string_view sv, CstNode &parent,
+                              Context &c) const {
+  return _expansion.parse_rule(sv, parent, c);
+}
+
+std::size_t Until::parse_hidden(std::string_view sv, CstNode &parent) const {
+  return _expansion.parse_hidden(sv, parent);
+}
+
+std::size_t Until::find(std::string_view sv,
+                        std::size_t from) const noexcept {
+  const auto n = _needle.size();
+  while (from + n <= sv.size()) {
+    const auto *hit = static_cast<const char *>(std::memchr(
+        sv.data() + from, _needle.front(), sv.size() - n + 1 - from));
+    if (!hit) {
+      break;
+    }
+    auto pos = static_cast<std::size_t>(hit - sv.data());
+    if (std::memcmp(hit + 1, _needle.data() + 1, n - 1) == 0) {
+      return pos;
+    }
+    from = pos + 1;
+  }
+  return std::string_view::npos;
+}
+
+std::size_t Until::parse_terminal(std::string_view sv) const {
+  if (_needle.empty()) {
+    return _expansion.parse_terminal(sv);
+  }
+  static const auto ascii = [] {
+    std::array<bool, 256> lookup{};
+    std::fill_n(lookup.begin(), 0x80, true);
+    return lookup;
+  }();
+  static const auto asciiRanges = ByteRanges::from(ascii);
+
+  // The expansion tests the needle at each codepoint boundary: step over the
+  // codepoints up to the next occurrence, and search again if the occurrence
+  // is inside a codepoint.
+  std::size_t i = 0;
+  while (true) {
+    auto pos = find(sv, i);
+    if (pos == std::string_view::npos) {
+      return PARSE_ERROR;
+    }
+    while (i < pos) {
+      i += scan(ascii, asciiRanges, {sv.data() + i, pos - i});
+      if (i == pos) {
+        break;
+      }
+      auto len = codepoint_length({sv.data() + i, sv.size() - i});
+      if (fail(len)) {
+        return PARSE_ERROR;
+      }
+      i += len;
+    }
+    if (i == pos) {
+      return pos + _needle.size();
+    }
+  }
+}
+
+std::size_t Until::match_terminal(std::string_view sv,
+                                  std::size_t &examined) const {
+  if (_needle.empty()) {
+    return GrammarElement::match_terminal(sv, examined);
+  }
+  auto i = parse_terminal(sv);
+  examined = fail(i) ? sv.size() : i;
+  return i;
+}
+
+void Until::accept(Visitor &v) const { v.visit(*this); }
+
 NotPredicate::NotPredicate(std::shared_ptr<GrammarElement> element)
     : _element(std::move(element)) {}
 
 std::size_t NotPredicate::parse_rule(std::string_view sv, CstNode &parent,
                                      Context &c) const {
-  CstNode node;
-  return success(_element->parse_rule(sv, node, c)) ? PARSE_ERROR : 0;
+  // the nodes created by the predicate are released once evaluated, except
+  // the memoized ones whose parent stays allocated with them
+  const auto checkpoint = c.checkpoint(parent);
+  CstNode scratch;
+  auto &node = c.buildsCst() ? parent.root->arena.allocate() : scratch;
+  node.root = parent.root;
+  c.mute();
+  auto i = _element->parse_rule(sv, node, c);
+  c.unmute();
+  c.rollback(parent, checkpoint);
+  c.discardCuts(checkpoint);
+  if (success(i)) {
+    c.expect(this, sv.data());
+    return PARSE_ERROR;
+  }
+  return 0;
 }
 std::size_t NotPredicate::parse_hidden(std::string_view sv,
                                        CstNode &parent) const {
+  const auto checkpoint = parent.checkpoint();
   CstNode node;
-  return success(_element->parse_hidden(sv, node)) ? PARSE_ERROR : 0;
+  node.root = parent.root;
+  auto i = _element->parse_hidden(sv, node);
+  parent.rollback(checkpoint);
+  return success(i) ? PARSE_ERROR : 0;
 }
 std::size_t NotPredicate::parse_terminal(std::string_view sv) const {
   return success(_element->parse_terminal(sv)) ? PARSE_ERROR : 0;
@@ -368,13 +1154,25 @@ AndPredicate::AndPredicate(std::shared_ptr<GrammarElement> element)
 
 std::size_t AndPredicate::parse_rule(std::string_view sv, CstNode &parent,
                                      Context &c) const {
-  CstNode node;
-  return success(_element->parse_rule(sv, node, c)) ? 0 : PARSE_ERROR;
+  // the nodes created by the predicate are released once evaluated, except
+  // the memoized ones whose parent stays allocated with them
+  const auto checkpoint = c.checkpoint(parent);
+  CstNode scratch;
+  auto &node = c.buildsCst() ? parent.root->arena.allocate() : scratch;
+  node.root = parent.root;
+  auto i = _element->parse_rule(sv, node, c);
+  c.rollback(parent, checkpoint);
+  c.discardCuts(checkpoint);
+  return success(i) ? 0 : PARSE_ERROR;
 }
 std::size_t AndPredicate::parse_hidden(std::string_view sv,
                                        CstNode &parent) const {
+  const auto checkpoint = parent.checkpoint();
   CstNode node;
-  return success(_element->parse_hidden(sv, node)) ? 0 : PARSE_ERROR;
+  node.root = parent.root;
+  auto i = _element->parse_hidden(sv, node);
+  parent.rollback(checkpoint);
+  return success(i) ? 0 : PARSE_ERROR;
 }
 
 std::size_t AndPredicate::parse_terminal(std::string_view sv) const {
@@ -387,32 +1185,139 @@ PrioritizedChoice::PrioritizedChoice(
     std::vector<std::shared_ptr<GrammarElement>> &&elements)
     : _elements{std::move(elements)} {}
 
+namespace {
+/// Visitor used to check if an element is a Keyword
+struct KeywordVisitor : GrammarElement::Visitor {
+  bool keyword = false;
+  void visit(const Keyword &) override { keyword = true; }
+};
+} // namespace
+
+const PrioritizedChoice::Dispatch &PrioritizedChoice::dispatch() const {
+  std::call_once(_dispatch_flag, [this] {
+    std::vector<std::shared_ptr<const Keyword>> keywords;
+    for (const auto &elem : _elements) {
+      KeywordVisitor v;
+      elem->accept(v);
+      if (!v.keyword) {
+        break;
+      }
+      keywords.emplace_back(std::static_pointer_cast<const Keyword>(elem));
+    }
+    if (_elements.size() > 1 && keywords.size() == _elements.size()) {
+      _dispatch.keywords = std::make_unique<KeywordSet>(std::move(keywords));
+      return;
+    }
+
+    // the grammar is complete once parsing starts, so the FIRST set of each
+    // alternative can be computed
+    std::vector<FirstSet> firsts;
+    firsts.reserve(_elements.size());
+    for (const auto &elem : _elements) {
+      firsts.emplace_back(first_set(*elem));
+    }
+    for (std::size_t c = 0; c <= 256; ++c) {
+      _dispatch.offsets[c] =
+          static_cast<std::uint32_t>(_dispatch.indexes.size());
+      for (std::uint32_t index = 0; index < firsts.size(); ++index) {
+        if (firsts[index].nullable || (c < 256 && firsts[index].chars[c])) {
+          _dispatch.indexes.emplace_back(index);
+        }
+      }
+    }
+    _dispatch.offsets[257] =
+        static_cast<std::uint32_t>(_dispatch.indexes.size());
+  });
+  return _dispatch;
+}
+
 std::size_t PrioritizedChoice::parse_rule(std::string_view sv, CstNode &parent,
                                           Context &c) const {
-  const auto size = parent.content.size();
-  for (const auto &elem : _elements) {
-    if (auto i = elem->parse_rule(sv, parent, c); success(i)) {
+  const auto &dispatch = this->dispatch();
+  if (dispatch.keywords) {
+    return dispatch.keywords->parse_rule(sv, parent, c);
+  }
+  const auto checkpoint = c.checkpoint(parent);
+  const auto candidates = dispatch.candidates(sv);
+  if (candidates.size() < _elements.size()) {
+    // the alternatives filtered out by their first character are not tried,
+    // so the choice is expected as a whole
+    c.expect(this, sv.data());
+  }
+  for (auto index : candidates) {
+    if (auto i = _elements[index]->parse_rule(sv, parent, c); success(i)) {
       return i;
     }
-    parent.content.resize(size);
+    c.rollback(parent, checkpoint);
+    if (c.committed(checkpoint)) {
+      // the alternative passed a cut, the next ones are not tried
+      break;
+    }
   }
   return PARSE_ERROR;
 }
 std::size_t PrioritizedChoice::parse_hidden(std::string_view sv,
                                             CstNode &parent) const {
-  auto size = parent.content.size();
-  for (const auto &elem : _elements) {
-    if (auto i = elem->parse_hidden(sv, parent); success(i)) {
+  const auto &dispatch = this->dispatch();
+  if (dispatch.keywords) {
+    return dispatch.keywords->parse_hidden(sv, parent);
+  }
+  auto checkpoint = parent.checkpoint();
+  for (auto index : dispatch.candidates(sv)) {
+    if (auto i = _elements[index]->parse_hidden(sv, parent); success(i)) {
+      return i;
+    }
+    parent.rollback(checkpoint);
+  }
+  return PARSE_ERROR;
+}
+std::size_t PrioritizedChoice::match_hidden(std::string_view sv,
+                                            CstNode &parent,
+                                            std::size_t &examined) const {
+  const auto &dispatch = this->dispatch();
+  if (dispatch.keywords) {
+    return dispatch.keywords->match_hidden(sv, parent, examined);
+  }
+  auto checkpoint = parent.checkpoint();
+  // the dispatch examined the first character
+  examined = 0;
+  for (auto index : dispatch.candidates(sv)) {
+    std::size_t alternative;
+    auto i = _elements[index]->match_hidden(sv, parent, alternative);
+    examined = std::max(examined, alternative);
+    if (success(i)) {
       return i;
     }
-    parent.content.resize(size);
+    parent.rollback(checkpoint);
   }
   return PARSE_ERROR;
 }
 
 std::size_t PrioritizedChoice::parse_terminal(std::string_view sv) const {
-  for (const auto &elem : _elements) {
-    if (auto i = elem->parse_terminal(sv); success(i)) {
+  const auto &dispatch = this->dispatch();
+  if (dispatch.keywords) {
+    return dispatch.keywords->parse_terminal(sv);
+  }
+  for (auto index : dispatch.candidates(sv)) {
+    if (auto i = _elements[index]->parse_terminal(sv); success(i)) {
+      return i;
+    }
+  }
+  return PARSE_ERROR;
+}
+std::size_t PrioritizedChoice::match_terminal(std::string_view sv,
+                                              std::size_t &examined) const {
+  const auto &dispatch = this->dispatch();
+  if (dispatch.keywords) {
+    return dispatch.keywords->match_terminal(sv, examined);
+  }
+  // the alternatives are dispatched on the first character
+  examined = 0;
+  for (auto index : dispatch.candidates(sv)) {
+    std::size_t alternative;
+    auto i = _elements[index]->match_terminal(sv, alternative);
+    examined = std::max(examined, alternative);
+    if (success(i)) {
       return i;
     }
   }
@@ -425,21 +1330,25 @@ std::size_t Repetition::parse_rule(std::string_view sv, CstNode &parent,
                                    Context &c) const {
   std::size_t count = 0;
   std::size_t i = 0;
-  auto size = parent.content.size();
+  const auto start = c.checkpoint(parent);
   while (count < _min) {
     auto len = _element->parse_rule({sv.data() + i, sv.size() - i}, parent, c);
     if (fail(len)) {
-      parent.content.resize(size);
+      c.rollback(parent, start);
       return len;
     }
     i += len;
     count++;
   }
   while (count < _max) {
-    size = parent.content.size();
+    const auto checkpoint = c.checkpoint(parent);
     auto len = _element->parse_rule({sv.data() + i, sv.size() - i}, parent, c);
     if (fail(len)) {
-      parent.content.resize(size);
+      if (c.committed(checkpoint)) {
+        c.rollback(parent, start);
+        return PARSE_ERROR;
+      }
+      c.rollback(parent, checkpoint);
       break;
     }
     i += len;
@@ -451,99 +1360,368 @@ std::size_t Repetition::parse_hidden(std::string_view sv,
                                      CstNode &parent) const {
   std::size_t count = 0;
   std::size_t i = 0;
-  auto size = parent.content.size();
+  auto checkpoint = parent.checkpoint();
   while (count < _min) {
     auto len = _element->parse_hidden({sv.data() + i, sv.size() - i}, parent);
     if (fail(len)) {
-      parent.content.resize(size);
+      parent.rollback(checkpoint);
       return len;
     }
     i += len;
     count++;
   }
   while (count < _max) {
-    size = parent.content.size();
+    checkpoint = parent.checkpoint();
     auto len = _element->parse_hidden({sv.data() + i, sv.size() - i}, parent);
     if (fail(len)) {
-      parent.content.resize(size);
+      parent.rollback(checkpoint);
+      break;
+    }
+    i += len;
+    count++;
+  }
+  return i;
+}
+
+std::size_t Repetition::parse_terminal(std::string_view sv) const {
+  std::size_t count = 0;
+  std::size_t i = 0;
+  while (count < _min) {
+    auto len = _element->parse_terminal({sv.data() + i, sv.size() - i});
+    if (fail(len)) {
+      return len;
+    }
+    i += len;
+    count++;
+  }
+  while (count < _max) {
+    auto len = _element->parse_terminal({sv.data() + i, sv.size() - i});
+    if (fail(len)) {
       break;
     }
     i += len;
     count++;
   }
-  return i;
+  return i;
+}
+void Repetition::accept(Visitor &v) const { v.visit(*this); }
+
+std::size_t Optional::parse_rule(std::string_view sv, CstNode &parent,
+                                 Context &c) const {
+  if (_class) {
+    // a failed lookup has nothing to roll back
+    auto i = _class->parse_terminal(sv);
+    if (fail(i)) {
+      c.expect(_class, sv.data());
+      return 0;
+    }
+    return c.leaf(_class, sv, i, parent);
+  }
+  auto checkpoint = c.checkpoint(parent);
+  auto i = _element->parse_rule(sv, parent, c);
+  if (fail(i)) {
+    c.rollback(parent, checkpoint);
+    return c.committed(checkpoint) ? PARSE_ERROR : 0;
+  }
+  return i;
+}
+
+std::size_t Optional::parse_hidden(std::string_view sv, CstNode &parent) const {
+  auto checkpoint = parent.checkpoint();
+  auto i = _element->parse_hidden(sv, parent);
+  if (fail(i)) {
+    parent.rollback(checkpoint);
+    return 0;
+  }
+  return i;
+}
+std::size_t Optional::parse_terminal(std::string_view sv) const {
+  auto i = _class ? _class->parse_terminal(sv) : _element->parse_terminal(sv);
+  return fail(i) ? 0 : i;
+}
+void Optional::accept(Visitor &v) const { v.visit(*this); }
+
+std::size_t Many::parse_rule(std::string_view sv, CstNode &parent,
+                             Context &c) const {
+  if (_parallel && c.parallel() && sv.size() >= 2 * _parallel->chunk) {
+    return parse_parallel(sv, parent, c);
+  }
+  return parse_sequential(sv, parent, c);
+}
+
+struct Many::Recovery {
+  RecoveryOptions options;
+  std::once_flag flag;
+  FirstSet first;
+};
+
+Many &Many::recover(RecoveryOptions options) {
+  _recovery = std::make_shared<Recovery>();
+  _recovery->options = options;
+  return *this;
+}
+
+void Many::prepare() const {
+  if (_recovery) {
+    first();
+  }
+}
+
+const FirstSet &Many::first() const {
+  std::call_once(_recovery->flag,
+                 [this] { _recovery->first = first_set(*_element); });
+  return _recovery->first;
+}
+
+std::size_t Many::parse_sequential(std::string_view sv, CstNode &parent,
+                                   Context &c, std::size_t i) const {
+  if (_recovery) {
+    return parse_recovering(sv, parent, c, i);
+  }
+  while (true) {
+    auto checkpoint = c.checkpoint(parent);
+    auto len = _element->parse_rule({sv.data() + i, sv.size() - i}, parent, c);
+    if (fail(len)) {
+      c.rollback(parent, checkpoint);
+      // an element failing after a cut fails the repetition
+      return c.committed(checkpoint) ? PARSE_ERROR : i;
+    }
+    i += len;
+  }
+}
+
+std::size_t Many::parse_recovering(std::string_view sv, CstNode &parent,
+                                   Context &c, std::size_t i) const {
+  while (true) {
+    const auto checkpoint = c.checkpoint(parent);
+    // the failure of a broken element is not the failure of the parse
+    auto failure = c.exchangeFailure({});
+    auto len = _element->parse_rule({sv.data() + i, sv.size() - i}, parent, c);
+    if (success(len)) {
+      c.mergeFailure(std::move(failure));
+      i += len;
+      continue;
+    }
+    c.rollback(parent, checkpoint);
+    if (!c.broken(checkpoint)) {
+      c.mergeFailure(std::move(failure));
+      return i;
+    }
+
+    // the element failed after a cut: it is skipped up to the next element
+    // that parses or the end of the block
+    const auto expected = c.failure().expected;
+    const auto &first = this->first();
+    auto next = i;
+    while (true) {
+      next = resync(sv, next, first);
+      const auto attempt = c.checkpoint(parent);
+      if (c.buildsCst()) {
+        auto &node = parent.emplace_back();
+        node.grammarSource = this;
+        node.text = {sv.data() + i, next - i};
+        node.isLeaf = true;
+        node.hidden = true;
+        node.recovered = true;
+      }
+      c.error({sv.data() + i, next - i, expected});
+      if (next == sv.size() || sv[next] == _recovery->options.close) {
+        c.exchangeFailure(std::move(failure));
+        return next;
+      }
+      len = _element->parse_rule({sv.data() + next, sv.size() - next}, parent,
+                                 c);
+      if (success(len)) {
+        break;
+      }
+      c.rollback(parent, attempt);
+    }
+    c.exchangeFailure(std::move(failure));
+    i = next + len;
+  }
 }
 
-std::size_t Repetition::parse_terminal(std::string_view sv) const {
-  std::size_t count = 0;
-  std::size_t i = 0;
-  while (count < _min) {
-    auto len = _element->parse_terminal({sv.data() + i, sv.size() - i});
-    if (fail(len)) {
-      return len;
+std::size_t Many::resync(std::string_view sv, std::size_t i,
+                         const FirstSet &first) const {
+  const auto &options = _recovery->options;
+  std::size_t depth = 0;
+  for (auto j = i + 1; j < sv.size(); ++j) {
+    const auto ch = sv[j];
+    if (options.quote && ch == options.quote) {
+      for (++j; j < sv.size() && sv[j] != options.quote; ++j) {
+        j += sv[j] == '\\';
+      }
+    } else if (ch == options.open) {
+      ++depth;
+    } else if (ch == options.close) {
+      if (depth == 0) {
+        return j;
+      }
+      --depth;
+    } else if (depth == 0 && first.chars[static_cast<unsigned char>(ch)] &&
+               !(isword(ch) && isword(sv[j - 1]))) {
+      // an element may start here, not in the middle of a word
+      return j;
     }
-    i += len;
-    count++;
   }
-  while (count < _max) {
-    auto len = _element->parse_terminal({sv.data() + i, sv.size() - i});
-    if (fail(len)) {
-      break;
+  return sv.size();
+}
+
+/// Guess where the elements of a repetition of blocks start: after a
+/// closing character at depth 0 and the hidden tokens following it. The
+/// hidden tokens (e.g. comments) and the quoted strings are skipped by the
+/// scan.
+/// @param sv the input text
+/// @param options the parallel options
+/// @param threads the number of threads
+/// @param c the parse context
+/// @return the start of each chunk, the first one being 0
+static std::vector<std::size_t> split(std::string_view sv,
+                                      const ParallelOptions &options,
+                                      std::size_t threads, Context &c) {
+  // a few chunks per thread balance the load when the blocks differ in size
+  const auto size = std::max(options.chunk, sv.size() / (threads * 4));
+  auto scan = c.fork();
+  scan.mode(ParseMode::Recognize);
+  RootCstNode scratch;
+  const auto hidden = c.hiddenElement() ? first_set(*c.hiddenElement()).chars
+                                        : std::array<bool, 256>{};
+
+  std::vector<std::size_t> starts{0};
+  std::size_t depth = 0;
+  for (std::size_t i = 0; i < sv.size(); ++i) {
+    const auto ch = sv[i];
+    if (hidden[static_cast<unsigned char>(ch)]) {
+      if (auto len = scan.skipHiddenNodes(sv.substr(i), scratch)) {
+        i += len - 1;
+        continue;
+      }
+    }
+    if (options.quote && ch == options.quote) {
+      for (++i; i < sv.size() && sv[i] != options.quote; ++i) {
+        i += sv[i] == '\\';
+      }
+    } else if (ch == options.open) {
+      ++depth;
+    } else if (ch == options.close) {
+      if (depth == 0) {
+        // unbalanced, e.g. in a character literal
+        continue;
+      }
+      if (--depth == 0 && i + 1 >= starts.back() + size) {
+        auto start = i + 1;
+        start += scan.skipHiddenNodes(sv.substr(start), scratch);
+        if (start == sv.size()) {
+          break;
+        }
+        starts.push_back(start);
+        i = start - 1;
+      }
     }
-    i += len;
-    count++;
   }
-  return i;
+  return starts;
 }
-void Repetition::accept(Visitor &v) const { v.visit(*this); }
 
-std::size_t Optional::parse_rule(std::string_view sv, CstNode &parent,
+std::size_t Many::parse_parallel(std::string_view sv, CstNode &parent,
                                  Context &c) const {
-  auto size = parent.content.size();
-  auto i = _element->parse_rule(sv, parent, c);
-  if (fail(i)) {
-    parent.content.resize(size);
-    return 0;
+  auto threads = _parallel->threads;
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
   }
-  return i;
-}
-
-std::size_t Optional::parse_hidden(std::string_view sv, CstNode &parent) const {
-  auto size = parent.content.size();
-  auto i = _element->parse_hidden(sv, parent);
-  if (fail(i)) {
-    parent.content.resize(size);
-    return 0;
+  if (threads <= 1) {
+    return parse_sequential(sv, parent, c);
   }
-  return i;
-}
-std::size_t Optional::parse_terminal(std::string_view sv) const {
-  auto i = _element->parse_terminal(sv);
-  return fail(i) ? 0 : i;
-}
+  const auto starts = split(sv, *_parallel, threads, c);
+
+  struct Chunk {
+    std::unique_ptr<RootCstNode> root;
+    Context context;
+    std::size_t end = 0;
+    bool failed = false;
+    /// the failed element passed a cut of the repeated element
+    bool committed = false;
+    /// the failed element passed a cut, possibly in a called rule
+    bool broken = false;
+  };
+  std::vector<Chunk> chunks;
+  chunks.reserve(starts.size());
+  for (std::size_t k = 0; k < starts.size(); ++k) {
+    chunks.push_back({std::make_unique<RootCstNode>(), c.fork()});
+  }
+  // each chunk parses the elements starting before the next chunk, with the
+  // whole remaining input visible to keep the same lookahead
+  parallel_for(chunks.size(), threads, [&](std::size_t k) {
+    auto &chunk = chunks[k];
+    const auto limit = k + 1 < starts.size() ? starts[k + 1] : sv.size() + 1;
+    auto i = starts[k];
+    while (i < limit) {
+      auto checkpoint = chunk.context.checkpoint(*chunk.root);
+      auto len = _element->parse_rule({sv.data() + i, sv.size() - i},
+                                      *chunk.root, chunk.context);
+      if (fail(len)) {
+        chunk.context.rollback(*chunk.root, checkpoint);
+        chunk.failed = true;
+        chunk.committed = chunk.context.committed(checkpoint);
+        chunk.broken = chunk.context.broken(checkpoint);
+        break;
+      }
+      i += len;
+    }
+    chunk.end = i;
+  });
 
-std::size_t Many::parse_rule(std::string_view sv, CstNode &parent,
-                             Context &c) const {
+  // stitch the chunks starting where the previous element ended
   std::size_t i = 0;
+  std::size_t k = 0;
   while (true) {
-    auto size = parent.content.size();
+    while (k < chunks.size() && starts[k] < i) {
+      ++k;
+    }
+    if (k < chunks.size() && starts[k] == i) {
+      auto &chunk = chunks[k++];
+      if (c.buildsCst()) {
+        // the chunk was parsed without the text examined by the previous
+        // elements
+        const auto *examined = c.examined();
+        for (const auto &child : chunk.root->children()) {
+          raise_examined(parent.append(child), examined);
+        }
+      }
+      c.append(std::move(chunk.context));
+      i = chunk.end;
+      if (chunk.failed && _recovery && chunk.broken) {
+        // the broken element is parsed again to be recovered
+        return parse_sequential(sv, parent, c, i);
+      }
+      if (chunk.failed && chunk.committed) {
+        return PARSE_ERROR;
+      }
+      if (chunk.failed) {
+        return i;
+      }
+      continue;
+    }
+    // a split point was wrongly guessed, parse the next element sequentially
+    auto checkpoint = c.checkpoint(parent);
     auto len = _element->parse_rule({sv.data() + i, sv.size() - i}, parent, c);
     if (fail(len)) {
-      parent.content.resize(size);
-      break;
+      c.rollback(parent, checkpoint);
+      if (_recovery && c.broken(checkpoint)) {
+        return parse_sequential(sv, parent, c, i);
+      }
+      return c.committed(checkpoint) ? PARSE_ERROR : i;
     }
     i += len;
   }
-  return i;
 }
 
 std::size_t Many::parse_hidden(std::string_view sv, CstNode &parent) const {
   std::size_t i = 0;
   while (true) {
-    auto size = parent.content.size();
+    auto checkpoint = parent.checkpoint();
     auto len = _element->parse_hidden({sv.data() + i, sv.size() - i}, parent);
     if (fail(len)) {
-      parent.content.resize(size);
+      parent.rollback(checkpoint);
       break;
     }
     i += len;
@@ -551,6 +1729,9 @@ std::size_t Many::parse_hidden(std::string_view sv, CstNode &parent) const {
   return i;
 }
 std::size_t Many::parse_terminal(std::string_view sv) const {
+  if (_class) {
+    return _class->scan(sv);
+  }
   std::size_t i = 0;
   while (true) {
     auto len = _element->parse_terminal({sv.data() + i, sv.size() - i});
@@ -561,22 +1742,28 @@ std::size_t Many::parse_terminal(std::string_view sv) const {
   }
   return i;
 }
+void Many::accept(Visitor &v) const { v.visit(*this); }
 
 std::size_t AtLeastOne::parse_rule(std::string_view sv, CstNode &parent,
                                    Context &c) const {
 
-  auto size = parent.content.size();
+  auto checkpoint = c.checkpoint(parent);
   auto i = _element->parse_rule(sv, parent, c);
   if (fail(i)) {
-    parent.content.resize(size);
+    c.rollback(parent, checkpoint);
     return i;
   }
+  const auto start = checkpoint;
   while (true) {
-    size = parent.content.size();
+    checkpoint = c.checkpoint(parent);
     auto len = _element->parse_rule({sv.data() + i, sv.size() - i}, parent, c);
 
     if (fail(len)) {
-      parent.content.resize(size);
+      if (c.committed(checkpoint)) {
+        c.rollback(parent, start);
+        return PARSE_ERROR;
+      }
+      c.rollback(parent, checkpoint);
       break;
     }
     i += len;
@@ -586,18 +1773,18 @@ std::size_t AtLeastOne::parse_rule(std::string_view sv, CstNode &parent,
 
 std::size_t AtLeastOne::parse_hidden(std::string_view sv,
                                      CstNode &parent) const {
-  auto size = parent.content.size();
+  auto checkpoint = parent.checkpoint();
   auto i = _element->parse_hidden(sv, parent);
   if (fail(i)) {
-    parent.content.resize(size);
+    parent.rollback(checkpoint);
     return i;
   }
   while (true) {
-    size = parent.content.size();
+    checkpoint = parent.checkpoint();
     auto len = _element->parse_hidden({sv.data() + i, sv.size() - i}, parent);
 
     if (fail(len)) {
-      parent.content.resize(size);
+      parent.rollback(checkpoint);
       break;
     }
     i += len;
@@ -605,6 +1792,10 @@ std::size_t AtLeastOne::parse_hidden(std::string_view sv,
   return i;
 }
 std::size_t AtLeastOne::parse_terminal(std::string_view sv) const {
+  if (_class) {
+    auto i = _class->scan(sv);
+    return i == 0 ? PARSE_ERROR : i;
+  }
   auto i = _element->parse_terminal(sv);
   if (fail(i))
     return i;
@@ -617,15 +1808,16 @@ std::size_t AtLeastOne::parse_terminal(std::string_view sv) const {
   }
   return i;
 }
+void AtLeastOne::accept(Visitor &v) const { v.visit(*this); }
 
 std::size_t Group::parse_rule(std::string_view sv, CstNode &parent,
                               Context &c) const {
   size_t i = 0;
-  auto size = parent.content.size();
+  auto checkpoint = c.checkpoint(parent);
   for (const auto &element : _elements) {
     auto len = element->parse_rule({sv.data() + i, sv.size() - i}, parent, c);
     if (fail(len)) {
-      parent.content.resize(size);
+      c.rollback(parent, checkpoint);
       return len;
     }
     i += len;
@@ -635,11 +1827,11 @@ std::size_t Group::parse_rule(std::string_view sv, CstNode &parent,
 
 std::size_t Group::parse_hidden(std::string_view sv, CstNode &parent) const {
   size_t i = 0;
-  auto size = parent.content.size();
+  auto checkpoint = parent.checkpoint();
   for (const auto &element : _elements) {
     auto len = element->parse_hidden({sv.data() + i, sv.size() - i}, parent);
     if (fail(len)) {
-      parent.content.resize(size);
+      parent.rollback(checkpoint);
       return len;
     }
     i += len;
@@ -666,12 +1858,17 @@ std::size_t UnorderedGroup::parse_rule(std::string_view sv, CstNode &parent,
   std::size_t i = 0;
   auto elements = _elements;
   bool progress_made = true;
-  auto size = parent.content.size();
+  auto checkpoint = c.checkpoint(parent);
   while (!elements.empty() && progress_made) {
     progress_made = false;
     for (auto it = elements.begin(); it != elements.end();) {
+      const auto attempt = c.checkpoint(parent);
       auto len = (*it)->parse_rule({sv.data() + i, sv.size() - i}, parent, c);
       if (fail(len)) {
+        if (c.committed(attempt)) {
+          c.rollback(parent, checkpoint);
+          return PARSE_ERROR;
+        }
         ++it;
       } else {
         i += len;
@@ -683,7 +1880,7 @@ std::size_t UnorderedGroup::parse_rule(std::string_view sv, CstNode &parent,
   if (elements.empty())
     return i;
 
-  parent.content.resize(size);
+  c.rollback(parent, checkpoint);
   return PARSE_ERROR;
 }
 std::size_t UnorderedGroup::parse_hidden(std::string_view sv,
@@ -691,7 +1888,7 @@ std::size_t UnorderedGroup::parse_hidden(std::string_view sv,
   std::size_t i = 0;
   auto elements = _elements;
   bool progress_made = true;
-  auto size = parent.content.size();
+  auto checkpoint = parent.checkpoint();
   while (!elements.empty() && progress_made) {
     progress_made = false;
     for (auto it = elements.begin(); it != elements.end();) {
@@ -709,7 +1906,7 @@ std::size_t UnorderedGroup::parse_hidden(std::string_view sv,
   if (elements.empty())
     return i;
 
-  parent.content.resize(size);
+  parent.rollback(checkpoint);
   return PARSE_ERROR;
 }
 
@@ -733,7 +1930,7 @@ std::size_t UnorderedGroup::parse_terminal(std::string_view sv) const {
   return elements.empty() ? i : PARSE_ERROR;
 }
 
-void UnorderedGroup::accept(Visitor &v) const { /*v.visit(*this);*/ }
+void UnorderedGroup::accept(Visitor &v) const { v.visit(*this); }
 
 Keyword::Keyword(std::string s, bool ignore_case)
     : _kw(std::move(s)), _ignore_case{ignore_case} {}
@@ -741,22 +1938,22 @@ Keyword::Keyword(std::string s, bool ignore_case)
 std::size_t Keyword::parse_rule(std::string_view sv, CstNode &parent,
                                 Context &c) const {
   auto i = Keyword::parse_terminal(sv);
-  if (fail(i) || (isword(_kw.back()) && isword(sv[i])))
+  if (fail(i) || (i > 0 && i < sv.size() && isword(_kw.back()) &&
+                   isword(sv[i]))) {
+    // the keyword and the character following it may have been examined
+    c.expect(this, sv.data(), std::min(_kw.size(), sv.size()));
     return PARSE_ERROR;
+  }
 
-  auto &node = parent.content.emplace_back();
-  node.grammarSource = this;
-  node.text = {sv.data(), i};
-  node.isLeaf = true;
-
-  return i + c.skipHiddenNodes({sv.data() + i, sv.size() - i}, parent);
+  return c.leaf(this, sv, i, parent);
 }
 std::size_t Keyword::parse_hidden(std::string_view sv, CstNode &parent) const {
   auto i = Keyword::parse_terminal(sv);
-  if (fail(i) || (isword(_kw.back()) && isword(sv[i])))
+  if (fail(i) || (i > 0 && i < sv.size() && isword(_kw.back()) &&
+                   isword(sv[i])))
     return PARSE_ERROR;
 
-  auto &node = parent.content.emplace_back();
+  auto &node = parent.emplace_back();
   node.grammarSource = this;
   node.text = {sv.data(), i};
   node.hidden = true;
@@ -772,7 +1969,6 @@ std::size_t Keyword::parse_terminal(std::string_view sv) const {
   for (; i < _kw.size(); i++) {
     if (_ignore_case ? (tolower(sv[i]) != tolower(_kw[i]))
                      : (sv[i] != _kw[i])) {
-      // c.set_error_pos(s, lit_.data());
       return PARSE_ERROR;
     }
   }
@@ -781,20 +1977,135 @@ std::size_t Keyword::parse_terminal(std::string_view sv) const {
 
 void Keyword::accept(Visitor &v) const { v.visit(*this); }
 
+KeywordSet::KeywordSet(std::vector<std::shared_ptr<const Keyword>> keywords)
+    : _keywords{std::move(keywords)} {
+  _sensitive.build(_keywords, false);
+  _insensitive.build(_keywords, true);
+}
+
+void KeywordSet::Trie::build(
+    const std::vector<std::shared_ptr<const Keyword>> &keywords,
+    bool ignore_case) {
+  ignoreCase = ignore_case;
+  // build the trie with sorted children then flatten it
+  std::vector<std::map<unsigned char, std::uint32_t>> children(1);
+  nodes.assign(1, Node{});
+  for (std::uint32_t index = 0; index < keywords.size(); ++index) {
+    const auto &keyword = *keywords[index];
+    if (keyword.ignoreCase() != ignore_case) {
+      continue;
+    }
+    std::uint32_t node = 0;
+    for (char ch : keyword.value()) {
+      auto c = static_cast<unsigned char>(ignore_case ? tolower(ch) : ch);
+      auto next = static_cast<std::uint32_t>(nodes.size());
+      auto [it, inserted] = children[node].try_emplace(c, next);
+      if (inserted) {
+        nodes.emplace_back();
+        children.emplace_back();
+      }
+      node = it->second;
+    }
+    nodes[node].keyword = std::min(nodes[node].keyword, index);
+  }
+  edges.clear();
+  for (std::size_t node = 0; node < nodes.size(); ++node) {
+    nodes[node].first = static_cast<std::uint32_t>(edges.size());
+    nodes[node].size = static_cast<std::uint32_t>(children[node].size());
+    for (auto [c, target] : children[node]) {
+      edges.push_back({c, target});
+    }
+  }
+}
+
+void KeywordSet::Trie::match(std::string_view sv, bool boundary,
+                             Match &best) const {
+  std::uint32_t node = 0;
+  for (std::size_t i = 0;; ++i) {
+    const auto &current = nodes[node];
+    // a keyword ending with a word character must not be followed by a word
+    // character
+    if (current.keyword < best.keyword &&
+        (!boundary || i == 0 || i == sv.size() ||
+         !(isword(sv[i - 1]) && isword(sv[i])))) {
+      best = {current.keyword, i};
+    }
+    if (i == sv.size() || current.size == 0) {
+      // the character following a keyword is examined by the boundary check
+      best.examined = std::max(best.examined, i);
+      return;
+    }
+    auto c = static_cast<unsigned char>(ignoreCase ? tolower(sv[i]) : sv[i]);
+    const auto *first = edges.data() + current.first;
+    const auto *last = first + current.size;
+    const auto *edge = std::lower_bound(
+        first, last, c, [](const Edge &e, unsigned char c) { return e.c < c; });
+    if (edge == last || edge->c != c) {
+      best.examined = std::max(best.examined, i);
+      return;
+    }
+    node = edge->target;
+  }
+}
+
+KeywordSet::Match KeywordSet::find(std::string_view sv, bool boundary) const {
+  Match best;
+  _sensitive.match(sv, boundary, best);
+  _insensitive.match(sv, boundary, best);
+  return best;
+}
+
+std::size_t KeywordSet::parse_rule(std::string_view sv, CstNode &parent,
+                                   Context &c) const {
+  auto match = find(sv, true);
+  c.examine(sv.data() + match.examined);
+  if (match.keyword == NONE) {
+    c.expect(this, sv.data());
+    return PARSE_ERROR;
+  }
+
+  return c.leaf(_keywords[match.keyword].get(), sv, match.len, parent);
+}
+
+std::size_t KeywordSet::parse_hidden(std::string_view sv,
+                                     CstNode &parent) const {
+  auto match = find(sv, true);
+  if (match.keyword == NONE)
+    return PARSE_ERROR;
+
+  auto &node = parent.emplace_back();
+  node.grammarSource = _keywords[match.keyword].get();
+  node.text = {sv.data(), match.len};
+  node.hidden = true;
+  node.isLeaf = true;
+  return match.len;
+}
+
+std::size_t KeywordSet::parse_terminal(std::string_view sv) const {
+  auto match = find(sv, false);
+  return match.keyword == NONE ? PARSE_ERROR : match.len;
+}
+std::size_t KeywordSet::match_terminal(std::string_view sv,
+                                       std::size_t &examined) const {
+  auto match = find(sv, false);
+  examined = match.examined;
+  return match.keyword == NONE ? PARSE_ERROR : match.len;
+}
+
+void KeywordSet::accept(Visitor &v) const { v.visit(*this); }
+
 Character::Character(char c) : _char(c) {}
 
 std::size_t Character::parse_rule(std::string_view sv, CstNode &parent,
                                   Context &c) const {
 
   auto i = Character::parse_terminal(sv);
-  if (fail(i) || (isword(_char) && sv.size() > i && isword(sv[i])))
+  if (fail(i) || (isword(_char) && sv.size() > i && isword(sv[i]))) {
+    c.expect(this, sv.data(), std::min<std::size_t>(1, sv.size()));
     return PARSE_ERROR;
+  }
 
-  auto &node = parent.content.emplace_back();
-  node.grammarSource = this;
-  node.text = {sv.data(), i};
-  node.isLeaf = true;
-  return i + c.skipHiddenNodes({sv.data() + i, sv.size() - i}, parent);
+  return c.leaf(this, sv, i, parent);
 }
 
 std::size_t Character::parse_hidden(std::string_view sv,
@@ -803,7 +2114,7 @@ std::size_t Character::parse_hidden(std::string_view sv,
   if (fail(i) || (isword(_char) && isword(sv[i])))
     return PARSE_ERROR;
 
-  auto &node = parent.content.emplace_back();
+  auto &node = parent.emplace_back();
   node.grammarSource = this;
   node.text = {sv.data(), i};
   node.hidden = true;
@@ -820,8 +2131,11 @@ void Character::accept(Visitor &v) const { v.visit(*this); }
 
 std::size_t Action::parse_rule(std::string_view sv, CstNode &parent,
                                Context &c) const {
-  auto &node = parent.content.emplace_back();
-  node.grammarSource = this;
+  if (c.buildsCst()) {
+    auto &node = parent.emplace_back();
+    node.grammarSource = this;
+  }
+  c.action(this);
   return 0;
 }
 std::size_t Action::parse_terminal(std::string_view sv) const { return 0; }
@@ -832,12 +2146,22 @@ void Action::accept(Visitor &v) const { v.visit(*this); }
 
 std::size_t Assignment::parse_rule(std::string_view sv, CstNode &parent,
                                    Context &c) const {
-  CstNode node;
-  auto i = elem->parse_rule(sv, node, c);
-  if (success(i)) {
-    node.text = {sv.data(), i};
-    node.grammarSource = this;
-    parent.content.emplace_back(std::move(node));
+  const auto checkpoint = c.checkpoint(parent);
+  auto i = PARSE_ERROR;
+  if (c.buildsCst()) {
+    auto &node = parent.emplace_back();
+    i = elem->parse_rule(sv, node, c);
+    if (success(i)) {
+      node.text = {sv.data(), i};
+      node.grammarSource = this;
+    }
+  } else {
+    i = elem->parse_rule(sv, parent, c);
+  }
+  if (fail(i)) {
+    c.rollback(parent, checkpoint);
+  } else if (c.buildsValue()) {
+    c.assign(*this, checkpoint);
   }
   return i;
 }
@@ -853,17 +2177,596 @@ std::size_t Assignment::parse_hidden(std::string_view sv,
 
 void Assignment::accept(Visitor &v) const { v.visit(*this); }
 
-Context::Context(std::shared_ptr<GrammarElement> hidden)
-    : hidden{std::move(hidden)} {}
+Context::Context(const GrammarElement *hidden, MemoOptions memo,
+                 [[maybe_unused]] Profiler *profiler)
+    : hidden{hidden}, _memoize_all{memo.all}, _memo{memo.limit},
+      _memo_options{memo} {
+#ifdef PEGIUM_ENABLE_PROFILING
+  _profile = ParseProfile{profiler};
+#endif
+}
+
+Context Context::fork() {
+  // the values built by the forked context must outlive it
+  if (buildsValue() && !_interner) {
+    _interner = std::make_shared<Interner>();
+  }
+#ifdef PEGIUM_ENABLE_PROFILING
+  Context context{hidden, _memo_options, _profile.profiler()};
+#else
+  Context context{hidden, _memo_options};
+#endif
+  context._mode = _mode;
+  context._text_depth = _text_depth;
+  context._parallel = false;
+  context.intern(_intern, _interner);
+  return context;
+}
+
+/// @param event a value event
+/// @return true if the event refers to a value by its index
+static bool indexed(const ValueEvent &event) noexcept {
+  return event.kind == ValueEvent::Kind::Assign ||
+         event.kind == ValueEvent::Kind::Memo;
+}
+
+/// @param value the value of a Memo event
+/// @return the block of the memoized call
+static const MemoBlock &memo_block(const std::any &value) {
+  return **std::any_cast<std::shared_ptr<const MemoBlock>>(&value);
+}
+
+void Context::append(Context &&other) {
+  const auto base = _values.size();
+  for (auto event : other._events) {
+    if (indexed(event)) {
+      event.value += base;
+    }
+    _events.push_back(event);
+  }
+  _values.insert(_values.end(), std::make_move_iterator(other._values.begin()),
+                 std::make_move_iterator(other._values.end()));
+  _cuts += other._cuts;
+  _passed += other._passed;
+  if (other._examined) {
+    examine(other._examined);
+  }
+  _arena.merge(std::move(other._arena));
+  _errors.insert(_errors.end(), std::make_move_iterator(other._errors.begin()),
+                 std::make_move_iterator(other._errors.end()));
+  mergeFailure(std::move(other._failure));
+}
+
+bool Context::memoized(const Rule &rule) const noexcept {
+  return rule.leftRecursion() != Rule::LeftRecursion::Involved &&
+         (_memoize_all || rule.memoized());
+}
+
+MemoTable::MemoTable(std::size_t limit) : _limit{limit} {}
+
+std::size_t MemoTable::KeyHash::operator()(const Key &key) const noexcept {
+  auto h = std::hash<const void *>{}(key.rule);
+  return h ^ (std::hash<const void *>{}(key.pos) + 0x9e3779b9 + (h << 6) +
+              (h >> 2));
+}
+
+const MemoTable::Entry *MemoTable::find(const Rule *rule,
+                                        const char *pos) const {
+  auto it = _entries.find({rule, pos});
+  if (it == _entries.end() ||
+      (it->second.node && _moved.contains(it->second.node))) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+void MemoTable::move(CstNode &node, CstNode &parent) {
+  // the released ancestors were completed, unlike the ancestors being parsed
+  // where the walk stops, and their ancestors were marked with them
+  for (const auto *ancestor = node.parent;
+       ancestor && ancestor->text.data() && _moved.insert(ancestor).second;
+       ancestor = ancestor->parent) {
+    ++_size;
+  }
+  node.nextSibling = nullptr;
+  parent.attach(&node);
+}
+
+void MemoTable::insert(const Rule *rule, const char *pos, Entry entry,
+                       std::size_t first) {
+  if (_size >= _limit || (entry.node && _root && entry.node->root != _root)) {
+    clear();
+  }
+  if (entry.node) {
+    _root = entry.node->root;
+    const auto watermark = _root->arena.watermark();
+    // only the nodes that were not pinned yet are counted
+    const auto pinned = std::max(first, _pinned);
+    _size += watermark > pinned ? watermark - pinned : 0;
+    _pinned = std::max(_pinned, watermark);
+  }
+  _size += 1 + (entry.block ? entry.block->events.size() : 0);
+  _entries.insert_or_assign({rule, pos}, std::move(entry));
+}
+
+void MemoTable::clear() noexcept {
+  _kept = 0;
+  _size = 0;
+  _root = nullptr;
+  _pinned = 0;
+  _entries.clear();
+  _moved.clear();
+}
+
+void MemoTable::release(const char *pos) noexcept {
+  if (_entries.size() <= 2 * _kept) {
+    return;
+  }
+  std::erase_if(_entries,
+                [pos](const auto &item) { return item.first.pos < pos; });
+  _kept = _entries.size();
+  if (_kept == 0) {
+    clear();
+  }
+}
+
+/// @param events the value events
+/// @param i the index of the start of a rule call
+/// @return the index of the event following the end of the rule call
+static std::size_t skip_call(std::span<const ValueEvent> events,
+                             std::size_t i) {
+  std::size_t depth = 0;
+  do {
+    switch (events[i].kind) {
+    case ValueEvent::Kind::Node:
+    case ValueEvent::Kind::Text:
+      ++depth;
+      break;
+    case ValueEvent::Kind::End:
+      --depth;
+      break;
+    default:
+      break;
+    }
+    ++i;
+  } while (depth > 0 && i < events.size());
+  return i;
+}
+
+/// Build the value of a parser rule call
+/// @param events the value events
+/// @param values the values assigned by the events
+/// @param i the index of the start of the rule call
+/// @param value the current value replaced by the created object
+/// @param arena the arena allocating the created objects
+/// @return the index of the event following the end of the rule call
+static std::size_t build_node(std::span<const ValueEvent> events,
+                              std::span<std::any> values, std::size_t i,
+                              std::any &value, AstArena &arena) {
+  // the object is created by the converter of the rule
+  static_cast<const Rule *>(events[i].source)->execute(value, arena);
+  ++i;
+  while (i < events.size()) {
+    const auto &event = events[i];
+    switch (event.kind) {
+    case ValueEvent::Kind::Node:
+      // an unassigned rule call replaces the current object
+      i = build_node(events, values, i, value, arena);
+      continue;
+    case ValueEvent::Kind::Text:
+      i = skip_call(events, i);
+      continue;
+    case ValueEvent::Kind::Memo: {
+      const auto &block = memo_block(values[event.value]);
+      if (block.events.front().kind == ValueEvent::Kind::Node) {
+        // the values are copied, the block being shared by the hits
+        std::vector<std::any> copy(block.values);
+        build_node(block.events, copy, 0, value, arena);
+      }
+      break;
+    }
+    case ValueEvent::Kind::End:
+      return i + 1;
+    case ValueEvent::Kind::Action:
+      static_cast<const Action *>(event.source)->execute(value, arena);
+      break;
+    case ValueEvent::Kind::Assign:
+      static_cast<const Assignment *>(event.source)
+          ->getFeature()
+          .assign(value, values[event.value]);
+      break;
+    case ValueEvent::Kind::Token:
+    case ValueEvent::Kind::Hidden:
+      break;
+    }
+    ++i;
+  }
+  return i;
+}
+
+/// @param source the grammar element of a token
+/// @return true if the value of the token is a std::string_view
+static bool text_view(const GrammarElement &source) {
+  struct ViewVisitor : public GrammarElement::Visitor {
+    void visit(const TerminalRule &rule) override { view = rule.textView(); }
+    bool view = false;
+  };
+  ViewVisitor v;
+  source.accept(v);
+  return v.view;
+}
+
+/// The text of a data type rule call
+struct TextValue {
+  /// the text of the tokens, viewed while they are contiguous
+  std::string_view view;
+  std::string text;
+  bool contiguous = true;
+
+  /// Append the text of the tokens of events, memoized calls included
+  /// @param events the value events
+  /// @param values the values assigned by the events
+  /// @param i the index of the first event
+  /// @param end the index following the last event
+  void append(std::span<const ValueEvent> events,
+              std::span<const std::any> values, std::size_t i,
+              std::size_t end) {
+    for (; i < end; ++i) {
+      if (events[i].kind == ValueEvent::Kind::Memo) {
+        const auto &block = memo_block(values[events[i].value]);
+        append(block.events, block.values, 0, block.events.size());
+        continue;
+      }
+      if (events[i].kind != ValueEvent::Kind::Token) {
+        continue;
+      }
+      const auto token = events[i].text;
+      if (contiguous && view.data() + view.size() == token.data()) {
+        view = {view.data(), view.size() + token.size()};
+        continue;
+      }
+      if (contiguous) {
+        contiguous = false;
+        text = view;
+      }
+      text += token;
+    }
+  }
+};
+
+/// Build the value starting at an event: the object of a parser rule call,
+/// the text of a data type rule call or the text of a token
+/// @param events the value events
+/// @param values the values assigned by the events
+/// @param i the index of the first event of the value
+/// @param value the built value
+/// @param c the context storing the text of the std::string_view values and
+/// the created objects
+static void build_value(std::span<const ValueEvent> events,
+                        std::span<std::any> values, std::size_t i,
+                        std::any &value, Context &c) {
+  const auto &event = events[i];
+  switch (event.kind) {
+  case ValueEvent::Kind::Token:
+    if (event.source && text_view(*event.source)) {
+      value = c.view(event.text, true);
+    } else {
+      value = std::string{event.text};
+    }
+    break;
+  case ValueEvent::Kind::Node:
+    build_node(events, values, i, value, c.arena());
+    break;
+  case ValueEvent::Kind::Text: {
+    const auto *rule = static_cast<const Rule *>(event.source);
+    TextValue text{{event.text.data(), 0}};
+    text.append(events, values, i, skip_call(events, i));
+    if (rule->textView()) {
+      value = text.contiguous ? c.view(text.view, true)
+                              : c.view(text.text, false);
+    } else {
+      value = text.contiguous ? std::string{text.view} : std::move(text.text);
+    }
+    rule->execute(value, c.arena());
+    break;
+  }
+  case ValueEvent::Kind::Memo: {
+    const auto &block = memo_block(values[event.value]);
+    // the values are copied, the block being shared by the hits
+    std::vector<std::any> copy(block.values);
+    build_value(block.events, copy, 0, value, c);
+    break;
+  }
+  default:
+    // an action or an assignment has no value
+    break;
+  }
+}
+
+void Context::end(std::size_t first, std::size_t len) {
+  if (!logsEvents()) {
+    return;
+  }
+  _text_depth -= _events[first].kind == ValueEvent::Kind::Text;
+  if (success(len)) {
+    const auto *source = _events[first].source;
+    const auto *pos = _events[first].text.data();
+    _events.push_back({ValueEvent::Kind::End, source, {pos, len}});
+  } else {
+    _events.resize(first);
+  }
+}
+
+void Context::action(const Action *action) {
+  if (buildsValue()) {
+    _events.push_back({ValueEvent::Kind::Action, action});
+  }
+}
+
+AstNode *Context::assign(const Assignment &assignment,
+                         const Checkpoint &checkpoint) {
+  std::any value;
+  if (checkpoint.events < _events.size()) {
+    build_value(_events, _values, checkpoint.events, value, *this);
+  }
+  _events.resize(checkpoint.events);
+  _values.resize(checkpoint.values);
+  AstNode *object = nullptr;
+  if (value.has_value()) {
+    if (auto *const *node = std::any_cast<AstNode *>(&value)) {
+      object = *node;
+    }
+    _events.push_back({ValueEvent::Kind::Assign, std::addressof(assignment),
+                       {}, _values.size()});
+    _values.push_back(std::move(value));
+  }
+  return object;
+}
+
+void Context::assign(const Assignment &assignment, AstNode *object) {
+  _events.push_back({ValueEvent::Kind::Assign, std::addressof(assignment),
+                     {}, _values.size()});
+  _values.emplace_back(object);
+}
+
+std::any Context::value(std::size_t first) {
+  std::any value;
+  if (first < _events.size()) {
+    build_value(_events, _values, first, value, *this);
+  }
+  if (auto *const *node = std::any_cast<AstNode *>(&value)) {
+    // the node shares the ownership of the arena of the parse
+    auto arena = std::make_shared<AstArena>(std::move(_arena));
+    value = std::shared_ptr<AstNode>{std::move(arena), *node};
+  }
+  return value;
+}
+
+std::any Context::value(std::shared_ptr<AstArena> &arena) {
+  std::any value;
+  if (!_events.empty()) {
+    build_value(_events, _values, 0, value, *this);
+  }
+  if (auto *const *node = std::any_cast<AstNode *>(&value)) {
+    if (arena) {
+      *arena = std::move(_arena);
+    } else {
+      arena = std::make_shared<AstArena>(std::move(_arena));
+    }
+    value = std::shared_ptr<AstNode>{arena, *node};
+  }
+  return value;
+}
+
+/// Send value events to a listener
+/// @param events the value events
+/// @param values the values assigned by the events
+/// @param listener the listener
+/// @param text the input text
+static void notify(std::span<const ValueEvent> events,
+                   std::span<const std::any> values, ParseListener &listener,
+                   std::string_view text) {
+  for (const auto &event : events) {
+    switch (event.kind) {
+    case ValueEvent::Kind::Memo: {
+      const auto &block = memo_block(values[event.value]);
+      notify(block.events, block.values, listener, text);
+      break;
+    }
+    case ValueEvent::Kind::Node:
+    case ValueEvent::Kind::Text:
+      listener.onRuleEnter(*static_cast<const Rule *>(event.source),
+                           event.text.data() - text.data());
+      break;
+    case ValueEvent::Kind::End:
+      listener.onRuleExit(*static_cast<const Rule *>(event.source),
+                          event.text.size());
+      break;
+    case ValueEvent::Kind::Token:
+    case ValueEvent::Kind::Hidden:
+      listener.onToken(*event.source, event.text,
+                       event.kind == ValueEvent::Kind::Hidden);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+void Context::notify(ParseListener &listener, std::string_view text) const {
+  pegium::notify(_events, _values, listener, text);
+}
+
+void Context::memoize(const Rule *rule, const char *pos, std::size_t len,
+                      CstNode *node, const Checkpoint &checkpoint) {
+  MemoTable::Entry entry{len, node};
+  if (success(len)) {
+    if (checkpoint.events < _events.size()) {
+      // the events are moved into a block logged by a single event, so the
+      // enclosing calls and the hits share them
+      auto block = std::make_shared<MemoBlock>();
+      block->events.assign(_events.begin() + checkpoint.events,
+                           _events.end());
+      block->values.assign(
+          std::make_move_iterator(_values.begin() + checkpoint.values),
+          std::make_move_iterator(_values.end()));
+      for (auto &event : block->events) {
+        if (indexed(event)) {
+          event.value -= checkpoint.values;
+        }
+      }
+      _events.resize(checkpoint.events);
+      _values.resize(checkpoint.values);
+      entry.block = std::move(block);
+      log(entry.block);
+    }
+    entry.errors.assign(_errors.begin() + checkpoint.errors, _errors.end());
+  }
+  entry.passed = _passed - checkpoint.passed;
+  _memo.insert(rule, pos, std::move(entry), checkpoint.node.watermark);
+}
+
+void Context::log(const std::shared_ptr<const MemoBlock> &block) {
+  _events.push_back({ValueEvent::Kind::Memo, nullptr, {}, _values.size()});
+  _values.emplace_back(block);
+}
+
+void Context::append(const MemoTable::Entry &entry) {
+  if (entry.block) {
+    log(entry.block);
+  }
+  _passed += entry.passed;
+  _errors.insert(_errors.end(), entry.errors.begin(), entry.errors.end());
+}
+
+void Context::mergeFailure(Failure &&failure) {
+  if (!failure.pos || (_failure.pos && failure.pos < _failure.pos)) {
+    return;
+  }
+  if (!_failure.pos || _failure.pos < failure.pos) {
+    _failure = std::move(failure);
+    return;
+  }
+  for (const auto *element : failure.expected) {
+    addExpected(element, failure.pos);
+  }
+}
+
+void Context::addExpected(const GrammarElement *element, const char *pos) {
+  if (_failure.pos != pos) {
+    _failure.pos = pos;
+    _failure.expected.clear();
+  }
+  if (std::ranges::find(_failure.expected, element) ==
+      _failure.expected.end()) {
+    _failure.expected.push_back(element);
+  }
+}
+
+void Context::append(std::span<const ValueEvent> events,
+                     std::span<const std::any> values) {
+  const auto base = _values.size();
+  for (auto event : events) {
+    if (indexed(event)) {
+      event.value += base;
+    }
+    _events.push_back(event);
+  }
+  _values.insert(_values.end(), values.begin(), values.end());
+}
+
+const Context::Seed *Context::findSeed(const Rule *rule,
+                                       const char *pos) const noexcept {
+  for (auto it = _seeds.rbegin(); it != _seeds.rend(); ++it) {
+    if (it->rule == rule && it->pos == pos) {
+      return std::addressof(*it);
+    }
+  }
+  return nullptr;
+}
+
+void Context::plantSeed(const Rule *rule, const char *pos) {
+  _seeds.push_back({rule, pos, PARSE_ERROR, nullptr, {}, {}});
+}
+
+void Context::growSeed(std::size_t len, CstNode &node,
+                       const Checkpoint &checkpoint) {
+  auto &seed = _seeds.back();
+  seed.len = len;
+  seed.children = node.detach(checkpoint.node);
+  seed.events.assign(_events.begin() + checkpoint.events, _events.end());
+  for (auto &event : seed.events) {
+    if (indexed(event)) {
+      event.value -= checkpoint.values;
+    }
+  }
+  seed.values.assign(
+      std::make_move_iterator(_values.begin() + checkpoint.values),
+      std::make_move_iterator(_values.end()));
+  _events.resize(checkpoint.events);
+  _values.resize(checkpoint.values);
+  if (!_events.empty()) {
+    auto &last = _events.back();
+    last.text = {last.text.data(), checkpoint.tail};
+  }
+}
+
+std::size_t Context::harvestSeed(CstNode &node) {
+  const auto seed = std::move(_seeds.back());
+  _seeds.pop_back();
+  if (success(seed.len)) {
+    node.attach(seed.children);
+    append(seed.events, seed.values);
+  }
+  return seed.len;
+}
 
-std::size_t Context::skipHiddenNodes(std::string_view sv, CstNode &node) const {
+void Context::appendSeed(const Seed &seed, CstNode &node) {
+  if (seed.len == 0) {
+    // an empty seed may be returned twice at the same position: its nodes
+    // are copied instead of being moved
+    for (const auto *child = seed.children; child;
+         child = child->nextSibling) {
+      node.append(*child);
+    }
+  } else {
+    node.attach(seed.children);
+  }
+  append(seed.events, seed.values);
+}
 
+std::size_t Context::skipHidden(std::string_view sv, CstNode &node) {
+  // each hidden token is measured by its match, so the text examined by the
+  // tokens and by the failure ending them is recorded
+  const bool materialized =
+      _mode == ParseMode::Full || _mode == ParseMode::Events;
+  const auto checkpoint = node.checkpoint();
   std::size_t i = 0;
-  auto len = hidden->parse_hidden(sv, node);
-  while (len != PARSE_ERROR) {
+  while (true) {
+    std::size_t examined;
+    // the hidden tokens are only materialized for the CST and the events
+    const auto len =
+        materialized ? hidden->match_hidden(sv.substr(i), node, examined)
+                     : hidden->match_terminal(sv.substr(i), examined);
+    examine(sv.data() + i + examined);
+    if (len == PARSE_ERROR) {
+      break;
+    }
     assert(len && "An hidden rule must consume at least one character.");
     i += len;
-    len = hidden->parse_hidden({sv.data() + i, sv.size() - i}, node);
+  }
+  if (!materialized) {
+    return i;
+  }
+  if (_mode == ParseMode::Events) {
+    // the hidden nodes are only created to log their tokens
+    for (auto *child = checkpoint.lastChild ? checkpoint.lastChild->nextSibling
+                                            : node.firstChild;
+         child; child = child->nextSibling) {
+      _events.push_back(
+          {ValueEvent::Kind::Hidden, child->grammarSource, child->text});
+    }
+    node.rollback(checkpoint);
   }
   return i;
 }
@@ -881,15 +2784,17 @@ std::size_t NoOp::parse_hidden(std::string_view sv, CstNode &parent) const {
 }
 void NoOp::accept(Visitor &v) const {}
 
-bool Feature::operator==(const Feature &rhs) const noexcept {
-  return _equal(*this, rhs);
-}
-void Feature::assign(const std::any &object, const std::any &value) const {
-  _assign(std::any_cast<std::shared_ptr<AstNode>>(object).get(), _feature,
-          value);
+std::size_t Cut::parse_rule(std::string_view sv, CstNode &,
+                            Context &c) const {
+  c.cut(sv.data());
+  return 0;
 }
-void Feature::assign(AstNode *object, const std::any &value) const {
-  _assign(object, _feature, value);
+std::size_t Cut::parse_terminal(std::string_view) const { return 0; }
+std::size_t Cut::parse_hidden(std::string_view, CstNode &) const { return 0; }
+void Cut::accept(Visitor &v) const { v.visit(*this); }
+
+void Feature::assign(const std::any &object, std::any &value) const {
+  _assign(std::any_cast<AstNode *>(object), value);
 }
 
 } // namespace pegium
\ No newline at end of file
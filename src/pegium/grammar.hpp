@@ -1,49 +1,82 @@
 #pragma once
 
+#include <any>
+#include <array>
 #include <cassert>
 #include <cctype>
 #include <concepts>
+#include <cstdint>
 #include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <pegium/IParser.hpp>
+#include <pegium/interner.hpp>
+#include <pegium/profiler.hpp>
+#include <pegium/scan.hpp>
 #include <pegium/syntax-tree.hpp>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 
 namespace pegium {
 
 class Context;
 class Group;
+class UnorderedGroup;
 class PrioritizedChoice;
+class Optional;
+class Many;
+class AtLeastOne;
 class Repetition;
 class AndPredicate;
 class NotPredicate;
 class Keyword;
+class KeywordSet;
 class ParserRule;
 class RuleCall;
 class AnyCharacter;
 class TerminalRule;
 class Character;
 class CharacterClass;
+class Until;
 class Assignment;
 class Action;
+class Cut;
 class DataTypeRule;
+class Program;
+struct FirstSet;
+namespace ct {
+struct Tag;
+class ExpressionElement;
+}
 
 class GrammarElement {
 public:
   struct Visitor {
     virtual ~Visitor() noexcept = default;
     virtual void visit(const Group &) { /* ignore */ }
+    virtual void visit(const UnorderedGroup &) { /* ignore */ }
     virtual void visit(const PrioritizedChoice &) { /* ignore */ }
+    virtual void visit(const Optional &) { /* ignore */ }
+    virtual void visit(const Many &) { /* ignore */ }
+    virtual void visit(const AtLeastOne &) { /* ignore */ }
     virtual void visit(const Repetition &) { /* ignore */ }
     virtual void visit(const AndPredicate &) { /* ignore */ }
     virtual void visit(const NotPredicate &) { /* ignore */ }
     virtual void visit(const Keyword &) { /* ignore */ }
+    virtual void visit(const KeywordSet &) { /* ignore */ }
     virtual void visit(const RuleCall &) { /* ignore */ }
     virtual void visit(const AnyCharacter &) { /* ignore */ }
     virtual void visit(const Character &) { /* ignore */ }
     virtual void visit(const CharacterClass &) { /* ignore */ }
+    virtual void visit(const Until &) { /* ignore */ }
     virtual void visit(const Assignment &) { /* ignore */ }
     virtual void visit(const Action &) { /* ignore */ }
+    virtual void visit(const Cut &) { /* ignore */ }
+    virtual void visit(const ct::ExpressionElement &) { /* ignore */ }
 
     virtual void visit(const ParserRule &) { /* ignore */ }
     virtual void visit(const DataTypeRule &) { /* ignore */ }
@@ -63,11 +96,29 @@ public:
   // elements
   virtual std::size_t parse_terminal(std::string_view sv) const = 0;
 
+  // parse the input text from a terminal and measure the furthest position
+  // examined by the match, the end of the text included: by default the
+  // whole text is assumed to be examined
+  virtual std::size_t match_terminal(std::string_view sv,
+                                     std::size_t &examined) const {
+    examined = sv.size();
+    return parse_terminal(sv);
+  }
+
   // parse the input text for hidden rules: ignored token are ignored, hidden
   // token are converted to hidden CstNode
   virtual std::size_t parse_hidden(std::string_view sv,
                                    CstNode &parent) const = 0;
 
+  // parse the input text for hidden rules and measure the furthest position
+  // examined by the match, as match_terminal: by default the whole text is
+  // assumed to be examined
+  virtual std::size_t match_hidden(std::string_view sv, CstNode &parent,
+                                   std::size_t &examined) const {
+    examined = sv.size();
+    return parse_hidden(sv, parent);
+  }
+
 protected:
   /// Utility to convert a GrammarElement to a shared_ptr
   /// @tparam T the element type
@@ -95,12 +146,87 @@ public:
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
   std::size_t parse_terminal(std::string_view sv) const override;
   void accept(Visitor &v) const override;
+  /// @return the keyword text
+  const std::string &value() const noexcept { return _kw; }
+  bool ignoreCase() const noexcept { return _ignore_case; }
 
 private:
   std::string _kw;
   bool _ignore_case;
 };
 
+/// An ordered choice of keywords.
+/// The keywords are compiled into a trie so that the first matching keyword
+/// is found in a time proportional to its length, regardless of the number
+/// of keywords.
+class KeywordSet final : public GrammarElement {
+public:
+  explicit KeywordSet(std::vector<std::shared_ptr<const Keyword>> keywords);
+  template <typename... Args>
+    requires(std::same_as<std::decay_t<Args>, Keyword> && ...)
+  explicit KeywordSet(Args &&...args)
+      : KeywordSet{std::vector<std::shared_ptr<const Keyword>>{
+            make_shared(std::forward<Args>(args))...}} {}
+
+  std::size_t parse_rule(std::string_view sv, CstNode &parent,
+                         Context &c) const override;
+  std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
+  std::size_t parse_terminal(std::string_view sv) const override;
+  std::size_t match_terminal(std::string_view sv,
+                             std::size_t &examined) const override;
+  void accept(Visitor &v) const override;
+  /// @return the keywords in priority order
+  const std::vector<std::shared_ptr<const Keyword>> &keywords() const noexcept {
+    return _keywords;
+  }
+
+private:
+  static constexpr std::uint32_t NONE =
+      std::numeric_limits<std::uint32_t>::max();
+
+  struct Match {
+    /// the index of the matched keyword or NONE
+    std::uint32_t keyword = NONE;
+    std::size_t len = 0;
+    /// the furthest position examined by the tries
+    std::size_t examined = 0;
+  };
+
+  /// A trie stored in flat arrays, the edges of a node are sorted by
+  /// character.
+  struct Trie {
+    struct Edge {
+      unsigned char c;
+      std::uint32_t target;
+    };
+    struct Node {
+      /// the edges of the node are edges[first..first+size]
+      std::uint32_t first = 0;
+      std::uint32_t size = 0;
+      /// the smallest index of a keyword ending on this node or NONE
+      std::uint32_t keyword = NONE;
+    };
+    std::vector<Node> nodes;
+    std::vector<Edge> edges;
+    bool ignoreCase = false;
+
+    void build(const std::vector<std::shared_ptr<const Keyword>> &keywords,
+               bool ignoreCase);
+    /// Update best with the keyword of smallest index matched by sv
+    /// @param sv the input text
+    /// @param boundary true to reject a keyword ending with a word character
+    /// followed by a word character
+    /// @param best the best match so far
+    void match(std::string_view sv, bool boundary, Match &best) const;
+  };
+
+  std::vector<std::shared_ptr<const Keyword>> _keywords;
+  Trie _sensitive;
+  Trie _insensitive;
+
+  Match find(std::string_view sv, bool boundary) const;
+};
+
 class Character final : public GrammarElement {
 public:
   Character(Character &&) = default;
@@ -111,6 +237,7 @@ public:
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
   std::size_t parse_terminal(std::string_view sv) const override;
   void accept(Visitor &v) const override;
+  char value() const noexcept { return _char; }
 
 private:
   char _char;
@@ -127,126 +254,846 @@ public:
   void accept(Visitor &v) const override;
 };
 
+/// A cut, or commit point: once it is passed the enclosing alternatives of
+/// the rule containing it are committed. A failure following a cut is not
+/// recovered by the choices, options and repetitions of the rule being tried
+/// when the cut was passed, up to the enclosing predicate: the rule fails
+/// fast and the memoized results before the cut are released. A failed
+/// element of a recovering repetition is recovered if it passed a cut, in
+/// any rule it called.
+class Cut final : public GrammarElement {
+public:
+  std::size_t parse_rule(std::string_view sv, CstNode &parent,
+                         Context &c) const override;
+  std::size_t parse_terminal(std::string_view sv) const override;
+  std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
+  void accept(Visitor &v) const override;
+};
+
+class Rule;
+
+/// Receive the events of a parse, in the order of the input, without any CST
+/// node or value being created. The events of the alternatives that failed
+/// are never received: they are buffered until the parse succeeds.
+struct ParseListener {
+  virtual ~ParseListener() noexcept = default;
+  /// A parser or data type rule call starts
+  /// @param rule the called rule
+  /// @param offset the offset of the call in the input text
+  virtual void onRuleEnter(const Rule &rule, std::size_t offset) {}
+  /// A token is matched
+  /// @param element the grammar element of the token
+  /// @param text the text of the token
+  /// @param hidden true if the token is hidden (e.g. a comment)
+  virtual void onToken(const GrammarElement &element, std::string_view text,
+                       bool hidden) {}
+  /// A rule call ends
+  /// @param rule the called rule
+  /// @param len the length parsed by the call, hidden tokens included
+  virtual void onRuleExit(const Rule &rule, std::size_t len) {}
+};
+
+/// An event of the construction of the value of a parse.
+/// The events are logged while parsing and rolled back with the CST nodes
+/// when an alternative fails. The value of an assignment is built from its
+/// events as soon as the assignment succeeds, and the value of the parse
+/// once the parsed rule succeeds.
+struct ValueEvent {
+  enum class Kind : std::uint8_t {
+    /// a matched token
+    Token,
+    /// a hidden token, only logged for a ParseListener
+    Hidden,
+    /// the start of a parser rule call
+    Node,
+    /// the start of a data type rule call
+    Text,
+    /// the end of a rule call
+    End,
+    /// an action executed on the current value
+    Action,
+    /// a value assigned to the current object
+    Assign,
+    /// a memoized rule call, logged by the MemoBlock at the index of the
+    /// value
+    Memo
+  };
+  Kind kind;
+  /// the rule, the action or the assignment of the event
+  const GrammarElement *source = nullptr;
+  /// the text of a token, the start of a rule call or the text of a rule
+  /// call at its end
+  std::string_view text;
+  /// the index of the assigned value or of the block of a memoized call
+  std::size_t value = 0;
+};
+
+/// The value events of a memoized rule call and their values, moved out of
+/// the parse once and shared by the events of its hits, so that nested
+/// memoized calls are stored once
+struct MemoBlock {
+  /// the events of the call, the indexes of the values being relative to
+  /// the first value of the block
+  std::vector<ValueEvent> events;
+  std::vector<std::any> values;
+};
+
+/// Options of the packrat memoization
+struct MemoOptions {
+  /// memoize the calls to all rules, otherwise only the calls to the rules
+  /// marked with `memoize()` are memoized
+  bool all = false;
+  /// the maximum number of entries, pinned CST nodes and value events kept
+  /// by the memo table. The table is cleared when the limit is reached to
+  /// bound the memory used on large inputs.
+  std::size_t limit = std::size_t{1} << 20;
+};
+
+/// Options of the parallel parse of a repetition
+struct ParallelOptions {
+  /// the characters opening and closing a block: the input is split after a
+  /// closing character at depth 0, the split points being only a guess
+  /// checked when the chunks are stitched together
+  char open = '{';
+  char close = '}';
+  /// the character delimiting the strings skipped by the pre-scan, '\0' if
+  /// there is none. A backslash escapes the next character.
+  char quote = '"';
+  /// the maximum number of threads, 0 to use the hardware concurrency
+  std::size_t threads = 0;
+  /// the minimum size of a chunk, smaller inputs are parsed sequentially
+  std::size_t chunk = std::size_t{1} << 16;
+};
+
+/// Options of the error recovery of a repetition
+struct RecoveryOptions {
+  /// the characters opening and closing a block: a broken element is skipped
+  /// up to the start of the next element or the end of the enclosing block,
+  /// the nested blocks being skipped as a whole
+  char open = '{';
+  char close = '}';
+  /// the character delimiting the strings skipped as a whole, '\0' if there
+  /// is none. A backslash escapes the next character.
+  char quote = '"';
+};
+
+/// A broken part of the input skipped by the error recovery
+struct SyntaxError {
+  /// the position of the broken element in the input text
+  const char *pos;
+  /// the length of the skipped text
+  std::size_t length;
+  /// the tokens expected at the furthest failure of the broken element
+  std::vector<const GrammarElement *> expected;
+};
+
+/// A memo table that caches the result of a rule call at a given position
+/// for the duration of a parse.
+class MemoTable final {
+public:
+  struct Entry {
+    /// the length parsed by the rule call or PARSE_ERROR
+    std::size_t len;
+    /// the CST node created by the rule call (nullptr on failure or when no
+    /// CST is built), kept in the arena of the parse and moved on a hit
+    CstNode *node;
+    /// the value events logged by the rule call or nullptr if none
+    std::shared_ptr<const MemoBlock> block;
+    /// the number of cuts passed by the rule call, including the calls it
+    /// made
+    std::size_t passed = 0;
+    /// the errors recovered by the rule call
+    std::vector<SyntaxError> errors;
+  };
+
+  explicit MemoTable(std::size_t limit);
+
+  /// Find the memoized result of a rule call
+  /// @param rule the called rule
+  /// @param pos the position of the call in the input text
+  /// @return the memoized entry or nullptr, e.g. if a node of the entry was
+  /// moved out by another hit
+  const Entry *find(const Rule *rule, const char *pos) const;
+
+  /// Memoize the result of a rule call. Its nodes are pinned in the arena of
+  /// the parse: a rollback no longer releases them, so they are stored once
+  /// and moved by the hits instead of being copied.
+  /// @param rule the called rule
+  /// @param pos the position of the call in the input text
+  /// @param entry the result of the call
+  /// @param first the watermark of the arena before the call
+  void insert(const Rule *rule, const char *pos, Entry entry,
+              std::size_t first = 0);
+  /// @param root the root of a rolled back node
+  /// @param watermark the watermark restored by the rollback
+  /// @return the watermark releasing none of the memoized nodes
+  std::size_t pinned(const RootCstNode *root,
+                     std::size_t watermark) const noexcept {
+    return root == _root ? std::max(watermark, _pinned) : watermark;
+  }
+  /// Move the node of a hit, released by a rollback, under a new parent. The
+  /// entries containing the node lose it, so they are not found anymore.
+  /// @param node the memoized node
+  /// @param parent the new parent
+  void move(CstNode &node, CstNode &parent);
+
+  std::size_t size() const noexcept { return _entries.size(); }
+  /// Release the entries and unpin their nodes
+  void clear() noexcept;
+  /// Release the entries of the calls before a committed position, which are
+  /// unlikely to be reused. The table is only scanned once it has doubled
+  /// since the last scan, so that the releases cost a constant time per
+  /// insertion. The nodes of the released entries stay pinned until the
+  /// table is emptied.
+  /// @param pos the committed position in the input text
+  void release(const char *pos) noexcept;
+
+private:
+  struct Key {
+    const Rule *rule;
+    const char *pos;
+    bool operator==(const Key &) const = default;
+  };
+  struct KeyHash {
+    std::size_t operator()(const Key &key) const noexcept;
+  };
+  std::unordered_map<Key, Entry, KeyHash> _entries;
+  /// the root of the memoized nodes and the watermark pinning them
+  const RootCstNode *_root = nullptr;
+  std::size_t _pinned = 0;
+  /// the completed nodes that lost a descendant moved by a hit
+  std::unordered_set<const CstNode *> _moved;
+  /// the number of entries, pinned nodes and value events kept
+  std::size_t _size = 0;
+  std::size_t _limit;
+  /// the number of entries kept by the last scan of release
+  std::size_t _kept = 0;
+};
+
+/// What a parse materializes
+enum class ParseMode : std::uint8_t {
+  /// build the full CST, hidden tokens included, and the value
+  Full,
+  /// build the value only: no CST node is created
+  Ast,
+  /// only recognize the input: no CST node is created and no value is built
+  Recognize,
+  /// only log the events of a ParseListener: no CST node is created and no
+  /// value is built
+  Events
+};
+
+/// Options of a streamed parse
+struct StreamOptions {
+  /// the minimum number of characters pulled from the reader at once
+  std::size_t chunk = std::size_t{1} << 16;
+  /// the number of characters that must follow the furthest position
+  /// examined by the parse of an element before it is committed, or before
+  /// its failure is final. The text examined by a token is measured, but a
+  /// compile-time expression is assumed to examine only the character
+  /// following its match. An element is also committed at the end of the
+  /// input.
+  std::size_t lookahead = std::size_t{1} << 12;
+  /// what the parse materializes for each element
+  ParseMode mode = ParseMode::Full;
+};
+/// Pull the next characters of a streamed input
+/// @param buffer the buffer receiving the characters
+/// @return the number of characters read, 0 at the end of the input
+using StreamReader = std::function<std::size_t(std::span<char> buffer)>;
+/// Receive the parse result of a committed element of a streamed input
+using StreamCallback = std::function<void(ParseResult element)>;
+
 class Context final {
 public:
-  explicit Context(
-      std::shared_ptr<GrammarElement> hidden = std::make_shared<NoOp>());
+  /// @param hidden the element matching the hidden tokens (nullptr if the
+  /// grammar has no hidden token), it must outlive the context
+  /// @param memo the memoization options
+  /// @param profiler the profiler receiving the profile of the parse, only
+  /// used when built with PEGIUM_ENABLE_PROFILING
+  explicit Context(const GrammarElement *hidden = nullptr,
+                   MemoOptions memo = {}, Profiler *profiler = nullptr);
+
+  std::size_t skipHiddenNodes(std::string_view sv, CstNode &node) {
+    if (!hidden) {
+      return 0;
+    }
+    return skipHidden(sv, node);
+  }
+  /// @return the element matching the hidden tokens or nullptr
+  const GrammarElement *hiddenElement() const noexcept { return hidden; }
+
+  /// Append a leaf node for a matched token, then skip the hidden tokens
+  /// following it. No node is created when the input is only recognized.
+  /// @param source the grammar element of the token
+  /// @param sv the input text starting with the token
+  /// @param len the length of the token
+  /// @param parent the parent of the leaf node
+  /// @return the length of the token and of the skipped hidden tokens
+  std::size_t leaf(const GrammarElement *source, std::string_view sv,
+                   std::size_t len, CstNode &parent) {
+    if (buildsCst()) {
+      auto &node = parent.emplace_back();
+      node.grammarSource = source;
+      node.text = {sv.data(), len};
+      node.isLeaf = true;
+    }
+    token(source, {sv.data(), len});
+    return len + skipHiddenNodes({sv.data() + len, sv.size() - len}, parent);
+  }
+
+  ParseMode mode() const noexcept { return _mode; }
+  void mode(ParseMode mode) noexcept { _mode = mode; }
+  /// @return true if the parse creates CST nodes
+  bool buildsCst() const noexcept { return _mode == ParseMode::Full; }
+  /// @return true if the parse builds a value
+  bool buildsValue() const noexcept {
+    return _mode == ParseMode::Full || _mode == ParseMode::Ast;
+  }
+  /// @return true if the parse logs the rule calls and the tokens
+  bool logsEvents() const noexcept { return _mode != ParseMode::Recognize; }
+
+  /// Set how the std::string_view values are interned: a value that is not a
+  /// contiguous text of the input is always interned
+  /// @param all true to intern all the values, equal values sharing the same
+  /// address
+  /// @param interner the interner shared by the parses or nullptr to create
+  /// one for this parse when needed
+  void intern(bool all, std::shared_ptr<Interner> interner) noexcept {
+    _intern = all;
+    _interner = std::move(interner);
+  }
+  /// @return the interner of the std::string_view values or nullptr if none
+  /// was needed
+  const std::shared_ptr<Interner> &interner() const noexcept {
+    return _interner;
+  }
+  /// @param text the text of a std::string_view value
+  /// @param contiguous true if the text is a view of the input text
+  /// @return the text to store in the value, valid as long as the input text
+  /// and the interner
+  std::string_view view(std::string_view text, bool contiguous) {
+    if (contiguous && !_intern) {
+      return text;
+    }
+    if (!_interner) {
+      _interner = std::make_shared<Interner>();
+    }
+    return _interner->intern(text);
+  }
+
+  /// The state of a parse, used to rollback a failed alternative
+  struct Checkpoint {
+    CstNode::Checkpoint node;
+    std::size_t events;
+    std::size_t values;
+    /// the length of the last token, which may be extended by a merge
+    std::size_t tail;
+    /// the number of cuts passed in the current rule, which is not restored
+    /// by a rollback
+    std::size_t cuts;
+    /// the number of cuts passed by the parse, which is restored neither by
+    /// a rollback nor by the end of a rule call
+    std::size_t passed;
+    std::size_t errors;
+#ifdef PEGIUM_ENABLE_PROFILING
+    /// the successful rule calls
+    std::size_t profile = 0;
+#endif
+  };
+  /// @param parent the node receiving the nodes of the alternative
+  /// @return a checkpoint of the current state
+  Checkpoint checkpoint(const CstNode &parent) const noexcept {
+    Checkpoint checkpoint{parent.checkpoint(), _events.size(), _values.size(),
+                          _events.empty() ? 0 : _events.back().text.size(),
+                          _cuts,
+                          _passed,
+                          _errors.size()};
+#ifdef PEGIUM_ENABLE_PROFILING
+    checkpoint.profile = _profile.checkpoint();
+#endif
+    return checkpoint;
+  }
+  /// Remove the nodes and the value events created since the checkpoint
+  /// @param parent the node used to create the checkpoint
+  /// @param checkpoint the checkpoint to restore
+  void rollback(CstNode &parent, const Checkpoint &checkpoint) noexcept {
+    // the memoized nodes are kept for the next hits
+    parent.rollback({checkpoint.node.lastChild,
+                     _memo.pinned(parent.root, checkpoint.node.watermark)});
+    _events.resize(checkpoint.events);
+    _values.resize(checkpoint.values);
+    _errors.resize(checkpoint.errors);
+    if (!_events.empty()) {
+      auto &last = _events.back();
+      last.text = {last.text.data(), checkpoint.tail};
+    }
+#ifdef PEGIUM_ENABLE_PROFILING
+    _profile.rollback(checkpoint.profile);
+#endif
+  }
 
-  std::size_t skipHiddenNodes(std::string_view sv, CstNode &node) const;
+  /// Pass a cut: the alternatives of the current rule being tried are
+  /// committed and the memoized calls before the cut are released
+  /// @param pos the position of the cut in the input text
+  void cut(const char *pos) noexcept {
+    ++_cuts;
+    ++_passed;
+    _memo.release(pos);
+  }
+  /// @param checkpoint a checkpoint created before an alternative
+  /// @return true if a cut of the current rule was passed since the
+  /// checkpoint: a failure is not recovered by trying another alternative
+  bool committed(const Checkpoint &checkpoint) const noexcept {
+    return _cuts != checkpoint.cuts;
+  }
+  /// @param checkpoint a checkpoint created before an element
+  /// @return true if a cut was passed since the checkpoint, in the current
+  /// rule or in a called one: a failed element is broken and may be
+  /// recovered
+  bool broken(const Checkpoint &checkpoint) const noexcept {
+    return _passed != checkpoint.passed;
+  }
+  /// End the scope of the cuts passed by a rule call, which only commit the
+  /// alternatives of the called rule
+  /// @param checkpoint the checkpoint created before the call
+  void endCuts(const Checkpoint &checkpoint) noexcept {
+    _cuts = checkpoint.cuts;
+  }
+  /// Forget the cuts passed since the checkpoint, the cuts of a predicate
+  /// neither commit the enclosing alternatives nor break the enclosing
+  /// elements
+  /// @param checkpoint the checkpoint created before the predicate
+  void discardCuts(const Checkpoint &checkpoint) noexcept {
+    _cuts = checkpoint.cuts;
+    _passed = checkpoint.passed;
+  }
+
+  /// The furthest position where a token failed to match and the tokens
+  /// expected there
+  struct Failure {
+    const char *pos = nullptr;
+    std::vector<const GrammarElement *> expected;
+  };
+  /// Record a token failing to match, only the furthest failures are kept
+  /// @param element the expected token
+  /// @param pos the position of the token in the input text
+  /// @param examined the furthest position examined by the token, as an
+  /// offset from pos
+  void expect(const GrammarElement *element, const char *pos,
+              std::size_t examined = 0) {
+    examine(pos + examined);
+    if (_muted == 0 && (!_failure.pos || pos >= _failure.pos)) {
+      addExpected(element, pos);
+    }
+  }
+  /// Stop recording the failing tokens until unmute is called, the failure
+  /// of the element of a negative predicate being expected
+  void mute() noexcept { ++_muted; }
+  /// Resume recording the failing tokens
+  void unmute() noexcept { --_muted; }
+  /// @return the furthest failure
+  const Failure &failure() const noexcept { return _failure; }
+  /// Replace the furthest failure, e.g. to find the failure of an element
+  /// @param failure the new furthest failure
+  /// @return the replaced failure
+  Failure exchangeFailure(Failure failure) noexcept {
+    return std::exchange(_failure, std::move(failure));
+  }
+  /// Keep the furthest of a failure and the current one
+  /// @param failure the failure
+  void mergeFailure(Failure &&failure);
+  /// Record a position examined by a token, the examined positions are not
+  /// released by a rollback
+  /// @param pos the position in the input text
+  void examine(const char *pos) noexcept {
+    if (!_examined || pos > _examined) {
+      _examined = pos;
+    }
+  }
+  /// @return the furthest position examined by the tokens, matched or not,
+  /// or nullptr if no token was tried
+  const char *examined() const noexcept { return _examined; }
+  /// Record an error skipped by the recovery
+  /// @param error the error
+  void error(SyntaxError error) { _errors.push_back(std::move(error)); }
+  /// @return the errors skipped by the recovery, in the order of the input
+  std::span<const SyntaxError> errors() const noexcept { return _errors; }
+
+  /// Profile the start of a rule call, does nothing unless built with
+  /// PEGIUM_ENABLE_PROFILING
+  /// @param rule the called rule
+  void profileEnter([[maybe_unused]] const Rule *rule) {
+#ifdef PEGIUM_ENABLE_PROFILING
+    _profile.enter(rule);
+#endif
+  }
+  /// Profile the end of the last started rule call
+  /// @param len the parsed length or PARSE_ERROR
+  void profileExit([[maybe_unused]] std::size_t len) {
+#ifdef PEGIUM_ENABLE_PROFILING
+    _profile.exit(len);
+#endif
+  }
+  /// Profile a rule call answered by the memo table
+  /// @param rule the called rule
+  /// @param len the memoized length or PARSE_ERROR
+  void profileHit([[maybe_unused]] const Rule *rule,
+                  [[maybe_unused]] std::size_t len) {
+#ifdef PEGIUM_ENABLE_PROFILING
+    _profile.hit(rule, len);
+#endif
+  }
+
+  /// Log a matched token
+  /// @param source the grammar element of the token
+  /// @param text the text of the token
+  void token(const GrammarElement *source, std::string_view text) {
+    // the character following a token decides where it ends
+    examine(text.data() + text.size());
+    if (!logsEvents()) {
+      return;
+    }
+    // in a data type rule only the text of the tokens is used: contiguous
+    // tokens are merged
+    if (_text_depth > 0 && buildsValue() && !_events.empty()) {
+      auto &last = _events.back();
+      if (last.kind == ValueEvent::Kind::Token &&
+          last.text.data() + last.text.size() == text.data()) {
+        last.text = {last.text.data(), last.text.size() + text.size()};
+        return;
+      }
+    }
+    _events.push_back({ValueEvent::Kind::Token, source, text});
+  }
+  /// Memoize the result of a rule call and the value events it logged
+  /// @param rule the called rule
+  /// @param pos the position of the call in the input text
+  /// @param len the parsed length or PARSE_ERROR
+  /// @param node the created CST node or nullptr
+  /// @param checkpoint the checkpoint created before the call
+  void memoize(const Rule *rule, const char *pos, std::size_t len,
+               CstNode *node, const Checkpoint &checkpoint);
+  /// Log the start of a rule call
+  /// @param kind ValueEvent::Kind::Node or ValueEvent::Kind::Text
+  /// @param rule the called rule
+  /// @param pos the position of the call in the input text
+  /// @return the index of the first event of the call
+  std::size_t begin(ValueEvent::Kind kind, const GrammarElement *rule,
+                    const char *pos) {
+    const auto first = _events.size();
+    if (logsEvents()) {
+      _events.push_back({kind, rule, {pos, 0}});
+      _text_depth += kind == ValueEvent::Kind::Text;
+    }
+    return first;
+  }
+  /// Log the end of a rule call, or discard its events if it failed
+  /// @param first the index returned by begin
+  /// @param len the length parsed by the rule call
+  void end(std::size_t first, std::size_t len);
+  /// Log an action executed on the current value
+  /// @param action the action
+  void action(const Action *action);
+  /// Log the events of a memoized rule call and pass its cuts
+  /// @param entry the memoized entry
+  void append(const MemoTable::Entry &entry);
+  /// Replace the events logged since the checkpoint by the assignment of
+  /// their value
+  /// @param assignment the assignment
+  /// @param checkpoint the checkpoint created before the assignment
+  /// @return the assigned object, nullptr if the value is not an object
+  AstNode *assign(const Assignment &assignment, const Checkpoint &checkpoint);
+  /// Log the assignment of an object built by a previous parse
+  /// @param assignment the assignment
+  /// @param object the assigned object
+  void assign(const Assignment &assignment, AstNode *object);
+  /// The assigned values are moved into the built value. A node value is a
+  /// std::shared_ptr<AstNode> owning the arena of the nodes, which is moved
+  /// out of the context.
+  /// @param first the index of the first event of the value
+  /// @return the value built from the events logged since first
+  std::any value(std::size_t first = 0);
+  /// Build the value of all the events, the arena of the nodes being moved
+  /// into a shared arena
+  /// @param arena the arena owned by the node value, created if nullptr
+  /// @return the value built from the events
+  std::any value(std::shared_ptr<AstArena> &arena);
+  /// @return the arena allocating the nodes of the parse, the node values
+  /// being AstNode pointers until the value of the parse is built
+  AstArena &arena() noexcept { return _arena; }
+  /// Send the logged events to a listener
+  /// @param listener the listener
+  /// @param text the input text
+  void notify(ParseListener &listener, std::string_view text) const;
+
+  /// Create an empty context for a parse running in parallel with this one,
+  /// with the same hidden element, options and mode. A forked context does
+  /// not parse in parallel. The interner is shared with the forked context.
+  /// @return the created context
+  Context fork();
+  /// Append the value events of a forked context
+  /// @param other the forked context, its values are moved
+  void append(Context &&other);
+  /// @return true if the repetitions marked as parallel are parsed in
+  /// parallel
+  bool parallel() const noexcept { return _parallel; }
+
+  /// @param rule the called rule
+  /// @return true if the calls to the rule are memoized
+  bool memoized(const Rule &rule) const noexcept;
+  MemoTable &memo() noexcept { return _memo; }
+
+  /// The result of a left recursive rule call being grown, returned by the
+  /// left recursive calls at the same position
+  struct Seed {
+    const Rule *rule;
+    const char *pos;
+    /// the parsed length or PARSE_ERROR
+    std::size_t len;
+    /// the unlinked children of the rule node (nullptr if no CST is built)
+    CstNode *children;
+    /// the value events of the rule call and their values
+    std::vector<ValueEvent> events;
+    std::vector<std::any> values;
+  };
+  /// @param rule the called rule
+  /// @param pos the position of the call in the input text
+  /// @return the seed grown for the call or nullptr
+  const Seed *findSeed(const Rule *rule, const char *pos) const noexcept;
+  /// Start growing a left recursive rule call, with a failed seed
+  /// @param rule the called rule
+  /// @param pos the position of the call in the input text
+  void plantSeed(const Rule *rule, const char *pos);
+  /// @return the length of the seed being grown
+  std::size_t seedLength() const noexcept { return _seeds.back().len; }
+  /// @return true if a left recursive call is growing a seed, whose
+  /// detached nodes may be attached again
+  bool growing() const noexcept { return !_seeds.empty(); }
+  /// Replace the seed being grown by the longer result of the last parse of
+  /// the rule: its nodes and events are moved out of the parse
+  /// @param len the parsed length
+  /// @param node the node of the rule call
+  /// @param checkpoint the checkpoint created before the last parse
+  void growSeed(std::size_t len, CstNode &node, const Checkpoint &checkpoint);
+  /// Stop growing the seed and append its result to the parse
+  /// @param node the node of the rule call
+  /// @return the length of the seed
+  std::size_t harvestSeed(CstNode &node);
+  /// Append the result of a seed at a left recursive call
+  /// @param seed the seed
+  /// @param node the node of the left recursive call
+  void appendSeed(const Seed &seed, CstNode &node);
 
 private:
-  std::shared_ptr<GrammarElement> hidden;
+  const GrammarElement *hidden;
+  bool _memoize_all;
+  ParseMode _mode = ParseMode::Full;
+  MemoTable _memo;
+  std::vector<ValueEvent> _events;
+  /// the values of the assignments, stored apart to keep the events
+  /// trivially copyable
+  std::vector<std::any> _values;
+  /// the number of data type rule calls in progress
+  std::size_t _text_depth = 0;
+  /// the number of cuts passed in the current rule
+  std::size_t _cuts = 0;
+  /// the number of cuts passed by the parse
+  std::size_t _passed = 0;
+  Failure _failure;
+  /// the furthest position examined by the tokens
+  const char *_examined = nullptr;
+  /// the number of mute calls not followed by unmute
+  std::size_t _muted = 0;
+  std::vector<SyntaxError> _errors;
+  /// the interner of the std::string_view values, created when needed
+  std::shared_ptr<Interner> _interner;
+  AstArena _arena;
+  /// true if all the std::string_view values are interned
+  bool _intern = false;
+  MemoOptions _memo_options;
+  bool _parallel = true;
+  /// the left recursive rule calls being grown, innermost last
+  std::vector<Seed> _seeds;
+#ifdef PEGIUM_ENABLE_PROFILING
+  ParseProfile _profile;
+#endif
+
+  std::size_t skipHidden(std::string_view sv, CstNode &node);
+  void addExpected(const GrammarElement *element, const char *pos);
+  /// Log the events of a memoized rule call by a single event
+  /// @param block the events of the call
+  void log(const std::shared_ptr<const MemoBlock> &block);
+  /// Append value events and their values, the indexes of the values being
+  /// relative to the first one
+  void append(std::span<const ValueEvent> events,
+              std::span<const std::any> values);
 };
 using ContextProvider = std::function<Context()>;
+/// Create the value of a parser rule or convert the text of a data type rule,
+/// the nodes being allocated in the arena of the parse
+using ValueConverter = std::function<void(std::any &value, AstArena &arena)>;
+
+/// A reference found in an AST, resolved by an Index
+struct ReferenceLink {
+  /// the Reference
+  void *reference;
+  /// resolve the reference to a node, false if the node has not the type of
+  /// the reference
+  bool (*resolve)(void *reference, AstNode *node);
+  /// the text of the reference
+  std::string_view text;
+};
+
+/// The nodes contained by AstNodes and the references they hold
+struct AstContents {
+  std::vector<AstNode *> nodes;
+  std::vector<ReferenceLink> references;
+};
 
+/// A feature of an AstNode, assigned by an Assignment.
+/// The setter of a feature is generated from its member pointer: the object
+/// is cast without RTTI and the value is moved into the member. The walker
+/// of a feature collects the nodes and the references of its member.
 struct Feature {
+  /// @tparam feature the member pointer of the feature
+  /// @return the feature
+  template <auto feature> static Feature of() noexcept {
+    using C = typename member_traits<decltype(feature)>::object_type;
+    return Feature{&id<feature>,
+                   [](AstNode *object, std::any &value) {
+                     assert(dynamic_cast<C *>(object));
+                     set(static_cast<C *>(object)->*feature, value);
+                   },
+                   [](AstNode *object, AstContents &contents) {
+                     auto *typed = dynamic_cast<C *>(object);
+                     if (typed) {
+                       walk(typed->*feature, contents);
+                     }
+                     return typed != nullptr;
+                   }};
+  }
 
-  template <typename R, typename C> static constexpr auto equalOperator() {
-    return [](const Feature &lhs, const Feature &rhs) {
-      return rhs._feature.type() == typeid(R C::*) &&
-             std::any_cast<R C::*>(lhs._feature) ==
-                 std::any_cast<R C::*>(rhs._feature);
-    };
+  /// Assign a value to a member, e.g. a string value to a string member or
+  /// a node value to a vector of nodes
+  /// @param member the member
+  /// @param value the value moved into the member
+  template <typename T> static void set(T &member, std::any &value) {
+    if constexpr (std::same_as<T, bool>) {
+      // an enabled feature unless the value is a boolean
+      const auto *result = std::any_cast<bool>(&value);
+      member = !result || *result;
+    } else if constexpr (is_vector<T>::value) {
+      using E = typename T::value_type;
+      if constexpr (is_reference_v<E>) {
+        member.emplace_back() = take<std::string>(value);
+      } else {
+        member.push_back(take<E>(value));
+      }
+    } else if constexpr (is_reference_v<T>) {
+      // store the reference as string
+      member = take<std::string>(value);
+    } else {
+      member = take<T>(value);
+    }
   }
 
-  template <typename R, typename C, typename Assign>
-  Feature(R C::*feature, Assign &&assign)
-      : _feature{feature}, _equal{equalOperator<std::shared_ptr<R>, C>()},
-        _assign{std::forward<Assign>(assign)} {}
-
-  // create a Feature for a reference
-  template <typename R, typename C>
-    requires std::derived_from<C, AstNode>
-  explicit Feature(Reference<R> C::*feature)
-      : Feature{feature, [](AstNode *object, const std::any &fea,
-                            const std::any &value) {
-                  auto *obj = dynamic_cast<C *>(object);
-                  assert(obj);
-                  auto &member = obj->*std::any_cast<Reference<R> C::*>(fea);
-                  // store the reference as string
-                  member = std::any_cast<std::string>(value);
-                  // TODO initialize resolve from the Context
-                }} {}
-
-  // create a feature for an attribute of data type
-  template <typename R, typename C>
-    requires std::derived_from<C, AstNode> && (!std::derived_from<R, AstNode>)
-  explicit Feature(R C::*feature)
-      : Feature{feature, [](AstNode *object, const std::any &fea,
-                            const std::any &value) {
-                  auto *obj = dynamic_cast<C *>(object);
-                  assert(obj);
-                  auto &member = obj->*std::any_cast<R C::*>(fea);
-                  member = std::any_cast<R>(value);
-                }} {}
-  // create a feature for an attribute of AstNode
-  template <typename R, typename C>
-    requires std::derived_from<C, AstNode> && std::derived_from<R, AstNode>
-  explicit Feature(std::shared_ptr<R> C::*feature)
-      : Feature{feature, [](AstNode *object, const std::any &fea,
-                            const std::any &value) {
-                  auto *obj = dynamic_cast<C *>(object);
-                  assert(obj);
-                  auto &member =
-                      obj->*std::any_cast<std::shared_ptr<R> C::*>(fea);
-                  member = std::dynamic_pointer_cast<R>(
-                      std::any_cast<std::shared_ptr<AstNode>>(value));
-                }} {}
-
-  // create a feature for a vector of reference
-  template <typename R, typename C>
-    requires std::derived_from<C, AstNode> && (!std::derived_from<R, AstNode>)
-  explicit Feature(std::vector<Reference<R>> C::*feature)
-      : Feature{feature, [](AstNode *object, const std::any &fea,
-                            const std::any &value) {
-                  auto *obj = dynamic_cast<C *>(object);
-                  assert(obj);
-                  auto &member =
-                      obj->*std::any_cast<std::vector<Reference<R>> C::*>(fea);
-                  member.emplace_back() = std::any_cast<std::string>(value);
-                }} {}
-  // create a feature for a vector of data type
-  template <typename R, typename C>
-    requires std::derived_from<C, AstNode> && (!std::derived_from<R, AstNode>)
-  explicit Feature(std::vector<R> C::*feature)
-      : Feature{feature, [](AstNode *object, const std::any &fea,
-                            const std::any &value) {
-                  auto *obj = dynamic_cast<C *>(object);
-                  assert(obj);
-                  auto &member = obj->*std::any_cast<std::vector<R> C::*>(fea);
-                  member.emplace_back(std::any_cast<R>(value));
-                }} {}
-
-  // create a feature for a vector of AstNode
-  template <typename R, typename C>
-    requires std::derived_from<C, AstNode> && std::derived_from<R, AstNode>
-  explicit Feature(std::vector<std::shared_ptr<R>> C::*feature)
-      : Feature{feature, [](AstNode *object, const std::any &fea,
-                            const std::any &value) {
-                  auto *obj = dynamic_cast<C *>(object);
-                  assert(obj);
-                  auto &member =
-                      obj->*std::any_cast<std::vector<std::shared_ptr<R>> C::*>(
-                                fea);
-                  member.emplace_back(std::dynamic_pointer_cast<R>(
-                      std::any_cast<std::shared_ptr<AstNode>>(value)));
-                }} {}
-
-  bool operator==(const Feature &rhs) const noexcept;
-  void assign(const std::any &object, const std::any &value) const;
-  void assign(AstNode *object, const std::any &value) const;
+  bool operator==(const Feature &rhs) const noexcept {
+    return _id == rhs._id;
+  }
+  /// Assign a value to the feature of an object
+  /// @param object the object, an AstNode pointer
+  /// @param value the value moved into the feature
+  /// @throw std::bad_any_cast if the value does not fit the feature
+  void assign(const std::any &object, std::any &value) const;
+  /// Assign a value to the feature of an object
+  /// @param object the object
+  /// @param value the value moved into the feature
+  /// @throw std::bad_any_cast if the value does not fit the feature
+  void assign(AstNode *object, std::any &value) const {
+    _assign(object, value);
+  }
+  /// Collect the contained nodes and the references of the feature of an
+  /// object
+  /// @param object the object
+  /// @param contents the collected nodes and references
+  /// @return false if the object has not the feature, it uses RTTI
+  bool walk(AstNode *object, AstContents &contents) const {
+    return _walk(object, contents);
+  }
 
   template <typename T>
     requires IsGrammarElement<T>
   Assignment operator=(T &&elem);
 
 private:
-  std::any _feature;
-  std::function<bool(const Feature &lhs, const Feature &rhs)> _equal;
+  using Setter = void (*)(AstNode *object, std::any &value);
+  using Walker = bool (*)(AstNode *object, AstContents &contents);
+  Feature(const void *id, Setter assign, Walker walk) noexcept
+      : _id{id}, _assign{assign}, _walk{walk} {}
+
+  template <typename T> struct member_traits;
+  template <typename R, typename C> struct member_traits<R C::*> {
+    using object_type = C;
+  };
+  /// a unique address identifying a feature
+  template <auto feature> static constexpr char id = 0;
+  template <typename T> struct is_vector : std::false_type {};
+  template <typename T>
+  struct is_vector<std::vector<T>> : std::true_type {};
+  template <typename T> struct is_containment : std::false_type {};
+  template <typename T>
+  struct is_containment<Containment<T>> : std::true_type {};
+
+  /// Move a value of type T out of a std::any, a node value is cast to the
+  /// node type without RTTI and a std::string_view value is copied into a
+  /// string
+  /// @throw std::bad_any_cast if the value has another type
+  template <typename T> static T take(std::any &value) {
+    if constexpr (std::same_as<T, std::string>) {
+      if (const auto *view = std::any_cast<std::string_view>(&value)) {
+        return std::string{*view};
+      }
+    }
+    if constexpr (is_containment<T>::value) {
+      using E = std::remove_pointer_t<decltype(std::declval<T>().get())>;
+      auto *node = take<AstNode *>(value);
+      assert(!node || dynamic_cast<E *>(node));
+      return T{static_cast<E *>(node)};
+    } else {
+      return std::any_cast<T>(std::move(value));
+    }
+  }
 
-  std::function<void(AstNode *object, const std::any &feature,
-                     const std::any &value)>
-      _assign;
+  /// Collect the nodes and the references of a member
+  /// @param member the member
+  /// @param contents the collected nodes and references
+  template <typename T>
+  static void walk(T &member, AstContents &contents) {
+    if constexpr (is_vector<T>::value) {
+      using E = typename T::value_type;
+      if constexpr (is_reference_v<E> || is_containment<E>::value) {
+        for (auto &element : member) {
+          walk(element, contents);
+        }
+      }
+    } else if constexpr (is_reference_v<T>) {
+      contents.references.push_back(
+          {std::addressof(member), &resolve<T>, member.text()});
+    } else if constexpr (is_containment<T>::value) {
+      if (member) {
+        contents.nodes.push_back(member.get());
+      }
+    }
+  }
+  template <typename T>
+  static bool resolve(void *reference, AstNode *node) noexcept {
+    return static_cast<T *>(reference)->resolve(node);
+  }
+
+  const void *_id;
+  Setter _assign;
+  Walker _walk;
 };
 
 class Assignment final : public GrammarElement {
@@ -260,21 +1107,22 @@ public:
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
   void accept(Visitor &v) const override;
   const Feature &getFeature() const noexcept { return feature; }
+  const GrammarElement &element() const noexcept { return *elem; }
 
   template <auto e, typename T>
     requires IsGrammarElement<T>
   static Assignment assign(T &&elem) {
-    return Assignment{Feature{e}, std::forward<T>(elem)};
+    return Assignment{Feature::of<e>(), std::forward<T>(elem)};
   }
   template <auto e, typename T>
     requires IsGrammarElement<T>
   static Assignment append(T &&elem) {
-    return Assignment{Feature{e}, std::forward<T>(elem)};
+    return Assignment{Feature::of<e>(), std::forward<T>(elem)};
   }
   template <auto e, typename T>
     requires IsGrammarElement<T>
   static Assignment enable(T &&elem) {
-    return Assignment{Feature{e}, std::forward<T>(elem)};
+    return Assignment{Feature::of<e>(), std::forward<T>(elem)};
   }
 
 private:
@@ -298,7 +1146,7 @@ public:
   Action(Action &&) = default;
   Action(const Action &) = default;
   template <typename Func>
-    requires std::invocable<Func, std::any &> &&
+    requires std::invocable<Func, std::any &, AstArena &> &&
              (!std::same_as<std::decay_t<Func>, Action>)
   explicit Action(Func &&func) : _action{std::forward<Func>(func)} {}
 
@@ -308,10 +1156,13 @@ public:
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
   void accept(Visitor &v) const override;
 
-  void execute(std::any &data) const { _action(data); }
+  /// Execute the action on the current value
+  /// @param data the current value
+  /// @param arena the arena allocating the created nodes
+  void execute(std::any &data, AstArena &arena) const { _action(data, arena); }
 
 private:
-  std::function<void(std::any &)> _action;
+  std::function<void(std::any &, AstArena &)> _action;
 };
 
 class Group final : public GrammarElement {
@@ -329,6 +1180,10 @@ public:
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
   std::size_t parse_terminal(std::string_view sv) const override;
   void accept(Visitor &v) const override;
+  const std::vector<std::shared_ptr<GrammarElement>> &
+  elements() const noexcept {
+    return _elements;
+  }
 
 private:
   std::vector<std::shared_ptr<GrammarElement>> _elements;
@@ -389,6 +1244,10 @@ public:
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
   std::size_t parse_terminal(std::string_view sv) const override;
   void accept(Visitor &v) const override;
+  const std::vector<std::shared_ptr<GrammarElement>> &
+  elements() const noexcept {
+    return _elements;
+  }
 
 private:
   std::vector<std::shared_ptr<GrammarElement>> _elements;
@@ -445,16 +1304,23 @@ public:
   template <typename T>
     requires IsGrammarElement<T> && (!std::same_as<std::decay_t<T>, Optional>)
   explicit Optional(T &&element)
-      : _element{make_shared(std::forward<T>(element))} {}
+      : _element{make_shared(std::forward<T>(element))} {
+    if constexpr (std::same_as<std::decay_t<T>, CharacterClass>) {
+      _class = static_cast<const std::decay_t<T> *>(_element.get());
+    }
+  }
 
   std::size_t parse_rule(std::string_view sv, CstNode &parent,
                          Context &c) const override;
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
   std::size_t parse_terminal(std::string_view sv) const override;
-  void accept(Visitor &v) const override {}
+  void accept(Visitor &v) const override;
+  const GrammarElement &element() const noexcept { return *_element; }
 
 private:
   std::shared_ptr<GrammarElement> _element;
+  /// set if the element is a CharacterClass, matched with a single lookup
+  const CharacterClass *_class = nullptr;
 };
 class Many final : public GrammarElement {
 public:
@@ -463,16 +1329,71 @@ public:
   template <typename T>
     requires IsGrammarElement<T> && (!std::same_as<std::decay_t<T>, Many>)
   explicit Many(T &&element)
-      : _element{make_shared(std::forward<T>(element))} {}
+      : _element{make_shared(std::forward<T>(element))} {
+    if constexpr (std::same_as<std::decay_t<T>, CharacterClass>) {
+      _class = static_cast<const std::decay_t<T> *>(_element.get());
+    }
+  }
 
   std::size_t parse_rule(std::string_view sv, CstNode &parent,
                          Context &c) const override;
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
   std::size_t parse_terminal(std::string_view sv) const override;
-  void accept(Visitor &v) const override {}
+  void accept(Visitor &v) const override;
+  const GrammarElement &element() const noexcept { return *_element; }
+
+  /// Parse the repetition in parallel. The input is split into chunks by a
+  /// pre-scan of the blocks, the chunks are parsed concurrently and then
+  /// stitched together in order. The result is identical to the sequential
+  /// parse: a chunk is only kept if the previous one ends where it starts,
+  /// otherwise the parse goes on sequentially.
+  /// It is intended for a top-level repetition of independent blocks.
+  /// @param options the parallel options
+  /// @return this repetition
+  Many &parallel(ParallelOptions options = {}) {
+    _parallel = options;
+    return *this;
+  }
+  /// Recover from the broken elements: an element failing after a cut is
+  /// skipped up to the start of the next element or the end of the
+  /// enclosing block, in a hidden leaf marked as recovered, and the parse
+  /// goes on. It is intended for the repetitions of statements or
+  /// declarations, so that a broken document still gets a mostly complete
+  /// CST and all its errors in a single pass.
+  /// @param options the recovery options
+  /// @return this repetition
+  Many &recover(RecoveryOptions options = {});
+  /// Compute the FIRST set used by the recovery before the first broken
+  /// element, e.g. when the grammar is finalized
+  void prepare() const;
 
 private:
+  /// The recovery options and the FIRST set of the element, computed once
+  struct Recovery;
   std::shared_ptr<GrammarElement> _element;
+  /// set if the element is a CharacterClass, used to scan the repetition
+  const CharacterClass *_class = nullptr;
+  std::optional<ParallelOptions> _parallel;
+  /// shared by the copies of the repetition, as the element is
+  std::shared_ptr<Recovery> _recovery;
+
+  /// @return the FIRST set of the element, computed on first use
+  const FirstSet &first() const;
+  /// Parse the elements starting at position i
+  std::size_t parse_sequential(std::string_view sv, CstNode &parent,
+                               Context &c, std::size_t i = 0) const;
+  std::size_t parse_parallel(std::string_view sv, CstNode &parent,
+                             Context &c) const;
+  /// Parse the elements starting at position i, skipping the broken ones
+  std::size_t parse_recovering(std::string_view sv, CstNode &parent,
+                               Context &c, std::size_t i) const;
+  /// Find where the parse resumes after a broken element
+  /// @param i the position of the broken element
+  /// @param first the FIRST set of the element
+  /// @return the position of the next element candidate, of the end of the
+  /// enclosing block or of the end of the input
+  std::size_t resync(std::string_view sv, std::size_t i,
+                     const FirstSet &first) const;
 };
 class AtLeastOne final : public GrammarElement {
 public:
@@ -481,16 +1402,23 @@ public:
   template <typename T>
     requires IsGrammarElement<T> && (!std::same_as<std::decay_t<T>, AtLeastOne>)
   explicit AtLeastOne(T &&element)
-      : _element{make_shared(std::forward<T>(element))} {}
+      : _element{make_shared(std::forward<T>(element))} {
+    if constexpr (std::same_as<std::decay_t<T>, CharacterClass>) {
+      _class = static_cast<const std::decay_t<T> *>(_element.get());
+    }
+  }
 
   std::size_t parse_rule(std::string_view sv, CstNode &parent,
                          Context &c) const override;
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
   std::size_t parse_terminal(std::string_view sv) const override;
-  void accept(Visitor &v) const override {}
+  void accept(Visitor &v) const override;
+  const GrammarElement &element() const noexcept { return *_element; }
 
 private:
   std::shared_ptr<GrammarElement> _element;
+  /// set if the element is a CharacterClass, used to scan the repetition
+  const CharacterClass *_class = nullptr;
 };
 
 class Repetition final : public GrammarElement {
@@ -508,6 +1436,9 @@ public:
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
   std::size_t parse_terminal(std::string_view sv) const override;
   void accept(Visitor &v) const override;
+  const GrammarElement &element() const noexcept { return *_element; }
+  std::size_t min() const noexcept { return _min; }
+  std::size_t max() const noexcept { return _max; }
 
 private:
   std::shared_ptr<GrammarElement> _element;
@@ -517,8 +1448,11 @@ private:
 
 class PrioritizedChoice final : public GrammarElement {
 public:
-  PrioritizedChoice(PrioritizedChoice &&) = default;
-  PrioritizedChoice(const PrioritizedChoice &) = default;
+  // the dispatch table is not copied, it is built on first use
+  PrioritizedChoice(PrioritizedChoice &&other) noexcept
+      : _elements{std::move(other._elements)} {}
+  PrioritizedChoice(const PrioritizedChoice &other)
+      : _elements{other._elements} {}
 
   explicit PrioritizedChoice(
       std::vector<std::shared_ptr<GrammarElement>> &&elements);
@@ -531,14 +1465,49 @@ public:
   std::size_t parse_rule(std::string_view sv, CstNode &parent,
                          Context &c) const override;
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
+  std::size_t match_hidden(std::string_view sv, CstNode &parent,
+                           std::size_t &examined) const override;
 
   std::size_t parse_terminal(std::string_view sv) const override;
+  std::size_t match_terminal(std::string_view sv,
+                             std::size_t &examined) const override;
 
   void accept(Visitor &v) const override;
+  const std::vector<std::shared_ptr<GrammarElement>> &
+  elements() const noexcept {
+    return _elements;
+  }
+  /// Build the dispatch table before the first use, e.g. when the grammar
+  /// is finalized
+  void prepare() const { dispatch(); }
 
 private:
   std::vector<std::shared_ptr<GrammarElement>> _elements;
 
+  /// A first-character dispatch table: the alternatives that may match an
+  /// input starting with a given character, in their original order.
+  struct Dispatch {
+    /// indexes[offsets[c]..offsets[c+1]] are the candidates for the
+    /// character c, the index 256 is used for an empty input.
+    std::array<std::uint32_t, 258> offsets{};
+    std::vector<std::uint32_t> indexes;
+    /// set when all the alternatives are keywords
+    std::unique_ptr<KeywordSet> keywords;
+
+    /// @param sv the input text
+    /// @return the indexes of the alternatives that may match the input
+    std::span<const std::uint32_t> candidates(std::string_view sv) const {
+      const std::size_t c =
+          sv.empty() ? 256 : static_cast<unsigned char>(sv[0]);
+      return {indexes.data() + offsets[c], indexes.data() + offsets[c + 1]};
+    }
+  };
+  mutable std::once_flag _dispatch_flag;
+  mutable Dispatch _dispatch;
+
+  /// @return the dispatch table, built on first use
+  const Dispatch &dispatch() const;
+
   // concat 2 PrioritizedChoices
   template <typename T, typename U>
     requires std::same_as<std::decay_t<T>, PrioritizedChoice> &&
@@ -602,6 +1571,7 @@ public:
   std::size_t parse_terminal(std::string_view sv) const override;
 
   void accept(Visitor &v) const override;
+  const GrammarElement &element() const noexcept { return *_element; }
 
 private:
   std::shared_ptr<GrammarElement> _element;
@@ -624,6 +1594,7 @@ public:
   std::size_t parse_terminal(std::string_view sv) const override;
 
   void accept(Visitor &v) const override;
+  const GrammarElement &element() const noexcept { return *_element; }
 
 private:
   std::shared_ptr<GrammarElement> _element;
@@ -650,15 +1621,145 @@ public:
   std::size_t parse_terminal(std::string_view sv) const override;
 
   void accept(Visitor &v) const override;
+  /// @return the lookup table of the characters of the class
+  const std::array<bool, 256> &characters() const noexcept { return lookup; }
+
+  /// Scan a repetition of characters of the class
+  /// @param sv the input text
+  /// @return the length of the longest prefix of sv made of characters of the
+  /// class
+  std::size_t scan(std::string_view sv) const noexcept {
+    return pegium::scan(lookup, _ranges, sv);
+  }
 
 private:
   std::array<bool, 256> lookup{};
+  ByteRanges _ranges;
   std::string _name;
 };
 
+/// Match any character until an element, the element included.
+/// Equivalent to `many(!to, dot), to`. In a terminal, a case sensitive
+/// Keyword or a Character is searched with memchr instead of testing the
+/// element on each character.
+class Until final : public GrammarElement {
+public:
+  Until(Until &&) = default;
+  Until(const Until &) = default;
+  template <typename T>
+    requires IsGrammarElement<T> && (!std::same_as<std::decay_t<T>, Until>)
+  explicit Until(const T &to)
+      : _expansion{Many{Group{NotPredicate{to}, AnyCharacter{}}}, to} {
+    if constexpr (std::same_as<T, Keyword>) {
+      if (!to.ignoreCase()) {
+        _needle = to.value();
+      }
+    } else if constexpr (std::same_as<T, Character>) {
+      _needle = std::string(1, to.value());
+    }
+  }
+
+  std::size_t parse_rule(std::string_view sv, CstNode &parent,
+                         Context &c) const override;
+  std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
+  std::size_t parse_terminal(std::string_view sv) const override;
+  /// The text up to the needle is examined, the expansion is measured as an
+  /// unknown element
+  std::size_t match_terminal(std::string_view sv,
+                             std::size_t &examined) const override;
+  void accept(Visitor &v) const override;
+  /// @return the generic expansion `many(!to, dot), to`
+  const Group &expansion() const noexcept { return _expansion; }
+
+private:
+  Group _expansion;
+  /// the text searched in a terminal, empty to use the expansion
+  std::string _needle;
+
+  /// @param sv the input text
+  /// @param from the start position of the search
+  /// @return the position of the first occurrence of the needle after from
+  /// or std::string_view::npos
+  std::size_t find(std::string_view sv, std::size_t from) const noexcept;
+};
+
 class Rule : public GrammarElement {
 public:
-  virtual ParseResult parse(std::string_view sv) const = 0;
+  /// Parse a copy of the input text
+  /// @param sv the input text
+  /// @return the parse result
+  ParseResult parse(std::string_view sv) const;
+  /// Parse a shared text without copying it. The text is kept alive by the
+  /// root node of the result.
+  /// @param text the input text
+  /// @return the parse result
+  ParseResult parse(std::shared_ptr<const std::string> text) const;
+  /// Parse a text without copying it.
+  /// @param sv the input text
+  /// @param storage the owner of the input text kept alive by the root node
+  /// of the result, or nullptr to borrow the text (the caller must keep it
+  /// alive as long as the CST is used)
+  /// @return the parse result
+  ParseResult parse(std::string_view sv,
+                    std::shared_ptr<const void> storage) const {
+    return parse(sv, std::move(storage), ParseMode::Full);
+  }
+  /// Parse a text without copying it.
+  /// @param sv the input text
+  /// @param storage the owner of the input text kept alive by the root node
+  /// of the result, or nullptr to borrow the text
+  /// @param mode what the parse materializes, the result has no root node
+  /// when the input is only recognized
+  /// @return the parse result
+  virtual ParseResult parse(std::string_view sv,
+                            std::shared_ptr<const void> storage,
+                            ParseMode mode) const = 0;
+  /// Parse an edited text, reusing the CST of a previous parse. Only the
+  /// smallest rule call enclosing the edit is parsed again. A previous
+  /// result moved in is patched in place: the other nodes are kept, their
+  /// texts being shifted into the edited text, and the objects assigned
+  /// outside of the call and of its ancestors are reused, so that beyond
+  /// the shift of the texts the cost is the size of the call and of the
+  /// children of its ancestors. A previous result still shared is copied and
+  /// its value rebuilt. The values of a reparsed result never view its text.
+  /// A rule call encloses the edit if its first and last tokens are not
+  /// touched by the edit, if the parse examined none of the edited text
+  /// before the call (see CstNode::examined), so that the choices and the
+  /// predicates enclosing the call decide as before, and if it parses the
+  /// edited text to the same end. The calls in a left recursive call are
+  /// not parsed alone. Otherwise the whole text is parsed again: the result
+  /// is always the one of a full parse.
+  /// @param previous the result of a parse of this rule, its value being
+  /// reused if nothing else owns it
+  /// @param edit the edit of the text of the previous result
+  /// @return the parse result of the edited text
+  ParseResult reparse(ParseResult previous, const TextEdit &edit) const;
+  /// Build the result of a CST of this rule without parsing its text, e.g. a
+  /// CST loaded from a snapshot: the value is rebuilt from the nodes
+  /// @param root the root of the CST of a successful parse
+  /// @return the parse result
+  ParseResult rebuild(std::shared_ptr<RootCstNode> root) const;
+  /// Parse a text and send its rule calls and tokens to a listener, without
+  /// creating any CST node or value
+  /// @param sv the input text
+  /// @param listener the listener receiving the events once the rule
+  /// succeeded
+  /// @return the parse result, without root node nor value
+  ParseResult parse(std::string_view sv, ParseListener &listener) const;
+  /// Parse a streamed input made of a sequence of elements of this rule.
+  /// The input is pulled in chunks and each element is emitted as soon as it
+  /// is committed: its text is then released from the buffer, so the memory
+  /// is bounded by the size of an element and by the lookahead instead of by
+  /// the size of the input. The parse stops at the first element that fails
+  /// without depending on the unread input. The root node of an emitted
+  /// element owns a copy of its text.
+  /// @param read the reader of the input
+  /// @param emit the callback receiving each element
+  /// @param options the stream options
+  /// @return the result of the whole parse, ret is true if all the input was
+  /// parsed and len is the number of parsed characters
+  ParseResult parse_stream(const StreamReader &read, const StreamCallback &emit,
+                           const StreamOptions &options = {}) const;
   const std::string &name() const noexcept;
 
   std::size_t parse_rule(std::string_view sv, CstNode &parent,
@@ -666,13 +1767,58 @@ public:
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
   std::size_t parse_terminal(std::string_view sv) const override;
 
-  bool execute(std::any &data, CstNode &node) const {
-    return _action(data, node);
+  /// Create or convert the value of the rule
+  /// @param value the value, the text of the rule for a data type rule
+  /// @param arena the arena allocating the created nodes
+  void execute(std::any &value, AstArena &arena) const {
+    _action(value, arena);
   }
 
+  /// @return true if the calls to this rule are memoized (packrat parsing)
+  bool memoized() const noexcept { return _memoize; }
+
+  /// How a rule takes part in a left recursion
+  enum class LeftRecursion : std::uint8_t {
+    /// the rule is not left recursive
+    None,
+    /// the calls to the rule grow a seed (Warth et al.): every left
+    /// recursive cycle goes through a head
+    Head,
+    /// the rule is in a left recursive cycle through a head: its calls are
+    /// never memoized since their result depends on the seed being grown
+    Involved
+  };
+  /// @return how the rule takes part in a left recursion, found when the
+  /// grammar is finalized
+  LeftRecursion leftRecursion() const noexcept { return _left_recursion; }
+  /// @param kind how the rule takes part in a left recursion
+  void leftRecursion(LeftRecursion kind) noexcept { _left_recursion = kind; }
+
+  /// @return true if the value of the rule is a std::string_view, viewing
+  /// the input text when the text of the rule is contiguous
+  bool textView() const noexcept { return _text_view; }
+  /// @param enable true if the value of the rule is a std::string_view
+  void textView(bool enable) noexcept { _text_view = enable; }
+
+  /// @return the element of the rule (nullptr if the rule is not defined yet)
+  const GrammarElement *element() const noexcept { return _element.get(); }
+
+  /// @return true if the rule is a TerminalRule
+  bool isTerminal() const noexcept { return _terminal; }
+
 protected:
   explicit Rule(std::string_view name, ContextProvider provider,
-                std::function<bool(std::any &, CstNode &)> action);
+                ValueConverter action);
+
+  /// Parse a left recursive rule: the rule is parsed again while the parsed
+  /// length grows, its left recursive calls returning the previous result
+  /// @param kind the kind of the first value event of the rule call
+  /// @param sv the input text
+  /// @param node the node of the rule call
+  /// @param c the context
+  /// @return the parsed length or PARSE_ERROR
+  std::size_t grow(ValueEvent::Kind kind, std::string_view sv, CstNode &node,
+                   Context &c) const;
 
 private:
   friend class ParserRule;
@@ -682,24 +1828,57 @@ private:
   std::string _name;
   ContextProvider _context_provider;
   std::shared_ptr<GrammarElement> _element;
-  /// the action to be called when invocating make_ast
-  std::function<bool(std::any &, CstNode &)> _action;
+  /// the converter creating or converting the value of the rule
+  ValueConverter _action;
+  bool _memoize = false;
+  LeftRecursion _left_recursion = LeftRecursion::None;
+  bool _text_view = false;
+  bool _terminal = false;
 };
 
 class TerminalRule final : public Rule {
 public:
-  ParseResult parse(std::string_view sv) const override;
+  using Rule::parse;
+  ParseResult parse(std::string_view sv, std::shared_ptr<const void> storage,
+                    ParseMode mode) const override;
 
   explicit TerminalRule(std::string_view name, ContextProvider provider,
-                        std::function<bool(std::any &, CstNode &)> action);
+                        ValueConverter action);
 
   std::size_t parse_rule(std::string_view sv, CstNode &parent,
                          Context &c) const override;
 
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
+  /// Match the rule with its compiled program if any, which measures the
+  /// examined text
+  std::size_t match_hidden(std::string_view sv, CstNode &parent,
+                           std::size_t &examined) const override;
+
+  /// Match the rule with its compiled program if any
+  std::size_t parse_terminal(std::string_view sv) const override;
+  /// Match the rule with its compiled program if any, which measures the
+  /// examined text
+  std::size_t match_terminal(std::string_view sv,
+                             std::size_t &examined) const override;
+
+  /// Append the node of a token matched by the rule, unless the rule is
+  /// ignored, then skip the hidden tokens following it
+  /// @param sv the input text starting with the token
+  /// @param len the length of the token
+  /// @param parent the parent of the node
+  /// @param c the context
+  /// @return the length of the token and of the skipped hidden tokens
+  std::size_t token(std::string_view sv, std::size_t len, CstNode &parent,
+                    Context &c) const;
 
   void accept(Visitor &v) const override;
 
+  /// Set the compiled program of the rule element
+  /// @param program the program or nullptr to use the element directly
+  void program(std::shared_ptr<const Program> program) noexcept {
+    _program = std::move(program);
+  }
+
   /// Initialize the rule with a list of elements
   /// @tparam ...Args
   /// @param ...args the list of elements
@@ -711,6 +1890,16 @@ public:
     return *this;
   }
 
+  /// Initialize the rule with a compile-time expression (see pegium/ct.hpp)
+  /// @param expression the expression
+  /// @return a reference to the rule
+  template <typename E>
+    requires std::derived_from<std::decay_t<E>, ct::Tag>
+  TerminalRule &operator()(E &&expression) {
+    _element = make_shared(to_element(std::forward<E>(expression)));
+    return *this;
+  }
+
   /// @return true if the rule is  hidden or ignored, false otherwise
   bool hidden() const noexcept { return _kind != Kind::Normal; }
   /// @return true if the rule is ignored, false otherwise
@@ -724,6 +1913,11 @@ public:
     _kind = Kind::Ignored;
     return *this;
   }
+  /// Memoize the calls to this rule (packrat parsing)
+  TerminalRule &memoize(bool enable = true) noexcept {
+    _memoize = enable;
+    return *this;
+  }
 
 private:
   enum class Kind {
@@ -736,16 +1930,21 @@ private:
   };
 
   Kind _kind = Kind::Normal;
+  std::shared_ptr<const Program> _program;
 };
 
 class ParserRule final : public Rule {
 public:
   explicit ParserRule(std::string_view name, ContextProvider provider,
-                      std::function<bool(std::any &, CstNode &)> action);
+                      ValueConverter action);
   ParserRule(const ParserRule &) = delete;
   ParserRule(ParserRule &&) = delete;
+  std::size_t parse_rule(std::string_view sv, CstNode &parent,
+                         Context &c) const override;
   void accept(Visitor &v) const override;
-  ParseResult parse(std::string_view sv) const override;
+  using Rule::parse;
+  ParseResult parse(std::string_view sv, std::shared_ptr<const void> storage,
+                    ParseMode mode) const override;
 
   template <typename... Args>
     requires(IsGrammarElement<Args> && ...)
@@ -753,14 +1952,24 @@ public:
     _element = make_shared((std::forward<Args>(args), ...));
     return *this;
   }
+
+  /// Memoize the calls to this rule (packrat parsing)
+  ParserRule &memoize(bool enable = true) noexcept {
+    _memoize = enable;
+    return *this;
+  }
 };
 
 class DataTypeRule final : public Rule {
 public:
   explicit DataTypeRule(std::string_view name, ContextProvider provider,
-                        std::function<bool(std::any &, CstNode &)> action);
+                        ValueConverter action);
+  std::size_t parse_rule(std::string_view sv, CstNode &parent,
+                         Context &c) const override;
   void accept(Visitor &v) const override;
-  ParseResult parse(std::string_view sv) const override;
+  using Rule::parse;
+  ParseResult parse(std::string_view sv, std::shared_ptr<const void> storage,
+                    ParseMode mode) const override;
 
   template <typename... Args>
     requires(IsGrammarElement<Args> && ...)
@@ -769,6 +1978,12 @@ public:
     return *this;
   }
 
+  /// Memoize the calls to this rule (packrat parsing)
+  DataTypeRule &memoize(bool enable = true) noexcept {
+    _memoize = enable;
+    return *this;
+  }
+
 private:
   // TODO add value_converter
 };
@@ -783,9 +1998,15 @@ public:
                          Context &c) const override;
 
   std::size_t parse_hidden(std::string_view sv, CstNode &parent) const override;
+  std::size_t match_hidden(std::string_view sv, CstNode &parent,
+                           std::size_t &examined) const override;
   std::size_t parse_terminal(std::string_view sv) const override;
+  std::size_t match_terminal(std::string_view sv,
+                             std::size_t &examined) const override;
 
   void accept(Visitor &v) const override;
+  /// @return the called rule (nullptr if the rule is not defined yet)
+  const Rule *rule() const noexcept { return _rule.get(); }
 
 private:
   const std::shared_ptr<Rule> &_rule;
@@ -0,0 +1,82 @@
+#include <numeric>
+#include <pegium/index.hpp>
+#include <pegium/parallel.hpp>
+#include <typeindex>
+
+namespace pegium {
+
+Index::Index(std::span<const Feature> features, NameProvider name)
+    : _features{features.begin(), features.end()}, _name{name} {}
+
+Index::Document Index::walk(AstNode *root) const {
+  Document document;
+  AstContents contents;
+  // the features of each type of node, found by trying all the features on
+  // the first node of the type
+  std::unordered_map<std::type_index, std::vector<const Feature *>> types;
+  // the walked features push the contained nodes to visit
+  auto &pending = contents.nodes;
+  pending.push_back(root);
+  while (!pending.empty()) {
+    auto *node = pending.back();
+    pending.pop_back();
+    if (auto name = _name(*node); !name.empty()) {
+      document.names.emplace_back(name, node);
+    }
+    auto [it, inserted] = types.try_emplace(typeid(*node));
+    if (inserted) {
+      for (const auto &feature : _features) {
+        if (feature.walk(node, contents)) {
+          it->second.push_back(&feature);
+        }
+      }
+    } else {
+      for (const auto *feature : it->second) {
+        feature->walk(node, contents);
+      }
+    }
+  }
+  document.references = std::move(contents.references);
+  return document;
+}
+
+void Index::add(std::span<const ParseResult> documents, std::size_t threads) {
+  std::vector<Document> walked(documents.size());
+  parallel_for(documents.size(), threads, [&](std::size_t i) {
+    const auto *root = std::any_cast<std::shared_ptr<AstNode>>(
+        &documents[i].value);
+    if (root && *root) {
+      walked[i] = walk(root->get());
+    }
+  });
+  for (auto &document : walked) {
+    for (const auto &[name, node] : document.names) {
+      _nodes.try_emplace(name, node);
+    }
+    if (!document.references.empty()) {
+      _references.push_back(std::move(document.references));
+    }
+  }
+}
+
+std::size_t Index::link(std::size_t threads) {
+  std::vector<std::size_t> unresolved(_references.size());
+  // the index is only read, each reference being written by one thread
+  parallel_for(_references.size(), threads, [&](std::size_t i) {
+    for (const auto &link : _references[i]) {
+      auto *node = find(link.text);
+      if (!node || !link.resolve(link.reference, node)) {
+        ++unresolved[i];
+      }
+    }
+  });
+  return std::accumulate(unresolved.begin(), unresolved.end(),
+                         std::size_t{0});
+}
+
+AstNode *Index::find(std::string_view name) const {
+  auto it = _nodes.find(name);
+  return it != _nodes.end() ? it->second : nullptr;
+}
+
+} // namespace pegium
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <pegium/IParser.hpp>
+#include <pegium/grammar.hpp>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace pegium {
+
+/// A global index of the named AstNodes of a set of documents, resolving
+/// their references by name. The documents are walked in parallel when
+/// added, then the references are resolved in bulk: nothing is locked and a
+/// resolved Reference only stores the found node.
+/// The names are views of the nodes: the documents must outlive the index.
+class Index final {
+public:
+  /// Provide the name of a node, or an empty name if the node is not named
+  using NameProvider = std::string_view (*)(const AstNode &node);
+
+  /// @tparam feature the member pointer of the name, e.g.
+  /// &NamedElement::name. Its class must be polymorphic.
+  /// @return the provider of the names read from the member
+  template <auto feature> static NameProvider name() noexcept {
+    using C = typename member_traits<decltype(feature)>::object_type;
+    return [](const AstNode &node) -> std::string_view {
+      const auto *named = dynamic_cast<const C *>(&node);
+      return named ? std::string_view{named->*feature} : std::string_view{};
+    };
+  }
+
+  /// @param features the features of the AstNodes, e.g. Parser::features()
+  /// @param name the provider of the names of the nodes
+  Index(std::span<const Feature> features, NameProvider name);
+
+  /// Add the named nodes of documents and collect their references. The
+  /// first node added with a name is kept.
+  /// @param documents the parse results, their value being the AST root
+  /// @param threads the maximum number of threads, 0 to use the hardware
+  /// concurrency
+  void add(std::span<const ParseResult> documents, std::size_t threads = 0);
+  /// Resolve the references of the added documents
+  /// @param threads the maximum number of threads, 0 to use the hardware
+  /// concurrency
+  /// @return the number of unresolved references
+  std::size_t link(std::size_t threads = 0);
+
+  /// @param name a name
+  /// @return the node with the name or nullptr
+  AstNode *find(std::string_view name) const;
+  /// @return the number of named nodes
+  std::size_t size() const noexcept { return _nodes.size(); }
+
+private:
+  template <typename T> struct member_traits;
+  template <typename R, typename C> struct member_traits<R C::*> {
+    using object_type = C;
+  };
+
+  /// The named nodes and the references of a document
+  struct Document {
+    std::vector<std::pair<std::string_view, AstNode *>> names;
+    std::vector<ReferenceLink> references;
+  };
+
+  std::vector<Feature> _features;
+  NameProvider _name;
+  std::unordered_map<std::string_view, AstNode *> _nodes;
+  /// the references of the added documents
+  std::vector<std::vector<ReferenceLink>> _references;
+
+  /// Walk the AST of a document
+  /// @param root the root of the AST
+  /// @return the named nodes and the references of the document
+  Document walk(AstNode *root) const;
+};
+
+} // namespace pegium
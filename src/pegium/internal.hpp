@@ -0,0 +1,65 @@
+#pragma once
+
+// Helpers shared by the implementation of the grammar elements
+
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <pegium/lookup.hpp>
+#include <string_view>
+#include <utility>
+
+namespace pegium {
+
+inline bool isword(char c) {
+  static constexpr auto lookup = make_lookup(
+      std::pair{'a', 'z'}, std::pair{'A', 'Z'}, std::pair{'0', '9'}, '_');
+  return lookup[static_cast<unsigned char>(c)];
+}
+
+consteval std::array<unsigned char, 256> make_tolower() {
+  std::array<unsigned char, 256> table{};
+  for (int c = 0; c < 256; ++c) {
+    if (c >= 'A' && c <= 'Z') {
+      table[c] = static_cast<unsigned char>(c) + ('a' - 'A');
+    } else {
+      table[c] = static_cast<unsigned char>(c);
+    }
+  }
+  return table;
+}
+
+inline char tolower(char c) {
+  static constexpr auto tolower = make_tolower();
+  return static_cast<char>(tolower[static_cast<unsigned char>(c)]);
+}
+
+inline constexpr std::size_t PARSE_ERROR =
+    std::numeric_limits<std::size_t>::max();
+inline bool success(size_t len) { return len != PARSE_ERROR; }
+
+inline bool fail(size_t len) { return len == PARSE_ERROR; }
+/*-----------------------------------------------------------------------------
+ *  UTF8 functions
+ *---------------------------------------------------------------------------*/
+
+inline size_t codepoint_length(std::string_view sv) {
+  if (!sv.empty()) {
+    auto b = static_cast<std::byte>(sv.front());
+    if ((b & std::byte{0x80}) == std::byte{0}) {
+      return 1;
+    }
+    if ((b & std::byte{0xE0}) == std::byte{0xC0} && sv.size() >= 2) {
+      return 2;
+    }
+    if ((b & std::byte{0xF0}) == std::byte{0xE0} && sv.size() >= 3) {
+      return 3;
+    }
+    if ((b & std::byte{0xF8}) == std::byte{0xF0} && sv.size() >= 4) {
+      return 4;
+    }
+  }
+  return PARSE_ERROR;
+}
+
+} // namespace pegium
@@ -0,0 +1,40 @@
+#include <algorithm>
+#include <cstring>
+#include <pegium/interner.hpp>
+
+namespace pegium {
+
+std::string_view Interner::intern(std::string_view text) {
+  if (text.empty()) {
+    return {};
+  }
+  std::scoped_lock lock{_mutex};
+  if (auto it = _strings.find(text); it != _strings.end()) {
+    return *it;
+  }
+  if (text.size() > _available) {
+    // a large string gets its own block, the free space of the last block
+    // is kept for the next strings
+    const auto size = std::max(text.size(), BLOCK_SIZE);
+    auto &block = _blocks.emplace_back(std::make_unique<char[]>(size));
+    if (size == BLOCK_SIZE) {
+      _free = block.get();
+      _available = size;
+    } else {
+      std::memcpy(block.get(), text.data(), text.size());
+      return *_strings.emplace(block.get(), text.size()).first;
+    }
+  }
+  std::memcpy(_free, text.data(), text.size());
+  const std::string_view interned{_free, text.size()};
+  _free += text.size();
+  _available -= text.size();
+  return *_strings.insert(interned).first;
+}
+
+std::size_t Interner::size() const {
+  std::scoped_lock lock{_mutex};
+  return _strings.size();
+}
+
+} // namespace pegium
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace pegium {
+
+/// A set of unique strings: equal strings are interned at the same address,
+/// so their views are compared by pointer. The interned strings are never
+/// released before the interner, which is safe to share between threads.
+class Interner final {
+public:
+  Interner() = default;
+  Interner(const Interner &) = delete;
+  Interner &operator=(const Interner &) = delete;
+
+  /// @param text a string
+  /// @return the interned copy of the string, valid as long as the interner
+  std::string_view intern(std::string_view text);
+  /// @return the number of interned strings
+  std::size_t size() const;
+
+private:
+  /// the minimum size of the blocks storing the interned strings
+  static constexpr std::size_t BLOCK_SIZE = 4096;
+
+  mutable std::mutex _mutex;
+  std::unordered_set<std::string_view> _strings;
+  std::vector<std::unique_ptr<char[]>> _blocks;
+  /// the free space of the last block
+  char *_free = nullptr;
+  std::size_t _available = 0;
+};
+
+} // namespace pegium
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <array>
+#include <utility>
+
+namespace pegium {
+
+/// Build a lookup table of characters at compile time
+/// e.g. `make_lookup(std::pair{'a', 'z'}, '_')`
+/// @return the lookup table
+consteval std::array<bool, 256> make_lookup() { return {}; }
+
+template <typename... Args>
+consteval std::array<bool, 256> make_lookup(char single_char, Args... rest) {
+  std::array<bool, 256> result = make_lookup(rest...);
+  result[static_cast<unsigned char>(single_char)] = true;
+  return result;
+}
+template <typename... Args>
+consteval std::array<bool, 256> make_lookup(std::pair<char, char> range,
+                                            Args... rest) {
+  std::array<bool, 256> result = make_lookup(rest...);
+  for (char c = range.first; c <= range.second; ++c) {
+    result[static_cast<unsigned char>(c)] = true;
+  }
+  return result;
+}
+
+} // namespace pegium
@@ -0,0 +1,65 @@
+#pragma once
+
+// A minimal parallel loop used by the parallel parses
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pegium {
+
+/// Call func for each index in [0, count) from several threads. The threads
+/// are started by each call and joined before it returns, the calling
+/// thread being one of them: nothing is shared between the calls, so a
+/// nested call cannot wait for a busy thread. The indexes are distributed
+/// dynamically so that large inputs do not stall the others.
+/// @param count the number of indexes
+/// @param threads the maximum number of threads, 0 to use the hardware
+/// concurrency
+/// @param func the function called with an index
+/// @throw the first exception thrown by func, once all the threads are joined
+template <typename Func>
+void parallel_for(std::size_t count, std::size_t threads, Func func) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::min(threads, count);
+
+  std::atomic_size_t next = 0;
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto work = [&] {
+    for (auto i = next++; i < count; i = next++) {
+      try {
+        func(i);
+      } catch (...) {
+        std::scoped_lock lock{error_mutex};
+        if (!error) {
+          error = std::current_exception();
+        }
+        // stop distributing the remaining indexes
+        next = count;
+      }
+    }
+  };
+  if (threads <= 1) {
+    work();
+  } else {
+    std::vector<std::jthread> pool;
+    pool.reserve(threads - 1);
+    for (std::size_t t = 1; t < threads; ++t) {
+      pool.emplace_back(work);
+    }
+    work();
+    pool.clear();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+} // namespace pegium
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <pegium/grammar.hpp>
+#include <pegium/internal.hpp>
+#include <pegium/profiler.hpp>
+#include <string_view>
+#include <utility>
+
+namespace pegium {
+
+RuleProfile &RuleProfile::operator+=(const RuleProfile &other) noexcept {
+  calls += other.calls;
+  successes += other.successes;
+  failures += other.failures;
+  memo_hits += other.memo_hits;
+  consumed += other.consumed;
+  backtracked += other.backtracked;
+  inclusive += other.inclusive;
+  exclusive += other.exclusive;
+  return *this;
+}
+
+std::unordered_map<const Rule *, RuleProfile> Profiler::rules() const {
+  std::scoped_lock lock{_mutex};
+  return _rules;
+}
+
+std::vector<ProfileSpan> Profiler::spans() const {
+  std::vector<ProfileSpan> spans;
+  {
+    std::scoped_lock lock{_mutex};
+    spans = _spans;
+  }
+  std::ranges::stable_sort(spans, {}, &ProfileSpan::start);
+  return spans;
+}
+
+void Profiler::clear() {
+  std::scoped_lock lock{_mutex};
+  _rules.clear();
+  _spans.clear();
+  _lanes = 0;
+}
+
+void Profiler::merge(const std::unordered_map<const Rule *, RuleProfile> &rules,
+                     std::vector<ProfileSpan> &&spans) {
+  std::scoped_lock lock{_mutex};
+  for (const auto &[rule, profile] : rules) {
+    _rules[rule] += profile;
+  }
+  if (!spans.empty()) {
+    const auto lane = _lanes++;
+    for (auto &span : spans) {
+      span.lane = lane;
+    }
+    _spans.insert(_spans.end(), spans.begin(), spans.end());
+  }
+}
+
+/// @param duration a duration
+/// @return the duration in milliseconds
+static double milliseconds(std::chrono::nanoseconds duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void Profiler::write_table(std::ostream &os) const {
+  auto profiles = rules();
+  std::vector<std::pair<const Rule *, RuleProfile>> rows{profiles.begin(),
+                                                         profiles.end()};
+  std::ranges::sort(rows, [](const auto &lhs, const auto &rhs) {
+    return lhs.second.exclusive > rhs.second.exclusive;
+  });
+  std::size_t width = 4;
+  for (const auto &[rule, _] : rows) {
+    width = std::max(width, rule->name().size());
+  }
+
+  const auto flags = os.flags();
+  const auto precision = os.precision();
+  os << std::left << std::setw(static_cast<int>(width)) << "rule" << std::right
+     << std::setw(10) << "calls" << std::setw(10) << "success"
+     << std::setw(10) << "failure" << std::setw(10) << "memo"
+     << std::setw(12) << "consumed" << std::setw(12) << "backtracked"
+     << std::setw(12) << "incl. ms" << std::setw(12) << "excl. ms" << '\n';
+  os << std::fixed << std::setprecision(3);
+  for (const auto &[rule, profile] : rows) {
+    os << std::left << std::setw(static_cast<int>(width)) << rule->name()
+       << std::right << std::setw(10) << profile.calls << std::setw(10)
+       << profile.successes << std::setw(10) << profile.failures
+       << std::setw(10) << profile.memo_hits << std::setw(12)
+       << profile.consumed << std::setw(12) << profile.backtracked
+       << std::setw(12) << milliseconds(profile.inclusive) << std::setw(12)
+       << milliseconds(profile.exclusive) << '\n';
+  }
+  os.flags(flags);
+  os.precision(precision);
+}
+
+/// Write a JSON string
+/// @param os the output stream
+/// @param text the string content
+static void write_string(std::ostream &os, std::string_view text) {
+  constexpr std::string_view digits = "0123456789abcdef";
+  os << '"';
+  for (const auto c : text) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      os << "\\u00" << digits[c >> 4] << digits[c & 0xf];
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+void Profiler::write_trace(std::ostream &os) const {
+  const auto recorded = spans();
+  const auto origin = recorded.empty() ? std::chrono::steady_clock::time_point{}
+                                       : recorded.front().start;
+  const auto microseconds = [](auto duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+  };
+
+  const auto flags = os.flags();
+  const auto precision = os.precision();
+  os << std::fixed << std::setprecision(3);
+  os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  const char *separator = "\n";
+  for (const auto &span : recorded) {
+    os << separator << "{\"name\":";
+    write_string(os, span.rule->name());
+    os << ",\"cat\":\"rule\",\"ph\":\"X\",\"pid\":0,\"tid\":" << span.lane
+       << ",\"ts\":" << microseconds(span.start - origin)
+       << ",\"dur\":" << microseconds(span.duration) << ",\"args\":{";
+    if (success(span.len)) {
+      os << "\"len\":" << span.len;
+    } else {
+      os << "\"failed\":true";
+    }
+    os << "}}";
+    separator = ",\n";
+  }
+  os << "\n]}\n";
+  os.flags(flags);
+  os.precision(precision);
+}
+
+ParseProfile::ParseProfile(ParseProfile &&other) noexcept
+    : _profiler{std::exchange(other._profiler, nullptr)},
+      _tracing{other._tracing}, _rules{std::move(other._rules)},
+      _frames{std::move(other._frames)},
+      _successes{std::move(other._successes)},
+      _spans{std::move(other._spans)} {}
+
+ParseProfile &ParseProfile::operator=(ParseProfile &&other) noexcept {
+  if (this != &other) {
+    flush();
+    _profiler = std::exchange(other._profiler, nullptr);
+    _tracing = other._tracing;
+    _rules = std::move(other._rules);
+    _frames = std::move(other._frames);
+    _successes = std::move(other._successes);
+    _spans = std::move(other._spans);
+  }
+  return *this;
+}
+
+ParseProfile::~ParseProfile() noexcept { flush(); }
+
+void ParseProfile::flush() noexcept {
+  if (!_profiler || _rules.empty()) {
+    return;
+  }
+  std::unordered_map<const Rule *, RuleProfile> rules;
+  for (const auto &[rule, statistics] : _rules) {
+    rules.emplace(rule, statistics.profile);
+  }
+  _profiler->merge(rules, std::move(_spans));
+  _rules.clear();
+  _spans.clear();
+}
+
+void ParseProfile::enter(const Rule *rule) {
+  auto &statistics = _rules[rule];
+  ++statistics.depth;
+  _frames.push_back({rule, &statistics, clock::now()});
+}
+
+void ParseProfile::exit(std::size_t len) {
+  assert(!_frames.empty());
+  const auto frame = _frames.back();
+  _frames.pop_back();
+  const auto elapsed = clock::now() - frame.start;
+
+  auto &statistics = *frame.statistics;
+  auto &profile = statistics.profile;
+  ++profile.calls;
+  if (success(len)) {
+    ++profile.successes;
+    profile.consumed += len;
+    _successes.push_back({&statistics, len});
+  } else {
+    ++profile.failures;
+  }
+  profile.exclusive +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed -
+                                                           frame.nested);
+  // only the outermost call of a recursive rule counts for the inclusive
+  // time
+  if (--statistics.depth == 0) {
+    profile.inclusive +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+  }
+  if (!_frames.empty()) {
+    _frames.back().nested += elapsed;
+  }
+  if (_tracing) {
+    _spans.push_back(
+        {frame.rule, frame.start,
+         std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed), len,
+         0});
+  }
+}
+
+void ParseProfile::hit(const Rule *rule, std::size_t len) {
+  auto &statistics = _rules[rule];
+  auto &profile = statistics.profile;
+  ++profile.calls;
+  ++profile.memo_hits;
+  if (success(len)) {
+    ++profile.successes;
+    profile.consumed += len;
+    _successes.push_back({&statistics, len});
+  } else {
+    ++profile.failures;
+  }
+}
+
+void ParseProfile::rollback(std::size_t checkpoint) noexcept {
+  for (auto i = checkpoint; i < _successes.size(); ++i) {
+    _successes[i].statistics->profile.backtracked += _successes[i].len;
+  }
+  _successes.resize(checkpoint);
+}
+
+} // namespace pegium
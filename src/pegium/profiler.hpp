@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+namespace pegium {
+
+class Rule;
+
+/// The statistics of the calls of a rule
+struct RuleProfile {
+  /// the number of calls, memoized ones included
+  std::size_t calls = 0;
+  /// the number of successful calls
+  std::size_t successes = 0;
+  /// the number of failed calls
+  std::size_t failures = 0;
+  /// the number of calls answered by the memo table
+  std::size_t memo_hits = 0;
+  /// the number of characters consumed by the successful calls
+  std::size_t consumed = 0;
+  /// the number of characters consumed by successful calls then discarded
+  /// because an enclosing alternative failed
+  std::size_t backtracked = 0;
+  /// the time spent in the calls, nested calls included. The recursive calls
+  /// are only counted once.
+  std::chrono::nanoseconds inclusive{0};
+  /// the time spent in the calls, nested rule calls excluded
+  std::chrono::nanoseconds exclusive{0};
+
+  RuleProfile &operator+=(const RuleProfile &other) noexcept;
+};
+
+/// A rule call recorded for the trace of a parse
+struct ProfileSpan {
+  const Rule *rule;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::nanoseconds duration;
+  /// the parsed length or PARSE_ERROR
+  std::size_t len;
+  /// the context of the call, the calls of a context are properly nested
+  std::size_t lane;
+};
+
+/// The profile of the parses of a Parser, collected when the library is
+/// built with PEGIUM_ENABLE_PROFILING (the profile stays empty otherwise).
+/// The profile of each parse is merged once the parse is done: a Profiler
+/// is safe to read while other threads are parsing.
+class Profiler final {
+public:
+  /// @return true if the library collects the profiles
+  static constexpr bool enabled() noexcept {
+#ifdef PEGIUM_ENABLE_PROFILING
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /// @return the statistics of the called rules
+  std::unordered_map<const Rule *, RuleProfile> rules() const;
+  /// @return the recorded rule calls, sorted by start time
+  std::vector<ProfileSpan> spans() const;
+
+  /// Record the rule calls of the next parses, for the trace
+  /// @param enable true to record the rule calls
+  void tracing(bool enable) noexcept {
+    _tracing.store(enable, std::memory_order_relaxed);
+  }
+  /// @return true if the rule calls are recorded
+  bool tracing() const noexcept {
+    return _tracing.load(std::memory_order_relaxed);
+  }
+
+  /// Discard the collected statistics and rule calls
+  void clear();
+
+  /// Write the statistics of the rules as a table, sorted by decreasing
+  /// exclusive time
+  /// @param os the output stream
+  void write_table(std::ostream &os) const;
+  /// Write the recorded rule calls in the Chrome trace event format, to be
+  /// loaded in chrome://tracing or Perfetto
+  /// @param os the output stream
+  void write_trace(std::ostream &os) const;
+
+  /// Merge the profile of a parse
+  /// @param rules the statistics of the rules in the parse
+  /// @param spans the rule calls recorded in the parse
+  void merge(const std::unordered_map<const Rule *, RuleProfile> &rules,
+             std::vector<ProfileSpan> &&spans);
+
+private:
+  mutable std::mutex _mutex;
+  std::unordered_map<const Rule *, RuleProfile> _rules;
+  std::vector<ProfileSpan> _spans;
+  std::size_t _lanes = 0;
+  std::atomic_bool _tracing = false;
+};
+
+/// The profile of a single parse, collected without any lock and merged into
+/// the Profiler when destroyed
+class ParseProfile final {
+public:
+  /// @param profiler the profiler receiving the profile, or nullptr
+  explicit ParseProfile(Profiler *profiler = nullptr)
+      : _profiler{profiler}, _tracing{profiler && profiler->tracing()} {}
+  ParseProfile(const ParseProfile &) = delete;
+  ParseProfile &operator=(const ParseProfile &) = delete;
+  ParseProfile(ParseProfile &&other) noexcept;
+  ParseProfile &operator=(ParseProfile &&other) noexcept;
+  ~ParseProfile() noexcept;
+
+  /// @return the profiler receiving the profile or nullptr
+  Profiler *profiler() const noexcept { return _profiler; }
+
+  /// A rule call starts
+  /// @param rule the called rule
+  void enter(const Rule *rule);
+  /// The last started rule call ends
+  /// @param len the parsed length or PARSE_ERROR
+  void exit(std::size_t len);
+  /// A rule call is answered by the memo table
+  /// @param rule the called rule
+  /// @param len the memoized length or PARSE_ERROR
+  void hit(const Rule *rule, std::size_t len);
+
+  /// @return the state of the successful calls, used to rollback a failed
+  /// alternative
+  std::size_t checkpoint() const noexcept { return _successes.size(); }
+  /// Account the successful calls made since the checkpoint as backtracked
+  /// @param checkpoint the checkpoint to restore
+  void rollback(std::size_t checkpoint) noexcept;
+
+private:
+  using clock = std::chrono::steady_clock;
+  struct Statistics {
+    RuleProfile profile;
+    /// the number of calls of the rule in progress
+    std::size_t depth = 0;
+  };
+  struct Frame {
+    const Rule *rule;
+    Statistics *statistics;
+    clock::time_point start;
+    /// the time spent in the nested rule calls
+    clock::duration nested{0};
+  };
+  struct Success {
+    Statistics *statistics;
+    std::size_t len;
+  };
+
+  Profiler *_profiler;
+  bool _tracing;
+  /// the statistics of the rules, their addresses are stable
+  std::unordered_map<const Rule *, Statistics> _rules;
+  std::vector<Frame> _frames;
+  /// the successful calls that may still be rolled back
+  std::vector<Success> _successes;
+  std::vector<ProfileSpan> _spans;
+
+  /// Merge the collected profile into the profiler
+  void flush() noexcept;
+};
+
+} // namespace pegium
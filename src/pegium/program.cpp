@@ -0,0 +1,462 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <pegium/internal.hpp>
+#include <pegium/program.hpp>
+#include <unordered_map>
+
+namespace pegium {
+
+struct ProgramCompiler : GrammarElement::Visitor {
+  explicit ProgramCompiler(Program &program) : _program{program} {}
+
+  void compileMain(const GrammarElement &element) {
+    compile(element);
+    emit(Program::Opcode::End);
+    // compile the subroutines of the called rules
+    while (!_pending.empty()) {
+      const auto *rule = _pending.back();
+      _pending.pop_back();
+      _labels[rule] = here();
+      compile(*rule->element());
+      emit(Program::Opcode::Return);
+    }
+    for (auto [call, rule] : _calls) {
+      _program._code[call].arg = _labels[rule];
+    }
+  }
+
+  void visit(const Group &group) override {
+    _handled = true;
+    for (const auto &element : group.elements()) {
+      compile(*element);
+    }
+  }
+  void visit(const PrioritizedChoice &choice) override {
+    const auto &elements = choice.elements();
+    if (elements.size() > 1 && allKeywords(elements)) {
+      // keep the keyword trie of the choice
+      return;
+    }
+    _handled = true;
+    if (elements.empty()) {
+      emit(Program::Opcode::Fail);
+      return;
+    }
+    // Choice L1; p1; Commit end; L1: Choice L2; p2; Commit end; L2: p3; end:
+    std::vector<std::uint32_t> commits;
+    for (std::size_t i = 0; i + 1 < elements.size(); ++i) {
+      auto alternative = emit(Program::Opcode::Choice);
+      compile(*elements[i]);
+      commits.push_back(emit(Program::Opcode::Commit));
+      patch(alternative, here());
+    }
+    compile(*elements.back());
+    for (auto commit : commits) {
+      patch(commit, here());
+    }
+  }
+  void visit(const Optional &optional) override {
+    _handled = true;
+    // Choice end; p; Commit end; end:
+    auto choice = emit(Program::Opcode::Choice);
+    compile(optional.element());
+    auto commit = emit(Program::Opcode::Commit);
+    patch(commit, here());
+    patch(choice, here());
+  }
+  void visit(const Many &many) override {
+    _handled = true;
+    if (const auto *characters = characterClass(many.element())) {
+      emit(Program::Opcode::Span, set(*characters));
+      return;
+    }
+    loop(many.element());
+  }
+  void visit(const AtLeastOne &atLeastOne) override {
+    _handled = true;
+    if (const auto *characters = characterClass(atLeastOne.element())) {
+      auto index = set(*characters);
+      emit(Program::Opcode::Set, index);
+      emit(Program::Opcode::Span, index);
+      return;
+    }
+    compile(atLeastOne.element());
+    loop(atLeastOne.element());
+  }
+  void visit(const Repetition &repetition) override {
+    // unroll small repetitions only
+    static constexpr std::size_t MaxUnroll = 8;
+    if (repetition.max() > MaxUnroll || repetition.min() > repetition.max()) {
+      return;
+    }
+    _handled = true;
+    for (std::size_t i = 0; i < repetition.min(); ++i) {
+      compile(repetition.element());
+    }
+    // Choice end; p; Commit next; next: Choice end; p; Commit next; end:
+    std::vector<std::uint32_t> choices;
+    for (std::size_t i = repetition.min(); i < repetition.max(); ++i) {
+      choices.push_back(emit(Program::Opcode::Choice));
+      compile(repetition.element());
+      auto commit = emit(Program::Opcode::Commit);
+      patch(commit, here());
+    }
+    for (auto choice : choices) {
+      patch(choice, here());
+    }
+  }
+  void visit(const AndPredicate &predicate) override {
+    _handled = true;
+    // Choice fail; p; BackCommit end; fail: Fail; end:
+    auto choice = emit(Program::Opcode::Choice);
+    compile(predicate.element());
+    auto commit = emit(Program::Opcode::BackCommit);
+    patch(choice, here());
+    emit(Program::Opcode::Fail);
+    patch(commit, here());
+  }
+  void visit(const NotPredicate &predicate) override {
+    _handled = true;
+    // Choice end; p; FailTwice; end:
+    auto choice = emit(Program::Opcode::Choice);
+    compile(predicate.element());
+    emit(Program::Opcode::FailTwice);
+    patch(choice, here());
+  }
+  void visit(const Keyword &keyword) override {
+    _handled = true;
+    const auto &value = keyword.value();
+    if (keyword.ignoreCase()) {
+      std::string lower;
+      bool letter = false;
+      for (char c : value) {
+        lower += tolower(c);
+        letter |= lower.back() >= 'a' && lower.back() <= 'z';
+      }
+      // a keyword without letter is case sensitive
+      if (letter) {
+        emit(Program::Opcode::IString, string(std::move(lower)));
+        return;
+      }
+    }
+    if (value.size() == 1) {
+      emit(Program::Opcode::Char, static_cast<unsigned char>(value[0]));
+    } else if (!value.empty()) {
+      emit(Program::Opcode::String, string(value));
+    }
+  }
+  void visit(const Character &character) override {
+    _handled = true;
+    emit(Program::Opcode::Char,
+         static_cast<unsigned char>(character.value()));
+  }
+  void visit(const CharacterClass &characters) override {
+    _handled = true;
+    emit(Program::Opcode::Set, set(characters));
+  }
+  void visit(const AnyCharacter &) override {
+    _handled = true;
+    emit(Program::Opcode::Any);
+  }
+  void visit(const Action &) override {
+    // an action does not consume any character
+    _handled = true;
+  }
+  void visit(const Cut &) override {
+    // a cut only commits the alternatives of the parser rules
+    _handled = true;
+  }
+  void visit(const RuleCall &call) override {
+    if (call.rule()) {
+      this->call(*call.rule());
+    }
+  }
+  void visit(const ParserRule &rule) override { call(rule); }
+  void visit(const DataTypeRule &rule) override { call(rule); }
+  void visit(const TerminalRule &rule) override { call(rule); }
+
+private:
+  Program &_program;
+  bool _handled = false;
+  /// the label of the compiled subroutines
+  std::unordered_map<const Rule *, std::uint32_t> _labels;
+  /// the rules to be compiled as subroutines
+  std::vector<const Rule *> _pending;
+  /// the call instructions to be patched with the label of the rule
+  std::vector<std::pair<std::uint32_t, const Rule *>> _calls;
+
+  /// Compile an element, an element without instruction is executed with its
+  /// parse_terminal
+  void compile(const GrammarElement &element) {
+    bool handled = false;
+    std::swap(handled, _handled);
+    element.accept(*this);
+    std::swap(handled, _handled);
+    if (!handled) {
+      auto index = static_cast<std::uint32_t>(_program._elements.size());
+      _program._elements.push_back(std::addressof(element));
+      emit(Program::Opcode::Opaque, index);
+    }
+  }
+  /// L1: Choice L2; p; PartialCommit L1; L2:
+  void loop(const GrammarElement &element) {
+    auto choice = emit(Program::Opcode::Choice);
+    auto body = here();
+    compile(element);
+    emit(Program::Opcode::PartialCommit, body);
+    patch(choice, here());
+  }
+  void call(const Rule &rule) {
+    if (!rule.element()) {
+      return;
+    }
+    _handled = true;
+    const auto *address = std::addressof(rule);
+    if (!_labels.contains(address)) {
+      // the label is set when the subroutine is compiled
+      _labels[address] = 0;
+      _pending.push_back(address);
+    }
+    _calls.emplace_back(emit(Program::Opcode::Call), address);
+  }
+
+  std::uint32_t here() const noexcept {
+    return static_cast<std::uint32_t>(_program._code.size());
+  }
+  std::uint32_t emit(Program::Opcode op, std::uint32_t arg = 0) {
+    _program._code.push_back({op, arg});
+    return here() - 1;
+  }
+  void patch(std::uint32_t instruction, std::uint32_t label) {
+    _program._code[instruction].arg = label;
+  }
+  std::uint32_t set(const CharacterClass &characters) {
+    const auto &lookup = characters.characters();
+    _program._sets.push_back({lookup, ByteRanges::from(lookup)});
+    return static_cast<std::uint32_t>(_program._sets.size() - 1);
+  }
+  std::uint32_t string(std::string value) {
+    _program._strings.push_back(std::move(value));
+    return static_cast<std::uint32_t>(_program._strings.size() - 1);
+  }
+
+  static const CharacterClass *characterClass(const GrammarElement &element) {
+    struct ClassVisitor : GrammarElement::Visitor {
+      const CharacterClass *result = nullptr;
+      void visit(const CharacterClass &characters) override {
+        result = std::addressof(characters);
+      }
+    } v;
+    element.accept(v);
+    return v.result;
+  }
+  static bool
+  allKeywords(const std::vector<std::shared_ptr<GrammarElement>> &elements) {
+    struct KeywordVisitor : GrammarElement::Visitor {
+      bool keyword = false;
+      void visit(const Keyword &) override { keyword = true; }
+    };
+    for (const auto &element : elements) {
+      KeywordVisitor v;
+      element->accept(v);
+      if (!v.keyword) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+Program Program::compile(const GrammarElement &element) {
+  Program program;
+  ProgramCompiler compiler{program};
+  compiler.compileMain(element);
+  return program;
+}
+
+std::size_t Program::match(std::string_view sv) const {
+  std::size_t examined;
+  return run<false>(sv, examined);
+}
+
+std::size_t Program::match(std::string_view sv, std::size_t &examined) const {
+  return run<true>(sv, examined);
+}
+
+template <bool Examine>
+std::size_t Program::run(std::string_view sv, std::size_t &examined) const {
+  // a backtrack entry or a return address (pos == CallFrame)
+  struct Frame {
+    std::uint32_t pc;
+    std::size_t pos;
+  };
+  static constexpr std::size_t CallFrame = PARSE_ERROR;
+  // the stack is shared by the nested matches of a thread
+  thread_local std::vector<Frame> stack;
+  const auto base = stack.size();
+
+  const auto *code = _code.data();
+  const char *data = sv.data();
+  const std::size_t size = sv.size();
+  std::uint32_t pc = 0;
+  std::size_t pos = 0;
+  // the furthest position examined, the positions reached by the match
+  // being examined when it backtracks or ends
+  std::size_t far = 0;
+  while (true) {
+    const auto &instruction = code[pc];
+    switch (instruction.op) {
+    case Opcode::Any: {
+      auto len = codepoint_length({data + pos, size - pos});
+      if (fail(len)) {
+        if constexpr (Examine) {
+          // a codepoint has at most 4 bytes
+          far = std::max(far, std::min(pos + 3, size));
+        }
+        goto failure;
+      }
+      pos += len;
+      ++pc;
+      continue;
+    }
+    case Opcode::Char:
+      if (pos == size ||
+          static_cast<unsigned char>(data[pos]) != instruction.arg) {
+        goto failure;
+      }
+      ++pos;
+      ++pc;
+      continue;
+    case Opcode::Set:
+      if (pos == size ||
+          !_sets[instruction.arg]
+               .lookup[static_cast<unsigned char>(data[pos])]) {
+        goto failure;
+      }
+      ++pos;
+      ++pc;
+      continue;
+    case Opcode::Span: {
+      const auto &set = _sets[instruction.arg];
+      pos += scan(set.lookup, set.ranges, {data + pos, size - pos});
+      ++pc;
+      continue;
+    }
+    case Opcode::String: {
+      const auto &value = _strings[instruction.arg];
+      if (size - pos < value.size() ||
+          std::memcmp(data + pos, value.data(), value.size()) != 0) {
+        if constexpr (Examine) {
+          far = std::max(far, std::min(pos + value.size() - 1, size));
+        }
+        goto failure;
+      }
+      pos += value.size();
+      ++pc;
+      continue;
+    }
+    case Opcode::IString: {
+      const auto &value = _strings[instruction.arg];
+      if (size - pos < value.size()) {
+        if constexpr (Examine) {
+          far = std::max(far, size);
+        }
+        goto failure;
+      }
+      for (std::size_t i = 0; i < value.size(); ++i) {
+        if (tolower(data[pos + i]) != value[i]) {
+          if constexpr (Examine) {
+            far = std::max(far, pos + i);
+          }
+          goto failure;
+        }
+      }
+      pos += value.size();
+      ++pc;
+      continue;
+    }
+    case Opcode::Choice:
+      stack.push_back({instruction.arg, pos});
+      ++pc;
+      continue;
+    case Opcode::Commit:
+      stack.pop_back();
+      pc = instruction.arg;
+      continue;
+    case Opcode::PartialCommit:
+      stack.back().pos = pos;
+      pc = instruction.arg;
+      continue;
+    case Opcode::BackCommit:
+      if constexpr (Examine) {
+        far = std::max(far, pos);
+      }
+      pos = stack.back().pos;
+      stack.pop_back();
+      pc = instruction.arg;
+      continue;
+    case Opcode::FailTwice:
+      stack.pop_back();
+      goto failure;
+    case Opcode::Fail:
+      goto failure;
+    case Opcode::Jump:
+      pc = instruction.arg;
+      continue;
+    case Opcode::Call:
+      stack.push_back({pc + 1, CallFrame});
+      pc = instruction.arg;
+      continue;
+    case Opcode::Return:
+      pc = stack.back().pc;
+      stack.pop_back();
+      continue;
+    case Opcode::Opaque: {
+      std::size_t len;
+      if constexpr (Examine) {
+        std::size_t opaque;
+        len = _elements[instruction.arg]->match_terminal(
+            {data + pos, size - pos}, opaque);
+        far = std::max(far, pos + opaque);
+      } else {
+        len = _elements[instruction.arg]->parse_terminal(
+            {data + pos, size - pos});
+      }
+      if (fail(len)) {
+        goto failure;
+      }
+      pos += len;
+      ++pc;
+      continue;
+    }
+    case Opcode::End:
+      assert(stack.size() == base);
+      if constexpr (Examine) {
+        examined = std::max(far, pos);
+      }
+      return pos;
+    }
+  failure:
+    if constexpr (Examine) {
+      // the failed instruction examined the character at the position
+      far = std::max(far, pos);
+    }
+    // backtrack to the last choice, dropping the pending calls
+    while (stack.size() > base && stack.back().pos == CallFrame) {
+      stack.pop_back();
+    }
+    if (stack.size() == base) {
+      if constexpr (Examine) {
+        examined = far;
+      }
+      return PARSE_ERROR;
+    }
+    pc = stack.back().pc;
+    pos = stack.back().pos;
+    stack.pop_back();
+  }
+}
+
+} // namespace pegium
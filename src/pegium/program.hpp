@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <pegium/grammar.hpp>
+#include <pegium/scan.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pegium {
+
+/// A grammar element lowered into a flat instruction array, executed by a
+/// backtracking virtual machine in the style of LPeg.
+/// A program implements the terminal mode (parse_terminal) of the element:
+/// elements without an instruction are executed through their virtual
+/// parse_terminal.
+class Program final {
+public:
+  enum class Opcode : std::uint8_t {
+    /// match any codepoint
+    Any,
+    /// match the character arg
+    Char,
+    /// match a character of the set arg
+    Set,
+    /// match zero or more characters of the set arg
+    Span,
+    /// match the string arg
+    String,
+    /// match the lowercased string arg ignoring the case
+    IString,
+    /// push a backtrack entry to the label arg
+    Choice,
+    /// pop the backtrack entry and jump to the label arg
+    Commit,
+    /// update the position of the backtrack entry and jump to the label arg
+    PartialCommit,
+    /// restore the position of the backtrack entry, pop it and jump to the
+    /// label arg
+    BackCommit,
+    /// pop the backtrack entry and fail
+    FailTwice,
+    /// fail
+    Fail,
+    /// jump to the label arg
+    Jump,
+    /// call the subroutine at the label arg
+    Call,
+    /// return from a subroutine
+    Return,
+    /// match the element arg with its parse_terminal
+    Opaque,
+    /// the match succeeded
+    End
+  };
+
+  struct Instruction {
+    Opcode op;
+    std::uint32_t arg;
+  };
+
+  /// Compile the terminal mode of an element
+  /// @param element the element to compile
+  /// @return the compiled program
+  static Program compile(const GrammarElement &element);
+
+  /// Match the program against an input text
+  /// @param sv the input text
+  /// @return the matched length or PARSE_ERROR
+  std::size_t match(std::string_view sv) const;
+  /// Match the program against an input text and measure the furthest
+  /// position examined by the match, the end of the text included. An opaque
+  /// element is measured with its match_terminal.
+  /// @param sv the input text
+  /// @param examined the furthest position examined
+  /// @return the matched length or PARSE_ERROR
+  std::size_t match(std::string_view sv, std::size_t &examined) const;
+
+  /// @return the instructions of the program
+  const std::vector<Instruction> &code() const noexcept { return _code; }
+
+private:
+  friend struct ProgramCompiler;
+
+  template <bool Examine>
+  std::size_t run(std::string_view sv, std::size_t &examined) const;
+
+  struct CharacterSet {
+    std::array<bool, 256> lookup;
+    ByteRanges ranges;
+  };
+
+  std::vector<Instruction> _code;
+  std::vector<CharacterSet> _sets;
+  std::vector<std::string> _strings;
+  std::vector<const GrammarElement *> _elements;
+};
+
+} // namespace pegium
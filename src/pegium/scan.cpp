@@ -0,0 +1,146 @@
+#include <pegium/scan.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define PEGIUM_SCAN_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define PEGIUM_SCAN_NEON
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace pegium {
+
+namespace {
+
+inline unsigned count_trailing_zeros(std::uint64_t value) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctzll(value));
+#endif
+}
+
+std::size_t scan_scalar(const std::array<bool, 256> &lookup,
+                        std::string_view sv, std::size_t i) noexcept {
+  while (i < sv.size() && lookup[static_cast<unsigned char>(sv[i])]) {
+    ++i;
+  }
+  return i;
+}
+
+#if defined(PEGIUM_SCAN_SSE2)
+
+#if defined(__AVX2__)
+std::size_t scan_avx2(const ByteRanges &ranges, std::string_view sv,
+                      std::size_t i) noexcept {
+  __m256i low[ByteRanges::MAX];
+  __m256i width[ByteRanges::MAX];
+  for (std::size_t r = 0; r < ranges.count; ++r) {
+    low[r] = _mm256_set1_epi8(static_cast<char>(ranges.low[r]));
+    width[r] = _mm256_set1_epi8(static_cast<char>(ranges.width[r]));
+  }
+  const auto zero = _mm256_setzero_si256();
+  const std::uint32_t flip = ranges.negated ? 0xFFFFFFFFu : 0u;
+  for (; i + 32 <= sv.size(); i += 32) {
+    auto bytes = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(sv.data() + i));
+    auto in = zero;
+    for (std::size_t r = 0; r < ranges.count; ++r) {
+      // (byte - low) <= width using an unsigned saturated subtraction
+      auto offset = _mm256_sub_epi8(bytes, low[r]);
+      auto over = _mm256_subs_epu8(offset, width[r]);
+      in = _mm256_or_si256(in, _mm256_cmpeq_epi8(over, zero));
+    }
+    auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(in)) ^ flip;
+    if (mask != 0xFFFFFFFFu) {
+      return i + count_trailing_zeros(~mask);
+    }
+  }
+  return i;
+}
+#endif
+
+std::size_t scan_sse2(const ByteRanges &ranges, std::string_view sv,
+                      std::size_t i) noexcept {
+  __m128i low[ByteRanges::MAX];
+  __m128i width[ByteRanges::MAX];
+  for (std::size_t r = 0; r < ranges.count; ++r) {
+    low[r] = _mm_set1_epi8(static_cast<char>(ranges.low[r]));
+    width[r] = _mm_set1_epi8(static_cast<char>(ranges.width[r]));
+  }
+  const auto zero = _mm_setzero_si128();
+  const std::uint32_t flip = ranges.negated ? 0xFFFFu : 0u;
+  for (; i + 16 <= sv.size(); i += 16) {
+    auto bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(sv.data() + i));
+    auto in = zero;
+    for (std::size_t r = 0; r < ranges.count; ++r) {
+      // (byte - low) <= width using an unsigned saturated subtraction
+      auto offset = _mm_sub_epi8(bytes, low[r]);
+      auto over = _mm_subs_epu8(offset, width[r]);
+      in = _mm_or_si128(in, _mm_cmpeq_epi8(over, zero));
+    }
+    auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(in)) ^ flip;
+    if (mask != 0xFFFFu) {
+      return i + count_trailing_zeros(~mask & 0xFFFFu);
+    }
+  }
+  return i;
+}
+
+#elif defined(PEGIUM_SCAN_NEON)
+
+std::size_t scan_neon(const ByteRanges &ranges, std::string_view sv,
+                      std::size_t i) noexcept {
+  uint8x16_t low[ByteRanges::MAX];
+  uint8x16_t width[ByteRanges::MAX];
+  for (std::size_t r = 0; r < ranges.count; ++r) {
+    low[r] = vdupq_n_u8(ranges.low[r]);
+    width[r] = vdupq_n_u8(ranges.width[r]);
+  }
+  const std::uint64_t flip = ranges.negated ? ~std::uint64_t{0} : 0;
+  for (; i + 16 <= sv.size(); i += 16) {
+    const auto *data = reinterpret_cast<const std::uint8_t *>(sv.data());
+    auto bytes = vld1q_u8(data + i);
+    auto in = vdupq_n_u8(0);
+    for (std::size_t r = 0; r < ranges.count; ++r) {
+      in = vorrq_u8(in, vcleq_u8(vsubq_u8(bytes, low[r]), width[r]));
+    }
+    // narrow the byte mask to 4 bits per byte
+    auto nibbles = vshrn_n_u16(vreinterpretq_u16_u8(in), 4);
+    auto mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) ^ flip;
+    if (mask != ~std::uint64_t{0}) {
+      return i + count_trailing_zeros(~mask) / 4;
+    }
+  }
+  return i;
+}
+
+#endif
+
+} // namespace
+
+std::size_t scan(const std::array<bool, 256> &lookup, const ByteRanges &ranges,
+                 std::string_view sv) noexcept {
+  std::size_t i = 0;
+  if (ranges.valid) {
+#if defined(PEGIUM_SCAN_SSE2)
+#if defined(__AVX2__)
+    i = scan_avx2(ranges, sv, i);
+#endif
+    i = scan_sse2(ranges, sv, i);
+#elif defined(PEGIUM_SCAN_NEON)
+    i = scan_neon(ranges, sv, i);
+#endif
+  }
+  return scan_scalar(lookup, sv, i);
+}
+
+} // namespace pegium
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace pegium {
+
+/// A set of bytes described by a few inclusive ranges, used to classify
+/// several bytes at once with SIMD instructions.
+struct ByteRanges {
+  /// the maximum number of ranges
+  static constexpr std::size_t MAX = 8;
+  /// the first byte of each range
+  std::array<unsigned char, MAX> low{};
+  /// the size minus one of each range
+  std::array<unsigned char, MAX> width{};
+  /// the number of ranges
+  std::uint8_t count = 0;
+  /// true if the ranges describe the bytes that are not in the set
+  bool negated = false;
+  /// false if the set cannot be described by MAX ranges
+  bool valid = false;
+
+  /// Build the ranges of a set of bytes
+  /// @param lookup the set of bytes
+  /// @return the ranges, using the complement of the set if it is shorter
+  static constexpr ByteRanges
+  from(const std::array<bool, 256> &lookup) noexcept;
+};
+
+constexpr ByteRanges
+ByteRanges::from(const std::array<bool, 256> &lookup) noexcept {
+  ByteRanges result[2];
+  for (int negated = 0; negated < 2; ++negated) {
+    auto &ranges = result[negated];
+    ranges.negated = negated != 0;
+    ranges.valid = true;
+    std::size_t c = 0;
+    while (c < lookup.size()) {
+      if (lookup[c] == ranges.negated) {
+        ++c;
+        continue;
+      }
+      auto first = c;
+      while (c < lookup.size() && lookup[c] != ranges.negated) {
+        ++c;
+      }
+      if (ranges.count == MAX) {
+        ranges.valid = false;
+        break;
+      }
+      ranges.low[ranges.count] = static_cast<unsigned char>(first);
+      ranges.width[ranges.count] = static_cast<unsigned char>(c - 1 - first);
+      ++ranges.count;
+    }
+  }
+  if (!result[0].valid) {
+    return result[1];
+  }
+  if (!result[1].valid) {
+    return result[0];
+  }
+  return result[1].count < result[0].count ? result[1] : result[0];
+}
+
+/// Scan the longest prefix of a text made of bytes of a set
+/// @param lookup the set of bytes
+/// @param ranges the ranges of the set (used if valid)
+/// @param sv the input text
+/// @return the length of the prefix
+std::size_t scan(const std::array<bool, 256> &lookup, const ByteRanges &ranges,
+                 std::string_view sv) noexcept;
+
+} // namespace pegium
@@ -0,0 +1,385 @@
+#include <array>
+#include <cstring>
+#include <pegium/MappedFile.hpp>
+#include <pegium/analysis.hpp>
+#include <pegium/ct.hpp>
+#include <pegium/snapshot.hpp>
+#include <stdexcept>
+#include <system_error>
+
+namespace pegium {
+
+namespace {
+
+constexpr std::uint64_t FnvOffset = 0xcbf29ce484222325;
+constexpr std::uint64_t FnvPrime = 0x100000001b3;
+
+/// @param hash the hash
+/// @param data the bytes added to the hash
+/// @return the FNV-1a hash of the bytes following the hashed ones
+std::uint64_t fnv(std::uint64_t hash, std::string_view data) noexcept {
+  for (const auto c : data) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * FnvPrime;
+  }
+  return hash;
+}
+
+/// Number the elements of the rules in pre-order and hash their structure
+struct NumberingVisitor : public GrammarElement::Visitor {
+  /// the kinds of elements, hashed in the fingerprint
+  enum class Kind : std::uint8_t {
+    Group,
+    UnorderedGroup,
+    PrioritizedChoice,
+    Optional,
+    Many,
+    AtLeastOne,
+    Repetition,
+    AndPredicate,
+    NotPredicate,
+    Keyword,
+    KeywordSet,
+    RuleCall,
+    AnyCharacter,
+    Character,
+    CharacterClass,
+    Until,
+    Assignment,
+    Action,
+    Cut,
+    ParserRule,
+    DataTypeRule,
+    TerminalRule,
+    Expression
+  };
+
+  void visit(const Group &group) override {
+    if (add(group, Kind::Group)) {
+      children(group.elements());
+    }
+  }
+  void visit(const UnorderedGroup &group) override {
+    if (add(group, Kind::UnorderedGroup)) {
+      children(group.elements());
+    }
+  }
+  void visit(const PrioritizedChoice &choice) override {
+    if (add(choice, Kind::PrioritizedChoice)) {
+      children(choice.elements());
+    }
+  }
+  void visit(const Optional &optional) override {
+    if (add(optional, Kind::Optional)) {
+      optional.element().accept(*this);
+    }
+  }
+  void visit(const Many &many) override {
+    if (add(many, Kind::Many)) {
+      many.element().accept(*this);
+    }
+  }
+  void visit(const AtLeastOne &atLeastOne) override {
+    if (add(atLeastOne, Kind::AtLeastOne)) {
+      atLeastOne.element().accept(*this);
+    }
+  }
+  void visit(const Repetition &repetition) override {
+    if (add(repetition, Kind::Repetition)) {
+      mix(repetition.min());
+      mix(repetition.max());
+      repetition.element().accept(*this);
+    }
+  }
+  void visit(const AndPredicate &predicate) override {
+    if (add(predicate, Kind::AndPredicate)) {
+      predicate.element().accept(*this);
+    }
+  }
+  void visit(const NotPredicate &predicate) override {
+    if (add(predicate, Kind::NotPredicate)) {
+      predicate.element().accept(*this);
+    }
+  }
+  void visit(const Keyword &keyword) override {
+    // the description of a keyword is its quoted text
+    if (add(keyword, Kind::Keyword)) {
+      mix(keyword.ignoreCase());
+    }
+  }
+  void visit(const KeywordSet &keywords) override {
+    if (add(keywords, Kind::KeywordSet)) {
+      children(keywords.keywords());
+    }
+  }
+  // the called rule is numbered with the rules
+  void visit(const RuleCall &call) override { add(call, Kind::RuleCall); }
+  void visit(const AnyCharacter &any) override {
+    add(any, Kind::AnyCharacter);
+  }
+  void visit(const Character &character) override {
+    add(character, Kind::Character);
+  }
+  void visit(const CharacterClass &characterClass) override {
+    add(characterClass, Kind::CharacterClass);
+  }
+  void visit(const Until &until) override {
+    if (add(until, Kind::Until)) {
+      until.expansion().accept(*this);
+    }
+  }
+  void visit(const Assignment &assignment) override {
+    if (add(assignment, Kind::Assignment)) {
+      assignment.element().accept(*this);
+    }
+  }
+  void visit(const Action &action) override { add(action, Kind::Action); }
+  void visit(const Cut &cut) override { add(cut, Kind::Cut); }
+  void visit(const ct::ExpressionElement &element) override {
+    if (add(element, Kind::Expression)) {
+      std::string structure;
+      element.describe(structure);
+      hash = fnv(hash, structure);
+    }
+  }
+  void visit(const ParserRule &rule) override {
+    visitRule(rule, Kind::ParserRule);
+  }
+  void visit(const DataTypeRule &rule) override {
+    visitRule(rule, Kind::DataTypeRule);
+  }
+  void visit(const TerminalRule &rule) override {
+    if (add(rule, Kind::TerminalRule)) {
+      mix(rule.hidden() + rule.ignored());
+      if (rule.element()) {
+        rule.element()->accept(*this);
+      }
+    }
+  }
+
+  std::vector<const GrammarElement *> elements;
+  std::unordered_map<const GrammarElement *, std::uint32_t> ids;
+  std::uint64_t hash = FnvOffset;
+
+private:
+  void mix(std::uint64_t value) noexcept {
+    std::array<char, sizeof(value)> bytes;
+    std::memcpy(bytes.data(), &value, sizeof(value));
+    hash = fnv(hash, {bytes.data(), bytes.size()});
+  }
+  /// Number an element
+  /// @param element the element
+  /// @param kind the kind of the element
+  /// @return true if the element was not numbered yet
+  bool add(const GrammarElement &element, Kind kind) {
+    auto [it, inserted] = ids.try_emplace(
+        std::addressof(element), static_cast<std::uint32_t>(elements.size()));
+    if (!inserted) {
+      // a shared element is hashed as a back reference
+      mix(it->second);
+      return false;
+    }
+    elements.push_back(std::addressof(element));
+    mix(static_cast<std::uint64_t>(kind));
+    hash = fnv(hash, describe(element));
+    return true;
+  }
+  template <typename Range> void children(const Range &range) {
+    mix(range.size());
+    for (const auto &element : range) {
+      element->accept(*this);
+    }
+  }
+  void visitRule(const Rule &rule, Kind kind) {
+    if (add(rule, kind) && rule.element()) {
+      rule.element()->accept(*this);
+    }
+  }
+};
+
+/// The header of a snapshot
+struct Header {
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t reserved;
+  std::uint64_t fingerprint;
+  std::uint64_t hash;
+  std::uint64_t text;
+  std::uint64_t nodes;
+};
+constexpr std::array<char, 8> Magic{'P', 'E', 'G', 'I', 'U', 'M', 'S', 0};
+constexpr std::uint32_t Version = 1;
+
+/// A CST node of a snapshot
+struct Node {
+  std::uint32_t offset;
+  std::uint32_t length;
+  std::uint32_t source;
+  /// the number of descendants of the node
+  std::uint32_t descendants;
+  std::uint32_t flags;
+};
+enum NodeFlags : std::uint32_t { Leaf = 1, Hidden = 2, Recovered = 4 };
+
+/// The text is padded to align the nodes
+/// @param size the size of the text
+/// @return the size of the padded text
+constexpr std::size_t padded(std::size_t size) noexcept {
+  return (size + alignof(Node) - 1) & ~(alignof(Node) - 1);
+}
+
+/// Append the records of a node and of its descendants
+/// @param node the node
+/// @param text the full text
+/// @param elements the elements of the grammar
+/// @param nodes the records
+void flatten(const CstNode &node, std::string_view text,
+             const ElementTable &elements, std::vector<Node> &nodes) {
+  const auto index = nodes.size();
+  nodes.push_back(
+      {static_cast<std::uint32_t>(node.text.data() - text.data()),
+       static_cast<std::uint32_t>(node.text.size()),
+       elements.id(node.grammarSource), 0,
+       (node.isLeaf ? Leaf : 0u) | (node.hidden ? Hidden : 0u) |
+           (node.recovered ? Recovered : 0u)});
+  for (const auto &child : node.children()) {
+    flatten(child, text, elements, nodes);
+  }
+  nodes[index].descendants =
+      static_cast<std::uint32_t>(nodes.size() - index - 1);
+}
+
+} // namespace
+
+ElementTable::ElementTable(std::span<const Rule *const> rules) {
+  NumberingVisitor visitor;
+  for (const auto *rule : rules) {
+    rule->accept(visitor);
+  }
+  _elements = std::move(visitor.elements);
+  _ids = std::move(visitor.ids);
+  _fingerprint = visitor.hash;
+}
+
+std::uint32_t ElementTable::id(const GrammarElement *element) const {
+  if (!element) {
+    return None;
+  }
+  auto it = _ids.find(element);
+  if (it == _ids.end()) {
+    throw std::invalid_argument{"The grammar element is not in the grammar"};
+  }
+  return it->second;
+}
+
+bool ElementTable::find(std::uint32_t id,
+                        const GrammarElement *&element) const noexcept {
+  if (id == None) {
+    element = nullptr;
+    return true;
+  }
+  if (id >= _elements.size()) {
+    return false;
+  }
+  element = _elements[id];
+  return true;
+}
+
+std::uint64_t content_hash(std::string_view text) noexcept {
+  return fnv(FnvOffset, text);
+}
+
+void write_snapshot(std::ostream &os, const RootCstNode &root,
+                    const ElementTable &elements) {
+  const auto text = root.fullText;
+  if (text.size() > UINT32_MAX) {
+    throw std::invalid_argument{"The text is too large for a snapshot"};
+  }
+  std::vector<Node> nodes;
+  flatten(root, text, elements, nodes);
+
+  const Header header{Magic,
+                      Version,
+                      0,
+                      elements.fingerprint(),
+                      content_hash(text),
+                      text.size(),
+                      nodes.size()};
+  static constexpr std::array<char, alignof(Node)> padding{};
+  os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  os.write(text.data(), static_cast<std::streamsize>(text.size()));
+  os.write(padding.data(),
+           static_cast<std::streamsize>(padded(text.size()) - text.size()));
+  os.write(reinterpret_cast<const char *>(nodes.data()),
+           static_cast<std::streamsize>(nodes.size() * sizeof(Node)));
+}
+
+std::shared_ptr<RootCstNode> read_snapshot(const std::filesystem::path &path,
+                                           const ElementTable &elements,
+                                           std::string_view text) {
+  std::shared_ptr<const MappedFile> file;
+  try {
+    file = std::make_shared<const MappedFile>(path);
+  } catch (const std::system_error &) {
+    return nullptr;
+  }
+  const auto data = file->text();
+  Header header;
+  if (data.size() < sizeof(header)) {
+    return nullptr;
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+  // the text is bounded by the current one and the nodes by the size of the
+  // file, so that the expected size does not overflow
+  if (header.magic != Magic || header.version != Version ||
+      header.fingerprint != elements.fingerprint() ||
+      header.text != text.size() || header.nodes == 0 ||
+      header.nodes > data.size() / sizeof(Node) ||
+      data.size() != sizeof(header) + padded(header.text) +
+                         header.nodes * sizeof(Node)) {
+    return nullptr;
+  }
+  // the texts are compared rather than their hashes, which would cost as
+  // much without ruling out a collision
+  const std::string_view snapshot{data.data() + sizeof(header), header.text};
+  if (snapshot != text) {
+    return nullptr;
+  }
+  const auto *records = data.data() + sizeof(header) + padded(header.text);
+
+  auto root = std::make_shared<RootCstNode>();
+  root->fullText = snapshot;
+  root->text = snapshot;
+  // the parents of the next node and the index following their descendants
+  std::vector<std::pair<CstNode *, std::size_t>> parents;
+  for (std::size_t i = 0; i < header.nodes; ++i) {
+    Node record;
+    std::memcpy(&record, records + i * sizeof(Node), sizeof(Node));
+    const GrammarElement *source = nullptr;
+    if (!elements.find(record.source, source) ||
+        std::size_t{record.offset} + record.length > snapshot.size() ||
+        i + record.descendants >= header.nodes) {
+      return nullptr;
+    }
+    while (!parents.empty() && parents.back().second <= i) {
+      parents.pop_back();
+    }
+    // a node lies in its parent, the root being the only node without one
+    if (i > 0 && (parents.empty() ||
+                  i + 1 + record.descendants > parents.back().second)) {
+      return nullptr;
+    }
+    auto &node = i == 0 ? *root : parents.back().first->emplace_back();
+    node.text = snapshot.substr(record.offset, record.length);
+    node.grammarSource = source;
+    node.isLeaf = record.flags & Leaf;
+    node.hidden = record.flags & Hidden;
+    node.recovered = record.flags & Recovered;
+    if (record.descendants > 0) {
+      parents.emplace_back(&node, i + 1 + record.descendants);
+    }
+  }
+  root->storage = std::move(file);
+  return root;
+}
+
+} // namespace pegium
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <ostream>
+#include <pegium/grammar.hpp>
+#include <pegium/syntax-tree.hpp>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace pegium {
+
+/// The grammar elements of a parser numbered in a stable order, identifying
+/// the grammar source of the CST nodes in a snapshot
+class ElementTable final {
+public:
+  /// the id of a null grammar source
+  static constexpr std::uint32_t None = UINT32_MAX;
+
+  ElementTable() = default;
+  /// Number the rules and their elements, in the order of the rules
+  /// @param rules the rules of the grammar
+  explicit ElementTable(std::span<const Rule *const> rules);
+
+  /// @param element a grammar element or nullptr
+  /// @return the id of the element
+  /// @throw std::invalid_argument if the element is not in the grammar
+  std::uint32_t id(const GrammarElement *element) const;
+  /// @param id an element id
+  /// @param element the element with the id, nullptr for None
+  /// @return false if the id is not valid
+  bool find(std::uint32_t id, const GrammarElement *&element) const noexcept;
+
+  /// @return a fingerprint of the structure of the grammar: the kinds of the
+  /// elements, their descriptions and their numbers of children, the case
+  /// sensitivity of the keywords and the structure of the compile-time
+  /// expressions
+  std::uint64_t fingerprint() const noexcept { return _fingerprint; }
+
+private:
+  std::vector<const GrammarElement *> _elements;
+  std::unordered_map<const GrammarElement *, std::uint32_t> _ids;
+  std::uint64_t _fingerprint = 0;
+};
+
+/// @param text a text
+/// @return the 64-bit FNV-1a hash of the text
+std::uint64_t content_hash(std::string_view text) noexcept;
+
+/// Write a snapshot of a CST: a header with the grammar fingerprint and the
+/// content hash identifying the snapshot, the text, then the nodes in
+/// pre-order made of the offset and the length of their text, the id of
+/// their grammar source and the number of their descendants. The integers
+/// are written in the byte order of the host.
+/// @param os the binary output stream
+/// @param root the root of the CST
+/// @param elements the elements of the grammar of the CST
+/// @throw std::invalid_argument if a node is not from the grammar or if the
+/// text is larger than 4 GiB, before anything is written
+void write_snapshot(std::ostream &os, const RootCstNode &root,
+                    const ElementTable &elements);
+
+/// Map a snapshot and rebuild its CST, the texts of the nodes viewing the
+/// mapped snapshot
+/// @param path the path of the snapshot
+/// @param elements the elements of the current grammar
+/// @param text the current text of the snapshot source, compared with the
+/// text stored in the snapshot
+/// @return the root of the CST, owning the mapping, or nullptr if the
+/// snapshot is missing, invalid, or made from another grammar or text
+std::shared_ptr<RootCstNode> read_snapshot(const std::filesystem::path &path,
+                                           const ElementTable &elements,
+                                           std::string_view text);
+
+} // namespace pegium
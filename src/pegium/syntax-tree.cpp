@@ -2,51 +2,57 @@
 
 namespace pegium {
 
-CstNode::Iterator::Iterator(CstNode::Iterator::pointer root) {
-  if (root) {
-    stack.emplace_back(root, 0);
+CstNode::Iterator::Iterator(pointer root, Filter filter)
+    : _root{root}, _node{root}, _filter{filter} {
+  if (_node && !accept(*_node)) {
+    ++*this;
   }
 }
 
-CstNode::Iterator::reference CstNode::Iterator::operator*() const {
-  return *stack.back().first;
-}
-CstNode::Iterator::pointer CstNode::Iterator::operator->() const {
-  return stack.back().first;
-}
-
 CstNode::Iterator &CstNode::Iterator::operator++() {
-  advance();
+  do {
+    advance();
+  } while (_node && !accept(*_node));
   return *this;
 }
 
-bool CstNode::Iterator::operator==(const Iterator &other) const {
-  return stack /*.empty()*/ == other.stack /*.empty()*/;
+bool CstNode::Iterator::accept(const CstNode &node) const noexcept {
+  const auto filter = static_cast<std::uint8_t>(_filter);
+  if ((filter & static_cast<std::uint8_t>(Filter::Leaves)) && !node.isLeaf) {
+    return false;
+  }
+  return !(filter & static_cast<std::uint8_t>(Filter::Visible)) ||
+         !node.hidden;
 }
 
+void CstNode::Iterator::advance() noexcept {
+  // Traverse child nodes unless prune was called
+  if (!_prune && _node->firstChild) {
+    _node = _node->firstChild;
+    return;
+  }
+  _prune = false;
+  // move up to the first ancestor with a next sibling, never leaving the
+  // subtree of the iterated node
+  auto *node = _node;
+  while (node != _root && !node->nextSibling) {
+    node = node->parent;
+  }
+  _node = node == _root ? nullptr : node->nextSibling;
+}
 
-void CstNode::Iterator::prune() { pruneCurrent = true; }
-
-void CstNode::Iterator::advance() {
-  while (!stack.empty()) {
-    auto [node, index] = stack.back();
-    stack.pop_back();
-
-    // Skip the current node's subtree if prune was called
-    if (pruneCurrent) {
-      pruneCurrent = false; // Reset prune flag
-      continue;
-    }
-
-    // Traverse child nodes
-    if (index < node->content.size()) {
-      stack.emplace_back(
-          node, index + 1); // Save next child index for the current node
-      stack.emplace_back(&node->content[index],
-                         0); // Start with the first child
-      return;
-    }
+CstNode &CstNode::append(const CstNode &node) {
+  auto &copy = emplace_back();
+  copy.text = node.text;
+  copy.grammarSource = node.grammarSource;
+  copy.isLeaf = node.isLeaf;
+  copy.hidden = node.hidden;
+  copy.recovered = node.recovered;
+  copy.examined = node.examined;
+  for (const auto &child : node.children()) {
+    copy.append(child);
   }
+  return copy;
 }
 
-} // namespace pegium
\ No newline at end of file
+} // namespace pegium
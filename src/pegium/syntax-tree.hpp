@@ -1,60 +1,61 @@
 #pragma once
 
 #include <any>
-#include <atomic>
+#include <algorithm>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
 #include <cstdint>
 #include <deque>
-#include <functional>
 #include <memory>
-#include <mutex>
-#include <optional>
+#include <new>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace pegium {
 
-/// A Reference to an AstNode of type T.
+struct AstNode;
+
+/// A Reference to an AstNode of type T: the text of the reference and the
+/// resolved node. The references are resolved in bulk by an Index, reading a
+/// reference never locks.
 /// @tparam T the AstNode type.
 template <typename T>
 // do not add requirement std::is_base_of_v<AstNode, T> because T may be
 // incomplete at this stage.
 struct Reference {
-  /// Resolve the reference.
-  /// @return the resolved reference or nullptr.
-  T *get() const {
-    if (resolved.load(std::memory_order_acquire)) {
-      return ref;
-    }
-    std::scoped_lock lock(mutex);
-    if (!resolved.load(std::memory_order_relaxed)) {
-      auto value = resolve(_refText);
-      if (value) {
-        ref = value.value();
-        resolved.store(true, std::memory_order_release);
-      }
-    }
-    return ref;
-  }
-  T &operator->() { return *get(); }
+  /// @return the resolved node or nullptr.
+  T *get() const noexcept { return ref; }
+  T *operator->() const noexcept { return ref; }
 
   /// Check if the reference is resolved
-  explicit operator bool() const { return get(); }
+  explicit operator bool() const noexcept { return ref; }
+
+  /// @return the text of the reference
+  const std::string &text() const noexcept { return _refText; }
 
   /// Set the text of the reference (internally used by parser)
   /// @param refText the reference text
   /// @return the current object.
   Reference &operator=(std::string refText) noexcept {
     _refText = std::move(refText);
+    ref = nullptr;
     return *this;
   }
 
+  /// Resolve the reference (internally used by Index)
+  /// @param node the node named by the text of the reference
+  /// @return true if the node is a T, otherwise the reference is unresolved
+  bool resolve(AstNode *node) noexcept {
+    ref = dynamic_cast<T *>(node);
+    return ref;
+  }
+
 private:
   std::string _refText;
-  std::function<std::optional<T *>(const std::string &)> resolve;
-  mutable std::atomic_bool resolved = false;
-  mutable T *ref = nullptr;
-  mutable std::mutex mutex;
+  T *ref = nullptr;
 };
 
 /// Helpers to check if an object is a Reference
@@ -63,6 +64,33 @@ template <typename T> struct is_reference : std::false_type {};
 template <typename T> struct is_reference<Reference<T>> : std::true_type {};
 template <typename T> constexpr bool is_reference_v = is_reference<T>::value;
 
+/// A handle on a contained AstNode of type T. The node is owned by the
+/// AstArena of its document, the handle is a plain pointer copied without
+/// any reference counting and valid as long as the arena.
+/// @tparam T the AstNode type
+template <typename T>
+// do not add requirement std::is_base_of_v<AstNode, T> because T may be
+// incomplete at this stage.
+class Containment {
+public:
+  Containment() noexcept = default;
+  Containment(std::nullptr_t) noexcept {}
+  explicit Containment(T *node) noexcept : _node{node} {}
+  template <typename U>
+    requires std::convertible_to<U *, T *>
+  Containment(const Containment<U> &other) noexcept : _node{other.get()} {}
+
+  /// @return the contained node or nullptr
+  T *get() const noexcept { return _node; }
+  T *operator->() const noexcept { return _node; }
+  T &operator*() const noexcept { return *_node; }
+  explicit operator bool() const noexcept { return _node; }
+  bool operator==(const Containment &) const noexcept = default;
+
+private:
+  T *_node = nullptr;
+};
+
 /// Represent a node in the AST. Each node in the AST must derived from AstNode
 struct AstNode {
   virtual ~AstNode() noexcept = default;
@@ -83,7 +111,7 @@ struct AstNode {
   template <typename T>
   // do not add requirement std::is_base_of_v<AstNode, T> because T may be
   // incomplete at this stage.
-  using containment = std::shared_ptr<T>;
+  using containment = Containment<T>;
 
   /// A vector of elements of type T.
   /// @tparam T type of element
@@ -101,11 +129,95 @@ struct AstNode {
   template <typename T> using vector = std::vector<T>;
 };
 
+/// A bump allocator of AstNode.
+/// The nodes of a document are allocated contiguously in blocks, and they
+/// are all destroyed with the arena: the nodes never count references.
+class AstArena {
+public:
+  AstArena() noexcept = default;
+  AstArena(AstArena &&other) noexcept { swap(other); }
+  AstArena &operator=(AstArena &&other) noexcept {
+    AstArena moved{std::move(other)};
+    swap(moved);
+    return *this;
+  }
+  ~AstArena() noexcept {
+    for (auto it = _nodes.rbegin(); it != _nodes.rend(); ++it) {
+      (*it)->~AstNode();
+    }
+  }
+
+  /// @tparam T the node type
+  /// @return a new value initialized node
+  template <typename T> T *create() {
+    static_assert(std::derived_from<T, AstNode>);
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    auto offset = (_used + alignof(T) - 1) & ~(alignof(T) - 1);
+    if (_blocks.empty() || offset + sizeof(T) > _capacity) {
+      // a node larger than a block gets its own block
+      _capacity = std::max(BlockSize, sizeof(T));
+      _blocks.emplace_back(
+          std::make_unique_for_overwrite<std::byte[]>(_capacity));
+      offset = 0;
+    }
+    auto &slot = _nodes.emplace_back();
+    T *node;
+    try {
+      node = ::new (_blocks.back().get() + offset) T();
+    } catch (...) {
+      _nodes.pop_back();
+      throw;
+    }
+    slot = node;
+    _used = offset + sizeof(T);
+    return node;
+  }
+
+  /// Move the nodes of another arena into this one
+  /// @param other the arena, left empty
+  void merge(AstArena &&other) {
+    if (other._blocks.empty()) {
+      return;
+    }
+    _nodes.insert(_nodes.end(), other._nodes.begin(), other._nodes.end());
+    for (auto &block : other._blocks) {
+      _blocks.push_back(std::move(block));
+    }
+    // the allocation continues in the last block of the other arena
+    _used = other._used;
+    _capacity = other._capacity;
+    other._nodes.clear();
+    other._blocks.clear();
+  }
+
+  /// @return the number of allocated nodes
+  std::size_t size() const noexcept { return _nodes.size(); }
+
+private:
+  static constexpr std::size_t BlockSize = std::size_t{1} << 14;
+  std::vector<std::unique_ptr<std::byte[]>> _blocks;
+  /// the nodes to destroy, in the order of their creation
+  std::vector<AstNode *> _nodes;
+  /// the used and the total size of the last block
+  std::size_t _used = 0;
+  std::size_t _capacity = 0;
+
+  void swap(AstArena &other) noexcept {
+    std::swap(_blocks, other._blocks);
+    std::swap(_nodes, other._nodes);
+    std::swap(_used, other._used);
+    std::swap(_capacity, other._capacity);
+  }
+};
+
 struct RootCstNode;
 class GrammarElement;
 
 /**
  * A node in the Concrete Syntax Tree (CST).
+ * The nodes are allocated in the arena of the RootCstNode and linked together
+ * with parent/first-child/next-sibling pointers, so they can be traversed
+ * without any allocation.
  */
 struct CstNode {
 
@@ -114,61 +226,304 @@ struct CstNode {
   /** The actual text */
   std::string_view text;
   /** The root CST node */
-  RootCstNode *root;
+  RootCstNode *root = nullptr;
 
   /** The AST node created from this CST node */
   // std::any astNode;
 
+  /// The nodes visited by an Iterator
+  enum class Filter : std::uint8_t {
+    /// all the nodes
+    All = 0,
+    /// only the leaf nodes
+    Leaves = 1,
+    /// only the nodes that are not hidden
+    Visible = 2,
+    /// only the leaf nodes that are not hidden, i.e. the tokens
+    Tokens = Leaves | Visible,
+  };
+
+  /// A pre-order iterator over a node and its descendants.
+  /// The iterator only holds the iterated node and the current node: it
+  /// moves up with the parent links, never allocates and is compared in
+  /// constant time.
   class Iterator {
   public:
     using iterator_category = std::forward_iterator_tag;
     using value_type = CstNode;
+    using difference_type = std::ptrdiff_t;
     using pointer = CstNode *;
     using reference = CstNode &;
 
-    explicit Iterator(pointer root = nullptr);
-    reference operator*() const;
-    pointer operator->() const;
+    /// Create an iterator positioned on the first node of root accepted by
+    /// the filter
+    /// @param root the iterated node, nullptr for the end iterator
+    /// @param filter the visited nodes
+    explicit Iterator(pointer root = nullptr, Filter filter = Filter::All);
+    reference operator*() const { return *_node; }
+    pointer operator->() const { return _node; }
     Iterator &operator++();
-    bool operator==(const Iterator &other) const;
-    void prune();
+    Iterator operator++(int) {
+      auto it = *this;
+      ++*this;
+      return it;
+    }
+    bool operator==(const Iterator &other) const noexcept {
+      return _node == other._node;
+    }
+    /// Do not visit the descendants of the current node
+    void prune() noexcept { _prune = true; }
 
   private:
-    struct NodeFrame {
-      pointer node;
-      size_t childIndex;
-      bool prune;
-      NodeFrame(pointer n, size_t index, bool p)
-          : node(n), childIndex(index), prune(p) {}
-      bool operator==(const NodeFrame &other) const {
-        return node == other.node /*&& childIndex == other.childIndex &&
-               prune == other.prune*/
-            ;
-      }
-    };
-
-    std::vector<std::pair<CstNode *, size_t>> stack;
-    bool pruneCurrent = false;
-
-    void advance();
+    pointer _root;
+    pointer _node;
+    Filter _filter;
+    bool _prune = false;
+
+    bool accept(const CstNode &node) const noexcept;
+    void advance() noexcept;
+  };
+
+  /// A range over a node and its descendants
+  struct Range {
+    CstNode *root;
+    Filter filter;
+    Iterator begin() const { return Iterator{root, filter}; }
+    Iterator end() const { return Iterator{}; }
   };
 
   Iterator begin() { return Iterator(this); }
   Iterator end() { return Iterator(); }
 
-  std::vector<CstNode> content;
+  /// @param filter the visited nodes
+  /// @return the range of this node and its descendants accepted by filter
+  Range nodes(Filter filter = Filter::All) const noexcept {
+    return {const_cast<CstNode *>(this), filter};
+  }
+  /// @return the range of the leaf descendants of this node
+  Range leaves() const noexcept { return nodes(Filter::Leaves); }
+  /// @return the range of the non hidden leaf descendants of this node
+  Range tokens() const noexcept { return nodes(Filter::Tokens); }
+
+  /// An iterator over the direct children of a node
+  class ChildIterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = CstNode;
+    using difference_type = std::ptrdiff_t;
+    using pointer = CstNode *;
+    using reference = CstNode &;
+
+    explicit ChildIterator(pointer node = nullptr) : _node{node} {}
+    reference operator*() const { return *_node; }
+    pointer operator->() const { return _node; }
+    ChildIterator &operator++() {
+      _node = _node->nextSibling;
+      return *this;
+    }
+    ChildIterator operator++(int) {
+      auto it = *this;
+      ++*this;
+      return it;
+    }
+    bool operator==(const ChildIterator &other) const = default;
+
+  private:
+    pointer _node;
+  };
+
+  /// A range over the direct children of a node
+  struct Children {
+    CstNode *first;
+    ChildIterator begin() const { return ChildIterator{first}; }
+    ChildIterator end() const { return ChildIterator{}; }
+    bool empty() const noexcept { return first == nullptr; }
+  };
+
+  /// @return the range of the direct children of this node
+  Children children() const noexcept { return {firstChild}; }
+
+  /// Append a new child node allocated from the arena of the root node
+  /// @return the created child node
+  CstNode &emplace_back();
+
+  /// Append a deep copy of a node (and of its children).
+  /// @param node the node to copy
+  /// @return the created child node
+  CstNode &append(const CstNode &node);
+
+  /// The state of the children of a node, used to rollback the children
+  /// created by a failed alternative.
+  struct Checkpoint {
+    CstNode *lastChild;
+    std::size_t watermark;
+  };
+
+  /// @return a checkpoint of the current children of this node
+  Checkpoint checkpoint() const noexcept;
+
+  /// Remove all the children appended since the checkpoint was created. The
+  /// removed nodes are released at once by resetting the watermark of the
+  /// arena.
+  /// @param checkpoint the checkpoint to restore
+  void rollback(const Checkpoint &checkpoint) noexcept;
+
+  /// Unlink the children appended since the checkpoint without releasing
+  /// them, so they can be appended again by attach
+  /// @param checkpoint the checkpoint of the kept children
+  /// @return the first unlinked child or nullptr
+  CstNode *detach(const Checkpoint &checkpoint) noexcept;
+  /// Append the children unlinked by detach
+  /// @param first the first unlinked child or nullptr
+  void attach(CstNode *first) noexcept;
+
+  CstNode *parent = nullptr;
+  CstNode *firstChild = nullptr;
+  CstNode *lastChild = nullptr;
+  CstNode *nextSibling = nullptr;
 
   /** The grammar element from which this node was parsed */
-  const GrammarElement *grammarSource;
+  const GrammarElement *grammarSource = nullptr;
   // A leaf CST node corresponds to a token in the input token stream.
   bool isLeaf = false;
   // Whether the token is hidden, i.e. not explicitly part of the containing
   // grammar rule (e.g: comments)
   bool hidden = false;
+  // Whether the text was skipped by the error recovery, such a leaf is hidden
+  bool recovered = false;
+  /// For the node of a rule call, the furthest position examined by the
+  /// parse before the call, as an offset from the start of the node, or
+  /// Unexamined if unknown: the call can be parsed again alone only after an
+  /// edit of the text following that position and the positions of the calls
+  /// containing it
+  std::uint32_t examined = Unexamined;
+
+  static constexpr std::uint32_t Unexamined = UINT32_MAX;
+};
+
+/// A bump allocator of CstNode.
+/// The nodes are allocated in fixed size blocks so their addresses are stable,
+/// and they are all released by resetting the watermark.
+class CstArena {
+public:
+  /// @return a new default initialized node
+  CstNode &allocate() {
+    const auto block = _size >> BlockShift;
+    if (block == _blocks.size()) {
+      _blocks.emplace_back(std::make_unique<CstNode[]>(BlockSize));
+    }
+    auto &node = _blocks[block][_size & (BlockSize - 1)];
+    node = CstNode{};
+    ++_size;
+    return node;
+  }
+
+  /// @return the number of allocated nodes
+  std::size_t watermark() const noexcept { return _size; }
+
+  /// @param index the index of an allocated node, below the watermark
+  /// @return the node allocated at that index
+  CstNode &operator[](std::size_t index) noexcept {
+    assert(index < _size);
+    return _blocks[index >> BlockShift][index & (BlockSize - 1)];
+  }
+
+  /// Release all the nodes allocated after the watermark
+  /// @param watermark the watermark to restore
+  void rewind(std::size_t watermark) noexcept {
+    assert(watermark <= _size);
+    _size = watermark;
+  }
+
+private:
+  static constexpr std::size_t BlockShift = 10;
+  static constexpr std::size_t BlockSize = std::size_t{1} << BlockShift;
+  std::vector<std::unique_ptr<CstNode[]>> _blocks;
+  std::size_t _size = 0;
+};
+
+/// The objects of the value of a CST, kept by Rule::reparse to reuse the
+/// objects of the rule calls that are not parsed again
+struct CstValues {
+  /// the arena of the objects, shared with the value of the parse
+  std::shared_ptr<AstArena> arena;
+  /// the object assigned by each Assignment node whose value is an object
+  std::unordered_map<const CstNode *, AstNode *> objects;
+  /// the number of nodes and objects released by the reparses, which stay
+  /// allocated until the CST is copied
+  std::size_t released = 0;
 };
 
 struct RootCstNode : public CstNode {
-  std::string fullText;
+  RootCstNode() { root = this; }
+  RootCstNode(const RootCstNode &) = delete;
+  RootCstNode &operator=(const RootCstNode &) = delete;
+
+  /** The full parsed text */
+  std::string_view fullText;
+  /** The owner of the full text, nullptr if the text is borrowed from the
+   * caller */
+  std::shared_ptr<const void> storage;
+  /** The arena containing all the nodes of the tree */
+  CstArena arena;
+  /** The objects kept for the next reparse, nullptr if the CST was not
+   * reparsed */
+  std::unique_ptr<CstValues> values;
 };
 
+inline CstNode &CstNode::emplace_back() {
+  assert(root && "The node is not attached to a root node.");
+  auto &node = root->arena.allocate();
+  node.root = root;
+  node.parent = this;
+  if (lastChild) {
+    lastChild->nextSibling = &node;
+  } else {
+    firstChild = &node;
+  }
+  lastChild = &node;
+  return node;
+}
+
+inline CstNode::Checkpoint CstNode::checkpoint() const noexcept {
+  return {lastChild, root->arena.watermark()};
+}
+
+inline CstNode *CstNode::detach(const Checkpoint &checkpoint) noexcept {
+  auto *first =
+      checkpoint.lastChild ? checkpoint.lastChild->nextSibling : firstChild;
+  lastChild = checkpoint.lastChild;
+  if (lastChild) {
+    lastChild->nextSibling = nullptr;
+  } else {
+    firstChild = nullptr;
+  }
+  return first;
+}
+
+inline void CstNode::attach(CstNode *first) noexcept {
+  if (!first) {
+    return;
+  }
+  if (lastChild) {
+    lastChild->nextSibling = first;
+  } else {
+    firstChild = first;
+  }
+  for (auto *child = first; child; child = child->nextSibling) {
+    child->parent = this;
+    lastChild = child;
+  }
+}
+
+inline void CstNode::rollback(const Checkpoint &checkpoint) noexcept {
+  root->arena.rewind(checkpoint.watermark);
+  lastChild = checkpoint.lastChild;
+  if (lastChild) {
+    lastChild->nextSibling = nullptr;
+  } else {
+    firstChild = nullptr;
+  }
+}
+
 } // namespace pegium
\ No newline at end of file
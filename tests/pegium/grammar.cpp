@@ -2,6 +2,8 @@
 #include <gtest/gtest.h>
 
 #include <pegium/Parser.hpp>
+#include <pegium/analysis.hpp>
+#include <pegium/program.hpp>
 
 TEST(GrammarTest, Optional) {
   class Parser : public pegium::Parser {
@@ -261,4 +263,887 @@ TEST(GrammarTest, PrioritizedChoiceWithGroup) {
   EXPECT_TRUE(p.parse("TERM", "AC").ret);
   EXPECT_FALSE(p.parse("TERM", " AB").ret);
   EXPECT_FALSE(p.parse("TERM", "AC ").ret);
-}
\ No newline at end of file
+}
+TEST(GrammarTest, Packrat) {
+  class Parser : public pegium::Parser {
+  public:
+    explicit Parser(bool memoize) {
+      using namespace pegium;
+      terminal("WS").ignore()(+s);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      rule("QualifiedName").memoize(memoize)(
+          at_least_one_sep('.'_kw, call("ID")));
+      rule("RULE")((call("QualifiedName"), "x"_kw) |
+                   (call("QualifiedName"), "y"_kw) |
+                   (call("QualifiedName"), "z"_kw));
+    }
+  };
+  Parser plain{false};
+  Parser memoized{true};
+
+  for (const auto *input : {"a.b x", "a . b y", "a.b.c z", "a.b w", ""}) {
+    auto expected = plain.parse("RULE", input);
+    auto result = memoized.parse("RULE", input);
+    EXPECT_EQ(expected.ret, result.ret) << input;
+    EXPECT_EQ(expected.len, result.len) << input;
+    if (expected.ret) {
+      EXPECT_EQ(std::any_cast<std::string>(expected.value),
+                std::any_cast<std::string>(result.value));
+    }
+    auto recognized =
+        memoized.parse("RULE", input, pegium::ParseMode::Recognize);
+    EXPECT_EQ(expected.len, recognized.len) << input;
+  }
+
+  class PackratParser : public Parser {
+  public:
+    PackratParser() : Parser{false} { packrat(true, 1); }
+  };
+  PackratParser bounded;
+  auto result = bounded.parse("RULE", "a.b.c z");
+  EXPECT_TRUE(result.ret);
+  EXPECT_EQ(std::any_cast<std::string>(result.value), "a.b.cz");
+
+  // each level parses its nested call once: the hit of the second
+  // alternative moves the memoized nodes instead of copying them
+  class NestedParser : public pegium::Parser {
+  public:
+    NestedParser() {
+      using namespace pegium;
+      rule("Nested").memoize()(("("_kw, call("Nested"), ")"_kw, "x"_kw) |
+                               ("("_kw, call("Nested"), ")"_kw, "y"_kw) |
+                               "z"_kw);
+    }
+  };
+  NestedParser nested;
+  constexpr std::size_t depth = 4000;
+  std::string input;
+  for (std::size_t i = 0; i < depth; ++i) {
+    input += '(';
+  }
+  input += 'z';
+  for (std::size_t i = 0; i < depth; ++i) {
+    input += ")y";
+  }
+  for (auto mode : {pegium::ParseMode::Full, pegium::ParseMode::Recognize}) {
+    result = nested.parse("Nested", input, mode);
+    EXPECT_TRUE(result.ret);
+    EXPECT_EQ(result.len, input.size());
+  }
+  result = nested.parse("Nested", input);
+  std::size_t tokens = 0;
+  for ([[maybe_unused]] const auto &token : result.root_node->tokens()) {
+    ++tokens;
+  }
+  EXPECT_EQ(tokens, 3 * depth + 1);
+  EXPECT_LE(result.root_node->arena.watermark(), 16 * depth);
+}
+
+TEST(GrammarTest, PrioritizedChoiceDispatch) {
+  class Parser : public pegium::Parser {
+  public:
+    Parser() {
+      using namespace pegium;
+      terminal("WS").ignore()(+s);
+      // "a" and "ab" share a first character: order must be kept
+      rule("RULE")("ab"_kw | "a"_kw | "B"_ikw | opt("c"_kw));
+      terminal("TERM")("ab"_kw | "a"_kw | dot | ""_kw);
+    }
+  };
+  Parser p;
+
+  EXPECT_TRUE(p.parse("RULE", "ab").ret);
+  EXPECT_TRUE(p.parse("RULE", "a").ret);
+  EXPECT_TRUE(p.parse("RULE", "b").ret);
+  EXPECT_TRUE(p.parse("RULE", "B").ret);
+  EXPECT_TRUE(p.parse("RULE", "c").ret);
+  EXPECT_TRUE(p.parse("RULE", "").ret);
+  EXPECT_FALSE(p.parse("RULE", "d").ret);
+
+  EXPECT_EQ(p.parse("TERM", "ab").len, 2);
+  EXPECT_EQ(p.parse("TERM", "a").len, 1);
+  EXPECT_EQ(p.parse("TERM", "\xC3\xA9").len, 2);
+  EXPECT_TRUE(p.parse("TERM", "").ret);
+
+  // the alternatives skipped by the dispatch are expected with the choice
+  class DeclParser : public pegium::Parser {
+  public:
+    DeclParser() {
+      using namespace pegium;
+      terminal("WS").ignore()(+s);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      rule("Decl")(call("Namespace") | call("Field"));
+      rule("Namespace")("namespace"_kw, call("ID"), ";"_kw);
+      rule("Field")("field"_kw, call("ID"), ";"_kw);
+    }
+  };
+  DeclParser decls;
+  auto result = decls.parse("Decl", "foo;");
+  EXPECT_FALSE(result.ret);
+  ASSERT_FALSE(result.errors.empty());
+  EXPECT_EQ(result.errors.back().offset, 0);
+  std::vector<std::string> expected;
+  for (const auto *element : result.errors.back().expected) {
+    expected.push_back(pegium::describe(*element));
+  }
+  EXPECT_EQ(expected,
+            (std::vector<std::string>{"Namespace or Field", "'field'"}));
+}
+
+TEST(GrammarTest, FirstSet) {
+  using namespace pegium;
+  auto first = first_set((("ab"_kw | Optional('c'_kw)), "d"_kw));
+  EXPECT_TRUE(first.chars['a']);
+  EXPECT_TRUE(first.chars['c']);
+  EXPECT_TRUE(first.chars['d']);
+  EXPECT_FALSE(first.chars['b']);
+  EXPECT_FALSE(first.nullable);
+
+  first = first_set(Many("x"_ikw));
+  EXPECT_TRUE(first.chars['x']);
+  EXPECT_TRUE(first.chars['X']);
+  EXPECT_TRUE(first.nullable);
+
+  first = first_set((!"x"_kw, CharacterClass("0-9", false, false)));
+  EXPECT_TRUE(first.chars['0']);
+  EXPECT_FALSE(first.chars['x']);
+  EXPECT_FALSE(first.nullable);
+}
+
+TEST(GrammarTest, KeywordSet) {
+  class Parser : public pegium::Parser {
+  public:
+    Parser() {
+      using namespace pegium;
+      terminal("WS").ignore()(+s);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      // "in" is a prefix of "int" and "interface", "for" is case insensitive
+      rule("KW")("int"_kw | "in"_kw | "interface"_kw | "for"_ikw | "+"_kw |
+                 "++"_kw);
+      rule("RULE")(+(call("KW") | call("ID")));
+      terminal("TERM")("in"_kw | "int"_kw | "FOR"_ikw);
+    }
+  };
+  Parser p;
+
+  EXPECT_TRUE(p.parse("KW", "int").ret);
+  EXPECT_TRUE(p.parse("KW", "in").ret);
+  EXPECT_TRUE(p.parse("KW", "interface").ret);
+  EXPECT_TRUE(p.parse("KW", "FoR").ret);
+  EXPECT_FALSE(p.parse("KW", "inter").ret);
+  EXPECT_FALSE(p.parse("KW", "fort").ret);
+  // "+" is tried first and is not a word so "++" cannot match
+  EXPECT_FALSE(p.parse("KW", "++").ret);
+  EXPECT_TRUE(p.parse("KW", "+").ret);
+
+  auto result = p.parse("RULE", "int in interface inter FOR fort");
+  EXPECT_TRUE(result.ret);
+  EXPECT_EQ(std::any_cast<std::string>(result.value),
+            "intininterfaceinterFORfort");
+
+  // the first matching keyword is used in a terminal
+  EXPECT_FALSE(p.parse("TERM", "int").ret);
+  EXPECT_EQ(p.parse("TERM", "int").len, 2);
+  EXPECT_TRUE(p.parse("TERM", "in").ret);
+  EXPECT_TRUE(p.parse("TERM", "for").ret);
+
+  using namespace pegium;
+  KeywordSet set{"a"_kw, "ab"_kw, "AB"_ikw};
+  EXPECT_EQ(set.parse_terminal("ab"), 1);
+  KeywordSet set2{"AB"_ikw, "a"_kw};
+  EXPECT_EQ(set2.parse_terminal("ab"), 2);
+  EXPECT_EQ(set2.parse_terminal("ac"), 1);
+}
+
+TEST(GrammarTest, CharacterClassScan) {
+  using namespace pegium;
+  std::vector<CharacterClass> classes{
+      CharacterClass{" \t\r\n", false, false},
+      CharacterClass{"\r\n", true, false},
+      CharacterClass{"a-zA-Z0-9_", false, false},
+      CharacterClass{"a-z", false, true},
+      // more ranges than supported by the vectorized scan
+      CharacterClass{"acegikmoqsuwy", false, false},
+      CharacterClass{"", false, false},
+      CharacterClass{"", true, false}};
+
+  std::string text;
+  for (int i = 0; i < 200; ++i) {
+    text += static_cast<char>((i * 37 + i / 7) % 256);
+  }
+  for (const auto &cls : classes) {
+    Many many{cls};
+    AtLeastOne atLeastOne{cls};
+    for (std::size_t start = 0; start < text.size(); ++start) {
+      // build inputs with long runs of characters of the class
+      std::string input;
+      for (std::size_t i = start; i < text.size(); ++i) {
+        if (cls.characters()[static_cast<unsigned char>(text[i])]) {
+          input.append(40, text[i]);
+        }
+        input += text[i];
+      }
+      std::size_t expected = 0;
+      while (expected < input.size() &&
+             cls.parse_terminal({input.data() + expected, 1}) == 1) {
+        ++expected;
+      }
+      EXPECT_EQ(many.parse_terminal(input), expected);
+      if (expected == 0) {
+        EXPECT_EQ(atLeastOne.parse_terminal(input), std::string::npos);
+      } else {
+        EXPECT_EQ(atLeastOne.parse_terminal(input), expected);
+      }
+    }
+  }
+}
+
+TEST(GrammarTest, Until) {
+  class Parser : public pegium::Parser {
+  public:
+    Parser() {
+      using namespace pegium;
+      terminal("WS").ignore()(+s);
+      terminal("ML_COMMENT").hide()("/*"_kw >> "*/"_kw);
+      terminal("LINE")('#'_kw >> '\n'_kw);
+      terminal("ID")(+w);
+      rule("RULE")(many(call("ID")));
+    }
+  };
+  Parser p;
+  EXPECT_TRUE(p.parse("ML_COMMENT", "/* a comment */").ret);
+  EXPECT_TRUE(p.parse("ML_COMMENT", "/**/").ret);
+  EXPECT_FALSE(p.parse("ML_COMMENT", "/*/").ret);
+  EXPECT_FALSE(p.parse("ML_COMMENT", "/* a comment").ret);
+  EXPECT_EQ(p.parse("ML_COMMENT", "/* a */ b */").len, 7);
+  EXPECT_TRUE(p.parse("LINE", "# a line\n").ret);
+  EXPECT_TRUE(p.parse("RULE", "a /* b */ c /* d\n */").ret);
+
+  using namespace pegium;
+  Until until{"*/"_kw};
+  Until character{'/'_kw};
+  for (std::string input :
+       {"", "*/", "abc*/def", "\xC3\xA9*/", "\xC3*/*/", "\xE2\x82*/x*/",
+        "\xF0*/\xF0\x9F\x98\x80*/", "\x80*/", "\xFF*/", "abc\xC3", "\xC3*",
+        "a\xC3/b/"}) {
+    EXPECT_EQ(until.parse_terminal(input),
+              until.expansion().parse_terminal(input))
+        << input;
+    EXPECT_EQ(character.parse_terminal(input),
+              character.expansion().parse_terminal(input))
+        << input;
+  }
+}
+
+TEST(GrammarTest, HiddenContext) {
+  class Parser : public pegium::Parser {
+  public:
+    explicit Parser(bool hidden) {
+      using namespace pegium;
+      if (hidden) {
+        terminal("WS").ignore()(+s);
+        terminal("COMMENT").hide()("//"_kw >> '\n'_kw);
+      }
+      rule("RULE")("a"_kw, "("_kw);
+    }
+  };
+  Parser plain{false};
+  Parser hidden{true};
+  // the context is built once and reused by the following parses
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(plain.parse("RULE", "a(").ret);
+    EXPECT_FALSE(plain.parse("RULE", "a (").ret);
+    EXPECT_TRUE(hidden.parse("RULE", " a // comment\n ( ").ret);
+  }
+}
+
+TEST(GrammarTest, Program) {
+  class Parser : public pegium::Parser {
+  public:
+    Parser() {
+      using namespace pegium;
+      auto terminal = [this](const std::string &name) -> TerminalRule & {
+        return *(rules[name] = std::addressof(this->terminal(name)));
+      };
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      terminal("NUMBER")(+d, opt('.'_kw, +d), opt(cls("eE"), opt('-'_kw), +d));
+      terminal("STRING")('"'_kw, many(('\\'_kw, dot) | cls("\"\\", true)),
+                         '"'_kw);
+      terminal("KW")("for"_ikw | "foreach"_kw | "if"_kw);
+      terminal("TOKEN")(call("ID") | call("NUMBER") | call("STRING"));
+      terminal("LIST")(call("TOKEN"), many(','_kw, call("TOKEN")));
+      terminal("REP")(Repetition{'a'_kw, 1, 3}, &'b'_kw, !"bc"_kw,
+                      at_least_one("b"_kw));
+      terminal("COMMENT")("/*"_kw >> "*/"_kw);
+    }
+    /// @return the result of the rule with and without its program
+    std::pair<std::size_t, std::size_t> match(const std::string &name,
+                                              std::string_view text) {
+      compile();
+      const auto &rule = *rules.at(name);
+      auto expected = rule.element()->parse_terminal(text);
+      return {expected, rule.parse_terminal(text)};
+    }
+    /// @return the furthest position examined by the program of the rule
+    std::size_t examined(const std::string &name, std::string_view text) {
+      compile();
+      std::size_t examined;
+      rules.at(name)->match_terminal(text, examined);
+      return examined;
+    }
+
+  private:
+    std::map<std::string, pegium::TerminalRule *> rules;
+  };
+  Parser p;
+  const std::vector<std::pair<std::string, std::vector<std::string>>> cases{
+      {"ID", {"", "a", "_a1", "1a", "ab cd"}},
+      {"NUMBER", {"1", "12.5", "1e-3", "1.", "1.5e", "x"}},
+      {"STRING", {"\"\"", "\"a\\\"b\"", "\"a", "\"\xC3\xA9\""}},
+      {"KW", {"FOR", "foreach", "for", "if", "iF", "x"}},
+      {"LIST", {"a,1,\"s\"", "a,", ",a", "a,b,c,12.5e3"}},
+      {"REP", {"ab", "aaab", "aaaab", "abc", "b", "abbb"}},
+      {"COMMENT", {"/**/", "/* a */", "/* a", "/*/"}}};
+  for (const auto &[name, inputs] : cases) {
+    for (const auto &input : inputs) {
+      auto [expected, result] = p.match(name, input);
+      EXPECT_EQ(expected, result) << name << ": " << input;
+    }
+  }
+  // the text examined includes the characters ending the repetitions, the
+  // failed alternatives and the end of the text
+  EXPECT_EQ(p.examined("ID", "ab cd"), 2);
+  EXPECT_EQ(p.examined("NUMBER", "1.x"), 2);
+  EXPECT_EQ(p.examined("KW", "fox"), 2);
+  EXPECT_EQ(p.examined("COMMENT", "/* a"), 4);
+}
+
+TEST(GrammarTest, CompileTimeExpression) {
+  using namespace pegium;
+  static_assert((ct::cls("a-zA-Z_"), *ct::w).match("a1_ b") == 3);
+  static_assert((ct::cls("a-z"), *ct::w).match("1a") == ct::npos);
+  static_assert((ct::kw("for") | ct::ikw("if")).match("IF") == 2);
+  static_assert((+ct::d, !ct::chr('.')).match("12.") == ct::npos);
+  static_assert(ct::rep(ct::d, 2, 3).match("12345") == 3);
+  static_assert(("[a-zA-Z_]\\w*"_reg).match("a1_ b") == 3);
+  static_assert(("(ab|cd){2}x?"_reg).match("abcdx") == 5);
+  static_assert(("\\d{2,}"_reg).match("1") == ct::npos);
+  static_assert(("[^\"\\\\]+"_reg).match("ab\"") == 2);
+  static_assert(("a.c"_reg).match("a\xC3\xA9" "c") == 4);
+  // the repetitions are possessive
+  static_assert(("a*a"_reg).match("aaa") == ct::npos);
+  // the escaped control characters outside of a class
+  static_assert(("a\\nb"_reg).match("a\nb") == 3);
+  static_assert(("\\t\\r"_reg).match("\t\r") == 2);
+  static_assert(("\\n"_reg).match("n") == ct::npos);
+  // the text examined by the failed alternatives and the predicates
+  constexpr auto examined = [](const auto &expression, std::string_view sv) {
+    std::size_t result = 0;
+    expression.match(sv, result);
+    return result;
+  };
+  static_assert(examined(ct::kw("abc") | ct::kw("b"), "abx") == 2);
+  static_assert(examined((ct::chr('a'), !ct::kw("bcd")), "abcx") == 3);
+  static_assert(examined("a(bcd|b)"_reg, "abcx") == 3);
+  static_assert(examined("a*b"_reg, "aac") == 2);
+
+  class Parser : public pegium::Parser {
+  public:
+    Parser() {
+      using namespace pegium;
+      terminal("WS").ignore()("\\s+"_reg);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      terminal("CT_ID")((ct::cls("a-zA-Z_"), *ct::w));
+      terminal("NUMBER")(+d, opt('.'_kw, +d), opt(cls("eE"), opt('-'_kw), +d));
+      terminal("CT_NUMBER")("\\d+(\\.\\d+)?([eE]-?\\d+)?"_reg);
+      terminal("STRING")('"'_kw, many(('\\'_kw, dot) | cls("\"\\", true)),
+                         '"'_kw);
+      terminal("CT_STRING")(R"("(\\.|[^"\\])*")"_reg);
+      rule("LIST")(call("CT_ID"), many(','_kw, call("CT_NUMBER")));
+    }
+  };
+  Parser p;
+  const std::vector<std::pair<std::string, std::vector<std::string>>> cases{
+      {"ID", {"", "a", "_a1", "1a", "ab cd"}},
+      {"NUMBER", {"1", "12.5", "1e-3", "1.", "1.5e", "x"}},
+      {"STRING", {"\"\"", "\"a\\\"b\"", "\"a", "\"\xC3\xA9\""}}};
+  for (const auto &[name, inputs] : cases) {
+    for (const auto &input : inputs) {
+      auto expected = p.parse(name, input);
+      auto result = p.parse("CT_" + name, input);
+      EXPECT_EQ(expected.ret, result.ret) << name << ": " << input;
+      EXPECT_EQ(expected.len, result.len) << name << ": " << input;
+    }
+  }
+  auto result = p.parse("LIST", "a , 1.5 ,2e3 ");
+  EXPECT_TRUE(result.ret);
+  EXPECT_EQ(result.len, 13);
+  EXPECT_FALSE(p.parse("LIST", "a , b").ret);
+
+  // an expression of a parser rule is expected when it fails
+  class RuleParser : public pegium::Parser {
+  public:
+    RuleParser() {
+      using namespace pegium;
+      rule("Rule")("("_kw, ct::to_element(ct::kw("bcd") | ct::kw("b")));
+    }
+  };
+  RuleParser rules;
+  auto element = rules.parse("Rule", "(b");
+  EXPECT_TRUE(element.ret);
+  element = rules.parse("Rule", "(x");
+  EXPECT_FALSE(element.ret);
+  ASSERT_FALSE(element.errors.empty());
+  EXPECT_EQ(element.errors.back().offset, 1);
+  EXPECT_EQ(element.errors.back().expected.size(), 1);
+}
+
+struct ItemAst : pegium::AstNode {
+  string name;
+  vector<string> tags;
+  vector<containment<ItemAst>> items;
+};
+
+TEST(GrammarTest, FusedAst) {
+  class Parser : public pegium::Parser {
+  public:
+    Parser() {
+      using namespace pegium;
+      terminal("WS").ignore()(+s);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      rule("QualifiedName")(at_least_one_sep('.'_kw, call("ID")));
+      rule<ItemAst>("Base").memoize()(
+          append<&ItemAst::tags>(call("QualifiedName")));
+      // the assignments of a failed alternative are rolled back
+      rule<ItemAst>("Item")(
+          (call("Base"), append<&ItemAst::tags>(call("ID")), "!"_kw) |
+          (call("Base"), append<&ItemAst::tags>(call("ID")), "?"_kw,
+           opt(assign<&ItemAst::name>(call("ID")), "x"_kw)));
+      rule<ItemAst>("List")(
+          "list"_kw, *(append<&ItemAst::items>(call("Item")), ";"_kw));
+    }
+  };
+  Parser p;
+  const std::string input = "list a . b c ? d x ; e f ? ; h i !;";
+  for (auto mode : {pegium::ParseMode::Full, pegium::ParseMode::Ast}) {
+    auto result = p.parse("List", input, mode);
+    EXPECT_TRUE(result.ret);
+    auto value = std::any_cast<std::shared_ptr<pegium::AstNode>>(result.value);
+    auto *list = dynamic_cast<ItemAst *>(value.get());
+    ASSERT_TRUE(list);
+    ASSERT_EQ(list->items.size(), 3);
+    EXPECT_EQ(list->items[0]->tags,
+              (std::vector<std::string>{"a.b", "c"}));
+    EXPECT_EQ(list->items[0]->name, "d");
+    EXPECT_EQ(list->items[1]->tags, (std::vector<std::string>{"e", "f"}));
+    EXPECT_EQ(list->items[1]->name, "");
+    EXPECT_EQ(list->items[2]->tags, (std::vector<std::string>{"h", "i"}));
+  }
+  EXPECT_EQ(std::any_cast<std::string>(p.parse("ID", "abc").value), "abc");
+}
+
+struct FlagAst : pegium::AstNode {
+  bool flag = false;
+  bool other = false;
+  string name;
+  containment<FlagAst> next;
+};
+
+TEST(GrammarTest, FeatureAssignment) {
+  class Parser : public pegium::Parser {
+  public:
+    Parser() {
+      using namespace pegium;
+      terminal("WS").ignore()(+s);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      rule<FlagAst>("Flag")(enable<&FlagAst::flag>("flag"_kw),
+                            assign<&FlagAst::name>(call("ID")),
+                            opt(assign<&FlagAst::next>(call("Flag"))));
+    }
+  };
+  using pegium::Feature;
+  EXPECT_EQ(Feature::of<&FlagAst::flag>(), Feature::of<&FlagAst::flag>());
+  EXPECT_NE(Feature::of<&FlagAst::flag>(), Feature::of<&FlagAst::other>());
+
+  Parser p;
+  auto result = p.parse("Flag", "flag a flag b", pegium::ParseMode::Ast);
+  EXPECT_TRUE(result.ret);
+  auto value = std::any_cast<std::shared_ptr<pegium::AstNode>>(result.value);
+  auto *flag = dynamic_cast<FlagAst *>(value.get());
+  ASSERT_TRUE(flag);
+  EXPECT_TRUE(flag->flag);
+  EXPECT_FALSE(flag->other);
+  EXPECT_EQ(flag->name, "a");
+  ASSERT_TRUE(flag->next);
+  EXPECT_TRUE(flag->next->flag);
+  EXPECT_EQ(flag->next->name, "b");
+
+  // a value that does not fit the feature ends the parse with an exception
+  class WrongParser : public pegium::Parser {
+  public:
+    WrongParser() {
+      using namespace pegium;
+      terminal("WS").ignore()(+s);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      // the name is assigned a node instead of a string
+      rule<FlagAst>("Flag")(enable<&FlagAst::flag>("flag"_kw),
+                            assign<&FlagAst::name>(call("Name")));
+      rule<FlagAst>("Name")(assign<&FlagAst::name>(call("ID")));
+    }
+  };
+  WrongParser wrong;
+  EXPECT_THROW(wrong.parse("Flag", "flag a"), std::bad_any_cast);
+}
+
+/// Check that two CST parsed by two instances of the same grammar are
+/// identical
+static void expect_same_cst(const pegium::CstNode &lhs,
+                            const pegium::CstNode &rhs) {
+  EXPECT_EQ(lhs.text.data(), rhs.text.data());
+  EXPECT_EQ(lhs.text.size(), rhs.text.size());
+  ASSERT_EQ(!lhs.grammarSource, !rhs.grammarSource);
+  if (lhs.grammarSource) {
+    EXPECT_EQ(typeid(*lhs.grammarSource), typeid(*rhs.grammarSource));
+  }
+  EXPECT_EQ(lhs.isLeaf, rhs.isLeaf);
+  EXPECT_EQ(lhs.hidden, rhs.hidden);
+  auto l = lhs.children().begin();
+  auto r = rhs.children().begin();
+  for (; l != lhs.children().end() && r != rhs.children().end(); ++l, ++r) {
+    expect_same_cst(*l, *r);
+  }
+  EXPECT_EQ(l == lhs.children().end(), r == rhs.children().end());
+}
+
+TEST(GrammarTest, ParallelMany) {
+  class Parser : public pegium::Parser {
+  public:
+    explicit Parser(bool parallel) {
+      using namespace pegium;
+      terminal("WS").ignore()(+s);
+      terminal("ML_COMMENT").hide()("/*"_kw >> "*/"_kw);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      terminal("STRING")('"'_kw, *(!'"'_kw, dot), '"'_kw);
+      terminal("CHAR")('\''_kw, dot, '\''_kw);
+      rule<ItemAst>("Item")(
+          "namespace"_kw, assign<&ItemAst::name>(call("ID")), "{"_kw,
+          *((append<&ItemAst::tags>(call("ID") | call("STRING") |
+                                          call("CHAR")),
+             ";"_kw) |
+            append<&ItemAst::items>(call("Item"))),
+          "}"_kw);
+      auto blocks = many(append<&ItemAst::items>(call("Item")));
+      if (parallel) {
+        blocks.parallel({.threads = 16, .chunk = 32});
+      }
+      rule<ItemAst>("Document")(blocks);
+    }
+  };
+  Parser p{true};
+  Parser sequential{false};
+
+  std::string input;
+  for (int i = 0; i < 100; ++i) {
+    input += "namespace n" + std::to_string(i) + " { a; namespace m { b; } }\n";
+    if (i % 7 == 0) {
+      // the braces of a string or of a comment are skipped by the pre-scan
+      input += "namespace s { \"}\"; } /* } namespace x { */\n";
+    } else if (i % 3 == 1) {
+      // the braces of a character mislead the pre-scan
+      input += "namespace c { '}'; }\n";
+    }
+  }
+  for (auto mode : {pegium::ParseMode::Full, pegium::ParseMode::Ast,
+                    pegium::ParseMode::Recognize}) {
+    auto result = p.parse("Document", input, mode);
+    EXPECT_TRUE(result.ret);
+    EXPECT_EQ(result.len, input.size());
+    if (mode == pegium::ParseMode::Recognize) {
+      continue;
+    }
+    auto value = std::any_cast<std::shared_ptr<pegium::AstNode>>(result.value);
+    auto *document = dynamic_cast<ItemAst *>(value.get());
+    ASSERT_TRUE(document);
+    ASSERT_EQ(document->items.size(), 143);
+    EXPECT_EQ(document->items[0]->name, "n0");
+    EXPECT_EQ(document->items[1]->tags, (std::vector<std::string>{"\"}\""}));
+    EXPECT_EQ(document->items[3]->tags, (std::vector<std::string>{"'}'"}));
+    EXPECT_EQ(document->items.back()->name, "n99");
+    ASSERT_EQ(document->items.back()->items.size(), 1);
+    EXPECT_EQ(document->items.back()->items[0]->name, "m");
+  }
+
+  // the parallel parse builds the same CST as the sequential parse
+  expect_same_cst(*p.parse("Document", input, nullptr).root_node,
+                  *sequential.parse("Document", input, nullptr).root_node);
+
+  // the repetition stops at the first invalid block
+  auto invalid = input;
+  const auto pos = input.find("namespace n50");
+  invalid.insert(pos, "namespace { }");
+  auto partial = p.parse("Document", invalid, nullptr);
+  EXPECT_FALSE(partial.ret);
+  EXPECT_EQ(partial.len, pos);
+  expect_same_cst(*partial.root_node,
+                  *sequential.parse("Document", invalid, nullptr).root_node);
+}
+
+struct ExprAst : pegium::AstNode {
+  string value;
+  string op;
+  containment<ExprAst> left;
+  containment<ExprAst> right;
+};
+
+/// @param expr an expression
+/// @return the expression with the binary operations in parentheses
+static std::string to_string(const ExprAst &expr) {
+  if (!expr.left) {
+    return expr.value;
+  }
+  return "(" + to_string(*expr.left) + expr.op + to_string(*expr.right) + ")";
+}
+
+TEST(GrammarTest, LeftRecursion) {
+  class Parser : public pegium::Parser {
+  public:
+    explicit Parser(bool memoize) {
+      using namespace pegium;
+      packrat(memoize);
+      terminal("WS").ignore()(+s);
+      terminal("INT")(+d);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      rule<ExprAst>("Add")((assign<&ExprAst::left>(call("Add")),
+                            assign<&ExprAst::op>("+"_kw | "-"_kw),
+                            assign<&ExprAst::right>(call("Mul"))) |
+                           call("Mul"));
+      rule<ExprAst>("Mul")((assign<&ExprAst::left>(call("Mul")),
+                            assign<&ExprAst::op>("*"_kw | "/"_kw),
+                            assign<&ExprAst::right>(call("Primary"))) |
+                           call("Primary"));
+      rule<ExprAst>("Primary")(assign<&ExprAst::value>(call("INT")) |
+                               ("("_kw, call("Add"), ")"_kw));
+      // an indirect left recursion
+      rule("Member")((call("Postfix"), "."_kw, call("ID")) | call("ID"));
+      rule("Postfix")((call("Member"), "()"_kw) | call("Member"));
+    }
+  };
+  const std::string input = "1 - 2 - 3 * (4 + 5) / 6 + 7";
+  for (bool memoize : {false, true}) {
+    Parser p{memoize};
+    for (auto mode : {pegium::ParseMode::Full, pegium::ParseMode::Ast}) {
+      auto result = p.parse("Add", input, mode);
+      EXPECT_TRUE(result.ret);
+      EXPECT_EQ(result.len, input.size());
+      auto value =
+          std::any_cast<std::shared_ptr<pegium::AstNode>>(result.value);
+      auto *expr = dynamic_cast<ExprAst *>(value.get());
+      ASSERT_TRUE(expr);
+      EXPECT_EQ(to_string(*expr), "(((1-2)-((3*(4+5))/6))+7)");
+    }
+    auto result = p.parse("Add", input);
+    std::string tokens;
+    for (const auto &token : result.root_node->tokens()) {
+      tokens += token.text;
+    }
+    EXPECT_EQ(tokens, "1-2-3*(4+5)/6+7");
+    // the nested rule calls of the left operands end before their parent
+    for (const auto &node : *result.root_node) {
+      if (node.parent && !node.isLeaf) {
+        EXPECT_LE(node.text.data() + node.text.size(),
+                  node.parent->text.data() + node.parent->text.size());
+      }
+    }
+
+    EXPECT_TRUE(p.parse("Add", input, pegium::ParseMode::Recognize).ret);
+    EXPECT_FALSE(p.parse("Add", "1 + ", pegium::ParseMode::Recognize).ret);
+
+    result = p.parse("Postfix", "a.b().c.d()");
+    EXPECT_TRUE(result.ret);
+    EXPECT_EQ(std::any_cast<std::string>(result.value), "a.b().c.d()");
+  }
+
+  // a long chain is parsed in a single pass
+  std::string chain = "0";
+  for (int i = 0; i < 5'000; ++i) {
+    chain += " + 1";
+  }
+  Parser p{false};
+  auto result = p.parse("Add", chain, pegium::ParseMode::Ast);
+  EXPECT_TRUE(result.ret);
+  auto value = std::any_cast<std::shared_ptr<pegium::AstNode>>(result.value);
+  std::size_t depth = 0;
+  for (auto *expr = dynamic_cast<ExprAst *>(value.get()); expr && expr->left;
+       expr = expr->left.get()) {
+    ++depth;
+  }
+  EXPECT_EQ(depth, 5'000);
+}
+
+TEST(GrammarTest, Cut) {
+  class Parser : public pegium::Parser {
+  public:
+    Parser(bool committed, bool memoize) {
+      using namespace pegium;
+      packrat(memoize);
+      terminal("WS").ignore()(+s);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      // a cut only commits the alternatives of the rule containing it
+      if (committed) {
+        rule("Decl")(("namespace"_kw, cut, call("ID"), "{"_kw,
+                      many(call("Decl")), "}"_kw) |
+                     ("namespace"_kw, call("ID"), ";"_kw) |
+                     (call("ID"), ";"_kw));
+        rule("OptionalNamespace")(
+            opt("namespace"_kw, cut, call("ID"), "{"_kw, "}"_kw), call("ID"),
+            ";"_kw);
+      } else {
+        rule("Decl")(("namespace"_kw, call("ID"), "{"_kw, many(call("Decl")),
+                      "}"_kw) |
+                     ("namespace"_kw, call("ID"), ";"_kw) |
+                     (call("ID"), ";"_kw));
+        rule("OptionalNamespace")(
+            opt("namespace"_kw, call("ID"), "{"_kw, "}"_kw), call("ID"),
+            ";"_kw);
+      }
+      rule("Namespace")("namespace"_kw, cut, call("ID"), "{"_kw, "}"_kw);
+      rule("Decls")(many(call("Decl")));
+      // the cuts of a predicate do not commit the enclosing alternatives
+      rule("Peek")((!call("Namespace"), "?"_kw) | (call("ID"), ";"_kw));
+      // nor do the cuts of a rule that returned
+      rule("N")("n"_kw, cut, call("ID"));
+      rule("P")((call("N"), "x"_kw) | (call("N"), "y"_kw));
+      // nor do the cuts of a called rule that failed after them
+      rule("Caller")(call("Namespace") | (call("ID"), ";"_kw));
+    }
+  };
+  for (bool memoize : {false, true}) {
+    Parser plain{false, memoize};
+    Parser committed{true, memoize};
+    for (const auto *input : {"namespace a { b; } c;", "a; namespace b {}"}) {
+      EXPECT_TRUE(plain.parse("Decls", input).ret) << input;
+      auto result = committed.parse("Decls", input);
+      EXPECT_TRUE(result.ret) << input;
+      EXPECT_EQ(result.len, std::string_view{input}.size()) << input;
+    }
+    // the alternatives of a committed namespace are not tried
+    for (const auto *input : {"namespace a;", "namespace a { b; } namespace c;",
+                              "namespace a { namespace b; }"}) {
+      EXPECT_TRUE(plain.parse("Decls", input).ret) << input;
+      EXPECT_FALSE(committed.parse("Decls", input).ret) << input;
+      EXPECT_FALSE(
+          committed.parse("Decls", input, pegium::ParseMode::Recognize).ret)
+          << input;
+    }
+    EXPECT_TRUE(plain.parse("OptionalNamespace", "namespace;").ret);
+    EXPECT_FALSE(committed.parse("OptionalNamespace", "namespace;").ret);
+    EXPECT_TRUE(committed.parse("OptionalNamespace", "a;").ret);
+    EXPECT_TRUE(committed.parse("Peek", "namespace;").ret);
+    EXPECT_TRUE(committed.parse("P", "n a y").ret);
+    EXPECT_FALSE(committed.parse("P", "n 1 y").ret);
+    EXPECT_FALSE(committed.parse("Namespace", "namespace;").ret);
+    for (auto mode : {pegium::ParseMode::Full, pegium::ParseMode::Recognize}) {
+      auto result = committed.parse("Caller", "namespace;", mode);
+      EXPECT_TRUE(result.ret);
+      EXPECT_EQ(result.len, 10);
+    }
+  }
+
+  // a cut releases the memoized calls before it
+  pegium::Context context;
+  pegium::RootCstNode root;
+  const std::string_view input = "ab";
+  context.memo().insert(nullptr, input.data(), {0, nullptr});
+  context.memo().insert(nullptr, input.data() + 1, {0, nullptr});
+  EXPECT_EQ(context.memo().size(), 2);
+  pegium::Cut{}.parse_rule(input.substr(1), root, context);
+  EXPECT_EQ(context.memo().size(), 1);
+  EXPECT_NE(context.memo().find(nullptr, input.data() + 1), nullptr);
+}
+
+TEST(GrammarTest, Recovery) {
+  class Parser : public pegium::Parser {
+  public:
+    Parser() {
+      using namespace pegium;
+      terminal("WS").ignore()(+s);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      rule("Decl")(call("Namespace") | call("Field"));
+      rule("Namespace")("namespace"_kw, cut, call("ID"), "{"_kw,
+                        many(call("Decl")).recover(), "}"_kw);
+      rule("Field")("field"_kw, cut, call("ID"), ";"_kw);
+      rule("Document")(many(call("Decl")).recover());
+    }
+  };
+  Parser p;
+  const auto descriptions = [](const pegium::ParseError &error) {
+    std::vector<std::string> result;
+    for (const auto *element : error.expected) {
+      result.push_back(pegium::describe(*element));
+    }
+    return result;
+  };
+  const auto recovered = [](const pegium::ParseResult &result) {
+    std::vector<std::string_view> texts;
+    for (const auto &node : *result.root_node) {
+      if (node.recovered) {
+        EXPECT_TRUE(node.isLeaf && node.hidden);
+        texts.push_back(node.text);
+      }
+    }
+    return texts;
+  };
+
+  auto result = p.parse("Document", "namespace a { field b; } field c;");
+  EXPECT_TRUE(result.ret);
+  EXPECT_FALSE(result.recovered);
+  EXPECT_TRUE(result.errors.empty());
+
+  // a broken element is skipped up to the next element
+  const std::string input =
+      "field a field b; namespace n { field ; field c; } field d;";
+  result = p.parse("Document", input);
+  EXPECT_TRUE(result.ret);
+  EXPECT_TRUE(result.recovered);
+  EXPECT_EQ(result.len, input.size());
+  ASSERT_EQ(result.errors.size(), 2);
+  EXPECT_EQ(result.errors[0].offset, 0);
+  EXPECT_EQ(result.errors[0].length, 8);
+  EXPECT_EQ(descriptions(result.errors[0]), std::vector<std::string>{"';'"});
+  EXPECT_EQ(result.errors[1].offset, input.find("field ;"));
+  EXPECT_EQ(result.errors[1].length, 8);
+  EXPECT_EQ(descriptions(result.errors[1]), std::vector<std::string>{"ID"});
+  EXPECT_EQ(recovered(result),
+            (std::vector<std::string_view>{"field a ", "field ; "}));
+  std::string tokens;
+  for (const auto &token : result.root_node->tokens()) {
+    tokens += token.text;
+  }
+  EXPECT_EQ(tokens, "fieldb;namespacen{fieldc;}fieldd;");
+
+  // or up to the end of the enclosing block
+  result = p.parse("Document", "namespace n { field x } field y;");
+  EXPECT_TRUE(result.ret);
+  ASSERT_EQ(result.errors.size(), 1);
+  EXPECT_EQ(result.errors[0].offset, 14);
+  EXPECT_EQ(recovered(result), std::vector<std::string_view>{"field x "});
+  auto recognized = p.parse("Document", "namespace n { field x } field y;",
+                            pegium::ParseMode::Recognize);
+  EXPECT_TRUE(recognized.ret);
+  EXPECT_EQ(recognized.errors.size(), 1);
+
+  // an element failing before any cut is not recovered: the furthest
+  // failure is reported
+  result = p.parse("Document", "field a; 1");
+  EXPECT_FALSE(result.ret);
+  EXPECT_FALSE(result.recovered);
+  ASSERT_EQ(result.errors.size(), 1);
+  EXPECT_EQ(result.errors[0].offset, 9);
+  EXPECT_EQ(descriptions(result.errors[0]),
+            std::vector<std::string>{"Namespace or Field"});
+  result = p.parse("Field", "field 1;");
+  EXPECT_FALSE(result.ret);
+  ASSERT_EQ(result.errors.size(), 1);
+  EXPECT_EQ(result.errors[0].offset, 6);
+  EXPECT_EQ(descriptions(result.errors[0]), std::vector<std::string>{"ID"});
+}
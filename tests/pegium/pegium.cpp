@@ -1,8 +1,9 @@
-#include <chrono>
+#include <filesystem>
 #include <fstream>
 #include <gtest/gtest.h>
-#include <iostream>
 #include <pegium/Parser.hpp>
+#include <pegium/index.hpp>
+#include <sstream>
 
 using namespace pegium;
 struct TestAst : public pegium::AstNode {
@@ -82,58 +83,743 @@ TEST(PegiumTest, QualifiedNameWithSpacesAndComment) {
   auto str = std::any_cast<std::string>(result.value);
   EXPECT_EQ(str, "a.b.c");
 }
-TEST(PegiumTest, DISABLED_Bench) {
+
+TEST(PegiumTest, CstArena) {
+  class Parser : public pegium::Parser {
+  public:
+    Parser() {
+      using namespace pegium;
+      terminal("WS").ignore()(+s);
+      rule("RULE")(("A"_kw, "B"_kw) | ("A"_kw, "C"_kw, "D"_kw));
+    }
+  };
+  Parser p;
+  auto result = p.parse("RULE", "A C D");
+  ASSERT_TRUE(result.ret);
+
+  // the nodes of the failed alternative are released
+  EXPECT_EQ(result.root_node->arena.watermark(), 3);
+
+  std::string text;
+  for (const auto &node : result.root_node->children())
+    text += node.text;
+  EXPECT_EQ(text, "ACD");
+
+  std::size_t count = 0;
+  for (auto it = result.root_node->begin(); it != result.root_node->end();
+       ++it) {
+    ++count;
+  }
+  EXPECT_EQ(count, 4);
+}
+
+TEST(PegiumTest, CstIterator) {
   TestGrammar g;
+  auto result = g.parse("TestAst", "test a /* c */ { test b { } test c }");
+  ASSERT_TRUE(result.ret);
+  auto &root = *result.root_node;
 
-  std::string input;
-  for (int i = 0; i < 1'000'000; ++i)
-    input += R"(
-    // comment
-    a.b.c.d.e.
-    /* comment*/
-    g.h.
-    )";
-  input += "end";
+  std::string tokens;
+  for (const auto &token : root.tokens()) {
+    EXPECT_TRUE(token.isLeaf);
+    tokens += token.text;
+  }
+  EXPECT_EQ(tokens, "testa{testb{}testc}");
 
-  // std::ofstream out("output.txt");
-  // out << input;
+  std::string leaves;
+  for (const auto &leaf : root.leaves()) {
+    leaves += leaf.text;
+  }
+  EXPECT_EQ(leaves, "testa/* c */{testb{}testc}");
 
-  using namespace std::chrono;
-  auto start = high_resolution_clock::now();
+  // the parent links lead back to the root
+  for (const auto &node : root) {
+    const auto *ancestor = std::addressof(node);
+    while (ancestor->parent) {
+      ancestor = ancestor->parent;
+    }
+    EXPECT_EQ(ancestor, std::addressof(root));
+  }
 
-  auto l = g.parse("QualifiedName", input);
+  // a pruned node is visited without its descendants
+  std::size_t count = 0;
+  for (auto it = root.begin(); it != root.end(); ++it) {
+    ++count;
+    if (it != root.begin()) {
+      it.prune();
+    }
+  }
+  std::size_t children = 0;
+  for ([[maybe_unused]] const auto &child : root.children()) {
+    ++children;
+  }
+  EXPECT_EQ(count, children + 1);
 
-  auto end = high_resolution_clock::now();
-  auto duration = duration_cast<milliseconds>(end - start).count();
+  // the iteration of a subtree stops at its last descendant
+  const auto &last = *root.lastChild;
+  EXPECT_EQ(std::distance(last.nodes().begin(), last.nodes().end()), 1);
+}
+
+TEST(PegiumTest, AstArena) {
+  static int destroyed = 0;
+  struct Counted : public AstNode {
+    ~Counted() noexcept override { ++destroyed; }
+    std::string name = "a long name that is not a small string";
+  };
+  {
+    AstArena arena;
+    auto *first = arena.create<Counted>();
+    auto *second = arena.create<Counted>();
+    // the nodes are allocated contiguously
+    EXPECT_EQ(reinterpret_cast<char *>(second),
+              reinterpret_cast<char *>(first) + sizeof(Counted));
+    AstArena other;
+    other.create<Counted>();
+    arena.merge(std::move(other));
+    EXPECT_EQ(arena.size(), 3);
+    EXPECT_EQ(other.size(), 0);
+    EXPECT_EQ(destroyed, 0);
+  }
+  EXPECT_EQ(destroyed, 3);
 
-  std::cout << "Parsed " << l.len << " / " << input.size() << " characters in "
-            << duration << "ms\n";
+  // the arena of a parse is kept alive by the value
+  TestGrammar g;
+  std::shared_ptr<AstNode> value;
+  {
+    auto result = g.parse("TestAst", "test a { test b test c { test d } }");
+    ASSERT_TRUE(result.ret);
+    value = std::any_cast<std::shared_ptr<AstNode>>(result.value);
+  }
+  auto *ast = dynamic_cast<TestAst *>(value.get());
+  ASSERT_TRUE(ast);
+  ASSERT_EQ(ast->child.size(), 2);
+  EXPECT_EQ(ast->child[1]->child[0]->name, "d");
 }
 
-TEST(PegiumTest, DISABLED_Bench2) {
+TEST(PegiumTest, ZeroCopy) {
   TestGrammar g;
+  auto text = std::make_shared<const std::string>("a . b.c");
+  auto result = g.parse("QualifiedName", text);
+  EXPECT_TRUE(result.ret);
+  EXPECT_EQ(result.root_node->fullText.data(), text->data());
+  EXPECT_EQ(result.root_node->storage, text);
+  EXPECT_EQ(std::any_cast<std::string>(result.value), "a.b.c");
 
-  std::string input;
-  for (int i = 0; i < 1'000'000; ++i)
-    input += R"(
-    // comment
-    test.test.TEST.test
-    /* comment*/
-    .test.TesT.Test.TeST.test.tesT.
-    )";
-  input += "test";
+  std::string input = "x.y";
+  auto borrowed = g.parse("QualifiedName", input, nullptr);
+  EXPECT_TRUE(borrowed.ret);
+  EXPECT_EQ(borrowed.root_node->fullText.data(), input.data());
+  EXPECT_EQ(borrowed.root_node->firstChild->text.data(), input.data());
+  EXPECT_FALSE(borrowed.root_node->storage);
+}
 
-  // std::ofstream out("output.txt");
-  // out << input;
+TEST(PegiumTest, ParseMode) {
+  TestGrammar g;
+  const std::string input = R"(
+      test name // comment
+      { test child1 test child2 { test nested } }
+      )";
+  auto recognized = g.parse("TestAst", input, ParseMode::Recognize);
+  EXPECT_TRUE(recognized.ret);
+  EXPECT_EQ(recognized.len, input.size());
+  EXPECT_FALSE(recognized.root_node);
+  EXPECT_FALSE(recognized.value.has_value());
+  EXPECT_FALSE(g.parse("TestAst", "test a { test }", ParseMode::Recognize).ret);
+  EXPECT_EQ(g.parse("ID", "abc", ParseMode::Recognize).len, 3);
 
-  using namespace std::chrono;
-  auto start = high_resolution_clock::now();
+  auto result = g.parse("TestAst", input, ParseMode::Ast);
+  EXPECT_TRUE(result.ret);
+  EXPECT_FALSE(result.root_node);
+  auto test = std::any_cast<std::shared_ptr<pegium::AstNode>>(result.value);
+  auto *ast = dynamic_cast<TestAst *>(test.get());
+  ASSERT_TRUE(ast);
+  EXPECT_EQ(ast->name, "name");
+  ASSERT_EQ(ast->child.size(), 2);
+  ASSERT_EQ(ast->child[1]->child.size(), 1);
+  EXPECT_EQ(ast->child[1]->child[0]->name, "nested");
 
-  auto l = g.parse("QualifiedName2", input);
+  auto name = g.parse("QualifiedName", "a /* x */ . b", ParseMode::Ast);
+  EXPECT_EQ(std::any_cast<std::string>(name.value), "a.b");
+}
+
+TEST(PegiumTest, StringView) {
+  struct ViewGrammar : public Parser {
+    explicit ViewGrammar(std::shared_ptr<Interner> interner = nullptr) {
+      terminal("WS").ignore()(+s);
+      terminal("ML_COMMENT").hide()("/*"_kw >> "*/"_kw);
+      terminal<std::string_view>("ID")(cls("a-zA-Z_"), *w);
+      rule<std::string_view>("QualifiedName")(
+          at_least_one_sep('.'_kw, call("ID")));
+      rule<TestAst>("TestAst")("test"_kw,
+                               assign<&TestAst::name>(call("QualifiedName")));
+      if (interner) {
+        intern(true, std::move(interner));
+      }
+    }
+    const Rule &get(const std::string &name) { return *call(name).rule(); }
+  } g;
+
+  // a contiguous value views the input text
+  auto text = std::make_shared<const std::string>("a.b.c");
+  auto contiguous = g.parse("QualifiedName", text);
+  ASSERT_TRUE(contiguous.ret);
+  auto view = std::any_cast<std::string_view>(contiguous.value);
+  EXPECT_EQ(view, "a.b.c");
+  EXPECT_EQ(view.data(), text->data());
+  EXPECT_FALSE(contiguous.interner);
 
-  auto end = high_resolution_clock::now();
-  auto duration = duration_cast<milliseconds>(end - start).count();
+  // the other values are interned
+  auto split = g.parse("QualifiedName", "a /* x */ . b");
+  ASSERT_TRUE(split.ret);
+  EXPECT_EQ(std::any_cast<std::string_view>(split.value), "a.b");
+  ASSERT_TRUE(split.interner);
+  EXPECT_EQ(split.interner->size(), 1);
+
+  // without root node, the owner of the viewed text is kept by the result
+  auto ast = g.get("QualifiedName").parse(*text, text, ParseMode::Ast);
+  EXPECT_FALSE(ast.root_node);
+  EXPECT_EQ(ast.storage, text);
+  EXPECT_EQ(std::any_cast<std::string_view>(ast.value).data(), text->data());
+
+  // a view is copied into a string feature
+  auto node = g.parse("TestAst", "test x.y");
+  ASSERT_TRUE(node.ret);
+  auto *test = dynamic_cast<TestAst *>(
+      std::any_cast<std::shared_ptr<AstNode>>(node.value).get());
+  ASSERT_TRUE(test);
+  EXPECT_EQ(test->name, "x.y");
+
+  // the values of the parses sharing an interner are equal by address
+  auto interner = std::make_shared<Interner>();
+  ViewGrammar interning{interner};
+  auto first = interning.parse("ID", "abc");
+  auto second = interning.parse("QualifiedName", "abc");
+  EXPECT_EQ(std::any_cast<std::string_view>(first.value).data(),
+            std::any_cast<std::string_view>(second.value).data());
+  EXPECT_EQ(first.interner, interner);
+  EXPECT_EQ(interner->size(), 1);
+}
+
+TEST(PegiumTest, Index) {
+  struct Entity : public AstNode {
+    string name;
+    vector<reference<Entity>> uses;
+    vector<containment<Entity>> members;
+  };
+  struct IndexGrammar : public Parser {
+    IndexGrammar() {
+      terminal("WS").ignore()(+s);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      rule<Entity>("Entity")(
+          "entity"_kw, assign<&Entity::name>(call("ID")),
+          opt("uses"_kw,
+              at_least_one_sep(','_kw, append<&Entity::uses>(call("ID")))),
+          opt("{"_kw, many(append<&Entity::members>(call("Entity"))),
+              "}"_kw));
+    }
+  } g;
+
+  const std::vector<std::string_view> texts{
+      "entity a uses b, c { entity d uses a }",
+      "entity b uses d, missing",
+  };
+  auto documents = g.parse_many("Entity", texts, 2);
+  ASSERT_TRUE(documents[0].ret && documents[1].ret);
+  Index index{g.features(), Index::name<&Entity::name>()};
+  index.add(documents, 2);
+  EXPECT_EQ(index.size(), 3);
+  EXPECT_EQ(index.link(2), 2);
+
+  auto entity = [](const ParseResult &result) {
+    return static_cast<Entity *>(
+        std::any_cast<std::shared_ptr<AstNode>>(result.value).get());
+  };
+  auto *a = entity(documents[0]);
+  auto *b = entity(documents[1]);
+  auto *d = a->members[0].get();
+  EXPECT_EQ(index.find("d"), d);
+  ASSERT_EQ(a->uses.size(), 2);
+  EXPECT_EQ(a->uses[0].get(), b);
+  EXPECT_FALSE(a->uses[1]);
+  EXPECT_EQ(a->uses[1].text(), "c");
+  EXPECT_EQ(d->uses[0].get(), a);
+  EXPECT_EQ(b->uses[0].get(), d);
+  EXPECT_FALSE(b->uses[1]);
+}
+
+TEST(PegiumTest, ParseFile) {
+  TestGrammar g;
+  auto path = std::filesystem::temp_directory_path() / "pegium_parse_file.txt";
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << "a.b /* comment */ . c";
+  }
+  auto result = g.parse_file("QualifiedName", path);
+  std::filesystem::remove(path);
 
-  std::cout << "Parsed " << l.len << " / " << input.size() << " characters in "
-            << duration << "ms\n";
-}
\ No newline at end of file
+  EXPECT_TRUE(result.ret);
+  EXPECT_TRUE(result.root_node->storage);
+  EXPECT_EQ(result.root_node->fullText, "a.b /* comment */ . c");
+  EXPECT_EQ(std::any_cast<std::string>(result.value), "a.b.c");
+
+  EXPECT_THROW(g.parse_file("QualifiedName", path), std::system_error);
+}
+
+TEST(PegiumTest, Snapshot) {
+  TestGrammar g;
+  const auto directory = std::filesystem::temp_directory_path();
+  const auto path = directory / "pegium_snapshot.txt";
+  const auto snapshot = directory / "pegium_snapshot.bin";
+  const std::string text = "test a // comment\n{ test b test c { test d } }";
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << text;
+  }
+  std::filesystem::remove(snapshot);
+
+  // the first parse writes the snapshot, the second one loads it
+  auto parsed = g.parse_file("TestAst", path, snapshot);
+  ASSERT_TRUE(parsed.ret);
+  ASSERT_TRUE(std::filesystem::exists(snapshot));
+  auto loaded = g.parse_file("TestAst", path, snapshot);
+  std::filesystem::remove(path);
+  ASSERT_TRUE(loaded.ret);
+  EXPECT_EQ(loaded.len, text.size());
+  EXPECT_NE(loaded.root_node->fullText.data(),
+            parsed.root_node->fullText.data());
+  EXPECT_EQ(loaded.root_node->fullText, text);
+  EXPECT_EQ(loaded.root_node->grammarSource,
+            parsed.root_node->grammarSource);
+  auto expected = parsed.root_node->begin();
+  for (const auto &node : *loaded.root_node) {
+    ASSERT_NE(expected, parsed.root_node->end());
+    EXPECT_EQ(node.text, expected->text);
+    EXPECT_EQ(node.grammarSource, expected->grammarSource);
+    EXPECT_EQ(node.hidden, expected->hidden);
+    ++expected;
+  }
+  EXPECT_EQ(expected, parsed.root_node->end());
+
+  auto value = std::any_cast<std::shared_ptr<AstNode>>(loaded.value);
+  auto *ast = dynamic_cast<TestAst *>(value.get());
+  ASSERT_TRUE(ast);
+  EXPECT_EQ(ast->name, "a");
+  ASSERT_EQ(ast->child.size(), 2);
+  EXPECT_EQ(ast->child[1]->child[0]->name, "d");
+
+  // a snapshot is only loaded for the text and the grammar it was made from
+  EXPECT_FALSE(g.load_snapshot(snapshot, "test a").ret);
+  auto same_size = text;
+  same_size[5] = 'z';
+  EXPECT_FALSE(g.load_snapshot(snapshot, same_size).ret);
+  EXPECT_TRUE(g.load_snapshot(snapshot, text).ret);
+  struct OtherGrammar : public Parser {
+    OtherGrammar() {
+      terminal("WS").ignore()(+s);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      rule<TestAst>("TestAst")(
+          "test"_kw, assign<&TestAst::name>(call("ID")),
+          opt("{"_kw, *append<&TestAst::child>(call("TestAst")), "}"_kw));
+    }
+  };
+  OtherGrammar other;
+  EXPECT_NE(other.fingerprint(), g.fingerprint());
+  EXPECT_FALSE(other.load_snapshot(snapshot, text).ret);
+
+  // a node count overflowing the expected size is rejected
+  {
+    std::fstream file(snapshot,
+                      std::ios::binary | std::ios::in | std::ios::out);
+    std::uint64_t nodes;
+    file.seekg(40);
+    file.read(reinterpret_cast<char *>(&nodes), sizeof(nodes));
+    nodes += std::uint64_t{1} << 62;
+    file.seekp(40);
+    file.write(reinterpret_cast<const char *>(&nodes), sizeof(nodes));
+  }
+  EXPECT_FALSE(g.load_snapshot(snapshot, text).ret);
+  std::filesystem::remove(snapshot);
+  EXPECT_FALSE(g.load_snapshot(snapshot, text).ret);
+
+  // the case of the keywords and the compile-time expressions are part of
+  // the fingerprint, and the expressions are numbered with the elements
+  struct KeywordGrammar : public Parser {
+    explicit KeywordGrammar(bool ignoreCase) {
+      rule("Keyword")(ignoreCase ? "abc"_ikw : "abc"_kw);
+    }
+  };
+  EXPECT_NE(KeywordGrammar{false}.fingerprint(),
+            KeywordGrammar{true}.fingerprint());
+  struct RegexGrammar : public Parser {
+    explicit RegexGrammar(bool digits) {
+      if (digits) {
+        terminal("ID")("[0-9]+"_reg);
+      } else {
+        terminal("ID")("[a-z]+"_reg);
+      }
+      rule("Name")(call("ID"));
+    }
+  };
+  const RegexGrammar letters{false};
+  EXPECT_NE(letters.fingerprint(), RegexGrammar{true}.fingerprint());
+  EXPECT_EQ(letters.fingerprint(), RegexGrammar{false}.fingerprint());
+  std::ostringstream regex;
+  letters.save_snapshot(letters.parse("Name", "abc"), regex);
+  EXPECT_FALSE(regex.str().empty());
+
+  // a failed parse has no snapshot
+  std::ostringstream os;
+  EXPECT_THROW(g.save_snapshot(g.parse("TestAst", "test"), os),
+               std::invalid_argument);
+}
+
+TEST(PegiumTest, NullableLoops) {
+  TestGrammar g;
+  EXPECT_TRUE(g.nullable_loops().empty());
+
+  struct LoopGrammar : public Parser {
+    LoopGrammar() {
+      terminal("WS").hide()(*s);
+      terminal("ID")(cls("a-z"), *w);
+      rule("Names")(many(opt(call("ID"))));
+      rule("Signs")(opt('-'_kw), call("ID"), opt(cls("+-")));
+    }
+  };
+  LoopGrammar loops;
+  // the hidden rule and the repetition of an optional name never end
+  ASSERT_EQ(loops.nullable_loops().size(), 2);
+  EXPECT_EQ(describe(*loops.nullable_loops()[0].rule), "WS");
+  EXPECT_EQ(loops.nullable_loops()[0].loop, loops.nullable_loops()[0].rule);
+  EXPECT_EQ(describe(*loops.nullable_loops()[1].rule), "Names");
+
+  // the call of a terminal rule and an optional character class produce the
+  // nodes of the generic rule call and of the optional element
+  auto result = g.parse("QualifiedName", "a . b");
+  ASSERT_TRUE(result.ret);
+  const auto &call = *result.root_node->firstChild;
+  EXPECT_FALSE(call.isLeaf);
+  EXPECT_EQ(call.text, "a ");
+  EXPECT_EQ(call.firstChild->text, "a");
+  EXPECT_TRUE(call.firstChild->isLeaf);
+  EXPECT_EQ(call.firstChild->grammarSource, call.grammarSource);
+}
+
+TEST(PegiumTest, ParseMany) {
+  const TestGrammar g;
+  std::vector<std::string> inputs;
+  for (std::size_t i = 0; i < 200; ++i) {
+    inputs.push_back("test item" + std::to_string(i) +
+                     " { test a test b { test c } }");
+  }
+  inputs.emplace_back("test invalid {");
+  std::vector<std::string_view> texts{inputs.begin(), inputs.end()};
+
+  for (std::size_t threads : {0, 1, 4}) {
+    auto results = g.parse_many("TestAst", texts, threads);
+    ASSERT_EQ(results.size(), texts.size());
+    for (std::size_t i = 0; i + 1 < texts.size(); ++i) {
+      ASSERT_TRUE(results[i].ret);
+      EXPECT_EQ(results[i].root_node->fullText, inputs[i]);
+      auto value =
+          std::any_cast<std::shared_ptr<pegium::AstNode>>(results[i].value);
+      EXPECT_EQ(dynamic_cast<TestAst *>(value.get())->name,
+                "item" + std::to_string(i));
+    }
+    EXPECT_FALSE(results.back().ret);
+  }
+  EXPECT_TRUE(g.parse_many("TestAst", std::span<const std::string_view>{})
+                  .empty());
+
+  const std::vector<std::filesystem::path> missing{
+      std::filesystem::temp_directory_path() / "pegium_parse_many.txt"};
+  EXPECT_THROW(g.parse_many("QualifiedName", missing, 2), std::system_error);
+}
+
+/// Check that two CST of the same parser are identical
+static void expect_same_cst(const CstNode &lhs, std::string_view lhsText,
+                            const CstNode &rhs, std::string_view rhsText) {
+  EXPECT_EQ(lhs.text, rhs.text);
+  if (lhs.text.data()) {
+    EXPECT_EQ(lhs.text.data() - lhsText.data(),
+              rhs.text.data() - rhsText.data());
+  }
+  EXPECT_EQ(lhs.grammarSource, rhs.grammarSource);
+  EXPECT_EQ(lhs.isLeaf, rhs.isLeaf);
+  EXPECT_EQ(lhs.hidden, rhs.hidden);
+  auto l = lhs.children().begin();
+  auto r = rhs.children().begin();
+  for (; l != lhs.children().end() && r != rhs.children().end(); ++l, ++r) {
+    expect_same_cst(*l, lhsText, *r, rhsText);
+  }
+  EXPECT_EQ(l == lhs.children().end(), r == rhs.children().end());
+}
+
+TEST(PegiumTest, Reparse) {
+  TestGrammar g;
+  const std::string input =
+      "test name { test child1 test child2 { test nested /* } */ } }";
+  auto previous = g.parse("TestAst", input);
+  ASSERT_TRUE(previous.ret);
+
+  auto check = [&](const TextEdit &edit) {
+    auto expected = input;
+    expected.replace(edit.offset, edit.removed, edit.inserted);
+    auto result = g.reparse(previous, edit);
+    auto full = g.parse("TestAst", expected);
+    EXPECT_EQ(result.ret, full.ret);
+    EXPECT_EQ(result.len, full.len);
+    EXPECT_EQ(result.root_node->fullText, expected);
+    expect_same_cst(*result.root_node, result.root_node->fullText,
+                    *full.root_node, full.root_node->fullText);
+    return result;
+  };
+
+  // the block of child2 is parsed again
+  auto result = check({input.find("nested"), 6, "renamed test other"});
+  auto test = std::any_cast<std::shared_ptr<pegium::AstNode>>(result.value);
+  auto *ast = dynamic_cast<TestAst *>(test.get());
+  ASSERT_TRUE(ast);
+  EXPECT_EQ(ast->name, "name");
+  ASSERT_EQ(ast->child.size(), 2);
+  EXPECT_EQ(ast->child[0]->name, "child1");
+  ASSERT_EQ(ast->child[1]->child.size(), 2);
+  EXPECT_EQ(ast->child[1]->child[0]->name, "renamed");
+  EXPECT_EQ(ast->child[1]->child[1]->name, "other");
+
+  // an edit of the first or the last token of a block
+  check({input.find("child2"), 6, "child3"});
+  check({input.rfind('}') - 2, 1, ""});
+  // the whole text is parsed again
+  check({input.find("name"), 4, "other"});
+  EXPECT_FALSE(check({input.find("{ test nested"), 1, ""}).ret);
+  // the closing brace in the comment becomes effective
+  EXPECT_FALSE(check({input.find("*/"), 2, ""}).ret);
+
+  // a choice that examined the edit before the call decides differently
+  struct ChoiceGrammar : public Parser {
+    ChoiceGrammar() {
+      terminal("WS").ignore()(+s);
+      terminal("ID")(cls("a-z"), *w);
+      rule("X")("a"_kw, call("ID"), "c"_kw);
+      rule("P")(("a"_kw, "b"_kw, "c"_kw) | call("X"));
+    }
+  };
+  ChoiceGrammar choice;
+  auto edited = choice.reparse(choice.parse("P", "a d c"), {2, 1, "b"});
+  auto full = choice.parse("P", "a b c");
+  ASSERT_TRUE(edited.ret);
+  expect_same_cst(*edited.root_node, edited.root_node->fullText,
+                  *full.root_node, full.root_node->fullText);
+  // the call of a terminal rule records the text examined before it: the
+  // failed keyword "b" and the character following it
+  auto parsed = choice.parse("P", "a d c");
+  const CstNode *id = nullptr;
+  for (const auto &node : *parsed.root_node) {
+    if (!node.isLeaf && node.grammarSource &&
+        describe(*node.grammarSource) == "ID") {
+      id = std::addressof(node);
+    }
+  }
+  ASSERT_TRUE(id);
+  EXPECT_EQ(id->text, "d ");
+  EXPECT_EQ(id->examined, 1);
+
+  // a result moved in is patched in place, reusing the untouched nodes and
+  // the objects assigned outside of the reparsed call and of its ancestors
+  auto token = [](const ParseResult &result, std::string_view text) {
+    for (const auto &node : result.root_node->tokens()) {
+      if (node.text == text) {
+        return std::addressof(node);
+      }
+    }
+    return static_cast<const CstNode *>(nullptr);
+  };
+  auto object = [](const ParseResult &result) {
+    return dynamic_cast<TestAst *>(
+        std::any_cast<std::shared_ptr<pegium::AstNode>>(result.value).get());
+  };
+  auto patched =
+      g.reparse(g.parse("TestAst", input), {input.find("nested"), 6, "inner"});
+  ASSERT_TRUE(patched.ret);
+  const std::string text{patched.root_node->fullText};
+  const auto *node = token(patched, "child1");
+  const auto *child1 = object(patched)->child[0].get();
+  const auto *child2 = object(patched)->child[1].get();
+  auto again = g.reparse(std::move(patched), {text.find("inner"), 5, "deep"});
+  full = g.parse("TestAst", "test name { test child1 test child2 { test deep "
+                            "/* } */ } }");
+  ASSERT_TRUE(again.ret);
+  expect_same_cst(*again.root_node, again.root_node->fullText,
+                  *full.root_node, full.root_node->fullText);
+  EXPECT_EQ(token(again, "child1"), node);
+  ast = object(again);
+  EXPECT_EQ(ast->child[0].get(), child1);
+  EXPECT_EQ(ast->child[0]->name, "child1");
+  EXPECT_NE(ast->child[1].get(), child2);
+  EXPECT_EQ(ast->child[1]->child[0]->name, "deep");
+}
+
+TEST(PegiumTest, ParseStream) {
+  TestGrammar g;
+  const std::string input = R"(
+    test a { test b } // comment
+    test c /* comment */ test d { test e { test f } }
+    test g
+  )";
+  // a reader returning a few characters at once, the text examined by the
+  // comments cut by the end of the buffer is measured without lookahead
+  std::size_t pos = 0;
+  auto read = [&](std::span<char> buffer) {
+    const auto count = std::min({buffer.size(), input.size() - pos,
+                                 std::size_t{3}});
+    std::copy_n(input.data() + pos, count, buffer.data());
+    pos += count;
+    return count;
+  };
+
+  std::vector<std::string> names;
+  std::string text;
+  auto result = g.parse_stream(
+      "TestAst", read,
+      [&](ParseResult element) {
+        EXPECT_TRUE(element.ret);
+        text += element.root_node->fullText;
+        EXPECT_EQ(element.root_node->fullText.size(), element.len);
+        auto value =
+            std::any_cast<std::shared_ptr<pegium::AstNode>>(element.value);
+        names.push_back(dynamic_cast<TestAst *>(value.get())->name);
+      },
+      {.chunk = 4, .lookahead = 0});
+  EXPECT_TRUE(result.ret);
+  EXPECT_EQ(result.len, input.size());
+  EXPECT_EQ(text, input);
+  EXPECT_EQ(names, (std::vector<std::string>{"a", "c", "d", "g"}));
+
+  // the elements before an invalid one are emitted
+  std::istringstream invalid{"test a test b { test } test c"};
+  names.clear();
+  result = g.parse_stream(
+      "TestAst", invalid,
+      [&](ParseResult element) {
+        EXPECT_FALSE(element.root_node);
+        auto value =
+            std::any_cast<std::shared_ptr<pegium::AstNode>>(element.value);
+        names.push_back(dynamic_cast<TestAst *>(value.get())->name);
+      },
+      {.mode = ParseMode::Ast});
+  EXPECT_FALSE(result.ret);
+  EXPECT_EQ(result.len, 14);
+  EXPECT_EQ(names, (std::vector<std::string>{"a", "b"}));
+
+  // a syntax error stops the parse without reading the rest of the input
+  const std::string broken = "test a test b { test } ";
+  std::size_t count = 0;
+  result = g.parse_stream(
+      "TestAst",
+      [&](std::span<char> buffer) {
+        for (auto &ch : buffer) {
+          ch = count < broken.size() ? broken[count] : " test c"[count % 7];
+          ++count;
+        }
+        return buffer.size();
+      },
+      [](ParseResult) {}, {.chunk = 16, .lookahead = 16});
+  EXPECT_FALSE(result.ret);
+  EXPECT_EQ(result.len, 14);
+  EXPECT_LT(count, 256);
+}
+
+TEST(PegiumTest, ParseListener) {
+  struct ListenerGrammar : public Parser {
+    ListenerGrammar() {
+      terminal("WS").ignore()(+s);
+      terminal("ML_COMMENT").hide()("/*"_kw >> "*/"_kw);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      rule("Name")(call("ID"));
+      rule<TestAst>("A")((assign<&TestAst::name>(call("Name")), "!"_kw) |
+                         (assign<&TestAst::name>(call("Name")), "?"_kw));
+    }
+  } g;
+
+  struct Trace : public ParseListener {
+    std::vector<std::string> events;
+    void onRuleEnter(const Rule &rule, std::size_t offset) override {
+      events.push_back("enter " + rule.name() + " " +
+                       std::to_string(offset));
+    }
+    void onToken(const GrammarElement &, std::string_view text,
+                 bool hidden) override {
+      events.push_back((hidden ? "hidden " : "token ") + std::string{text});
+    }
+    void onRuleExit(const Rule &rule, std::size_t len) override {
+      events.push_back("exit " + rule.name() + " " + std::to_string(len));
+    }
+  } trace;
+
+  // the events of the failed alternative are not received
+  auto result = g.parse("A", " x /* c */ ?", trace);
+  EXPECT_TRUE(result.ret);
+  EXPECT_EQ(result.len, 12);
+  EXPECT_FALSE(result.root_node);
+  EXPECT_EQ(trace.events,
+            (std::vector<std::string>{"enter A 1", "enter Name 1", "token x",
+                                      "hidden /* c */", "exit Name 10",
+                                      "token ?", "exit A 11"}));
+
+  // nothing is received when the parse fails
+  trace.events.clear();
+  result = g.parse("A", "x .", trace);
+  EXPECT_FALSE(result.ret);
+  EXPECT_TRUE(trace.events.empty());
+}
+
+TEST(PegiumTest, Profiler) {
+  struct ProfiledGrammar : public Parser {
+    ProfiledGrammar() {
+      terminal("WS").ignore()(+s);
+      terminal("ID")(cls("a-zA-Z_"), *w);
+      rule("B")(call("ID"));
+      rule("A")((call("B"), "!"_kw) | (call("B"), "?"_kw));
+    }
+  } g;
+  g.profiler().tracing(true);
+  auto result = g.parse("A", "x ?");
+  ASSERT_TRUE(result.ret);
+
+  auto rules = g.profiler().rules();
+  std::ostringstream table;
+  g.profiler().write_table(table);
+  std::ostringstream trace;
+  g.profiler().write_trace(trace);
+  if constexpr (!Profiler::enabled()) {
+    EXPECT_TRUE(rules.empty());
+    EXPECT_TRUE(g.profiler().spans().empty());
+    return;
+  }
+
+  auto profile = [&](std::string_view name) {
+    for (const auto &[rule, profile] : rules) {
+      if (rule->name() == name) {
+        return profile;
+      }
+    }
+    return RuleProfile{};
+  };
+  // the first call of B is discarded with the first alternative
+  const auto b = profile("B");
+  EXPECT_EQ(b.calls, 2);
+  EXPECT_EQ(b.successes, 2);
+  EXPECT_EQ(b.failures, 0);
+  EXPECT_EQ(b.consumed, 4);
+  EXPECT_EQ(b.backtracked, 2);
+  EXPECT_GE(b.inclusive, b.exclusive);
+  EXPECT_EQ(profile("ID").calls, 2);
+  EXPECT_EQ(profile("ID").backtracked, 2);
+
+  EXPECT_NE(table.str().find("backtracked"), std::string::npos);
+  EXPECT_EQ(g.profiler().spans().size(), 4);
+  EXPECT_NE(trace.str().find(R"("name":"B")"), std::string::npos);
+
+  g.profiler().clear();
+  EXPECT_TRUE(g.profiler().rules().empty());
+}